@@ -0,0 +1,220 @@
+/*
+ * src/batch_stat.c
+ *
+ * This file implements the batched lookup declared in batch_stat.h. The
+ * threads share one counter of the next group of paths, like the tree hash,
+ * and write each result into its own slot, so the results keep the order of
+ * the request. Whether openat2 works is found out on the first lookup and
+ * remembered for the life of the process.
+ */
+#define _GNU_SOURCE // For statx and syscall
+#include "batch_stat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#ifdef SYS_openat2
+#include <linux/openat2.h>
+#endif
+
+#include "dir_cache.h"
+#include "protocol.h"
+
+#define STATX_WANTED (STATX_TYPE | STATX_SIZE | STATX_MTIME)
+#define PATHS_PER_CLAIM 16 // Paths a thread takes from the shared counter at once
+
+typedef struct batch_stat_work_s {
+    int root_fd;
+    const char *root_path;
+    const char *const *paths;
+    batch_stat_result_t *results;
+    size_t count;
+    atomic_size_t next_path;
+} batch_stat_work_t;
+
+static atomic_int g_openat2_missing = 0; // Set once openat2 failed with ENOSYS
+
+/*
+ * Purpose:
+ *   Tells whether a resolved path is the root or below it.
+ *
+ * Parameters:
+ *   path: The resolved absolute path.
+ *   root_path: The absolute path of the root.
+ *
+ * Returns:
+ *   1 if the path is inside the root, 0 otherwise.
+ */
+static int within_root(const char *path, const char *root_path) {
+    size_t root_len = strlen(root_path);
+    if (strncmp(path, root_path, root_len) != 0) return 0;
+    if (root_len == 1) return 1; // Root is "/"
+    return path[root_len] == '\0' || path[root_len] == '/';
+}
+
+/*
+ * Purpose:
+ *   Looks up a path with realpath and a prefix check, for kernels without
+ *   openat2. The directory part is resolved, so a symbolic link in the last
+ *   component is reported itself.
+ *
+ * Parameters:
+ *   work: The shared state.
+ *   path: The path, relative to the root.
+ *   stx: Receives the status.
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno is set).
+ */
+static int statx_by_realpath(const batch_stat_work_t *work, const char *path, struct statx *stx) {
+    char full[MAX_PATH_LEN];
+    char resolved[MAX_PATH_LEN];
+    char target[MAX_PATH_LEN];
+    if (snprintf(full, sizeof(full), "%s/%s", work->root_path, path) >= (int)sizeof(full)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    char *slash = strrchr(full, '/');
+    const char *base = slash + 1;
+    if (*base == '\0' || strcmp(base, ".") == 0 || strcmp(base, "..") == 0) {
+        if (realpath(full, resolved) == NULL) return -1;
+        base = NULL;
+    } else {
+        *slash = '\0';
+        if (realpath(full, resolved) == NULL) return -1;
+    }
+    if (!within_root(resolved, work->root_path)) {
+        errno = ENOENT; // Outside the root, so not there as far as the client can tell
+        return -1;
+    }
+    if (base == NULL) return statx(AT_FDCWD, resolved, AT_SYMLINK_NOFOLLOW, STATX_WANTED, stx);
+    if (snprintf(target, sizeof(target), "%s/%s", strcmp(resolved, "/") == 0 ? "" : resolved, base) >= (int)sizeof(target)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return statx(AT_FDCWD, target, AT_SYMLINK_NOFOLLOW, STATX_WANTED, stx);
+}
+
+/*
+ * Purpose:
+ *   Looks up one path and fills in its result.
+ *
+ * Parameters:
+ *   work: The shared state.
+ *   index: The number of the path.
+ *
+ * Returns:
+ *   void
+ */
+static void stat_one(batch_stat_work_t *work, size_t index) {
+    const char *path = work->paths[index];
+    batch_stat_result_t *result = &work->results[index];
+    struct statx stx;
+    int rc = -1;
+    int done = 0;
+    memset(result, 0, sizeof(*result));
+
+#ifdef SYS_openat2
+    if (!atomic_load(&g_openat2_missing)) {
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags = O_PATH | O_NOFOLLOW | O_CLOEXEC;
+        how.resolve = RESOLVE_IN_ROOT | RESOLVE_NO_MAGICLINKS;
+        int fd = (int)syscall(SYS_openat2, work->root_fd, path[0] != '\0' ? path : ".", &how, sizeof(how));
+        if (fd != -1) {
+            rc = statx(fd, "", AT_EMPTY_PATH, STATX_WANTED, &stx);
+            int saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            done = 1;
+        } else if (errno == ENOSYS) {
+            atomic_store(&g_openat2_missing, 1);
+        } else {
+            done = 1;
+        }
+    }
+#endif
+    if (!done) rc = statx_by_realpath(work, path, &stx);
+
+    if (rc == -1) {
+        result->error = errno;
+        return;
+    }
+    if (S_ISREG(stx.stx_mode)) result->type = DIR_ENTRY_FILE;
+    else if (S_ISDIR(stx.stx_mode)) result->type = DIR_ENTRY_DIR;
+    else if (S_ISLNK(stx.stx_mode)) result->type = DIR_ENTRY_LINK;
+    else result->type = BATCH_STAT_OTHER;
+    result->size = (unsigned long long)stx.stx_size;
+    result->mtime = (long long)stx.stx_mtime.tv_sec;
+}
+
+/*
+ * Purpose:
+ *   Thread function: looks up groups of paths until none are left. Also
+ *   run by the calling thread.
+ *
+ * Parameters:
+ *   arg: The shared state.
+ *
+ * Returns:
+ *   NULL
+ */
+static void *batch_stat_thread(void *arg) {
+    batch_stat_work_t *work = arg;
+    for (;;) {
+        size_t first = atomic_fetch_add(&work->next_path, PATHS_PER_CLAIM);
+        if (first >= work->count) break;
+        size_t end = (first + PATHS_PER_CLAIM < work->count) ? first + PATHS_PER_CLAIM : work->count;
+        for (size_t i = first; i < end; i++) stat_one(work, i);
+    }
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Looks up a batch of paths inside a root. Symbolic links are reported
+ *   themselves, not followed, in the last component.
+ *
+ * Parameters:
+ *   root_path: The absolute path of the root.
+ *   paths: The paths, relative to the root (a leading '/' is the root).
+ *   count: The number of paths.
+ *   results: Receives one result per path, in order.
+ *
+ * Returns:
+ *   0 on success (per-path failures are in the results), or -1 if the root
+ *   cannot be opened.
+ */
+int batch_stat(const char *root_path, const char *const *paths, size_t count, batch_stat_result_t *results) {
+    batch_stat_work_t work;
+    work.root_fd = open(root_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (work.root_fd == -1) return -1;
+    work.root_path = root_path;
+    work.paths = paths;
+    work.results = results;
+    work.count = count;
+    atomic_init(&work.next_path, 0);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t thread_count = (cpus > 0) ? (size_t)cpus : 1;
+    if (thread_count > BATCH_STAT_MAX_THREADS) thread_count = BATCH_STAT_MAX_THREADS;
+    size_t useful = (count + BATCH_STAT_PATHS_PER_THREAD - 1) / BATCH_STAT_PATHS_PER_THREAD;
+    if (thread_count > useful) thread_count = (useful > 0) ? useful : 1;
+
+    pthread_t helpers[BATCH_STAT_MAX_THREADS];
+    size_t helper_count = 0;
+    for (size_t i = 1; i < thread_count; i++) {
+        if (pthread_create(&helpers[helper_count], NULL, batch_stat_thread, &work) != 0) break;
+        helper_count++;
+    }
+    batch_stat_thread(&work);
+    for (size_t i = 0; i < helper_count; i++) pthread_join(helpers[i], NULL);
+    close(work.root_fd);
+    return 0;
+}
@@ -0,0 +1,45 @@
+/*
+ * src/batch_stat.h
+ *
+ * This header file declares the batched lookup behind the STAT command. Each
+ * path is resolved inside a root directory and inspected with statx, asking
+ * only for the type, size and modification time. The paths are resolved with
+ * openat2 and RESOLVE_IN_ROOT where the kernel has it, so ".." and absolute
+ * symbolic links cannot leave the root; older kernels fall back to realpath
+ * and a prefix check. Large batches are split across several threads.
+ */
+#ifndef BATCH_STAT_H
+#define BATCH_STAT_H
+
+#include <stddef.h> // For size_t
+
+#define BATCH_STAT_MAX_THREADS 8
+#define BATCH_STAT_PATHS_PER_THREAD 64 // Smaller batches are not split
+#define BATCH_STAT_OTHER 'o'           // Type of devices, FIFOs and sockets
+
+// What was found for one path.
+typedef struct batch_stat_result_s {
+    int error;                 // 0, or the errno of the failed lookup
+    char type;                 // One of DIR_ENTRY_* or BATCH_STAT_OTHER
+    unsigned long long size;
+    long long mtime;           // Seconds since the epoch
+} batch_stat_result_t;
+
+/*
+ * Purpose:
+ *   Looks up a batch of paths inside a root. Symbolic links are reported
+ *   themselves, not followed, in the last component.
+ *
+ * Parameters:
+ *   root_path: The absolute path of the root.
+ *   paths: The paths, relative to the root (a leading '/' is the root).
+ *   count: The number of paths.
+ *   results: Receives one result per path, in order.
+ *
+ * Returns:
+ *   0 on success (per-path failures are in the results), or -1 if the root
+ *   cannot be opened.
+ */
+int batch_stat(const char *root_path, const char *const *paths, size_t count, batch_stat_result_t *results);
+
+#endif // BATCH_STAT_H
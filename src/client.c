@@ -4,7 +4,14 @@
  * This file implements the TCP client application. It connects to the server,
  * handles user input for interactive sessions, processes client-side commands
  * like LCD, and sends all other commands to the server for execution, including
- * server-side script requests using the '@' syntax.
+ * server-side script requests using the '@' syntax. Server output is relayed
+ * through a buffered output sink, optionally into a file given with '-o'.
+ * In a terminal, Tab completes server paths with the COMPLETE command; recent
+ * answers are cached so repeated Tabs in the same directory stay local.
+ * Listings are cached per directory with their version token; a repeated
+ * LIST only asks the server whether the directory changed. JOBGET downloads
+ * the output of a background job into a local file and resumes where an
+ * earlier, interrupted download stopped.
  */
 #define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
@@ -12,22 +19,104 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/un.h>   // For sockaddr_un
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <sys/time.h> // For timeval in setsockopt
 #include <signal.h>   // For signal handling
+#include <time.h>
+#include <netdb.h>    // For getaddrinfo
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
 
 #include "common.h"
 #include "protocol.h"
+#include "output_sink.h"
+#include "line_editor.h"
+#include "ktls.h"
+#include "shm_channel.h"
+
+#define COMPLETION_CACHE_SIZE 16
+#define COMPLETION_CACHE_TTL_SEC 10
+#define LISTING_CACHE_SIZE 32
+#define LISTING_CACHE_MAX_BYTES (8 * 1024 * 1024) // Larger listings are shown but not cached
+#define MAX_CONNECT_ADDRESSES 16
+#define CONNECT_ATTEMPT_DELAY_MS 250 // Head start of one address before the next is tried
+#define CONNECT_TIMEOUT_MS 10000
+#define JOBGET_CHUNK_BYTES (1024 * 1024) // Output requested per JOB FETCH (the server's maximum)
+#define JOBGET_IDLE_LIMIT 50             // Receive timeouts in a row before JOBGET gives up
+#define JOBGET_POLL_SEC 1                // Wait before asking a running job for more output
+
+#ifdef WITH_TLS
+#define TLS_OPTSTRING "t:"
+#define TLS_USAGE " [-t trusted_cert_file]"
+#else
+#define TLS_OPTSTRING ""
+#define TLS_USAGE ""
+#endif
+
+// One answer of the server to COMPLETE.
+typedef struct completion_entry_s {
+    char dir_key[MAX_PATH_LEN]; // Prompt directory and the word's directory part
+    char prefix[MAX_PATH_LEN];  // Name prefix the server completed
+    char **names;
+    size_t count;
+    int truncated;              // The server had more matches than it sent
+    time_t fetched;
+    unsigned long last_used;
+} completion_entry_t;
+
+// The last listing received for one server directory.
+typedef struct cached_listing_s {
+    char dir[MAX_PATH_LEN]; // Server directory as shown in the prompt
+    char token[MAX_CMD_LEN];
+    char *body;             // NULL if the slot is unused
+    size_t len;
+    unsigned long last_used;
+} cached_listing_t;
+
+typedef struct listing_cache_s {
+    cached_listing_t entries[LISTING_CACHE_SIZE];
+    unsigned long use_counter;
+} listing_cache_t;
+
+typedef struct completion_cache_s {
+    int sockfd;
+    const char *prompt_dir;
+    completion_entry_t entries[COMPLETION_CACHE_SIZE];
+    unsigned long use_counter;
+    const char **matches; // Filtered result handed to the line editor
+    size_t matches_capacity;
+} completion_cache_t;
 
 // Global flag for handling graceful shutdown on signals.
 static volatile sig_atomic_t g_shutdown_flag = 0;
+// Ctrl-C while a reply is being relayed cancels the command instead.
+static volatile sig_atomic_t g_awaiting_response = 0;
+static volatile sig_atomic_t g_cancel_requested = 0;
+// Command lines sent; the server numbers a session's requests the same way.
+static unsigned long g_requests_sent = 0;
 
 // Function Prototypes
-static void interactive_mode(int sockfd, char *current_prompt_dir);
+static void interactive_mode(int sockfd, char *current_prompt_dir, output_sink_t *sink);
 static void update_prompt_dir(const char *server_response, char *current_prompt_dir, size_t prompt_dir_size);
 static void signal_handler(int signum);
+static int send_request(int sockfd, const char *line);
+static ssize_t relay_response(output_sink_t *sink, int sockfd, int *peer_closed);
+static int complete_from_server(void *ctx, const char *word, const char *const **matches_out, size_t *count_out);
+static int fetch_completions(completion_cache_t *cache, const char *word, completion_entry_t *entry);
+static void free_completion_entry(completion_entry_t *entry);
+static ssize_t list_with_cache(int sockfd, listing_cache_t *cache, const char *dir, output_sink_t *sink);
+static int connect_tcp(const char *server_host, const char *port_arg);
+static size_t order_addresses(const struct addrinfo *list, const struct addrinfo **ordered, size_t max_count);
+static int start_connect_attempt(const struct addrinfo *address);
+static int race_connect(const struct addrinfo *const *addresses, size_t count);
+static long elapsed_ms(const struct timespec *start);
+static int connect_local(const char *socket_path);
+static int job_get(int sockfd, const char *id, const char *local_path);
+static int recv_job_bytes(int sockfd, char *buffer, size_t length);
 
 /*
  * Purpose:
@@ -39,7 +128,8 @@ static void signal_handler(int signum);
  * Parameters:
  *   argc: The number of command-line arguments.
  *   argv: An array of command-line argument strings. The expected usage is:
- *         ./myclient <server_address> <port_number> [@batch_file_on_server]
+ *         ./myclient [-o output_file] [-r root_name] [-t trusted_cert_file] {<server_address> <port_number> | -U local_socket} [@batch_file_on_server]
+ *         (-t only when built with TLS=1)
  *
  * Returns:
  *   0 on successful completion, and 1 on error.
@@ -47,10 +137,48 @@ static void signal_handler(int signum);
 int main(int argc, char *argv[]) {
     initialize_static_memory();
 
-    if (argc < 3 || argc > 4) {
-        fprintf(stderr, "Usage: %s <server_address> <port_number> [@batch_file_on_server]\n", argv[0]);
+    const char *output_path = NULL;
+    const char *root_name = NULL;
+    const char *local_socket = NULL;
+#ifdef WITH_TLS
+    const char *tls_ca_file = NULL;
+#endif
+    int opt;
+    while ((opt = getopt(argc, argv, "o:r:U:" TLS_OPTSTRING)) != -1) {
+        switch (opt) {
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'r':
+                root_name = optarg;
+                break;
+            case 'U':
+                local_socket = optarg;
+                break;
+#ifdef WITH_TLS
+            case 't':
+                tls_ca_file = optarg;
+                break;
+#endif
+            default:
+                fprintf(stderr, "Usage: %s [-o output_file] [-r root_name]" TLS_USAGE " {<server_address> <port_number> | -U local_socket} [@batch_file_on_server]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    int server_args = (local_socket != NULL) ? 0 : 2; // Address and port, unless -U
+    int positional_count = argc - optind;
+    if (positional_count < server_args || positional_count > server_args + 1) {
+        fprintf(stderr, "Usage: %s [-o output_file] [-r root_name]" TLS_USAGE " {<server_address> <port_number> | -U local_socket} [@batch_file_on_server]\n", argv[0]);
         return 1;
     }
+    char **positional = argv + optind;
+#ifdef WITH_TLS
+    if (local_socket != NULL && tls_ca_file != NULL) {
+        fprintf(stderr, "Error: TLS (-t) is not used for same-host connections (-U).\n");
+        return 1;
+    }
+#endif
 
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
@@ -67,33 +195,20 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    const char *server_ip = argv[1];
-    char *endptr;
-    long port_long = strtol(argv[2], &endptr, 10);
-    if (endptr == argv[2] || *endptr != '\0' || port_long <= 0 || port_long > 65535) {
-        fprintf(stderr, "Error: Invalid port number '%s'. Must be an integer between 1 and 65535.\n", argv[2]);
-        return 1;
-    }
-    uint16_t port = (uint16_t)port_long;
-
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    int sockfd = (local_socket != NULL) ? connect_local(local_socket) : connect_tcp(positional[0], positional[1]);
     if (sockfd == -1) {
-        perror("socket creation failed");
         return 1;
     }
 
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) <= 0) {
-        perror("inet_pton failed for server address");
+#ifdef WITH_TLS
+    if (tls_ca_file != NULL && (ktls_client_init(tls_ca_file) == -1 || ktls_connect(sockfd, positional[0]) == -1)) {
         close(sockfd);
         return 1;
     }
+#endif
 
-    if (connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
-        perror("connect to server failed");
+    output_sink_t sink;
+    if (output_sink_open(&sink, output_path) == -1) {
         close(sockfd);
         return 1;
     }
@@ -110,7 +225,7 @@ int main(int argc, char *argv[]) {
 
     int welcome_received_complete = 0;
     while ((nbytes = recv_line(sockfd, buffer, MAX_BUFFER_SIZE)) > 0) {
-        printf("%s", buffer);
+        output_sink_write(&sink, buffer, (size_t)nbytes);
         if (strstr(buffer, "Developer:") != NULL) {
             welcome_received_complete = 1;
             break;
@@ -118,32 +233,50 @@ int main(int argc, char *argv[]) {
     }
     if (!welcome_received_complete && nbytes <= 0 && nbytes != -2) {
         fprintf(stderr, "Failed to receive complete welcome message or connection closed prematurely.\n");
+        output_sink_close(&sink);
         close(sockfd);
         return (nbytes == 0) ? 0 : 1;
     }
 
+    if (root_name != NULL) { // Select a named root before anything else
+        char root_cmd[MAX_BUFFER_SIZE];
+        snprintf(root_cmd, sizeof(root_cmd), "%s %s\n", CMD_ROOT, root_name);
+        nbytes = 0;
+        if (send_request(sockfd, root_cmd) == -1 ||
+            (nbytes = recv_line(sockfd, buffer, MAX_BUFFER_SIZE)) <= 0 ||
+            strncmp(buffer, RESP_ERROR_PREFIX, strlen(RESP_ERROR_PREFIX)) == 0) {
+            output_sink_flush(&sink);
+            fprintf(stderr, "\nFailed to select root '%s'%s%s", root_name, nbytes > 0 ? ": " : ".\n", nbytes > 0 ? buffer : "");
+            output_sink_close(&sink);
+            close(sockfd);
+            return 1;
+        }
+    }
+
     char current_prompt_dir[MAX_PATH_LEN] = "";
 
-    if (argc == 4) { // Non-interactive mode
-        const char* command_arg = argv[3];
+    if (positional_count == server_args + 1) { // Non-interactive mode
+        const char* command_arg = positional[server_args];
         if (command_arg[0] != '@') {
             fprintf(stderr, "Error: Invalid fourth argument. Must be of the form @filename\n");
+            output_sink_close(&sink);
             close(sockfd);
             return 1;
         }
-        printf("> %s\n", command_arg);
         char command_to_send[MAX_BUFFER_SIZE];
-        snprintf(command_to_send, sizeof(command_to_send), "%s\n", command_arg);
-        if (send_all(sockfd, command_to_send, strlen(command_to_send)) == -1) {
+        snprintf(command_to_send, sizeof(command_to_send), "> %s\n", command_arg);
+        output_sink_write(&sink, command_to_send, strlen(command_to_send));
+        if (send_request(sockfd, command_to_send + 2) == -1) {
             fprintf(stderr, "Error sending command to server.\n");
         } else {
-            while ((nbytes = recv_line(sockfd, buffer, MAX_BUFFER_SIZE)) > 0) {
-                printf("%s", buffer);
-            }
+            int peer_closed;
+            relay_response(&sink, sockfd, &peer_closed);
         }
     } else { // Interactive mode
-        interactive_mode(sockfd, current_prompt_dir);
+        output_sink_flush(&sink);
+        interactive_mode(sockfd, current_prompt_dir, &sink);
     }
+    output_sink_close(&sink);
 
     if (g_shutdown_flag) {
         fprintf(stdout, "\nShutdown signal caught. Notifying server...\n");
@@ -154,16 +287,260 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    shm_channel_release(sockfd);
     if (close(sockfd) == -1) {
         perror("close sockfd failed");
     }
     return 0;
 }
 
+/*
+ * Purpose:
+ *   Connects to the server over TCP. The address may be a host name or an
+ *   IPv4 or IPv6 literal; all addresses it resolves to are raced (see
+ *   race_connect), so setup takes as long as the fastest one.
+ *
+ * Parameters:
+ *   server_host: The server's host name or address.
+ *   port_arg: The port number as given on the command line.
+ *
+ * Returns:
+ *   The connected (blocking) socket, or -1 on error (a message is printed).
+ */
+static int connect_tcp(const char *server_host, const char *port_arg) {
+    char *endptr;
+    long port_long = strtol(port_arg, &endptr, 10);
+    if (endptr == port_arg || *endptr != '\0' || port_long <= 0 || port_long > 65535) {
+        fprintf(stderr, "Error: Invalid port number '%s'. Must be an integer between 1 and 65535.\n", port_arg);
+        return -1;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    struct addrinfo *result = NULL;
+    int status = getaddrinfo(server_host, port_arg, &hints, &result);
+    if (status != 0) {
+        fprintf(stderr, "Error: Cannot resolve server address '%s': %s\n", server_host, gai_strerror(status));
+        return -1;
+    }
+
+    const struct addrinfo *addresses[MAX_CONNECT_ADDRESSES];
+    size_t count = order_addresses(result, addresses, MAX_CONNECT_ADDRESSES);
+    int sockfd = race_connect(addresses, count);
+    freeaddrinfo(result);
+    return sockfd;
+}
+
+/*
+ * Purpose:
+ *   Orders resolved addresses for connection attempts: the resolver's
+ *   preferred family first, then alternating between the families, so a
+ *   broken IPv6 (or IPv4) path delays the connection by one attempt at most.
+ *
+ * Parameters:
+ *   list: The getaddrinfo() result.
+ *   ordered: Receives the addresses in attempt order.
+ *   max_count: The capacity of ordered.
+ *
+ * Returns:
+ *   The number of addresses stored.
+ */
+static size_t order_addresses(const struct addrinfo *list, const struct addrinfo **ordered, size_t max_count) {
+    const struct addrinfo *preferred[MAX_CONNECT_ADDRESSES];
+    const struct addrinfo *other[MAX_CONNECT_ADDRESSES];
+    size_t preferred_count = 0, other_count = 0;
+    for (const struct addrinfo *entry = list; entry != NULL; entry = entry->ai_next) {
+        if (entry->ai_family == list->ai_family) {
+            if (preferred_count < MAX_CONNECT_ADDRESSES) preferred[preferred_count++] = entry;
+        } else if (other_count < MAX_CONNECT_ADDRESSES) {
+            other[other_count++] = entry;
+        }
+    }
+    size_t count = 0;
+    for (size_t i = 0; count < max_count && (i < preferred_count || i < other_count); i++) {
+        if (i < preferred_count) ordered[count++] = preferred[i];
+        if (i < other_count && count < max_count) ordered[count++] = other[i];
+    }
+    return count;
+}
+
+/*
+ * Purpose:
+ *   Starts a non-blocking connect to one address.
+ *
+ * Parameters:
+ *   address: The address.
+ *
+ * Returns:
+ *   The socket, connected or with the connect in progress, or -1 if the
+ *   attempt failed at once (errno is set).
+ */
+static int start_connect_attempt(const struct addrinfo *address) {
+    int sockfd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (sockfd == -1) return -1;
+    int flags = fcntl(sockfd, F_GETFL);
+    if (flags == -1 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1 ||
+        (connect(sockfd, address->ai_addr, address->ai_addrlen) == -1 && errno != EINPROGRESS)) {
+        int saved_errno = errno;
+        close(sockfd);
+        errno = saved_errno;
+        return -1;
+    }
+    return sockfd;
+}
+
+/*
+ * Purpose:
+ *   Connects to the first of several addresses that answers, in the manner
+ *   of Happy Eyeballs (RFC 8305): attempts are started in order, each one
+ *   CONNECT_ATTEMPT_DELAY_MS after the previous (or at once when the
+ *   previous one fails), and they run in parallel until one completes. The
+ *   others are then abandoned.
+ *
+ * Parameters:
+ *   addresses: The addresses in attempt order.
+ *   count: The number of addresses.
+ *
+ * Returns:
+ *   The connected socket, switched back to blocking mode, or -1 if no
+ *   attempt succeeded within CONNECT_TIMEOUT_MS (a message is printed).
+ */
+static int race_connect(const struct addrinfo *const *addresses, size_t count) {
+    struct pollfd pending[MAX_CONNECT_ADDRESSES];
+    size_t pending_count = 0;
+    size_t next = 0;
+    long next_start_ms = 0;
+    int last_error = ETIMEDOUT;
+    int winner = -1;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (winner == -1 && !g_shutdown_flag) {
+        long elapsed = elapsed_ms(&start);
+        if (elapsed >= CONNECT_TIMEOUT_MS) {
+            last_error = ETIMEDOUT;
+            break;
+        }
+        if (next < count && (pending_count == 0 || elapsed >= next_start_ms)) {
+            int sockfd = start_connect_attempt(addresses[next++]);
+            if (sockfd == -1) {
+                last_error = errno;
+                next_start_ms = elapsed; // Go on with the next address at once
+                continue;
+            }
+            pending[pending_count].fd = sockfd;
+            pending[pending_count].events = POLLOUT;
+            pending[pending_count].revents = 0;
+            pending_count++;
+            next_start_ms = elapsed + CONNECT_ATTEMPT_DELAY_MS;
+        }
+        if (pending_count == 0) break; // Every address failed
+
+        long timeout = CONNECT_TIMEOUT_MS - elapsed;
+        if (next < count && next_start_ms - elapsed < timeout) timeout = next_start_ms - elapsed;
+        int ready = poll(pending, (nfds_t)pending_count, timeout > 0 ? (int)timeout : 0);
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+            last_error = errno;
+            break;
+        }
+        for (size_t i = 0; i < pending_count && winner == -1;) {
+            if (pending[i].revents == 0) {
+                i++;
+                continue;
+            }
+            int error = 0;
+            socklen_t error_len = sizeof(error);
+            if (getsockopt(pending[i].fd, SOL_SOCKET, SO_ERROR, &error, &error_len) == -1) error = errno;
+            if (error == 0) {
+                winner = pending[i].fd;
+            } else {
+                last_error = error;
+                close(pending[i].fd);
+                next_start_ms = elapsed;
+            }
+            pending[i] = pending[--pending_count];
+        }
+    }
+
+    for (size_t i = 0; i < pending_count; i++) close(pending[i].fd);
+    if (winner == -1) {
+        fprintf(stderr, "connect to server failed: %s\n", strerror(g_shutdown_flag ? EINTR : last_error));
+        return -1;
+    }
+    int flags = fcntl(winner, F_GETFL);
+    if (flags == -1 || fcntl(winner, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+        perror("fcntl to restore blocking mode failed");
+        close(winner);
+        return -1;
+    }
+    return winner;
+}
+
+/*
+ * Purpose:
+ *   Returns the time passed since a point on the monotonic clock.
+ *
+ * Parameters:
+ *   start: The starting point.
+ *
+ * Returns:
+ *   The elapsed time in milliseconds.
+ */
+static long elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - start->tv_sec) * 1000L + (now.tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+/*
+ * Purpose:
+ *   Connects to a server on the same host through its Unix socket and sets
+ *   up the shared-memory channel the server offers; all further traffic
+ *   goes through that channel.
+ *
+ * Parameters:
+ *   socket_path: The server's local socket (its -U option).
+ *
+ * Returns:
+ *   The connected socket, or -1 on error (a message is printed).
+ */
+static int connect_local(const char *socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Local socket path '%s' is too long.\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd == -1) {
+        perror("socket creation failed");
+        return -1;
+    }
+    if (connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror("connect to local server socket failed");
+        close(sockfd);
+        return -1;
+    }
+    if (shm_channel_accept(sockfd) == -1) {
+        perror("setting up shared-memory channel failed");
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
 /*
  * Purpose:
  *   A signal handler that catches SIGINT and SIGTERM to set a global flag,
- *   allowing the main loops to terminate gracefully.
+ *   allowing the main loops to terminate gracefully. SIGINT while a reply is
+ *   being relayed only asks for the running command to be cancelled.
  *
  * Parameters:
  *   signum: The signal number that was caught.
@@ -172,11 +549,77 @@ int main(int argc, char *argv[]) {
  *   void
  */
 static void signal_handler(int signum) {
-    if (signum == SIGINT || signum == SIGTERM) {
+    if (signum == SIGINT && g_awaiting_response) {
+        g_cancel_requested = 1;
+    } else if (signum == SIGINT || signum == SIGTERM) {
         g_shutdown_flag = 1;
     }
 }
 
+/*
+ * Purpose:
+ *   Sends one command line to the server and counts it, so that the id of
+ *   the running request is known for CANCEL.
+ *
+ * Parameters:
+ *   sockfd: The connected server socket.
+ *   line: The command, terminated by a newline.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+static int send_request(int sockfd, const char *line) {
+    if (send_all(sockfd, line, strlen(line)) == -1) return -1;
+    g_requests_sent++;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Relays a command's reply to the sink like output_sink_recv_stream. If
+ *   Ctrl-C is pressed meanwhile, "CANCEL <request_id>" is sent and relaying
+ *   goes on, so the partial reply and the server's "CANCELLED" line are
+ *   still shown.
+ *
+ * Parameters:
+ *   sink: The output sink.
+ *   sockfd: The connected server socket (with SO_RCVTIMEO set).
+ *   peer_closed: Set to 1 if the server closed the connection, 0 otherwise.
+ *
+ * Returns:
+ *   The number of bytes relayed, or -1 on a socket or output error.
+ */
+static ssize_t relay_response(output_sink_t *sink, int sockfd, int *peer_closed) {
+    ssize_t total = 0;
+    g_cancel_requested = 0;
+    g_awaiting_response = 1;
+    for (;;) {
+        ssize_t relayed = output_sink_recv_stream(sink, sockfd, peer_closed);
+        if (relayed >= 0) {
+            total += relayed;
+            break;
+        }
+        if (errno != EINTR) {
+            total = -1;
+            break;
+        }
+        if (g_cancel_requested) {
+            g_cancel_requested = 0;
+            char cancel_cmd[MAX_CMD_LEN];
+            snprintf(cancel_cmd, sizeof(cancel_cmd), "%s %lu\n", CMD_CANCEL, g_requests_sent);
+            output_sink_flush(sink);
+            fprintf(stderr, "\nCancelling request %lu...\n", g_requests_sent);
+            if (send_all(sockfd, cancel_cmd, strlen(cancel_cmd)) == -1) {
+                total = -1;
+                break;
+            }
+        }
+        if (g_shutdown_flag) break;
+    }
+    g_awaiting_response = 0;
+    return total;
+}
+
 /*
  * Purpose:
  *   Updates the client's command prompt string based on the server's response
@@ -213,30 +656,38 @@ static void update_prompt_dir(const char *server_response, char *current_prompt_
  * Parameters:
  *   sockfd: The file descriptor for the connected server socket.
  *   current_prompt_dir: A buffer containing the string for the current server directory prompt.
+ *   sink: The output sink that receives the server's responses.
  *
  * Returns:
  *   void
  */
-static void interactive_mode(int sockfd, char *current_prompt_dir) {
+static void interactive_mode(int sockfd, char *current_prompt_dir, output_sink_t *sink) {
     char command_buffer[MAX_BUFFER_SIZE];
     char response_buffer[MAX_BUFFER_SIZE];
+    char prompt[MAX_PATH_LEN + 3];
     ssize_t nbytes_recv;
 
-    while (!g_shutdown_flag) {
-        if (strlen(current_prompt_dir) == 0) printf("> ");
-        else printf("%s> ", current_prompt_dir);
-        fflush(stdout);
+    listing_cache_t *listings = calloc(1, sizeof(listing_cache_t));
+    completion_cache_t *completions = calloc(1, sizeof(completion_cache_t));
+    if (completions != NULL) {
+        completions->sockfd = sockfd;
+        completions->prompt_dir = current_prompt_dir;
+    }
 
-        if (fgets(command_buffer, sizeof(command_buffer), stdin) == NULL) {
+    while (!g_shutdown_flag) {
+        snprintf(prompt, sizeof(prompt), "%s> ", current_prompt_dir);
+        int read_status = line_editor_read(prompt, command_buffer, sizeof(command_buffer),
+                                           completions ? complete_from_server : NULL, completions);
+        if (read_status != 1) {
             if (g_shutdown_flag) break;
-            if (feof(stdin)) {
+            if (read_status == 0) {
                 printf("\nEOF detected on stdin. Sending QUIT command.\n");
                 snprintf(command_buffer, sizeof(command_buffer), "%s", CMD_QUIT);
             } else if (errno == EINTR) {
                 clearerr(stdin);
                 continue;
             } else {
-                perror("fgets from stdin failed");
+                perror("Reading from stdin failed");
                 break;
             }
         }
@@ -263,7 +714,34 @@ static void interactive_mode(int sockfd, char *current_prompt_dir) {
             continue;
         }
 
-        if (send_all(sockfd, command_buffer, strlen(command_buffer)) == -1 || send_all(sockfd, "\n", 1) == -1) {
+        if (strncmp(command_buffer, "JOBGET ", 7) == 0) {
+            char id[MAX_CMD_LEN];
+            int consumed = 0;
+            if (sscanf(command_buffer + 7, "%255s %n", id, &consumed) != 1 || command_buffer[7 + consumed] == '\0') {
+                fprintf(stderr, "Usage: JOBGET <job_id> <local_file>\n");
+            } else if (job_get(sockfd, id, command_buffer + 7 + consumed) == -1) {
+                fprintf(stderr, "\nConnection to the server failed during JOBGET.\n");
+                break;
+            }
+            continue;
+        }
+
+        if (listings != NULL && strcmp(command_buffer, CMD_LIST) == 0) {
+            nbytes_recv = list_with_cache(sockfd, listings, current_prompt_dir, sink);
+            output_sink_flush(sink);
+            if (nbytes_recv == 0) {
+                fprintf(stderr, "\nServer closed connection unexpectedly.\n");
+                break;
+            } else if (nbytes_recv == -1) {
+                fprintf(stderr, "\nError receiving response from server.\n");
+                break;
+            }
+            continue;
+        }
+
+        char request_line[MAX_BUFFER_SIZE + 1];
+        snprintf(request_line, sizeof(request_line), "%s\n", command_buffer);
+        if (send_request(sockfd, request_line) == -1) {
             fprintf(stderr, "Error sending command/newline: %s\n", command_buffer);
             break;
         }
@@ -272,23 +750,29 @@ static void interactive_mode(int sockfd, char *current_prompt_dir) {
         sscanf(command_buffer, "%s", temp_cmd_check);
         if (strcmp(temp_cmd_check, CMD_QUIT) == 0) {
             if ((nbytes_recv = recv_line(sockfd, response_buffer, MAX_BUFFER_SIZE)) > 0) {
-                printf("%s", response_buffer);
+                output_sink_write(sink, response_buffer, (size_t)nbytes_recv);
             }
             break;
         }
 
-        int is_cd_command = (strcmp(temp_cmd_check, CMD_CD) == 0);
-        int first_line_after_cd = 1;
-
-        while ((nbytes_recv = recv_line(sockfd, response_buffer, MAX_BUFFER_SIZE)) > 0) {
-            printf("%s", response_buffer);
-            if (is_cd_command && first_line_after_cd) {
-                if (strncmp(response_buffer, RESP_ERROR_PREFIX, strlen(RESP_ERROR_PREFIX)) != 0) {
-                    update_prompt_dir(response_buffer, current_prompt_dir, MAX_PATH_LEN);
+        if (strcmp(temp_cmd_check, CMD_CD) == 0) {
+            int first_line_after_cd = 1;
+            while ((nbytes_recv = recv_line(sockfd, response_buffer, MAX_BUFFER_SIZE)) > 0) {
+                output_sink_write(sink, response_buffer, (size_t)nbytes_recv);
+                if (first_line_after_cd) {
+                    if (strncmp(response_buffer, RESP_ERROR_PREFIX, strlen(RESP_ERROR_PREFIX)) != 0) {
+                        update_prompt_dir(response_buffer, current_prompt_dir, MAX_PATH_LEN);
+                    }
+                    first_line_after_cd = 0;
                 }
-                first_line_after_cd = 0;
             }
+        } else {
+            // Bulk responses (e.g. LIST) are relayed in blocks without line splitting.
+            int peer_closed;
+            ssize_t relayed = relay_response(sink, sockfd, &peer_closed);
+            nbytes_recv = peer_closed ? 0 : (relayed == -1 ? -1 : -2);
         }
+        output_sink_flush(sink);
 
         if (nbytes_recv == 0) {
             fprintf(stderr, "\nServer closed connection unexpectedly.\n");
@@ -297,7 +781,375 @@ static void interactive_mode(int sockfd, char *current_prompt_dir) {
             fprintf(stderr, "\nError receiving response from server.\n");
             break;
         }
-        fflush(stdout);
         if (feof(stdin)) break;
     }
+
+    if (completions != NULL) {
+        for (size_t i = 0; i < COMPLETION_CACHE_SIZE; i++) free_completion_entry(&completions->entries[i]);
+        free(completions->matches);
+        free(completions);
+    }
+    if (listings != NULL) {
+        for (size_t i = 0; i < LISTING_CACHE_SIZE; i++) free(listings->entries[i].body);
+        free(listings);
+    }
+}
+
+/*
+ * Purpose:
+ *   Runs LIST for the current server directory using the client's listing
+ *   cache. If a listing of the directory is cached, the server is asked with
+ *   "LIST -c <token>" whether it changed and the cached copy is shown when it
+ *   did not; otherwise "LIST -v" fetches the listing with its token.
+ *   Listings over LISTING_CACHE_MAX_BYTES are shown without being cached.
+ *
+ * Parameters:
+ *   sockfd: The connected server socket.
+ *   cache: The listing cache.
+ *   dir: The current server directory (as shown in the prompt).
+ *   sink: The output sink that receives the listing.
+ *
+ * Returns:
+ *   A positive value on success, 0 if the server closed the connection,
+ *   -1 on error, or -2 if the response ended with a timeout.
+ */
+static ssize_t list_with_cache(int sockfd, listing_cache_t *cache, const char *dir, output_sink_t *sink) {
+    cached_listing_t *entry = NULL;
+    cached_listing_t *victim = &cache->entries[0];
+    for (size_t i = 0; i < LISTING_CACHE_SIZE; i++) {
+        cached_listing_t *candidate = &cache->entries[i];
+        if (candidate->body != NULL && strcmp(candidate->dir, dir) == 0) {
+            entry = candidate;
+            break;
+        }
+        if (victim->body != NULL && (candidate->body == NULL || candidate->last_used < victim->last_used)) {
+            victim = candidate;
+        }
+    }
+
+    char line[MAX_BUFFER_SIZE];
+    if (entry != NULL) snprintf(line, sizeof(line), "%s -c %s\n", CMD_LIST, entry->token);
+    else snprintf(line, sizeof(line), "%s -v\n", CMD_LIST);
+    if (send_request(sockfd, line) == -1) return -1;
+
+    ssize_t nbytes = recv_line(sockfd, line, sizeof(line));
+    if (nbytes <= 0) return nbytes;
+
+    char token[MAX_CMD_LEN];
+    unsigned long long len;
+    if (entry != NULL && strncmp(line, RESP_NOT_MODIFIED " ", strlen(RESP_NOT_MODIFIED) + 1) == 0) {
+        entry->last_used = ++cache->use_counter;
+        return output_sink_write(sink, entry->body, entry->len) == -1 ? -1 : 1;
+    }
+    if (sscanf(line, RESP_VERSION " %255s %llu", token, &len) != 2) {
+        // An error or an unexpected reply: relay it as is.
+        output_sink_write(sink, line, (size_t)nbytes);
+        int peer_closed;
+        ssize_t relayed = relay_response(sink, sockfd, &peer_closed);
+        return peer_closed ? 0 : (relayed == -1 ? -1 : -2);
+    }
+
+    if (len > LISTING_CACHE_MAX_BYTES) {
+        // Too large to cache, or a bogus length: pass it through in pieces
+        // instead of allocating what the server claims.
+        while (len > 0) {
+            size_t chunk = (len < sizeof(line)) ? (size_t)len : sizeof(line);
+            nbytes = recv_all(sockfd, line, chunk);
+            if (nbytes > 0 && output_sink_write(sink, line, (size_t)nbytes) == -1) return -1;
+            if (nbytes != (ssize_t)chunk) return nbytes == -2 ? -2 : (nbytes <= 0 ? nbytes : -1);
+            len -= chunk;
+        }
+        return 1;
+    }
+    char *body = malloc(len > 0 ? (size_t)len : 1);
+    if (body == NULL) {
+        perror("malloc for cached listing failed");
+        return -1;
+    }
+    nbytes = (len > 0) ? recv_all(sockfd, body, (size_t)len) : 0;
+    if (nbytes != (ssize_t)len) {
+        if (nbytes > 0) output_sink_write(sink, body, (size_t)nbytes);
+        free(body);
+        return nbytes == -2 ? -2 : (nbytes <= 0 ? nbytes : -1);
+    }
+    if (output_sink_write(sink, body, (size_t)len) == -1) {
+        free(body);
+        return -1;
+    }
+
+    if (entry == NULL) {
+        entry = victim;
+        snprintf(entry->dir, sizeof(entry->dir), "%s", dir);
+    }
+    free(entry->body);
+    entry->body = body;
+    entry->len = (size_t)len;
+    snprintf(entry->token, sizeof(entry->token), "%s", token);
+    entry->last_used = ++cache->use_counter;
+    return 1;
+}
+
+/*
+ * Purpose:
+ *   Frees the names of a completion cache entry and marks it unused.
+ *
+ * Parameters:
+ *   entry: The cache entry.
+ *
+ * Returns:
+ *   void
+ */
+static void free_completion_entry(completion_entry_t *entry) {
+    for (size_t i = 0; i < entry->count; i++) free(entry->names[i]);
+    free(entry->names);
+    entry->names = NULL;
+    entry->count = 0;
+    entry->dir_key[0] = '\0';
+}
+
+/*
+ * Purpose:
+ *   Sends COMPLETE for a word and stores the server's answer in a cache
+ *   entry. The answer is a "COMPLETE <count> [MORE]" line followed by one
+ *   name per line.
+ *
+ * Parameters:
+ *   cache: The completion cache (for the socket).
+ *   word: The word to complete.
+ *   entry: The cache entry that receives the names.
+ *
+ * Returns:
+ *   0 on success, or -1 on error or an error reply.
+ */
+static int fetch_completions(completion_cache_t *cache, const char *word, completion_entry_t *entry) {
+    char line[MAX_BUFFER_SIZE];
+    snprintf(line, sizeof(line), "%s %s\n", CMD_COMPLETE, word);
+    if (send_request(cache->sockfd, line) == -1) return -1;
+    if (recv_line(cache->sockfd, line, sizeof(line)) <= 0) return -1;
+
+    unsigned long count;
+    char more[8] = "";
+    if (sscanf(line, "COMPLETE %lu %7s", &count, more) < 1) return -1;
+    entry->names = calloc(count > 0 ? count : 1, sizeof(char *));
+    if (entry->names == NULL) return -1;
+    entry->truncated = (strcmp(more, "MORE") == 0);
+
+    while (entry->count < count) {
+        if (recv_line(cache->sockfd, line, sizeof(line)) <= 0) break;
+        line[strcspn(line, "\r\n")] = '\0';
+        entry->names[entry->count] = strdup(line);
+        if (entry->names[entry->count] == NULL) break;
+        entry->count++;
+    }
+    if (entry->count < count) {
+        free_completion_entry(entry);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Completion callback for the line editor. The server's answers are kept
+ *   per directory; a later, longer prefix in the same directory is answered
+ *   by filtering a cached complete answer instead of asking the server again.
+ *   Answers expire after COMPLETION_CACHE_TTL_SEC seconds.
+ *
+ * Parameters:
+ *   ctx: The completion_cache_t.
+ *   word: The word to complete.
+ *   matches_out: Receives the matching names.
+ *   count_out: Receives the number of matches.
+ *
+ * Returns:
+ *   0 on success, or -1 if no completions are available.
+ */
+static int complete_from_server(void *ctx, const char *word, const char *const **matches_out, size_t *count_out) {
+    completion_cache_t *cache = (completion_cache_t *)ctx;
+    const char *name_prefix = strrchr(word, '/');
+    name_prefix = name_prefix ? name_prefix + 1 : word;
+
+    char dir_key[MAX_PATH_LEN];
+    snprintf(dir_key, sizeof(dir_key), "%s\n%.*s", cache->prompt_dir, (int)(name_prefix - word), word);
+    time_t now = time(NULL);
+
+    completion_entry_t *entry = NULL;
+    completion_entry_t *victim = NULL; // An unused entry, or else the least recently used one
+    for (size_t i = 0; i < COMPLETION_CACHE_SIZE; i++) {
+        completion_entry_t *candidate = &cache->entries[i];
+        if (candidate->dir_key[0] != '\0' && now - candidate->fetched > COMPLETION_CACHE_TTL_SEC) {
+            free_completion_entry(candidate);
+        }
+        if (candidate->dir_key[0] == '\0') {
+            if (victim == NULL || victim->dir_key[0] != '\0') victim = candidate;
+            continue;
+        }
+        if (victim == NULL || (victim->dir_key[0] != '\0' && candidate->last_used < victim->last_used)) victim = candidate;
+        if (strcmp(candidate->dir_key, dir_key) != 0) continue;
+        size_t prefix_len = strlen(candidate->prefix);
+        if (strncmp(name_prefix, candidate->prefix, prefix_len) != 0) continue;
+        if (candidate->truncated && name_prefix[prefix_len] != '\0') continue;
+        entry = candidate;
+        break;
+    }
+
+    if (entry == NULL) {
+        entry = victim;
+        free_completion_entry(entry);
+        if (fetch_completions(cache, word, entry) == -1) return -1;
+        snprintf(entry->dir_key, sizeof(entry->dir_key), "%s", dir_key);
+        snprintf(entry->prefix, sizeof(entry->prefix), "%s", name_prefix);
+        entry->fetched = now;
+    }
+    entry->last_used = ++cache->use_counter;
+
+    if (entry->count > cache->matches_capacity) {
+        const char **grown = realloc(cache->matches, entry->count * sizeof(char *));
+        if (grown == NULL) return -1;
+        cache->matches = grown;
+        cache->matches_capacity = entry->count;
+    }
+    size_t count = 0;
+    size_t typed = strlen(name_prefix);
+    for (size_t i = 0; i < entry->count; i++) {
+        if (strncmp(entry->names[i], name_prefix, typed) == 0) cache->matches[count++] = entry->names[i];
+    }
+    *matches_out = cache->matches;
+    *count_out = count;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Receives exactly the given number of bytes, waiting through up to
+ *   JOBGET_IDLE_LIMIT receive timeouts in a row.
+ *
+ * Parameters:
+ *   sockfd: The connected server socket (with SO_RCVTIMEO set).
+ *   buffer: The destination buffer.
+ *   length: The number of bytes to receive.
+ *
+ * Returns:
+ *   0 on success, or -1 if the connection failed or stayed silent.
+ */
+static int recv_job_bytes(int sockfd, char *buffer, size_t length) {
+    size_t total = 0;
+    int idle = 0;
+    while (total < length) {
+        ssize_t nbytes = transport_recv(sockfd, buffer + total, length - total);
+        if (nbytes > 0) {
+            total += (size_t)nbytes;
+            idle = 0;
+        } else if (nbytes == 0) {
+            return -1;
+        } else if (errno == EINTR) {
+            continue;
+        } else if ((errno != EAGAIN && errno != EWOULDBLOCK) || ++idle >= JOBGET_IDLE_LIMIT) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Handles the client-side JOBGET command: appends the output of a
+ *   background job to a local file with repeated "JOB FETCH" requests,
+ *   starting at the file's current size, so a download that was cut off
+ *   resumes where it stopped. While the job is still running, its output is
+ *   fetched as it grows. Ctrl-C stops the download; the file keeps what was
+ *   received.
+ *
+ * Parameters:
+ *   sockfd: The connected server socket.
+ *   id: The job id.
+ *   local_path: The local file.
+ *
+ * Returns:
+ *   0 when done (also after a server error reply or Ctrl-C), or -1 if the
+ *   connection failed.
+ */
+static int job_get(int sockfd, const char *id, const char *local_path) {
+    int fd = open(local_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror("JOBGET: Cannot open local file");
+        if (fd != -1) close(fd);
+        return 0;
+    }
+    char *chunk = malloc(JOBGET_CHUNK_BYTES);
+    if (chunk == NULL) {
+        perror("malloc for JOBGET failed");
+        close(fd);
+        return 0;
+    }
+    unsigned long long offset = (unsigned long long)st.st_size;
+    if (offset > 0) printf("Resuming job %s at byte %llu.\n", id, offset);
+
+    char line[MAX_BUFFER_SIZE];
+    char state[MAX_CMD_LEN] = "";
+    int result = 0, finished = 0;
+    int idle = 0;
+    g_cancel_requested = 0;
+    g_awaiting_response = 1;
+    while (!finished && !g_cancel_requested && !g_shutdown_flag) {
+        snprintf(line, sizeof(line), "%s FETCH %s %llu\n", CMD_JOB, id, offset);
+        if (send_request(sockfd, line) == -1) {
+            result = -1;
+            break;
+        }
+        ssize_t nbytes;
+        while ((nbytes = recv_line(sockfd, line, sizeof(line))) == -2 && ++idle < JOBGET_IDLE_LIMIT) {}
+        if (nbytes <= 0) {
+            result = -1;
+            break;
+        }
+        idle = 0;
+        unsigned long long reply_offset;
+        size_t length;
+        if (sscanf(line, RESP_RESULT " %*s %llu %zu", &reply_offset, &length) != 2 || reply_offset != offset ||
+            length > JOBGET_CHUNK_BYTES) {
+            fprintf(stderr, "%s", line);
+            break;
+        }
+        if (length > 0) {
+            if (recv_job_bytes(sockfd, chunk, length) == -1) {
+                result = -1;
+                break;
+            }
+            if (write(fd, chunk, length) != (ssize_t)length) {
+                perror("JOBGET: Writing local file failed");
+                break;
+            }
+            offset += length;
+            continue;
+        }
+
+        // At the end of the output so far: done unless the job is still running.
+        snprintf(line, sizeof(line), "%s STATUS %s\n", CMD_JOB, id);
+        if (send_request(sockfd, line) == -1 || recv_line(sockfd, line, sizeof(line)) <= 0) {
+            result = -1;
+            break;
+        }
+        if (sscanf(line, CMD_JOB " %*s %255s", state) != 1) {
+            fprintf(stderr, "%s", line);
+            break;
+        }
+        if (strcmp(state, "QUEUED") == 0 || strcmp(state, "RUNNING") == 0) {
+            struct timespec pause = { JOBGET_POLL_SEC, 0 };
+            nanosleep(&pause, NULL);
+        } else {
+            finished = 1;
+            printf("%s", line);
+        }
+    }
+    g_awaiting_response = 0;
+    if (!finished && result == 0) {
+        printf("JOBGET stopped at byte %llu; run it again to resume.\n", offset);
+    } else if (finished) {
+        printf("Job %s: %llu bytes in '%s'.\n", id, offset, local_path);
+    }
+    free(chunk);
+    close(fd);
+    return result;
 }
@@ -3,7 +3,10 @@
  *
  * This file implements the shared utility functions declared in common.h. These
  * functions provide common functionality required by both the client and server,
- * such as reliable socket I/O and timestamp generation.
+ * such as reliable socket I/O and timestamp generation. All socket I/O goes
+ * through transport_recv and transport_send, which switch to a same-host
+ * shared-memory channel when one is set up for the socket, and which can
+ * busy-poll a socket for a while before blocking on it.
  */
 #define _POSIX_C_SOURCE 200809L
 #include "common.h"
@@ -15,6 +18,156 @@
 #include <sys/socket.h>
 #include <errno.h>
 
+#include "shm_channel.h"
+
+#define BUSY_POLL_CLOCK_INTERVAL 64 // Polls between reads of the clock
+
+static long g_busy_poll_usec = 0; // Spin budget of transport_recv; 0 blocks at once
+
+/*
+ * Purpose:
+ *   Sets how long transport_recv polls a socket without blocking before it
+ *   sleeps in recv(). Must be called before any thread receives.
+ *
+ * Parameters:
+ *   usec: The spin budget in microseconds, or 0 to block at once.
+ *
+ * Returns:
+ *   void
+ */
+void transport_set_busy_poll(long usec) {
+    g_busy_poll_usec = (usec > 0) ? usec : 0;
+}
+
+/*
+ * Purpose:
+ *   Polls a socket with non-blocking reads until data arrives or the spin
+ *   budget is used up.
+ *
+ * Parameters:
+ *   sockfd: The socket to receive from.
+ *   buffer: The destination buffer.
+ *   length: The size of the buffer.
+ *
+ * Returns:
+ *   The result of the first read that did not find the socket empty, or -1
+ *   with errno EAGAIN if the budget ran out.
+ */
+static ssize_t busy_poll_recv(int sockfd, void *buffer, size_t length) {
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned long polls = 1;; polls++) {
+        ssize_t nbytes = recv(sockfd, buffer, length, MSG_DONTWAIT);
+        if (nbytes >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return nbytes;
+        if (polls % BUSY_POLL_CLOCK_INTERVAL == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long spent_usec = (long)(now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000;
+            if (spent_usec >= g_busy_poll_usec) {
+                errno = EAGAIN;
+                return -1;
+            }
+        }
+    }
+}
+
+/*
+ * Purpose:
+ *   Receives data like recv(), through the shared-memory channel registered
+ *   under the socket if there is one (see shm_channel.h). With a busy-poll
+ *   budget set, a socket is polled without blocking for that long first.
+ *
+ * Parameters:
+ *   sockfd: The socket to receive from.
+ *   buffer: The destination buffer.
+ *   length: The size of the buffer.
+ *
+ * Returns:
+ *   The number of bytes received, 0 if the peer closed the connection, or
+ *   -1 on error (errno is set; EAGAIN if SO_RCVTIMEO expired).
+ */
+ssize_t transport_recv(int sockfd, void *buffer, size_t length) {
+    shm_channel_t *channel = shm_channel_find(sockfd);
+    if (channel != NULL) return shm_channel_recv(channel, buffer, length);
+    if (g_busy_poll_usec > 0) {
+        ssize_t nbytes = busy_poll_recv(sockfd, buffer, length);
+        if (nbytes >= 0 || errno != EAGAIN) return nbytes;
+    }
+    return recv(sockfd, buffer, length, 0);
+}
+
+/*
+ * Purpose:
+ *   Returns the data waiting on a socket (or its shared-memory channel)
+ *   without consuming it and without waiting.
+ *
+ * Parameters:
+ *   sockfd: The socket.
+ *   buffer: The destination buffer.
+ *   length: The size of the buffer.
+ *
+ * Returns:
+ *   The number of bytes copied, 0 if the peer closed the connection, or -1
+ *   on error (errno is EAGAIN if nothing is waiting).
+ */
+ssize_t transport_peek(int sockfd, void *buffer, size_t length) {
+    shm_channel_t *channel = shm_channel_find(sockfd);
+    if (channel != NULL) return shm_channel_peek(channel, buffer, length);
+    return recv(sockfd, buffer, length, MSG_PEEK | MSG_DONTWAIT);
+}
+
+/*
+ * Purpose:
+ *   Sends data like send(), through the shared-memory channel registered
+ *   under the socket if there is one.
+ *
+ * Parameters:
+ *   sockfd: The socket to send to.
+ *   buffer: The data.
+ *   length: The number of bytes.
+ *
+ * Returns:
+ *   The number of bytes sent, or -1 on error (errno is set).
+ */
+ssize_t transport_send(int sockfd, const void *buffer, size_t length) {
+    shm_channel_t *channel = shm_channel_find(sockfd);
+    if (channel != NULL) return shm_channel_send(channel, buffer, length);
+    return send(sockfd, buffer, length, 0);
+}
+
+/*
+ * Purpose:
+ *   Receives exactly the given number of bytes from a socket, handling
+ *   partial reads.
+ *
+ * Parameters:
+ *   sockfd: The file descriptor of the socket to receive data from.
+ *   buffer: A pointer to the buffer that receives the data.
+ *   length: The number of bytes to receive.
+ *
+ * Returns:
+ *   The number of bytes received (equal to length on success).
+ *   0 if the connection was closed before any byte arrived.
+ *   -1 on a critical socket error.
+ *   -2 if a timeout occurred (if SO_RCVTIMEO is set).
+ */
+ssize_t recv_all(int sockfd, char *buffer, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t nbytes = transport_recv(sockfd, buffer + total, length - total);
+        if (nbytes > 0) {
+            total += (size_t)nbytes;
+        } else if (nbytes == 0) {
+            break;
+        } else {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return -2;
+            perror("recv in recv_all");
+            return -1;
+        }
+    }
+    return (ssize_t)total;
+}
+
 /*
  * Purpose:
  *   Initializes any static memory that requires runtime setup. This function
@@ -88,7 +241,7 @@ int send_all(int sockfd, const char *buffer, size_t length) {
     }
     size_t total_sent = 0;
     while (total_sent < length) {
-        ssize_t sent_bytes = send(sockfd, buffer + total_sent, length - total_sent, 0);
+        ssize_t sent_bytes = transport_send(sockfd, buffer + total_sent, length - total_sent);
         if (sent_bytes == -1) {
             if (errno == EINTR) continue;
             perror("send in send_all");
@@ -134,7 +287,7 @@ ssize_t recv_line(int sockfd, char *buffer, size_t max_len) {
     ssize_t nbytes;
 
     while (current_len < max_len - 1) {
-        nbytes = recv(sockfd, &ch, 1, 0);
+        nbytes = transport_recv(sockfd, &ch, 1);
         if (nbytes == 1) {
             buffer[current_len++] = ch;
             if (ch == '\n') break;
@@ -157,3 +310,22 @@ ssize_t recv_line(int sockfd, char *buffer, size_t max_len) {
     buffer[current_len] = '\0';
     return (ssize_t)current_len;
 }
+
+/*
+ * Purpose:
+ *   Checks that a resolved absolute path lies inside a root directory. Unlike
+ *   a plain prefix test, "/srv/ab" is not considered to be inside "/srv/a".
+ *
+ * Parameters:
+ *   path: The resolved absolute path to check.
+ *   root_path: The resolved absolute path of the root.
+ *
+ * Returns:
+ *   1 if the path is the root or below it, 0 otherwise.
+ */
+int path_within_root(const char *path, const char *root_path) {
+    size_t root_len = strlen(root_path);
+    if (strncmp(path, root_path, root_len) != 0) return 0;
+    if (root_len == 1) return 1; // Root is "/"
+    return path[root_len] == '\0' || path[root_len] == '/';
+}
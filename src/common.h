@@ -24,6 +24,67 @@
  */
 void get_timestamp(char *buffer, size_t len);
 
+/*
+ * Purpose:
+ *   Sets how long transport_recv polls a socket without blocking before it
+ *   sleeps in recv(). Must be called before any thread receives.
+ *
+ * Parameters:
+ *   usec: The spin budget in microseconds, or 0 to block at once.
+ *
+ * Returns:
+ *   void
+ */
+void transport_set_busy_poll(long usec);
+
+/*
+ * Purpose:
+ *   Receives data like recv(), through the shared-memory channel registered
+ *   under the socket if there is one (see shm_channel.h). With a busy-poll
+ *   budget set, a socket is polled without blocking for that long first.
+ *
+ * Parameters:
+ *   sockfd: The socket to receive from.
+ *   buffer: The destination buffer.
+ *   length: The size of the buffer.
+ *
+ * Returns:
+ *   The number of bytes received, 0 if the peer closed the connection, or
+ *   -1 on error (errno is set; EAGAIN if SO_RCVTIMEO expired).
+ */
+ssize_t transport_recv(int sockfd, void *buffer, size_t length);
+
+/*
+ * Purpose:
+ *   Returns the data waiting on a socket (or its shared-memory channel)
+ *   without consuming it and without waiting.
+ *
+ * Parameters:
+ *   sockfd: The socket.
+ *   buffer: The destination buffer.
+ *   length: The size of the buffer.
+ *
+ * Returns:
+ *   The number of bytes copied, 0 if the peer closed the connection, or -1
+ *   on error (errno is EAGAIN if nothing is waiting).
+ */
+ssize_t transport_peek(int sockfd, void *buffer, size_t length);
+
+/*
+ * Purpose:
+ *   Sends data like send(), through the shared-memory channel registered
+ *   under the socket if there is one.
+ *
+ * Parameters:
+ *   sockfd: The socket to send to.
+ *   buffer: The data.
+ *   length: The number of bytes.
+ *
+ * Returns:
+ *   The number of bytes sent, or -1 on error (errno is set).
+ */
+ssize_t transport_send(int sockfd, const void *buffer, size_t length);
+
 /*
  * Purpose:
  *   Reliably sends a specified number of bytes from a buffer over a socket,
@@ -57,6 +118,24 @@ int send_all(int sockfd, const char *buffer, size_t length);
  */
 ssize_t recv_line(int sockfd, char *buffer, size_t max_len);
 
+/*
+ * Purpose:
+ *   Receives exactly the given number of bytes from a socket, handling
+ *   partial reads.
+ *
+ * Parameters:
+ *   sockfd: The file descriptor of the socket to receive data from.
+ *   buffer: A pointer to the buffer that receives the data.
+ *   length: The number of bytes to receive.
+ *
+ * Returns:
+ *   The number of bytes received (equal to length on success).
+ *   0 if the connection was closed before any byte arrived.
+ *   -1 on a critical socket error.
+ *   -2 if a timeout occurred (if SO_RCVTIMEO is set).
+ */
+ssize_t recv_all(int sockfd, char *buffer, size_t length);
+
 /*
  * Purpose:
  *   Initializes any static memory that requires runtime setup. This function
@@ -70,4 +149,18 @@ ssize_t recv_line(int sockfd, char *buffer, size_t max_len);
  */
 void initialize_static_memory(void);
 
+/*
+ * Purpose:
+ *   Checks that a resolved absolute path lies inside a root directory. Unlike
+ *   a plain prefix test, "/srv/ab" is not considered to be inside "/srv/a".
+ *
+ * Parameters:
+ *   path: The resolved absolute path to check.
+ *   root_path: The resolved absolute path of the root.
+ *
+ * Returns:
+ *   1 if the path is the root or below it, 0 otherwise.
+ */
+int path_within_root(const char *path, const char *root_path);
+
 #endif // COMMON_H
@@ -0,0 +1,602 @@
+/*
+ * src/dir_cache.c
+ *
+ * This file implements the directory listing cache declared in dir_cache.h.
+ * Listings are immutable once published and reference counted, so threads can
+ * send a listing to their client while another thread replaces it. The cache
+ * is a hash table with an LRU list to bound the number of directories kept.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "dir_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <inttypes.h>
+
+#include "protocol.h"
+#include "dir_changes.h"
+
+typedef struct raw_entry_s {
+    size_t name_off;
+    size_t target_off; // SIZE_MAX if none
+    char type;
+} raw_entry_t;
+
+static pthread_mutex_t g_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static dir_listing_t **g_buckets = NULL;
+static size_t g_bucket_count = 0;
+static size_t g_max_listings = DIR_CACHE_DEFAULT_MAX_LISTINGS;
+static size_t g_listing_count = 0;
+static dir_listing_t *g_lru_head = NULL; // Most recently used
+static dir_listing_t *g_lru_tail = NULL; // Least recently used
+static uint64_t g_next_generation = 0;
+
+/*
+ * Purpose:
+ *   Computes the FNV-1a hash of a path.
+ *
+ * Parameters:
+ *   path: The string to hash.
+ *
+ * Returns:
+ *   The hash value.
+ */
+static size_t hash_path(const char *path) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return (size_t)hash;
+}
+
+/*
+ * Purpose:
+ *   Initializes the directory cache. Must be called once before any other
+ *   dir_cache function.
+ *
+ * Parameters:
+ *   max_listings: The maximum number of directories kept in the cache.
+ *
+ * Returns:
+ *   0 on success, or -1 on allocation failure.
+ */
+int dir_cache_init(size_t max_listings) {
+    g_max_listings = max_listings > 0 ? max_listings : DIR_CACHE_DEFAULT_MAX_LISTINGS;
+    g_bucket_count = 64;
+    while (g_bucket_count < g_max_listings * 2) g_bucket_count *= 2;
+    g_buckets = calloc(g_bucket_count, sizeof(dir_listing_t *));
+    if (g_buckets == NULL) {
+        perror("calloc for directory cache failed");
+        return -1;
+    }
+    // Seeding from the clock keeps generations unique across restarts, so
+    // version tokens handed out by an earlier process never match by accident.
+    g_next_generation = (uint64_t)time(NULL) << 20;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Reads the version stamp of a directory.
+ *
+ * Parameters:
+ *   path: The absolute path of the directory.
+ *   stamp: Receives the stamp.
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno is set).
+ */
+int dir_stamp_read(const char *path, dir_stamp_t *stamp) {
+    struct stat st;
+    if (stat(path, &st) == -1) return -1;
+    if (!S_ISDIR(st.st_mode)) {
+        errno = ENOTDIR;
+        return -1;
+    }
+    memset(stamp, 0, sizeof(*stamp));
+    stamp->dev = st.st_dev;
+    stamp->ino = st.st_ino;
+    stamp->mtime = st.st_mtim;
+    stamp->ctime = st.st_ctim;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Compares two directory version stamps.
+ *
+ * Parameters:
+ *   a: The first stamp.
+ *   b: The second stamp.
+ *
+ * Returns:
+ *   1 if the stamps are identical, 0 otherwise.
+ */
+int dir_stamp_equal(const dir_stamp_t *a, const dir_stamp_t *b) {
+    return a->dev == b->dev && a->ino == b->ino &&
+           a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec &&
+           a->ctime.tv_sec == b->ctime.tv_sec && a->ctime.tv_nsec == b->ctime.tv_nsec;
+}
+
+/*
+ * Purpose:
+ *   Formats the version token of a listing: its generation followed by a
+ *   hash of its stamp, as hex digits. Two listings have the same token only
+ *   if they are the same listing, so a matching token proves that a client's
+ *   copy is current.
+ *
+ * Parameters:
+ *   listing: The listing.
+ *   buffer: The destination buffer (at least DIR_TOKEN_SIZE bytes).
+ *   size: The size of the buffer.
+ *
+ * Returns:
+ *   void
+ */
+void dir_listing_token(const dir_listing_t *listing, char *buffer, size_t size) {
+    const dir_stamp_t *stamp = &listing->stamp;
+    uint64_t fields[6] = {
+        (uint64_t)stamp->dev, (uint64_t)stamp->ino,
+        (uint64_t)stamp->mtime.tv_sec, (uint64_t)stamp->mtime.tv_nsec,
+        (uint64_t)stamp->ctime.tv_sec, (uint64_t)stamp->ctime.tv_nsec
+    };
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        hash ^= fields[i];
+        hash *= 1099511628211ULL;
+    }
+    snprintf(buffer, size, "%016" PRIx64 "%016" PRIx64, listing->generation, hash);
+}
+
+/*
+ * Purpose:
+ *   Determines whether a listing may miss a change. Directory timestamps have
+ *   coarse granularity, so a modification in the same clock tick as the read
+ *   would leave the stamp unchanged; such listings are never trusted.
+ *
+ * Parameters:
+ *   listing: The listing to check.
+ *
+ * Returns:
+ *   1 if the listing must be re-read, 0 if its stamp is reliable.
+ */
+static int listing_is_racy(const dir_listing_t *listing) {
+    const struct timespec *newest = &listing->stamp.mtime;
+    if (listing->stamp.ctime.tv_sec > newest->tv_sec ||
+        (listing->stamp.ctime.tv_sec == newest->tv_sec && listing->stamp.ctime.tv_nsec > newest->tv_nsec)) {
+        newest = &listing->stamp.ctime;
+    }
+    return listing->loaded_at.tv_sec <= newest->tv_sec + 1;
+}
+
+/*
+ * Purpose:
+ *   Frees a listing and all of its storage.
+ *
+ * Parameters:
+ *   listing: The listing to free.
+ *
+ * Returns:
+ *   void
+ */
+static void listing_free(dir_listing_t *listing) {
+    free(listing->path);
+    free(listing->entries);
+    free(listing->arena);
+    dir_changes_free(listing->changes);
+    free(listing);
+}
+
+/*
+ * Purpose:
+ *   Removes a listing from the hash table and LRU list. Must be called with
+ *   the cache lock held. The listing is freed once unreferenced.
+ *
+ * Parameters:
+ *   listing: The cached listing to unlink.
+ *
+ * Returns:
+ *   void
+ */
+static void unlink_listing_locked(dir_listing_t *listing) {
+    dir_listing_t **link = &g_buckets[hash_path(listing->path) & (g_bucket_count - 1)];
+    while (*link != NULL && *link != listing) link = &(*link)->hash_next;
+    if (*link == listing) *link = listing->hash_next;
+
+    if (listing->lru_prev) listing->lru_prev->lru_next = listing->lru_next;
+    else g_lru_head = listing->lru_next;
+    if (listing->lru_next) listing->lru_next->lru_prev = listing->lru_prev;
+    else g_lru_tail = listing->lru_prev;
+
+    listing->hash_next = listing->lru_prev = listing->lru_next = NULL;
+    listing->in_cache = 0;
+    g_listing_count--;
+    if (listing->refcount == 0) listing_free(listing);
+}
+
+/*
+ * Purpose:
+ *   Moves a cached listing to the front of the LRU list. Must be called with
+ *   the cache lock held.
+ *
+ * Parameters:
+ *   listing: The listing that was just used.
+ *
+ * Returns:
+ *   void
+ */
+static void touch_listing_locked(dir_listing_t *listing) {
+    if (g_lru_head == listing) return;
+    if (listing->lru_prev) listing->lru_prev->lru_next = listing->lru_next;
+    if (listing->lru_next) listing->lru_next->lru_prev = listing->lru_prev;
+    else g_lru_tail = listing->lru_prev;
+    listing->lru_prev = NULL;
+    listing->lru_next = g_lru_head;
+    if (g_lru_head) g_lru_head->lru_prev = listing;
+    g_lru_head = listing;
+    if (g_lru_tail == NULL) g_lru_tail = listing;
+}
+
+/*
+ * Purpose:
+ *   Finds the cached listing for a path. Must be called with the cache lock held.
+ *
+ * Parameters:
+ *   path: The absolute path of the directory.
+ *
+ * Returns:
+ *   The cached listing, or NULL if none.
+ */
+static dir_listing_t *find_listing_locked(const char *path) {
+    dir_listing_t *listing = g_buckets[hash_path(path) & (g_bucket_count - 1)];
+    while (listing != NULL && strcmp(listing->path, path) != 0) listing = listing->hash_next;
+    return listing;
+}
+
+/*
+ * Purpose:
+ *   Allocates an empty listing with room for the given number of entries and
+ *   bytes of name storage. Used to rebuild listings from persisted data.
+ *
+ * Parameters:
+ *   path: The absolute path of the directory.
+ *   stamp: The directory's version stamp.
+ *   count: The number of entries.
+ *   arena_size: The size of the name storage in bytes.
+ *
+ * Returns:
+ *   A new listing with one reference, or NULL on allocation failure.
+ */
+dir_listing_t *dir_listing_new(const char *path, const dir_stamp_t *stamp, size_t count, size_t arena_size) {
+    dir_listing_t *listing = calloc(1, sizeof(dir_listing_t));
+    if (listing == NULL) return NULL;
+    listing->path = strdup(path);
+    listing->entries = calloc(count > 0 ? count : 1, sizeof(dir_cache_entry_t));
+    listing->arena = malloc(arena_size > 0 ? arena_size : 1);
+    if (listing->path == NULL || listing->entries == NULL || listing->arena == NULL) {
+        listing_free(listing);
+        return NULL;
+    }
+    listing->stamp = *stamp;
+    listing->count = count;
+    listing->arena_size = arena_size;
+    listing->refcount = 1;
+    clock_gettime(CLOCK_REALTIME, &listing->loaded_at);
+    return listing;
+}
+
+/*
+ * Purpose:
+ *   qsort comparator ordering listing entries by name.
+ *
+ * Parameters:
+ *   a: The first dir_cache_entry_t.
+ *   b: The second dir_cache_entry_t.
+ *
+ * Returns:
+ *   A negative, zero or positive value, as required by qsort.
+ */
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const dir_cache_entry_t *)a)->name, ((const dir_cache_entry_t *)b)->name);
+}
+
+/*
+ * Purpose:
+ *   Appends a string to a growable arena.
+ *
+ * Parameters:
+ *   arena: The arena buffer pointer (may be reallocated).
+ *   used: The number of bytes in use (updated).
+ *   capacity: The allocated size (updated).
+ *   str: The string to append, including its terminator.
+ *
+ * Returns:
+ *   The offset of the appended string, or SIZE_MAX on allocation failure.
+ */
+static size_t arena_append(char **arena, size_t *used, size_t *capacity, const char *str) {
+    size_t len = strlen(str) + 1;
+    if (*used + len > *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 4096;
+        while (new_capacity < *used + len) new_capacity *= 2;
+        char *grown = realloc(*arena, new_capacity);
+        if (grown == NULL) return SIZE_MAX;
+        *arena = grown;
+        *capacity = new_capacity;
+    }
+    memcpy(*arena + *used, str, len);
+    *used += len;
+    return *used - len;
+}
+
+/*
+ * Purpose:
+ *   Reads a directory from disk into a new, sorted listing.
+ *
+ * Parameters:
+ *   path: The absolute path of the directory.
+ *   stamp: The stamp read before the directory was opened.
+ *   filter: If not NULL, entries it rejects are skipped before they are
+ *           inspected.
+ *   filter_ctx: The context passed to filter.
+ *
+ * Returns:
+ *   A new listing with one reference, or NULL on error (errno is set).
+ */
+static dir_listing_t *load_listing(const char *path, const dir_stamp_t *stamp, dir_entry_filter_fn filter, void *filter_ctx) {
+    DIR *dirp = opendir(path);
+    if (dirp == NULL) return NULL;
+    int dir_fd = dirfd(dirp);
+
+    raw_entry_t *raw = NULL;
+    size_t raw_count = 0, raw_capacity = 0;
+    char *arena = NULL;
+    size_t arena_used = 0, arena_capacity = 0;
+    int saved_errno = 0;
+    struct timespec loaded_at;
+    clock_gettime(CLOCK_REALTIME, &loaded_at);
+
+    struct dirent *entry;
+    errno = 0;
+    while ((entry = readdir(dirp)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        if (filter != NULL && !filter(entry->d_name, filter_ctx)) continue;
+
+        struct stat st;
+        if (fstatat(dir_fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+            errno = 0;
+            continue;
+        }
+
+        if (raw_count == raw_capacity) {
+            raw_capacity = raw_capacity ? raw_capacity * 2 : 64;
+            raw_entry_t *grown = realloc(raw, raw_capacity * sizeof(raw_entry_t));
+            if (grown == NULL) {
+                saved_errno = ENOMEM;
+                break;
+            }
+            raw = grown;
+        }
+        raw_entry_t *item = &raw[raw_count];
+        item->target_off = SIZE_MAX;
+        item->type = S_ISDIR(st.st_mode) ? DIR_ENTRY_DIR : (S_ISLNK(st.st_mode) ? DIR_ENTRY_LINK : DIR_ENTRY_FILE);
+        item->name_off = arena_append(&arena, &arena_used, &arena_capacity, entry->d_name);
+        if (item->name_off == SIZE_MAX) {
+            saved_errno = ENOMEM;
+            break;
+        }
+        if (item->type == DIR_ENTRY_LINK) {
+            char target_buf[MAX_PATH_LEN];
+            ssize_t len = readlinkat(dir_fd, entry->d_name, target_buf, sizeof(target_buf) - 1);
+            if (len != -1) {
+                target_buf[len] = '\0';
+                item->target_off = arena_append(&arena, &arena_used, &arena_capacity, target_buf);
+                if (item->target_off == SIZE_MAX) {
+                    saved_errno = ENOMEM;
+                    break;
+                }
+            }
+        }
+        raw_count++;
+        errno = 0;
+    }
+    if (saved_errno == 0 && errno != 0 && entry == NULL) saved_errno = errno;
+    closedir(dirp);
+
+    dir_listing_t *listing = NULL;
+    if (saved_errno == 0) {
+        listing = dir_listing_new(path, stamp, raw_count, 0);
+        if (listing == NULL) saved_errno = ENOMEM;
+    }
+    if (listing != NULL) {
+        free(listing->arena);
+        listing->arena = arena;
+        listing->arena_size = arena_used;
+        listing->loaded_at = loaded_at;
+        arena = NULL;
+        for (size_t i = 0; i < raw_count; i++) {
+            listing->entries[i].name = listing->arena + raw[i].name_off;
+            listing->entries[i].link_target = raw[i].target_off == SIZE_MAX ? NULL : listing->arena + raw[i].target_off;
+            listing->entries[i].type = raw[i].type;
+        }
+        qsort(listing->entries, listing->count, sizeof(dir_cache_entry_t), compare_entries);
+    }
+
+    free(raw);
+    free(arena);
+    if (listing == NULL) errno = saved_errno;
+    return listing;
+}
+
+/*
+ * Purpose:
+ *   Inserts a fully built listing into the cache, replacing any listing for
+ *   the same directory. The caller keeps its own reference.
+ *
+ * Parameters:
+ *   listing: The listing to publish.
+ *
+ * Returns:
+ *   void
+ */
+void dir_cache_publish(dir_listing_t *listing) {
+    pthread_mutex_lock(&g_cache_lock);
+    listing->generation = ++g_next_generation;
+
+    dir_listing_t *old = find_listing_locked(listing->path);
+    if (old != NULL) {
+        listing->hits = old->hits;
+        unlink_listing_locked(old);
+    }
+
+    size_t bucket = hash_path(listing->path) & (g_bucket_count - 1);
+    listing->hash_next = g_buckets[bucket];
+    g_buckets[bucket] = listing;
+    listing->lru_prev = NULL;
+    listing->lru_next = g_lru_head;
+    if (g_lru_head) g_lru_head->lru_prev = listing;
+    g_lru_head = listing;
+    if (g_lru_tail == NULL) g_lru_tail = listing;
+    listing->in_cache = 1;
+    g_listing_count++;
+
+    while (g_listing_count > g_max_listings && g_lru_tail != NULL && g_lru_tail != listing) {
+        unlink_listing_locked(g_lru_tail);
+    }
+    pthread_mutex_unlock(&g_cache_lock);
+}
+
+/*
+ * Purpose:
+ *   Returns the listing of a directory, from the cache if the cached copy is
+ *   still current, otherwise by reading the directory and caching the result.
+ *   A listing that replaces a cached one records the changes between them.
+ *   The caller owns a reference and must call dir_cache_release.
+ *
+ * Parameters:
+ *   path: The absolute path of the directory.
+ *
+ * Returns:
+ *   A referenced listing, or NULL on error (errno is set).
+ */
+dir_listing_t *dir_cache_get(const char *path) {
+    dir_stamp_t stamp;
+    if (dir_stamp_read(path, &stamp) == -1) return NULL;
+
+    pthread_mutex_lock(&g_cache_lock);
+    dir_listing_t *cached = find_listing_locked(path);
+    if (cached != NULL) {
+        cached->hits++;
+        if (dir_stamp_equal(&cached->stamp, &stamp) && !listing_is_racy(cached)) {
+            cached->refcount++;
+            touch_listing_locked(cached);
+            pthread_mutex_unlock(&g_cache_lock);
+            return cached;
+        }
+        cached->refcount++; // Kept alive to diff against
+    }
+    pthread_mutex_unlock(&g_cache_lock);
+
+    dir_listing_t *listing = load_listing(path, &stamp, NULL, NULL);
+    if (listing == NULL) {
+        int saved_errno = errno;
+        dir_cache_release(cached);
+        errno = saved_errno;
+        return NULL;
+    }
+    if (cached == NULL) listing->hits = 1;
+    else listing->changes = dir_changes_build(cached, listing);
+    dir_cache_publish(listing);
+    dir_cache_release(cached);
+    return listing;
+}
+
+/*
+ * Purpose:
+ *   Returns the listing of a directory for a caller that only wants the
+ *   entries a filter accepts. A current cached listing is returned whole;
+ *   otherwise the directory is read, and only the accepted entries are
+ *   inspected and kept, in a listing that is not cached. The caller applies
+ *   the filter to the result either way and must call dir_cache_release.
+ *
+ * Parameters:
+ *   path: The absolute path of the directory.
+ *   filter: The filter, or NULL to keep all entries.
+ *   ctx: The context passed to filter.
+ *
+ * Returns:
+ *   A referenced listing, or NULL on error (errno is set).
+ */
+dir_listing_t *dir_cache_get_filtered(const char *path, dir_entry_filter_fn filter, void *ctx) {
+    dir_stamp_t stamp;
+    if (dir_stamp_read(path, &stamp) == -1) return NULL;
+
+    pthread_mutex_lock(&g_cache_lock);
+    dir_listing_t *cached = find_listing_locked(path);
+    if (cached != NULL && dir_stamp_equal(&cached->stamp, &stamp) && !listing_is_racy(cached)) {
+        cached->hits++;
+        cached->refcount++;
+        touch_listing_locked(cached);
+        pthread_mutex_unlock(&g_cache_lock);
+        return cached;
+    }
+    pthread_mutex_unlock(&g_cache_lock);
+
+    // Partial, so it is neither cached nor diffed against the cached copy.
+    return load_listing(path, &stamp, filter, ctx);
+}
+
+/*
+ * Purpose:
+ *   Drops a reference obtained from dir_cache_get, dir_cache_get_filtered or
+ *   dir_cache_snapshot.
+ *
+ * Parameters:
+ *   listing: The listing to release (may be NULL).
+ *
+ * Returns:
+ *   void
+ */
+void dir_cache_release(dir_listing_t *listing) {
+    if (listing == NULL) return;
+    pthread_mutex_lock(&g_cache_lock);
+    listing->refcount--;
+    int should_free = (listing->refcount == 0 && !listing->in_cache);
+    pthread_mutex_unlock(&g_cache_lock);
+    if (should_free) listing_free(listing);
+}
+
+/*
+ * Purpose:
+ *   Takes a reference to every cached listing, for example to persist them.
+ *
+ * Parameters:
+ *   count_out: Receives the number of listings.
+ *
+ * Returns:
+ *   A malloc'ed array of referenced listings (release each and free the
+ *   array), or NULL if the cache is empty or allocation failed.
+ */
+dir_listing_t **dir_cache_snapshot(size_t *count_out) {
+    *count_out = 0;
+    pthread_mutex_lock(&g_cache_lock);
+    if (g_listing_count == 0) {
+        pthread_mutex_unlock(&g_cache_lock);
+        return NULL;
+    }
+    dir_listing_t **listings = malloc(g_listing_count * sizeof(dir_listing_t *));
+    if (listings != NULL) {
+        for (dir_listing_t *listing = g_lru_head; listing != NULL; listing = listing->lru_next) {
+            listing->refcount++;
+            listings[(*count_out)++] = listing;
+        }
+    }
+    pthread_mutex_unlock(&g_cache_lock);
+    return listings;
+}
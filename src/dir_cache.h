@@ -0,0 +1,216 @@
+/*
+ * src/dir_cache.h
+ *
+ * This header file declares the server's directory listing cache. Each cached
+ * listing holds the sorted entries of one directory together with a version
+ * stamp (device, inode, mtime and ctime of the directory). A listing is served
+ * from the cache only while the stamp still matches the directory on disk.
+ */
+#ifndef DIR_CACHE_H
+#define DIR_CACHE_H
+
+#include <sys/types.h> // For dev_t, ino_t
+#include <stddef.h>    // For size_t
+#include <stdint.h>    // For uint64_t
+#include <time.h>      // For struct timespec
+
+#define DIR_CACHE_DEFAULT_MAX_LISTINGS 4096
+#define DIR_TOKEN_SIZE 33 // 32 hex digits and the terminator
+
+// Entry types stored in a listing.
+#define DIR_ENTRY_FILE 'f'
+#define DIR_ENTRY_DIR 'd'
+#define DIR_ENTRY_LINK 'l'
+
+typedef struct dir_change_log_s dir_change_log_t; // See dir_changes.h
+
+typedef struct dir_stamp_s {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    struct timespec ctime;
+} dir_stamp_t;
+
+typedef struct dir_cache_entry_s {
+    const char *name;        // Points into the listing's arena
+    const char *link_target; // Symlink target, or NULL (broken link or not a link)
+    char type;               // One of DIR_ENTRY_*
+} dir_cache_entry_t;
+
+typedef struct dir_listing_s {
+    char *path;                // Absolute path of the directory
+    dir_stamp_t stamp;         // Directory state the entries were read from
+    struct timespec loaded_at; // Wall-clock time the entries were read
+    uint64_t generation;       // Unique, increasing number for this listing
+    unsigned long hits;        // Requests served by this directory
+    size_t count;
+    dir_cache_entry_t *entries; // Sorted by name
+    char *arena;                // Storage for names and link targets
+    size_t arena_size;
+    dir_change_log_t *changes;  // Changes since earlier versions, or NULL
+
+    // Cache bookkeeping, protected by the cache lock.
+    int refcount;
+    int in_cache;
+    struct dir_listing_s *hash_next;
+    struct dir_listing_s *lru_prev;
+    struct dir_listing_s *lru_next;
+} dir_listing_t;
+
+/*
+ * Purpose:
+ *   Initializes the directory cache. Must be called once before any other
+ *   dir_cache function.
+ *
+ * Parameters:
+ *   max_listings: The maximum number of directories kept in the cache.
+ *
+ * Returns:
+ *   0 on success, or -1 on allocation failure.
+ */
+int dir_cache_init(size_t max_listings);
+
+/*
+ * Purpose:
+ *   Reads the version stamp of a directory.
+ *
+ * Parameters:
+ *   path: The absolute path of the directory.
+ *   stamp: Receives the stamp.
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno is set).
+ */
+int dir_stamp_read(const char *path, dir_stamp_t *stamp);
+
+/*
+ * Purpose:
+ *   Compares two directory version stamps.
+ *
+ * Parameters:
+ *   a: The first stamp.
+ *   b: The second stamp.
+ *
+ * Returns:
+ *   1 if the stamps are identical, 0 otherwise.
+ */
+int dir_stamp_equal(const dir_stamp_t *a, const dir_stamp_t *b);
+
+/*
+ * Purpose:
+ *   Formats the version token of a listing: its generation followed by a
+ *   hash of its stamp, as hex digits. Two listings have the same token only
+ *   if they are the same listing, so a matching token proves that a client's
+ *   copy is current.
+ *
+ * Parameters:
+ *   listing: The listing.
+ *   buffer: The destination buffer (at least DIR_TOKEN_SIZE bytes).
+ *   size: The size of the buffer.
+ *
+ * Returns:
+ *   void
+ */
+void dir_listing_token(const dir_listing_t *listing, char *buffer, size_t size);
+
+/*
+ * Purpose:
+ *   Returns the listing of a directory, from the cache if the cached copy is
+ *   still current, otherwise by reading the directory and caching the result.
+ *   The caller owns a reference and must call dir_cache_release.
+ *
+ * Parameters:
+ *   path: The absolute path of the directory.
+ *
+ * Returns:
+ *   A referenced listing, or NULL on error (errno is set).
+ */
+dir_listing_t *dir_cache_get(const char *path);
+
+/*
+ * Purpose:
+ *   Decides by name whether an entry belongs in a filtered listing.
+ *
+ * Parameters:
+ *   name: The entry's name.
+ *   ctx: The caller's context.
+ *
+ * Returns:
+ *   Nonzero to keep the entry.
+ */
+typedef int (*dir_entry_filter_fn)(const char *name, void *ctx);
+
+/*
+ * Purpose:
+ *   Returns the listing of a directory for a caller that only wants the
+ *   entries a filter accepts. A current cached listing is returned whole;
+ *   otherwise the directory is read, and only the accepted entries are
+ *   inspected and kept, in a listing that is not cached. The caller applies
+ *   the filter to the result either way and must call dir_cache_release.
+ *
+ * Parameters:
+ *   path: The absolute path of the directory.
+ *   filter: The filter, or NULL to keep all entries.
+ *   ctx: The context passed to filter.
+ *
+ * Returns:
+ *   A referenced listing, or NULL on error (errno is set).
+ */
+dir_listing_t *dir_cache_get_filtered(const char *path, dir_entry_filter_fn filter, void *ctx);
+
+/*
+ * Purpose:
+ *   Drops a reference obtained from dir_cache_get, dir_cache_get_filtered or
+ *   dir_cache_snapshot.
+ *
+ * Parameters:
+ *   listing: The listing to release (may be NULL).
+ *
+ * Returns:
+ *   void
+ */
+void dir_cache_release(dir_listing_t *listing);
+
+/*
+ * Purpose:
+ *   Allocates an empty listing with room for the given number of entries and
+ *   bytes of name storage. Used to rebuild listings from persisted data.
+ *
+ * Parameters:
+ *   path: The absolute path of the directory.
+ *   stamp: The directory's version stamp.
+ *   count: The number of entries.
+ *   arena_size: The size of the name storage in bytes.
+ *
+ * Returns:
+ *   A new listing with one reference, or NULL on allocation failure.
+ */
+dir_listing_t *dir_listing_new(const char *path, const dir_stamp_t *stamp, size_t count, size_t arena_size);
+
+/*
+ * Purpose:
+ *   Inserts a fully built listing into the cache, replacing any listing for
+ *   the same directory. The caller keeps its own reference.
+ *
+ * Parameters:
+ *   listing: The listing to publish.
+ *
+ * Returns:
+ *   void
+ */
+void dir_cache_publish(dir_listing_t *listing);
+
+/*
+ * Purpose:
+ *   Takes a reference to every cached listing, for example to persist them.
+ *
+ * Parameters:
+ *   count_out: Receives the number of listings.
+ *
+ * Returns:
+ *   A malloc'ed array of referenced listings (release each and free the
+ *   array), or NULL if the cache is empty or allocation failed.
+ */
+dir_listing_t **dir_cache_snapshot(size_t *count_out);
+
+#endif // DIR_CACHE_H
@@ -0,0 +1,283 @@
+/*
+ * src/dir_changes.c
+ *
+ * This file implements the listing change log declared in dir_changes.h.
+ * Listings and change sets are both sorted by name, so computing a diff and
+ * combining two change sets are linear merges. Each merge runs twice: once
+ * to size the change set, once to fill it, so every set is a single
+ * allocation plus one string arena.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "dir_changes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct change_builder_s {
+    int filling;        // 0 while sizing, 1 while filling
+    size_t count;
+    size_t arena_used;
+    dir_change_t *changes;
+    char *arena;
+} change_builder_t;
+
+/*
+ * Purpose:
+ *   Compares two listing entries of the same name.
+ *
+ * Parameters:
+ *   a: The first entry.
+ *   b: The second entry.
+ *
+ * Returns:
+ *   1 if the type and link target are the same, 0 otherwise.
+ */
+static int entries_equal(const dir_cache_entry_t *a, const dir_cache_entry_t *b) {
+    if (a->type != b->type) return 0;
+    if (a->link_target == NULL || b->link_target == NULL) return a->link_target == b->link_target;
+    return strcmp(a->link_target, b->link_target) == 0;
+}
+
+/*
+ * Purpose:
+ *   Copies a string into the builder's arena (or only counts its size).
+ *
+ * Parameters:
+ *   builder: The change set builder.
+ *   str: The string, or NULL.
+ *
+ * Returns:
+ *   The copy (NULL while sizing or if str is NULL).
+ */
+static const char *builder_string(change_builder_t *builder, const char *str) {
+    if (str == NULL) return NULL;
+    size_t len = strlen(str) + 1;
+    char *copy = NULL;
+    if (builder->filling) {
+        copy = builder->arena + builder->arena_used;
+        memcpy(copy, str, len);
+    }
+    builder->arena_used += len;
+    return copy;
+}
+
+/*
+ * Purpose:
+ *   Records one change (or only counts it while sizing).
+ *
+ * Parameters:
+ *   builder: The change set builder.
+ *   name: The entry name.
+ *   before: The entry before the change, or NULL if it did not exist.
+ *   after: The entry after the change, or NULL if it was removed.
+ *
+ * Returns:
+ *   void
+ */
+static void builder_emit(change_builder_t *builder, const char *name, const dir_cache_entry_t *before,
+                         const dir_cache_entry_t *after) {
+    const char *name_copy = builder_string(builder, name);
+    const char *before_target = builder_string(builder, before ? before->link_target : NULL);
+    const char *after_target = builder_string(builder, after ? after->link_target : NULL);
+    if (builder->filling) {
+        dir_change_t *change = &builder->changes[builder->count];
+        memset(change, 0, sizeof(*change));
+        change->name = name_copy;
+        if (before != NULL) {
+            change->before.name = name_copy;
+            change->before.type = before->type;
+            change->before.link_target = before_target;
+        }
+        if (after != NULL) {
+            change->after.name = name_copy;
+            change->after.type = after->type;
+            change->after.link_target = after_target;
+        }
+    }
+    builder->count++;
+}
+
+/*
+ * Purpose:
+ *   Merges two sorted listings and records every entry that was added,
+ *   removed or changed.
+ *
+ * Parameters:
+ *   builder: The change set builder.
+ *   old_listing: The earlier listing.
+ *   new_listing: The later listing.
+ *
+ * Returns:
+ *   void
+ */
+static void diff_listings(change_builder_t *builder, const dir_listing_t *old_listing, const dir_listing_t *new_listing) {
+    size_t i = 0, j = 0;
+    while (i < old_listing->count || j < new_listing->count) {
+        const dir_cache_entry_t *a = (i < old_listing->count) ? &old_listing->entries[i] : NULL;
+        const dir_cache_entry_t *b = (j < new_listing->count) ? &new_listing->entries[j] : NULL;
+        int cmp = (a == NULL) ? 1 : (b == NULL) ? -1 : strcmp(a->name, b->name);
+        if (cmp < 0) {
+            builder_emit(builder, a->name, a, NULL);
+            i++;
+        } else if (cmp > 0) {
+            builder_emit(builder, b->name, NULL, b);
+            j++;
+        } else {
+            if (!entries_equal(a, b)) builder_emit(builder, a->name, a, b);
+            i++;
+            j++;
+        }
+    }
+}
+
+/*
+ * Purpose:
+ *   Combines an earlier change set with a later one into the changes from
+ *   the earlier set's base version to the later set's result.
+ *
+ * Parameters:
+ *   builder: The change set builder.
+ *   first: The earlier change set.
+ *   second: The later change set.
+ *
+ * Returns:
+ *   void
+ */
+static void compose_changes(change_builder_t *builder, const dir_changeset_t *first, const dir_changeset_t *second) {
+    size_t i = 0, j = 0;
+    while (i < first->count || j < second->count) {
+        const dir_change_t *a = (i < first->count) ? &first->changes[i] : NULL;
+        const dir_change_t *b = (j < second->count) ? &second->changes[j] : NULL;
+        int cmp = (a == NULL) ? 1 : (b == NULL) ? -1 : strcmp(a->name, b->name);
+        if (cmp < 0) {
+            builder_emit(builder, a->name, a->before.type ? &a->before : NULL, a->after.type ? &a->after : NULL);
+            i++;
+        } else if (cmp > 0) {
+            builder_emit(builder, b->name, b->before.type ? &b->before : NULL, b->after.type ? &b->after : NULL);
+            j++;
+        } else {
+            const dir_cache_entry_t *before = a->before.type ? &a->before : NULL;
+            const dir_cache_entry_t *after = b->after.type ? &b->after : NULL;
+            int unchanged = (before == NULL && after == NULL) ||
+                            (before != NULL && after != NULL && entries_equal(before, after));
+            if (!unchanged) builder_emit(builder, a->name, before, after);
+            i++;
+            j++;
+        }
+    }
+}
+
+/*
+ * Purpose:
+ *   Builds one change set with a diff or composition function, sizing it
+ *   first and then filling a single allocation.
+ *
+ * Parameters:
+ *   set: The change set to fill (its from_token is set by the caller).
+ *   old_listing, new_listing: The listings to diff (used if first is NULL).
+ *   first, second: The change sets to combine (used if first is not NULL).
+ *
+ * Returns:
+ *   0 on success, or -1 if the set is too large or allocation failed.
+ */
+static int build_changeset(dir_changeset_t *set, const dir_listing_t *old_listing, const dir_listing_t *new_listing,
+                           const dir_changeset_t *first, const dir_changeset_t *second) {
+    change_builder_t builder;
+    memset(&builder, 0, sizeof(builder));
+    if (first != NULL) compose_changes(&builder, first, second);
+    else diff_listings(&builder, old_listing, new_listing);
+    if (builder.count > DIR_CHANGELOG_MAX_CHANGES) return -1;
+
+    size_t count = builder.count;
+    size_t arena_size = builder.arena_used;
+    builder.changes = malloc((count > 0 ? count : 1) * sizeof(dir_change_t));
+    builder.arena = malloc(arena_size > 0 ? arena_size : 1);
+    if (builder.changes == NULL || builder.arena == NULL) {
+        free(builder.changes);
+        free(builder.arena);
+        return -1;
+    }
+    builder.filling = 1;
+    builder.count = 0;
+    builder.arena_used = 0;
+    if (first != NULL) compose_changes(&builder, first, second);
+    else diff_listings(&builder, old_listing, new_listing);
+
+    set->count = count;
+    set->changes = builder.changes;
+    set->arena = builder.arena;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Computes the change log of a listing that replaces an older one: the
+ *   changes from the older listing, plus the older listing's own change sets
+ *   combined with them.
+ *
+ * Parameters:
+ *   old_listing: The published listing being replaced.
+ *   new_listing: The freshly read listing (not yet published).
+ *
+ * Returns:
+ *   A new change log, or NULL if no changes could be recorded.
+ */
+dir_change_log_t *dir_changes_build(const dir_listing_t *old_listing, const dir_listing_t *new_listing) {
+    dir_change_log_t *log = calloc(1, sizeof(dir_change_log_t));
+    if (log == NULL) return NULL;
+
+    dir_changeset_t *latest = &log->sets[0];
+    if (build_changeset(latest, old_listing, new_listing, NULL, NULL) == -1) {
+        free(log);
+        return NULL;
+    }
+    dir_listing_token(old_listing, latest->from_token, sizeof(latest->from_token));
+    log->set_count = 1;
+
+    const dir_change_log_t *previous = old_listing->changes;
+    for (size_t i = 0; previous != NULL && i < previous->set_count && log->set_count < DIR_CHANGELOG_MAX_VERSIONS; i++) {
+        dir_changeset_t *set = &log->sets[log->set_count];
+        if (build_changeset(set, NULL, NULL, &previous->sets[i], latest) == -1) break;
+        memcpy(set->from_token, previous->sets[i].from_token, sizeof(set->from_token));
+        log->set_count++;
+    }
+    return log;
+}
+
+/*
+ * Purpose:
+ *   Finds the changes of a listing since a given version.
+ *
+ * Parameters:
+ *   listing: The current listing.
+ *   token: The version token the client has.
+ *
+ * Returns:
+ *   The change set, or NULL if that version is not in the log.
+ */
+const dir_changeset_t *dir_changes_find(const dir_listing_t *listing, const char *token) {
+    const dir_change_log_t *log = listing->changes;
+    for (size_t i = 0; log != NULL && i < log->set_count; i++) {
+        if (strcmp(log->sets[i].from_token, token) == 0) return &log->sets[i];
+    }
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Frees a change log.
+ *
+ * Parameters:
+ *   log: The change log (may be NULL).
+ *
+ * Returns:
+ *   void
+ */
+void dir_changes_free(dir_change_log_t *log) {
+    if (log == NULL) return;
+    for (size_t i = 0; i < log->set_count; i++) {
+        free(log->sets[i].changes);
+        free(log->sets[i].arena);
+    }
+    free(log);
+}
@@ -0,0 +1,78 @@
+/*
+ * src/dir_changes.h
+ *
+ * This header file declares the change log kept with each cached directory
+ * listing. When a changed directory is re-read, the new listing is compared
+ * with the one it replaces, and the resulting changes are stored together
+ * with the changes from a few earlier versions. A client that knows one of
+ * those versions can then be sent only the entries that changed since.
+ */
+#ifndef DIR_CHANGES_H
+#define DIR_CHANGES_H
+
+#include <stddef.h> // For size_t
+
+#include "dir_cache.h"
+
+#define DIR_CHANGELOG_MAX_VERSIONS 8     // Earlier versions a diff is kept for
+#define DIR_CHANGELOG_MAX_CHANGES 65536  // Larger diffs are not kept
+
+typedef struct dir_change_s {
+    const char *name;
+    dir_cache_entry_t before; // type is 0 if the entry did not exist
+    dir_cache_entry_t after;  // type is 0 if the entry was removed
+} dir_change_t;
+
+typedef struct dir_changeset_s {
+    char from_token[DIR_TOKEN_SIZE]; // Version the changes start from
+    size_t count;
+    dir_change_t *changes;           // Sorted by name
+    char *arena;                     // Storage for names and link targets
+} dir_changeset_t;
+
+struct dir_change_log_s {
+    size_t set_count;
+    dir_changeset_t sets[DIR_CHANGELOG_MAX_VERSIONS]; // Most recent base version first
+};
+
+/*
+ * Purpose:
+ *   Computes the change log of a listing that replaces an older one: the
+ *   changes from the older listing, plus the older listing's own change sets
+ *   combined with them.
+ *
+ * Parameters:
+ *   old_listing: The published listing being replaced.
+ *   new_listing: The freshly read listing (not yet published).
+ *
+ * Returns:
+ *   A new change log, or NULL if no changes could be recorded.
+ */
+dir_change_log_t *dir_changes_build(const dir_listing_t *old_listing, const dir_listing_t *new_listing);
+
+/*
+ * Purpose:
+ *   Finds the changes of a listing since a given version.
+ *
+ * Parameters:
+ *   listing: The current listing.
+ *   token: The version token the client has.
+ *
+ * Returns:
+ *   The change set, or NULL if that version is not in the log.
+ */
+const dir_changeset_t *dir_changes_find(const dir_listing_t *listing, const char *token);
+
+/*
+ * Purpose:
+ *   Frees a change log.
+ *
+ * Parameters:
+ *   log: The change log (may be NULL).
+ *
+ * Returns:
+ *   void
+ */
+void dir_changes_free(dir_change_log_t *log);
+
+#endif // DIR_CHANGES_H
@@ -0,0 +1,527 @@
+/*
+ * src/dir_index.c
+ *
+ * This file implements the persistent directory index declared in dir_index.h.
+ *
+ * File layout (host byte order, the file is not meant to be portable):
+ *   index_file_header_t
+ *   repeated listing records, each 8-byte aligned:
+ *     index_record_header_t
+ *     directory path, NUL-terminated, padded to 4 bytes
+ *     entry_count x index_entry_t (offsets into the record's arena)
+ *     arena of NUL-terminated names and link targets, padded to 8 bytes
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "dir_index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dir_cache.h"
+#include "protocol.h"
+
+#define DIR_INDEX_MAGIC "MSDIRIX"
+#define DIR_INDEX_VERSION 1
+#define DIR_INDEX_NO_TARGET UINT32_MAX
+
+typedef struct index_file_header_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t listing_count;
+} index_file_header_t;
+
+typedef struct index_record_header_s {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+    int64_t loaded_sec;
+    int64_t loaded_nsec;
+    uint64_t hits;
+    uint32_t path_len;    // Excluding the terminator
+    uint32_t entry_count;
+    uint32_t arena_size;
+    uint32_t record_size; // Including this header and all padding
+} index_record_header_t;
+
+typedef struct index_entry_s {
+    uint32_t name_off;
+    uint32_t target_off; // DIR_INDEX_NO_TARGET if none
+    char type;
+    char pad[3];
+} index_entry_t;
+
+typedef struct index_writer_args_s {
+    const char *index_path;
+    unsigned int interval_sec;
+} index_writer_args_t;
+
+static pthread_mutex_t g_save_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Purpose:
+ *   Rounds a size up to a multiple of a power-of-two alignment.
+ *
+ * Parameters:
+ *   size: The size to round.
+ *   align: The alignment (a power of two).
+ *
+ * Returns:
+ *   The rounded size.
+ */
+static size_t align_up(size_t size, size_t align) {
+    return (size + align - 1) & ~(align - 1);
+}
+
+/*
+ * Purpose:
+ *   Computes the layout of a listing's record in the index file.
+ *
+ * Parameters:
+ *   path_len: The length of the directory path.
+ *   entry_count: The number of entries.
+ *   arena_size: The size of the name arena.
+ *   entries_off: Receives the offset of the entry table within the record.
+ *   arena_off: Receives the offset of the arena within the record.
+ *
+ * Returns:
+ *   The total record size.
+ */
+static size_t record_layout(size_t path_len, size_t entry_count, size_t arena_size, size_t *entries_off, size_t *arena_off) {
+    *entries_off = align_up(sizeof(index_record_header_t) + path_len + 1, 4);
+    *arena_off = *entries_off + entry_count * sizeof(index_entry_t);
+    return align_up(*arena_off + arena_size, 8);
+}
+
+/*
+ * Purpose:
+ *   Rebuilds one listing from its record and publishes it to the cache if
+ *   the directory has not changed since the record was written.
+ *
+ * Parameters:
+ *   record: The start of the record in the mapped file.
+ *   available: The number of mapped bytes from the record to the end of file.
+ *   record_size_out: Receives the record's size, to advance to the next one.
+ *
+ * Returns:
+ *   1 if the listing was loaded, 0 if it was stale, -1 if the record is malformed.
+ */
+static int load_record(const char *record, size_t available, size_t *record_size_out) {
+    index_record_header_t header;
+    if (available < sizeof(header)) return -1;
+    memcpy(&header, record, sizeof(header));
+
+    size_t entries_off, arena_off;
+    size_t expected = record_layout(header.path_len, header.entry_count, header.arena_size, &entries_off, &arena_off);
+    if (header.record_size != expected || expected > available) return -1;
+    if (header.path_len >= MAX_PATH_LEN || record[sizeof(header) + header.path_len] != '\0') return -1;
+    if (header.arena_size > 0 && record[arena_off + header.arena_size - 1] != '\0') return -1;
+    *record_size_out = expected;
+
+    const char *path = record + sizeof(header);
+    dir_stamp_t recorded;
+    memset(&recorded, 0, sizeof(recorded));
+    recorded.dev = (dev_t)header.dev;
+    recorded.ino = (ino_t)header.ino;
+    recorded.mtime.tv_sec = (time_t)header.mtime_sec;
+    recorded.mtime.tv_nsec = (long)header.mtime_nsec;
+    recorded.ctime.tv_sec = (time_t)header.ctime_sec;
+    recorded.ctime.tv_nsec = (long)header.ctime_nsec;
+
+    dir_stamp_t current;
+    if (dir_stamp_read(path, &current) == -1 || !dir_stamp_equal(&recorded, &current)) return 0;
+
+    dir_listing_t *listing = dir_listing_new(path, &recorded, header.entry_count, header.arena_size);
+    if (listing == NULL) return 0;
+    memcpy(listing->arena, record + arena_off, header.arena_size);
+
+    for (uint32_t i = 0; i < header.entry_count; i++) {
+        index_entry_t entry;
+        memcpy(&entry, record + entries_off + i * sizeof(entry), sizeof(entry));
+        if (entry.name_off >= header.arena_size ||
+            (entry.target_off != DIR_INDEX_NO_TARGET && entry.target_off >= header.arena_size)) {
+            dir_cache_release(listing);
+            return -1;
+        }
+        listing->entries[i].name = listing->arena + entry.name_off;
+        listing->entries[i].link_target = entry.target_off == DIR_INDEX_NO_TARGET ? NULL : listing->arena + entry.target_off;
+        listing->entries[i].type = entry.type;
+    }
+    listing->loaded_at.tv_sec = (time_t)header.loaded_sec;
+    listing->loaded_at.tv_nsec = (long)header.loaded_nsec;
+    listing->hits = (unsigned long)header.hits;
+
+    dir_cache_publish(listing);
+    dir_cache_release(listing);
+    return 1;
+}
+
+/*
+ * Purpose:
+ *   Maps an index file read-only and checks its header.
+ *
+ * Parameters:
+ *   index_path: The path of the index file.
+ *   map_out: Receives the mapping (NULL if the file is missing or empty).
+ *   size_out: Receives the size of the mapping.
+ *
+ * Returns:
+ *   0 on success (including a missing or empty file), or -1 on error.
+ */
+static int map_index(const char *index_path, char **map_out, size_t *size_out) {
+    *map_out = NULL;
+    *size_out = 0;
+
+    int fd = open(index_path, O_RDONLY);
+    if (fd == -1) {
+        if (errno == ENOENT) return 0;
+        perror("open directory index");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat directory index");
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    if ((size_t)st.st_size < sizeof(index_file_header_t)) {
+        close(fd);
+        fprintf(stderr, "Directory index '%s' is truncated.\n", index_path);
+        return -1;
+    }
+    size_t file_size = (size_t)st.st_size;
+    char *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap directory index");
+        return -1;
+    }
+
+    index_file_header_t header;
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, DIR_INDEX_MAGIC, sizeof(DIR_INDEX_MAGIC)) != 0 || header.version != DIR_INDEX_VERSION) {
+        fprintf(stderr, "Directory index '%s' has an unknown format, ignoring it.\n", index_path);
+        munmap(map, file_size);
+        return -1;
+    }
+    *map_out = map;
+    *size_out = file_size;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Maps an index file and loads every still-valid listing into the
+ *   directory cache. Listings whose directory changed are skipped.
+ *
+ * Parameters:
+ *   index_path: The path of the index file.
+ *   loaded_out: Receives the number of listings loaded.
+ *   stale_out: Receives the number of listings skipped as out of date.
+ *
+ * Returns:
+ *   0 on success (including a missing index file), or -1 if the file is
+ *   unreadable or malformed.
+ */
+int dir_index_load(const char *index_path, size_t *loaded_out, size_t *stale_out) {
+    *loaded_out = 0;
+    *stale_out = 0;
+
+    char *map;
+    size_t file_size;
+    if (map_index(index_path, &map, &file_size) == -1) return -1;
+    if (map == NULL) return 0;
+
+    int result = 0;
+    index_file_header_t header;
+    memcpy(&header, map, sizeof(header));
+    size_t offset = align_up(sizeof(header), 8);
+    for (uint32_t i = 0; i < header.listing_count; i++) {
+        size_t record_size = 0;
+        int status = offset < file_size ? load_record(map + offset, file_size - offset, &record_size) : -1;
+        if (status == -1) {
+            fprintf(stderr, "Directory index '%s' is truncated or corrupt at record %u.\n", index_path, i);
+            result = -1;
+            break;
+        }
+        if (status == 1) (*loaded_out)++;
+        else (*stale_out)++;
+        offset += record_size;
+    }
+
+    munmap(map, file_size);
+    return result;
+}
+
+/*
+ * Purpose:
+ *   Returns the directories with the most requests recorded in an index file,
+ *   i.e. the hottest directories of the previous run.
+ *
+ * Parameters:
+ *   index_path: The path of the index file.
+ *   max_count: The maximum number of directories to return.
+ *   paths_out: Receives a malloc'ed array of malloc'ed absolute paths,
+ *              ordered by decreasing request count.
+ *   count_out: Receives the number of paths.
+ *
+ * Returns:
+ *   0 on success (including a missing index file), or -1 on error.
+ */
+int dir_index_hottest(const char *index_path, size_t max_count, char ***paths_out, size_t *count_out) {
+    *paths_out = NULL;
+    *count_out = 0;
+    if (max_count == 0) return 0;
+
+    char *map;
+    size_t file_size;
+    if (map_index(index_path, &map, &file_size) == -1) return -1;
+    if (map == NULL) return 0;
+
+    // Pointers into the mapping, kept ordered by hits (insertion into a short array).
+    const char **top_paths = calloc(max_count, sizeof(char *));
+    uint64_t *top_hits = calloc(max_count, sizeof(uint64_t));
+    if (top_paths == NULL || top_hits == NULL) {
+        perror("calloc for hottest directories failed");
+        free(top_paths);
+        free(top_hits);
+        munmap(map, file_size);
+        return -1;
+    }
+
+    int result = 0;
+    size_t top_count = 0;
+    index_file_header_t header;
+    memcpy(&header, map, sizeof(header));
+    size_t offset = align_up(sizeof(header), 8);
+    for (uint32_t i = 0; i < header.listing_count; i++) {
+        index_record_header_t record;
+        size_t entries_off, arena_off;
+        if (offset + sizeof(record) > file_size) {
+            result = -1;
+            break;
+        }
+        memcpy(&record, map + offset, sizeof(record));
+        if (record.record_size != record_layout(record.path_len, record.entry_count, record.arena_size, &entries_off, &arena_off) ||
+            record.record_size > file_size - offset || map[offset + sizeof(record) + record.path_len] != '\0') {
+            result = -1;
+            break;
+        }
+
+        if (top_count < max_count || record.hits > top_hits[top_count - 1]) {
+            size_t pos = top_count < max_count ? top_count++ : max_count - 1;
+            while (pos > 0 && top_hits[pos - 1] < record.hits) {
+                top_hits[pos] = top_hits[pos - 1];
+                top_paths[pos] = top_paths[pos - 1];
+                pos--;
+            }
+            top_hits[pos] = record.hits;
+            top_paths[pos] = map + offset + sizeof(record);
+        }
+        offset += record.record_size;
+    }
+    if (result == -1) {
+        fprintf(stderr, "Directory index '%s' is truncated or corrupt.\n", index_path);
+    }
+
+    char **paths = top_count > 0 ? malloc(top_count * sizeof(char *)) : NULL;
+    for (size_t i = 0; paths != NULL && i < top_count; i++) {
+        paths[i] = strdup(top_paths[i]);
+        if (paths[i] != NULL) (*count_out)++;
+    }
+    *paths_out = paths;
+
+    free(top_paths);
+    free(top_hits);
+    munmap(map, file_size);
+    return result;
+}
+
+/*
+ * Purpose:
+ *   Writes zero bytes to pad the output to the given alignment.
+ *
+ * Parameters:
+ *   out: The output stream.
+ *   written: The number of bytes written so far (updated).
+ *   align: The alignment.
+ *
+ * Returns:
+ *   0 on success, or -1 on write error.
+ */
+static int write_padding(FILE *out, size_t *written, size_t align) {
+    static const char zeros[8] = {0};
+    size_t padding = align_up(*written, align) - *written;
+    if (padding > 0 && fwrite(zeros, 1, padding, out) != padding) return -1;
+    *written += padding;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Serializes one listing as an index record.
+ *
+ * Parameters:
+ *   out: The output stream, positioned at an 8-byte boundary.
+ *   listing: The listing to write.
+ *
+ * Returns:
+ *   0 on success, or -1 on write error.
+ */
+static int write_record(FILE *out, const dir_listing_t *listing) {
+    index_record_header_t header;
+    memset(&header, 0, sizeof(header));
+    size_t path_len = strlen(listing->path);
+    size_t entries_off, arena_off;
+    header.dev = (uint64_t)listing->stamp.dev;
+    header.ino = (uint64_t)listing->stamp.ino;
+    header.mtime_sec = (int64_t)listing->stamp.mtime.tv_sec;
+    header.mtime_nsec = (int64_t)listing->stamp.mtime.tv_nsec;
+    header.ctime_sec = (int64_t)listing->stamp.ctime.tv_sec;
+    header.ctime_nsec = (int64_t)listing->stamp.ctime.tv_nsec;
+    header.loaded_sec = (int64_t)listing->loaded_at.tv_sec;
+    header.loaded_nsec = (int64_t)listing->loaded_at.tv_nsec;
+    header.hits = (uint64_t)listing->hits;
+    header.path_len = (uint32_t)path_len;
+    header.entry_count = (uint32_t)listing->count;
+    header.arena_size = (uint32_t)listing->arena_size;
+    header.record_size = (uint32_t)record_layout(path_len, listing->count, listing->arena_size, &entries_off, &arena_off);
+
+    size_t written = 0;
+    if (fwrite(&header, sizeof(header), 1, out) != 1) return -1;
+    if (fwrite(listing->path, 1, path_len + 1, out) != path_len + 1) return -1;
+    written = sizeof(header) + path_len + 1;
+    if (write_padding(out, &written, 4) == -1) return -1;
+
+    for (size_t i = 0; i < listing->count; i++) {
+        index_entry_t entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.name_off = (uint32_t)(listing->entries[i].name - listing->arena);
+        entry.target_off = listing->entries[i].link_target ? (uint32_t)(listing->entries[i].link_target - listing->arena) : DIR_INDEX_NO_TARGET;
+        entry.type = listing->entries[i].type;
+        if (fwrite(&entry, sizeof(entry), 1, out) != 1) return -1;
+    }
+    written += listing->count * sizeof(index_entry_t);
+    if (listing->arena_size > 0 && fwrite(listing->arena, 1, listing->arena_size, out) != listing->arena_size) return -1;
+    written += listing->arena_size;
+    return write_padding(out, &written, 8);
+}
+
+/*
+ * Purpose:
+ *   Writes the current contents of the directory cache to the index file.
+ *   The file is written under a temporary name and renamed into place, so a
+ *   crash never leaves a truncated index behind.
+ *
+ * Parameters:
+ *   index_path: The path of the index file.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+int dir_index_save(const char *index_path) {
+    char tmp_path[MAX_PATH_LEN];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", index_path) >= (int)sizeof(tmp_path)) {
+        fprintf(stderr, "Directory index path is too long: %s\n", index_path);
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_save_lock);
+    size_t count = 0;
+    dir_listing_t **listings = dir_cache_snapshot(&count);
+
+    int result = 0;
+    FILE *out = fopen(tmp_path, "wb");
+    if (out == NULL) {
+        perror("fopen for directory index");
+        result = -1;
+    } else {
+        index_file_header_t header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, DIR_INDEX_MAGIC, sizeof(DIR_INDEX_MAGIC));
+        header.version = DIR_INDEX_VERSION;
+        header.listing_count = (uint32_t)count;
+
+        size_t written = sizeof(header);
+        if (fwrite(&header, sizeof(header), 1, out) != 1 || write_padding(out, &written, 8) == -1) result = -1;
+        for (size_t i = 0; i < count && result == 0; i++) {
+            if (write_record(out, listings[i]) == -1) result = -1;
+        }
+        if (fflush(out) != 0 || fsync(fileno(out)) == -1) result = -1;
+        if (fclose(out) != 0) result = -1;
+
+        if (result == 0 && rename(tmp_path, index_path) == -1) result = -1;
+        if (result == -1) {
+            perror("Writing directory index failed");
+            unlink(tmp_path);
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) dir_cache_release(listings[i]);
+    free(listings);
+    pthread_mutex_unlock(&g_save_lock);
+    return result;
+}
+
+/*
+ * Purpose:
+ *   The body of the background index writer thread.
+ *
+ * Parameters:
+ *   arg: A pointer to a malloc'ed index_writer_args_t (freed by the thread).
+ *
+ * Returns:
+ *   A void pointer (always NULL; the thread runs until the process exits).
+ */
+static void *index_writer_thread(void *arg) {
+    index_writer_args_t args = *(index_writer_args_t *)arg;
+    free(arg);
+    for (;;) {
+        sleep(args.interval_sec);
+        dir_index_save(args.index_path);
+    }
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Starts a background thread that saves the index at a fixed interval.
+ *
+ * Parameters:
+ *   index_path: The path of the index file (must stay valid).
+ *   interval_sec: The number of seconds between saves.
+ *
+ * Returns:
+ *   0 on success, or -1 if the thread could not be started.
+ */
+int dir_index_start_writer(const char *index_path, unsigned int interval_sec) {
+    index_writer_args_t *args = malloc(sizeof(index_writer_args_t));
+    if (args == NULL) {
+        perror("malloc for index writer failed");
+        return -1;
+    }
+    args->index_path = index_path;
+    args->interval_sec = interval_sec > 0 ? interval_sec : DIR_INDEX_DEFAULT_INTERVAL_SEC;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, index_writer_thread, args) != 0) {
+        perror("pthread_create for index writer failed");
+        free(args);
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * src/dir_index.h
+ *
+ * This header file declares the persistent directory index. The server
+ * periodically writes the contents of its directory listing cache to an index
+ * file; at startup the file is mapped into memory and every listing whose
+ * version stamp still matches the directory on disk is put back into the
+ * cache, so listings are warm immediately after a restart.
+ */
+#ifndef DIR_INDEX_H
+#define DIR_INDEX_H
+
+#include <stddef.h> // For size_t
+
+#define DIR_INDEX_DEFAULT_INTERVAL_SEC 60
+
+/*
+ * Purpose:
+ *   Maps an index file and loads every still-valid listing into the
+ *   directory cache. Listings whose directory changed are skipped.
+ *
+ * Parameters:
+ *   index_path: The path of the index file.
+ *   loaded_out: Receives the number of listings loaded.
+ *   stale_out: Receives the number of listings skipped as out of date.
+ *
+ * Returns:
+ *   0 on success (including a missing index file), or -1 if the file is
+ *   unreadable or malformed.
+ */
+int dir_index_load(const char *index_path, size_t *loaded_out, size_t *stale_out);
+
+/*
+ * Purpose:
+ *   Returns the directories with the most requests recorded in an index file,
+ *   i.e. the hottest directories of the previous run.
+ *
+ * Parameters:
+ *   index_path: The path of the index file.
+ *   max_count: The maximum number of directories to return.
+ *   paths_out: Receives a malloc'ed array of malloc'ed absolute paths,
+ *              ordered by decreasing request count.
+ *   count_out: Receives the number of paths.
+ *
+ * Returns:
+ *   0 on success (including a missing index file), or -1 on error.
+ */
+int dir_index_hottest(const char *index_path, size_t max_count, char ***paths_out, size_t *count_out);
+
+/*
+ * Purpose:
+ *   Writes the current contents of the directory cache to the index file.
+ *   The file is written under a temporary name and renamed into place, so a
+ *   crash never leaves a truncated index behind.
+ *
+ * Parameters:
+ *   index_path: The path of the index file.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+int dir_index_save(const char *index_path);
+
+/*
+ * Purpose:
+ *   Starts a background thread that saves the index at a fixed interval.
+ *
+ * Parameters:
+ *   index_path: The path of the index file (must stay valid).
+ *   interval_sec: The number of seconds between saves.
+ *
+ * Returns:
+ *   0 on success, or -1 if the thread could not be started.
+ */
+int dir_index_start_writer(const char *index_path, unsigned int interval_sec);
+
+#endif // DIR_INDEX_H
@@ -0,0 +1,318 @@
+/*
+ * src/entry_filter.c
+ *
+ * This file implements the metadata filters declared in entry_filter.h. The
+ * compiled program is an array of tests in clause order; each test holds the
+ * index of the first test of the next clause, where evaluation continues when
+ * the test fails, and the last test of a clause is flagged, so passing it
+ * accepts the entry.
+ */
+#define _GNU_SOURCE // For statx
+#include "entry_filter.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "dir_cache.h"
+
+// Fields a test reads. Age tests are compiled into FIELD_MTIME tests.
+enum {
+    FIELD_SIZE,
+    FIELD_MTIME,
+    FIELD_TYPE
+};
+
+// Comparisons.
+enum {
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_EQ,
+    OP_NE
+};
+
+typedef struct filter_test_s {
+    unsigned char field;       // FIELD_*
+    unsigned char op;          // OP_*
+    unsigned char clause_end;  // Passing this test accepts the entry
+    size_t on_false;           // Test to continue with on failure
+    unsigned long long size;
+    long long mtime;
+    char type;
+} filter_test_t;
+
+struct entry_filter_s {
+    filter_test_t tests[ENTRY_FILTER_MAX_TESTS];
+    size_t test_count;
+    unsigned int statx_mask;   // Fields the tests read
+};
+
+/*
+ * Purpose:
+ *   Parses a comparison operator.
+ *
+ * Parameters:
+ *   p: The parse position; advanced past the operator.
+ *
+ * Returns:
+ *   One of OP_*, or -1 if there is none.
+ */
+static int parse_op(const char **p) {
+    const char *s = *p;
+    int op;
+    if (s[0] == '<' && s[1] == '=') op = OP_LE;
+    else if (s[0] == '>' && s[1] == '=') op = OP_GE;
+    else if (s[0] == '!' && s[1] == '=') op = OP_NE;
+    else if (s[0] == '<') op = OP_LT;
+    else if (s[0] == '>') op = OP_GT;
+    else if (s[0] == '=') op = OP_EQ;
+    else return -1;
+    *p = s + ((op == OP_LE || op == OP_GE || op == OP_NE) ? 2 : 1);
+    return op;
+}
+
+/*
+ * Purpose:
+ *   Parses a number with an optional unit suffix.
+ *
+ * Parameters:
+ *   p: The parse position; advanced past the number and suffix.
+ *   units: The suffix letters allowed.
+ *   factors: The multiplier of each suffix letter.
+ *   value: Receives the value.
+ *
+ * Returns:
+ *   0 on success, or -1 if the number is malformed or too large.
+ */
+static int parse_number(const char **p, const char *units, const unsigned long long *factors, unsigned long long *value) {
+    const char *s = *p;
+    if (*s < '0' || *s > '9') return -1;
+    unsigned long long number = 0;
+    for (; *s >= '0' && *s <= '9'; s++) {
+        if (number > (~0ULL - 9) / 10) return -1;
+        number = number * 10 + (unsigned long long)(*s - '0');
+    }
+    if (*s != '\0') {
+        const char *unit = (*s != ',' && *s != '|') ? strchr(units, *s) : NULL;
+        if (unit != NULL) {
+            unsigned long long factor = factors[unit - units];
+            if (number > ~0ULL / factor) return -1;
+            number *= factor;
+            s++;
+        }
+    }
+    *value = number;
+    *p = s;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Parses one test of an expression.
+ *
+ * Parameters:
+ *   p: The parse position; advanced past the test.
+ *   now: The current time, for age tests.
+ *   test: Receives the test.
+ *
+ * Returns:
+ *   0 on success, or -1 if the test is malformed.
+ */
+static int parse_test(const char **p, time_t now, filter_test_t *test) {
+    static const char size_units[] = "KMGTkmgt";
+    static const unsigned long long size_factors[] = {
+        1ULL << 10, 1ULL << 20, 1ULL << 30, 1ULL << 40, 1ULL << 10, 1ULL << 20, 1ULL << 30, 1ULL << 40
+    };
+    static const char age_units[] = "smhdw";
+    static const unsigned long long age_factors[] = { 1, 60, 3600, 86400, 604800 };
+    const char *s = *p;
+    size_t name_len = strcspn(s, "<>=!");
+    int op;
+    unsigned long long number;
+
+    memset(test, 0, sizeof(*test));
+    if (name_len == 4 && strncmp(s, "size", 4) == 0) {
+        s += 4;
+        if ((op = parse_op(&s)) == -1 || parse_number(&s, size_units, size_factors, &number) == -1) return -1;
+        test->field = FIELD_SIZE;
+        test->size = number;
+    } else if (name_len == 5 && strncmp(s, "mtime", 5) == 0) {
+        s += 5;
+        if ((op = parse_op(&s)) == -1 || parse_number(&s, "", NULL, &number) == -1 || number > (unsigned long long)(~0ULL >> 2)) return -1;
+        test->field = FIELD_MTIME;
+        test->mtime = (long long)number;
+    } else if (name_len == 3 && strncmp(s, "age", 3) == 0) {
+        s += 3;
+        if ((op = parse_op(&s)) == -1 || parse_number(&s, age_units, age_factors, &number) == -1 || number > (unsigned long long)(~0ULL >> 2)) return -1;
+        // A younger entry has a later modification time.
+        static const int flipped[] = { OP_GT, OP_GE, OP_LT, OP_LE, OP_EQ, OP_NE };
+        op = flipped[op];
+        test->field = FIELD_MTIME;
+        test->mtime = (long long)now - (long long)number;
+    } else if (name_len == 4 && strncmp(s, "type", 4) == 0) {
+        s += 4;
+        if ((op = parse_op(&s)) == -1 || (op != OP_EQ && op != OP_NE)) return -1;
+        if (*s != DIR_ENTRY_FILE && *s != DIR_ENTRY_DIR && *s != DIR_ENTRY_LINK) return -1;
+        test->field = FIELD_TYPE;
+        test->type = *s++;
+    } else {
+        return -1;
+    }
+    if (*s != '\0' && *s != ',' && *s != '|') return -1;
+    test->op = (unsigned char)op;
+    *p = s;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Compiles a filter expression.
+ *
+ * Parameters:
+ *   expression: The expression.
+ *   now: The current time, which age tests are relative to.
+ *
+ * Returns:
+ *   The filter (free with entry_filter_free), or NULL on error (errno
+ *   EINVAL for a malformed expression, ENOMEM).
+ */
+entry_filter_t *entry_filter_compile(const char *expression, time_t now) {
+    entry_filter_t *filter = calloc(1, sizeof(entry_filter_t));
+    if (filter == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    const char *p = expression;
+    size_t clause_start = 0;
+    for (;;) {
+        if (filter->test_count == ENTRY_FILTER_MAX_TESTS) goto invalid;
+        filter_test_t *test = &filter->tests[filter->test_count];
+        if (parse_test(&p, now, test) == -1) goto invalid;
+        filter->test_count++;
+        if (test->field == FIELD_SIZE) filter->statx_mask |= STATX_SIZE;
+        if (test->field == FIELD_MTIME) filter->statx_mask |= STATX_MTIME;
+        if (*p == ',') {
+            p++;
+            continue;
+        }
+        // End of a clause: its failing tests continue with the next one.
+        test->clause_end = 1;
+        for (size_t i = clause_start; i < filter->test_count; i++) filter->tests[i].on_false = filter->test_count;
+        clause_start = filter->test_count;
+        if (*p == '\0') break;
+        p++; // '|'
+    }
+    return filter;
+
+invalid:
+    free(filter);
+    errno = EINVAL;
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Tells whether a filter reads the size or modification time, which must
+ *   then be looked up with entry_filter_stat.
+ *
+ * Parameters:
+ *   filter: The filter.
+ *
+ * Returns:
+ *   Nonzero if entry_filter_stat is needed.
+ */
+int entry_filter_needs_stat(const entry_filter_t *filter) {
+    return filter->statx_mask != 0;
+}
+
+/*
+ * Purpose:
+ *   Looks up the fields a filter reads for one entry, with statx asking for
+ *   those fields only. Symbolic links are not followed.
+ *
+ * Parameters:
+ *   filter: The filter.
+ *   dir_fd: The directory containing the entry.
+ *   name: The entry's name.
+ *   info: Receives the size and modification time (type is left alone).
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno is set).
+ */
+int entry_filter_stat(const entry_filter_t *filter, int dir_fd, const char *name, entry_info_t *info) {
+    struct statx stx;
+    if (statx(dir_fd, name, AT_SYMLINK_NOFOLLOW, filter->statx_mask, &stx) == -1) return -1;
+    info->size = (unsigned long long)stx.stx_size;
+    info->mtime = (long long)stx.stx_mtime.tv_sec;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Compares two values.
+ *
+ * Parameters:
+ *   op: One of OP_*.
+ *   cmp: Negative, zero or positive as the entry's value is below, equal to
+ *        or above the test's.
+ *
+ * Returns:
+ *   Nonzero if the comparison holds.
+ */
+static int compare(int op, int cmp) {
+    switch (op) {
+    case OP_LT: return cmp < 0;
+    case OP_LE: return cmp <= 0;
+    case OP_GT: return cmp > 0;
+    case OP_GE: return cmp >= 0;
+    case OP_EQ: return cmp == 0;
+    default:    return cmp != 0;
+    }
+}
+
+/*
+ * Purpose:
+ *   Evaluates a filter.
+ *
+ * Parameters:
+ *   filter: The filter.
+ *   info: The entry's metadata.
+ *
+ * Returns:
+ *   1 if the entry passes, 0 otherwise.
+ */
+int entry_filter_match(const entry_filter_t *filter, const entry_info_t *info) {
+    size_t pc = 0;
+    while (pc < filter->test_count) {
+        const filter_test_t *test = &filter->tests[pc];
+        int cmp;
+        if (test->field == FIELD_SIZE) cmp = (info->size > test->size) - (info->size < test->size);
+        else if (test->field == FIELD_MTIME) cmp = (info->mtime > test->mtime) - (info->mtime < test->mtime);
+        else cmp = (info->type != test->type);
+        if (!compare(test->op, cmp)) {
+            pc = test->on_false;
+        } else if (test->clause_end) {
+            return 1;
+        } else {
+            pc++;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Frees a filter.
+ *
+ * Parameters:
+ *   filter: The filter (may be NULL).
+ *
+ * Returns:
+ *   void
+ */
+void entry_filter_free(entry_filter_t *filter) {
+    free(filter);
+}
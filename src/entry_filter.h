@@ -0,0 +1,107 @@
+/*
+ * src/entry_filter.h
+ *
+ * This header file declares the metadata filters of "LIST -w". A filter is an
+ * expression over an entry's size, age, modification time and type:
+ *
+ *   expression = clause { '|' clause }    (any clause holds)
+ *   clause     = test { ',' test }        (all tests hold)
+ *   test       = field op value, op one of < <= > >= = !=
+ *     size     bytes, with an optional K, M, G or T suffix (powers of 1024)
+ *     age      seconds since the last modification, with an optional s, m,
+ *              h, d or w suffix
+ *     mtime    modification time in seconds since the epoch
+ *     type     f, d or l (only = and !=)
+ *
+ * e.g. "size>1G,age<1d" or "type=d|size=0". The expression is compiled once
+ * into a short program of tests; each clause's tests run in order and the
+ * first failing one jumps to the next clause. Age tests are turned into
+ * modification time tests when the filter is compiled. The program also
+ * records which fields it reads, so an entry is looked up with statx for
+ * just those, and not at all for a filter on type only.
+ */
+#ifndef ENTRY_FILTER_H
+#define ENTRY_FILTER_H
+
+#include <time.h> // For time_t
+
+#define ENTRY_FILTER_MAX_TESTS 64
+
+// The metadata a filter is evaluated against.
+typedef struct entry_info_s {
+    char type;               // One of DIR_ENTRY_*
+    unsigned long long size;
+    long long mtime;         // Seconds since the epoch
+} entry_info_t;
+
+typedef struct entry_filter_s entry_filter_t;
+
+/*
+ * Purpose:
+ *   Compiles a filter expression.
+ *
+ * Parameters:
+ *   expression: The expression.
+ *   now: The current time, which age tests are relative to.
+ *
+ * Returns:
+ *   The filter (free with entry_filter_free), or NULL on error (errno
+ *   EINVAL for a malformed expression, ENOMEM).
+ */
+entry_filter_t *entry_filter_compile(const char *expression, time_t now);
+
+/*
+ * Purpose:
+ *   Tells whether a filter reads the size or modification time, which must
+ *   then be looked up with entry_filter_stat.
+ *
+ * Parameters:
+ *   filter: The filter.
+ *
+ * Returns:
+ *   Nonzero if entry_filter_stat is needed.
+ */
+int entry_filter_needs_stat(const entry_filter_t *filter);
+
+/*
+ * Purpose:
+ *   Looks up the fields a filter reads for one entry, with statx asking for
+ *   those fields only. Symbolic links are not followed.
+ *
+ * Parameters:
+ *   filter: The filter.
+ *   dir_fd: The directory containing the entry.
+ *   name: The entry's name.
+ *   info: Receives the size and modification time (type is left alone).
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno is set).
+ */
+int entry_filter_stat(const entry_filter_t *filter, int dir_fd, const char *name, entry_info_t *info);
+
+/*
+ * Purpose:
+ *   Evaluates a filter.
+ *
+ * Parameters:
+ *   filter: The filter.
+ *   info: The entry's metadata.
+ *
+ * Returns:
+ *   1 if the entry passes, 0 otherwise.
+ */
+int entry_filter_match(const entry_filter_t *filter, const entry_info_t *info);
+
+/*
+ * Purpose:
+ *   Frees a filter.
+ *
+ * Parameters:
+ *   filter: The filter (may be NULL).
+ *
+ * Returns:
+ *   void
+ */
+void entry_filter_free(entry_filter_t *filter);
+
+#endif // ENTRY_FILTER_H
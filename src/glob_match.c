@@ -0,0 +1,391 @@
+/*
+ * src/glob_match.c
+ *
+ * This file implements the glob matcher declared in glob_match.h. A pattern
+ * is parsed into elements (a character, '?', a set or '*'); the literal
+ * characters at both ends become the prefix and suffix, and the elements in
+ * between are matched by an NFA whose states are the positions between the
+ * elements. The set of active states is a bitset, so a step over one
+ * character of the name costs one pass over the active positions, with no
+ * backtracking however many '*' the pattern has.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "glob_match.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#define STATE_WORDS ((GLOB_MAX_ELEMENTS + 1 + 63) / 64)
+
+// Kinds of pattern elements.
+enum {
+    ELEMENT_CHAR,
+    ELEMENT_ANY,  // '?'
+    ELEMENT_SET,  // "[...]"
+    ELEMENT_STAR  // '*'
+};
+
+typedef struct glob_element_s {
+    unsigned char kind; // ELEMENT_*
+    unsigned char ch;   // For ELEMENT_CHAR
+    size_t set;         // For ELEMENT_SET: index into sets
+} glob_element_t;
+
+struct glob_pattern_s {
+    char *prefix;               // Literal characters before the first wildcard
+    size_t prefix_len;
+    char *suffix;               // Literal characters after the last wildcard
+    size_t suffix_len;
+    glob_element_t *elements;   // Everything in between
+    size_t element_count;
+    uint8_t (*sets)[32];        // One bitmap of 256 bytes per set
+    size_t set_count;
+    size_t min_middle;          // Characters the middle elements need at least
+    int has_star;
+    int leading_dot;            // The pattern starts with a literal '.'
+};
+
+/*
+ * Purpose:
+ *   Adds the members of a named character class ("alpha", "digit", ...) to
+ *   a set.
+ *
+ * Parameters:
+ *   name: The class name.
+ *   len: The length of the name.
+ *   set: The set's bitmap.
+ *
+ * Returns:
+ *   0 on success, or -1 for an unknown class.
+ */
+static int add_named_class(const char *name, size_t len, uint8_t set[32]) {
+    static const struct {
+        const char *name;
+        int (*test)(int);
+    } classes[] = {
+        { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank }, { "cntrl", iscntrl },
+        { "digit", isdigit }, { "graph", isgraph }, { "lower", islower }, { "print", isprint },
+        { "punct", ispunct }, { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit }
+    };
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (strlen(classes[i].name) != len || strncmp(classes[i].name, name, len) != 0) continue;
+        for (int c = 1; c < 256; c++) {
+            if (classes[i].test(c)) set[c / 8] |= (uint8_t)(1u << (c % 8));
+        }
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * Purpose:
+ *   Parses one character of a bracket expression: an ordinary character, a
+ *   quoted one, or "[.c.]" or "[=c=]", which stand for c (the C locale has
+ *   no longer collating elements).
+ *
+ * Parameters:
+ *   p: The parse position; advanced past the character.
+ *   out: Receives the character.
+ *
+ * Returns:
+ *   1 on success, 0 at the end of the pattern, or -1 if the element is
+ *   invalid.
+ */
+static int parse_set_char(const char **p, unsigned char *out) {
+    const char *s = *p;
+    if (s[0] == '\\') s++;
+    if (s[0] == '\0') return 0;
+    if (s == *p && s[0] == '[' && (s[1] == '.' || s[1] == '=')) {
+        if (s[2] == '\0' || s[3] != s[1] || s[4] != ']') return -1;
+        *out = (unsigned char)s[2];
+        *p = s + 5;
+        return 1;
+    }
+    *out = (unsigned char)s[0];
+    *p = s + 1;
+    return 1;
+}
+
+/*
+ * Purpose:
+ *   Parses a bracket expression.
+ *
+ * Parameters:
+ *   start: The character after the '['.
+ *   set: The bitmap that receives the set (cleared by the caller).
+ *   end_out: Receives the character after the closing ']'.
+ *
+ * Returns:
+ *   1 on success, 0 if there is no closing ']' (the '[' is then an ordinary
+ *   character), or -1 for an unknown class name.
+ */
+static int parse_set(const char *start, uint8_t set[32], const char **end_out) {
+    const char *p = start;
+    int negate = 0;
+    if (*p == '!' || *p == '^') {
+        negate = 1;
+        p++;
+    }
+    int first = 1;
+    while (*p != ']' || first) {
+        if (*p == '\0') return 0;
+        first = 0;
+        if (p[0] == '[' && p[1] == ':') {
+            const char *close = strstr(p + 2, ":]");
+            if (close == NULL) return 0;
+            if (add_named_class(p + 2, (size_t)(close - p - 2), set) == -1) return -1;
+            p = close + 2;
+            continue;
+        }
+        unsigned char low, high;
+        int parsed = parse_set_char(&p, &low);
+        if (parsed != 1) return parsed;
+        high = low;
+        if (p[0] == '-' && p[1] != ']' && p[1] != '\0') {
+            p++;
+            parsed = parse_set_char(&p, &high);
+            if (parsed != 1) return parsed;
+        }
+        for (unsigned int c = low; c <= high; c++) set[c / 8] |= (uint8_t)(1u << (c % 8));
+    }
+    if (negate) {
+        for (int i = 0; i < 32; i++) set[i] = (uint8_t)~set[i];
+    }
+    set[0] &= (uint8_t)~1u; // Never matches the terminating NUL
+    *end_out = p + 1;
+    return 1;
+}
+
+/*
+ * Purpose:
+ *   Compiles a glob pattern.
+ *
+ * Parameters:
+ *   pattern: The pattern.
+ *
+ * Returns:
+ *   The compiled pattern (free with glob_free), or NULL on error (errno
+ *   EINVAL if the pattern has too many elements, ENOMEM).
+ */
+glob_pattern_t *glob_compile(const char *pattern) {
+    size_t pattern_len = strlen(pattern);
+    glob_pattern_t *glob = calloc(1, sizeof(glob_pattern_t));
+    // No more elements or sets than characters in the pattern.
+    glob_element_t *elements = malloc((pattern_len + 1) * sizeof(glob_element_t));
+    uint8_t (*sets)[32] = calloc(pattern_len / 2 + 1, sizeof(*sets));
+    if (glob == NULL || elements == NULL || sets == NULL) {
+        free(glob);
+        free(elements);
+        free(sets);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    size_t count = 0, set_count = 0;
+    for (const char *p = pattern; *p != '\0';) {
+        glob_element_t *element = &elements[count];
+        if (*p == '*') {
+            p++;
+            if (count > 0 && elements[count - 1].kind == ELEMENT_STAR) continue;
+            element->kind = ELEMENT_STAR;
+        } else if (*p == '?') {
+            p++;
+            element->kind = ELEMENT_ANY;
+        } else if (*p == '[') {
+            const char *end;
+            int parsed = parse_set(p + 1, sets[set_count], &end);
+            if (parsed == -1) goto invalid;
+            if (parsed == 1) {
+                element->kind = ELEMENT_SET;
+                element->set = set_count++;
+                p = end;
+            } else {
+                memset(sets[set_count], 0, sizeof(sets[set_count]));
+                element->kind = ELEMENT_CHAR;
+                element->ch = (unsigned char)*p++;
+            }
+        } else {
+            if (*p == '\\') {
+                p++;
+                if (*p == '\0') goto invalid; // A trailing '\' never matches, as in fnmatch
+            }
+            element->kind = ELEMENT_CHAR;
+            element->ch = (unsigned char)*p++;
+        }
+        count++;
+    }
+
+    size_t head = 0, tail = count;
+    while (head < count && elements[head].kind == ELEMENT_CHAR) head++;
+    while (tail > head && elements[tail - 1].kind == ELEMENT_CHAR) tail--;
+    if (tail - head > GLOB_MAX_ELEMENTS) goto invalid;
+
+    glob->prefix = malloc(head + 1);
+    glob->suffix = malloc(count - tail + 1);
+    if (glob->prefix == NULL || glob->suffix == NULL) {
+        errno = ENOMEM;
+        goto fail;
+    }
+    for (size_t i = 0; i < head; i++) glob->prefix[i] = (char)elements[i].ch;
+    for (size_t i = tail; i < count; i++) glob->suffix[i - tail] = (char)elements[i].ch;
+    glob->prefix_len = head;
+    glob->suffix_len = count - tail;
+    glob->leading_dot = (count > 0 && elements[0].kind == ELEMENT_CHAR && elements[0].ch == '.');
+    memmove(elements, elements + head, (tail - head) * sizeof(glob_element_t));
+    glob->elements = elements;
+    glob->element_count = tail - head;
+    for (size_t i = 0; i < glob->element_count; i++) {
+        if (elements[i].kind == ELEMENT_STAR) glob->has_star = 1;
+        else glob->min_middle++;
+    }
+    glob->sets = sets;
+    glob->set_count = set_count;
+    return glob;
+
+invalid:
+    errno = EINVAL;
+fail:
+    free(elements);
+    free(sets);
+    free(glob->prefix);
+    free(glob->suffix);
+    free(glob);
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Tells whether an element matches a character.
+ *
+ * Parameters:
+ *   glob: The compiled pattern.
+ *   element: The element (not a star).
+ *   c: The character.
+ *
+ * Returns:
+ *   Nonzero on a match.
+ */
+static int element_matches(const glob_pattern_t *glob, const glob_element_t *element, unsigned char c) {
+    switch (element->kind) {
+    case ELEMENT_CHAR:
+        return element->ch == c;
+    case ELEMENT_SET:
+        return glob->sets[element->set][c / 8] & (1u << (c % 8));
+    default:
+        return 1;
+    }
+}
+
+/*
+ * Purpose:
+ *   Adds to a state set the states reachable without reading a character:
+ *   a star may match nothing, so the state after it is active as well.
+ *
+ * Parameters:
+ *   glob: The compiled pattern.
+ *   states: The state set.
+ *
+ * Returns:
+ *   void
+ */
+static void add_star_skips(const glob_pattern_t *glob, uint64_t *states) {
+    for (size_t i = 0; i < glob->element_count; i++) {
+        if (glob->elements[i].kind == ELEMENT_STAR && (states[i / 64] >> (i % 64) & 1)) {
+            states[(i + 1) / 64] |= (uint64_t)1 << ((i + 1) % 64);
+        }
+    }
+}
+
+/*
+ * Purpose:
+ *   Matches the part of a name between the prefix and the suffix against
+ *   the middle elements.
+ *
+ * Parameters:
+ *   glob: The compiled pattern.
+ *   text: The part of the name.
+ *   len: Its length.
+ *
+ * Returns:
+ *   1 on a match, 0 otherwise.
+ */
+static int match_middle(const glob_pattern_t *glob, const unsigned char *text, size_t len) {
+    size_t n = glob->element_count;
+    if (!glob->has_star) {
+        for (size_t i = 0; i < n; i++) {
+            if (!element_matches(glob, &glob->elements[i], text[i])) return 0;
+        }
+        return 1;
+    }
+
+    uint64_t current[STATE_WORDS], next[STATE_WORDS];
+    size_t words = n / 64 + 1;
+    memset(current, 0, words * sizeof(uint64_t));
+    current[0] = 1;
+    add_star_skips(glob, current);
+    for (size_t pos = 0; pos < len; pos++) {
+        memset(next, 0, words * sizeof(uint64_t));
+        uint64_t any = 0;
+        for (size_t w = 0; w < words; w++) {
+            if (current[w] == 0) continue;
+            for (size_t bit = 0; bit < 64; bit++) {
+                if (!(current[w] >> bit & 1)) continue;
+                size_t state = w * 64 + bit;
+                if (state >= n) break; // Accepting, but characters are left
+                const glob_element_t *element = &glob->elements[state];
+                size_t target = (element->kind == ELEMENT_STAR) ? state : state + 1;
+                if (element->kind == ELEMENT_STAR || element_matches(glob, element, text[pos])) {
+                    next[target / 64] |= (uint64_t)1 << (target % 64);
+                    any = 1;
+                }
+            }
+        }
+        if (!any) return 0;
+        add_star_skips(glob, next);
+        memcpy(current, next, words * sizeof(uint64_t));
+    }
+    return (current[n / 64] >> (n % 64)) & 1;
+}
+
+/*
+ * Purpose:
+ *   Matches a name against a compiled pattern.
+ *
+ * Parameters:
+ *   glob: The compiled pattern.
+ *   name: The name (a single path component).
+ *
+ * Returns:
+ *   1 if the name matches, 0 otherwise.
+ */
+int glob_match(const glob_pattern_t *glob, const char *name) {
+    if (name[0] == '.' && !glob->leading_dot) return 0;
+    size_t len = strlen(name);
+    if (len < glob->prefix_len + glob->suffix_len) return 0;
+    if (memcmp(name, glob->prefix, glob->prefix_len) != 0) return 0;
+    if (memcmp(name + len - glob->suffix_len, glob->suffix, glob->suffix_len) != 0) return 0;
+    size_t middle_len = len - glob->prefix_len - glob->suffix_len;
+    if (middle_len < glob->min_middle || (!glob->has_star && middle_len != glob->min_middle)) return 0;
+    return match_middle(glob, (const unsigned char *)name + glob->prefix_len, middle_len);
+}
+
+/*
+ * Purpose:
+ *   Frees a compiled pattern.
+ *
+ * Parameters:
+ *   glob: The compiled pattern (may be NULL).
+ *
+ * Returns:
+ *   void
+ */
+void glob_free(glob_pattern_t *glob) {
+    if (glob == NULL) return;
+    free(glob->prefix);
+    free(glob->suffix);
+    free(glob->elements);
+    free(glob->sets);
+    free(glob);
+}
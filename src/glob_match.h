@@ -0,0 +1,61 @@
+/*
+ * src/glob_match.h
+ *
+ * This header file declares a compiled matcher for shell glob patterns, used
+ * to filter LIST by name. The syntax and results are those of fnmatch with
+ * FNM_PERIOD on a single name: '*' matches any run of characters, '?' one
+ * character, "[...]" one character of a set (with ranges, "[:class:]" names
+ * and '!' or '^' to negate), and '\' quotes the next character. A leading
+ * '.' of a name is only matched by a literal '.'.
+ *
+ * A pattern is compiled once. Matching first compares the pattern's literal
+ * prefix and suffix with the ends of the name, so most names are rejected
+ * with two memcmp calls; only the rest of the name is run through a
+ * bit-parallel NFA over the remaining pattern elements.
+ */
+#ifndef GLOB_MATCH_H
+#define GLOB_MATCH_H
+
+#define GLOB_MAX_ELEMENTS 1024 // Wildcards and characters between the literal prefix and suffix
+
+typedef struct glob_pattern_s glob_pattern_t;
+
+/*
+ * Purpose:
+ *   Compiles a glob pattern.
+ *
+ * Parameters:
+ *   pattern: The pattern.
+ *
+ * Returns:
+ *   The compiled pattern (free with glob_free), or NULL on error (errno
+ *   EINVAL if the pattern has too many elements, ENOMEM).
+ */
+glob_pattern_t *glob_compile(const char *pattern);
+
+/*
+ * Purpose:
+ *   Matches a name against a compiled pattern.
+ *
+ * Parameters:
+ *   glob: The compiled pattern.
+ *   name: The name (a single path component).
+ *
+ * Returns:
+ *   1 if the name matches, 0 otherwise.
+ */
+int glob_match(const glob_pattern_t *glob, const char *name);
+
+/*
+ * Purpose:
+ *   Frees a compiled pattern.
+ *
+ * Parameters:
+ *   glob: The compiled pattern (may be NULL).
+ *
+ * Returns:
+ *   void
+ */
+void glob_free(glob_pattern_t *glob);
+
+#endif // GLOB_MATCH_H
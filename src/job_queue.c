@@ -0,0 +1,670 @@
+/*
+ * src/job_queue.c
+ *
+ * This file implements the background job queue declared in job_queue.h.
+ * Jobs live in a fixed table guarded by one mutex. Each pool thread takes the
+ * oldest queued job, creates a socketpair, starts the runner on one end and
+ * collects the runner's reply from the other end into the job's output
+ * buffer until the runner closes its end. Cancelling a running job writes a
+ * "CANCEL" line to the runner, which notices it the way a session notices a
+ * client's CANCEL. Output beyond JOB_SPOOL_THRESHOLD is moved to a file named
+ * "job-<id>" in the spool directory, written and read by offset outside the
+ * mutex.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "job_queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/random.h>
+
+#include "protocol.h"
+
+#define JOB_READ_CHUNK (64 * 1024)
+#define JOB_INITIAL_OUTPUT (64 * 1024)
+#define JOB_SPOOL_PREFIX "job-"
+
+typedef struct job_s {
+    int in_use;
+    char id[JOB_ID_LEN + 1];
+    char *command;
+    void *context;
+    unsigned long sequence; // Submission order; the oldest queued job runs first
+    int state;              // JOB_*
+    int cancel_requested;   // Set by job_queue_cancel
+    int stop_sent;          // A "CANCEL" line was written to the runner
+    int truncated;
+    char *output;
+    size_t output_len;
+    size_t output_capacity;
+    int spool_fd;           // Spool file holding the output (instead of output), or -1
+    int spool_failed;       // The spool file could not be written; the output stays in memory
+    int control_fd;         // Collector's end of the socketpair while running, else -1
+    int runner_fd;          // Runner's end of the socketpair while running
+    time_t finished;
+} job_t;
+
+static pthread_mutex_t g_job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_job_queued = PTHREAD_COND_INITIALIZER;
+static job_t g_jobs[JOB_MAX_JOBS];
+static unsigned long g_next_sequence = 1;
+static size_t g_context_size = 0;
+static job_runner_fn g_runner = NULL;
+static int g_started = 0;
+static char g_spool_dir[MAX_PATH_LEN]; // Empty if output is kept in memory only
+
+/*
+ * Purpose:
+ *   Finds a job by id. The caller holds g_job_lock.
+ *
+ * Parameters:
+ *   id: The job id.
+ *
+ * Returns:
+ *   The job, or NULL if there is none with this id.
+ */
+static job_t *find_job(const char *id) {
+    for (size_t i = 0; i < JOB_MAX_JOBS; i++) {
+        if (g_jobs[i].in_use && strcmp(g_jobs[i].id, id) == 0) return &g_jobs[i];
+    }
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Frees a finished job's memory and its table slot. The caller holds
+ *   g_job_lock.
+ *
+ * Parameters:
+ *   job: The job.
+ *
+ * Returns:
+ *   void
+ */
+static void free_job(job_t *job) {
+    if (job->spool_fd != -1) {
+        char path[MAX_PATH_LEN + 32];
+        snprintf(path, sizeof(path), "%s/%s%s", g_spool_dir, JOB_SPOOL_PREFIX, job->id);
+        close(job->spool_fd);
+        unlink(path);
+    }
+    free(job->command);
+    free(job->context);
+    free(job->output);
+    memset(job, 0, sizeof(*job));
+}
+
+/*
+ * Purpose:
+ *   Forgets finished jobs older than JOB_RESULT_TTL_SEC. The caller holds
+ *   g_job_lock.
+ *
+ * Parameters:
+ *   now: The current time.
+ *
+ * Returns:
+ *   void
+ */
+static void expire_jobs(time_t now) {
+    for (size_t i = 0; i < JOB_MAX_JOBS; i++) {
+        job_t *job = &g_jobs[i];
+        if (job->in_use && (job->state == JOB_DONE || job->state == JOB_CANCELLED) &&
+            now - job->finished > JOB_RESULT_TTL_SEC) {
+            free_job(job);
+        }
+    }
+}
+
+/*
+ * Purpose:
+ *   Asks a running job's runner to stop by writing a "CANCEL" line to it,
+ *   once. The caller holds g_job_lock.
+ *
+ * Parameters:
+ *   job: The running job.
+ *
+ * Returns:
+ *   void
+ */
+static void send_stop(job_t *job) {
+    static const char line[] = "CANCEL\n";
+    if (job->stop_sent || job->control_fd == -1) return;
+    job->stop_sent = 1;
+    if (send(job->control_fd, line, sizeof(line) - 1, MSG_NOSIGNAL | MSG_DONTWAIT) == -1) {
+        perror("send of CANCEL to job failed");
+    }
+}
+
+/*
+ * Purpose:
+ *   Writes a whole buffer to a spool file at an offset.
+ *
+ * Parameters:
+ *   fd: The spool file.
+ *   data: The data.
+ *   len: Its length.
+ *   offset: The file offset.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+static int spool_write(int fd, const char *data, size_t len, size_t offset) {
+    while (len > 0) {
+        ssize_t written = pwrite(fd, data, len, (off_t)offset);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += written;
+        len -= (size_t)written;
+        offset += (size_t)written;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Copies a job's in-memory output to a new spool file. Called by the job's
+ *   collector without g_job_lock: only the collector changes the output, so
+ *   it stays the same meanwhile, and readers keep using it until the caller
+ *   switches the job to the file.
+ *
+ * Parameters:
+ *   job: The running job.
+ *
+ * Returns:
+ *   The spool file's descriptor, or -1 if the output stays in memory.
+ */
+static int start_spool(job_t *job) {
+    char path[MAX_PATH_LEN + 32];
+    snprintf(path, sizeof(path), "%s/%s%s", g_spool_dir, JOB_SPOOL_PREFIX, job->id);
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        perror("Cannot create job spool file");
+        return -1;
+    }
+    if (spool_write(fd, job->output, job->output_len, 0) == -1) {
+        perror("Writing job spool file failed");
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Purpose:
+ *   Appends runner output to a job: in memory, or in its spool file once
+ *   the output has grown beyond JOB_SPOOL_THRESHOLD and a spool directory is
+ *   set. Output beyond the limit is dropped and the runner is asked to
+ *   stop. Called by the job's collector without g_job_lock; the lock is
+ *   only held to update the job, never during file I/O, so a slow disk does
+ *   not hold up other jobs or JOB requests. The new bytes become visible to
+ *   readers once they are written.
+ *
+ * Parameters:
+ *   job: The running job.
+ *   data: The output.
+ *   len: Its length.
+ *
+ * Returns:
+ *   void
+ */
+static void append_output(job_t *job, const char *data, size_t len) {
+    pthread_mutex_lock(&g_job_lock);
+    int spool = (job->spool_fd == -1 && !job->spool_failed && g_spool_dir[0] != '\0' &&
+                 job->output_len + len > JOB_SPOOL_THRESHOLD);
+    pthread_mutex_unlock(&g_job_lock);
+    if (spool) {
+        int fd = start_spool(job);
+        pthread_mutex_lock(&g_job_lock);
+        if (fd == -1) {
+            job->spool_failed = 1;
+        } else {
+            free(job->output);
+            job->output = NULL;
+            job->output_capacity = 0;
+            job->spool_fd = fd;
+        }
+        pthread_mutex_unlock(&g_job_lock);
+    }
+
+    pthread_mutex_lock(&g_job_lock);
+    size_t limit = (job->spool_fd != -1) ? (size_t)JOB_MAX_SPOOLED_OUTPUT : JOB_MAX_OUTPUT;
+    if (len > limit - job->output_len) {
+        len = limit - job->output_len;
+        job->truncated = 1;
+        send_stop(job);
+    }
+    if (len > 0 && job->spool_fd != -1) {
+        // The spool file is only closed once the job has finished.
+        int fd = job->spool_fd;
+        size_t offset = job->output_len;
+        pthread_mutex_unlock(&g_job_lock);
+        int result = spool_write(fd, data, len, offset);
+        pthread_mutex_lock(&g_job_lock);
+        if (result == -1) {
+            perror("Writing job spool file failed");
+            job->truncated = 1;
+            send_stop(job);
+        } else {
+            job->output_len += len;
+        }
+        len = 0;
+    }
+    if (len > 0 && job->output_len + len > job->output_capacity) {
+        size_t capacity = job->output_capacity > 0 ? job->output_capacity : JOB_INITIAL_OUTPUT;
+        while (capacity < job->output_len + len) capacity *= 2;
+        if (capacity > JOB_MAX_OUTPUT) capacity = JOB_MAX_OUTPUT;
+        char *grown = realloc(job->output, capacity);
+        if (grown == NULL) {
+            perror("realloc for job output failed");
+            job->truncated = 1;
+            send_stop(job);
+            len = 0;
+        } else {
+            job->output = grown;
+            job->output_capacity = capacity;
+        }
+    }
+    if (len > 0) {
+        memcpy(job->output + job->output_len, data, len);
+        job->output_len += len;
+    }
+    pthread_mutex_unlock(&g_job_lock);
+}
+
+/*
+ * Purpose:
+ *   Thread function running one job's command through the runner callback.
+ *   Shutting down the runner's end afterwards is the collector's EOF.
+ *
+ * Parameters:
+ *   arg: The job.
+ *
+ * Returns:
+ *   NULL
+ */
+static void *job_runner_thread(void *arg) {
+    job_t *job = arg;
+    g_runner(job->runner_fd, job->command, job->context);
+    shutdown(job->runner_fd, SHUT_RDWR);
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Runs a job that was just marked running: starts the runner and collects
+ *   its output until it is done, then records the final state.
+ *
+ * Parameters:
+ *   job: The job.
+ *
+ * Returns:
+ *   void
+ */
+static void run_job(job_t *job) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+        perror("socketpair for job failed");
+        sv[0] = sv[1] = -1;
+    } else {
+        pthread_mutex_lock(&g_job_lock);
+        job->runner_fd = sv[0];
+        job->control_fd = sv[1];
+        if (job->cancel_requested) send_stop(job);
+        pthread_mutex_unlock(&g_job_lock);
+
+        pthread_t runner;
+        if (pthread_create(&runner, NULL, job_runner_thread, job) != 0) {
+            perror("pthread_create for job runner failed");
+        } else {
+            char buffer[JOB_READ_CHUNK];
+            for (;;) {
+                ssize_t nbytes = read(sv[1], buffer, sizeof(buffer));
+                if (nbytes == 0) break;
+                if (nbytes == -1) {
+                    if (errno == EINTR) continue;
+                    perror("read of job output failed");
+                    break;
+                }
+                append_output(job, buffer, (size_t)nbytes);
+            }
+            pthread_join(runner, NULL);
+        }
+    }
+
+    pthread_mutex_lock(&g_job_lock);
+    job->state = job->cancel_requested ? JOB_CANCELLED : JOB_DONE;
+    job->finished = time(NULL);
+    job->control_fd = -1;
+    job->runner_fd = -1;
+    pthread_mutex_unlock(&g_job_lock);
+    if (sv[0] != -1) {
+        close(sv[0]);
+        close(sv[1]);
+    }
+}
+
+/*
+ * Purpose:
+ *   Thread function of the pool: runs the oldest queued job, forever.
+ *
+ * Parameters:
+ *   arg: Unused.
+ *
+ * Returns:
+ *   Never returns.
+ */
+static void *job_pool_thread(void *arg) {
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&g_job_lock);
+        job_t *next = NULL;
+        while (next == NULL) {
+            for (size_t i = 0; i < JOB_MAX_JOBS; i++) {
+                job_t *job = &g_jobs[i];
+                if (job->in_use && job->state == JOB_QUEUED && (next == NULL || job->sequence < next->sequence)) next = job;
+            }
+            if (next == NULL) pthread_cond_wait(&g_job_queued, &g_job_lock);
+        }
+        next->state = JOB_RUNNING;
+        pthread_mutex_unlock(&g_job_lock);
+        run_job(next);
+    }
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Sets the directory for spool files and removes the spool files left in
+ *   it by an earlier run. Must be called before job_queue_start.
+ *
+ * Parameters:
+ *   dir: The spool directory; it must exist and be writable.
+ *
+ * Returns:
+ *   0 on success, or -1 if the directory cannot be used.
+ */
+int job_queue_set_spool_dir(const char *dir) {
+    if (strlen(dir) >= sizeof(g_spool_dir) || access(dir, W_OK | X_OK) == -1) {
+        fprintf(stderr, "Error: Spool directory '%s' is not a writable directory.\n", dir);
+        return -1;
+    }
+    DIR *dirp = opendir(dir);
+    if (dirp == NULL) {
+        perror("Cannot open spool directory");
+        return -1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dirp)) != NULL) {
+        if (strncmp(entry->d_name, JOB_SPOOL_PREFIX, strlen(JOB_SPOOL_PREFIX)) == 0) {
+            unlinkat(dirfd(dirp), entry->d_name, 0);
+        }
+    }
+    closedir(dirp);
+    snprintf(g_spool_dir, sizeof(g_spool_dir), "%s", dir);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Starts the pool threads that run queued jobs.
+ *
+ * Parameters:
+ *   thread_count: The number of jobs that may run at once.
+ *   context_size: The size of the context copied with each job.
+ *   runner: The function that runs a job's command.
+ *
+ * Returns:
+ *   0 on success, or -1 if no thread could be started.
+ */
+int job_queue_start(unsigned int thread_count, size_t context_size, job_runner_fn runner) {
+    g_context_size = context_size;
+    g_runner = runner;
+    unsigned int started = 0;
+    for (unsigned int i = 0; i < thread_count; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, job_pool_thread, NULL) != 0) {
+            perror("pthread_create for job pool failed");
+            break;
+        }
+        pthread_detach(tid);
+        started++;
+    }
+    if (started == 0) return -1;
+    pthread_mutex_lock(&g_job_lock);
+    g_started = 1;
+    pthread_mutex_unlock(&g_job_lock);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Queues a command as a new job.
+ *
+ * Parameters:
+ *   command: The command line.
+ *   context: The submitter's context (context_size bytes are copied).
+ *   id_out: Receives the job id.
+ *   id_size: The size of id_out (at least JOB_ID_LEN + 1).
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno EAGAIN if JOB_MAX_JOBS jobs are kept,
+ *   ENOSYS if the queue was not started).
+ */
+int job_queue_submit(const char *command, const void *context, char *id_out, size_t id_size) {
+    unsigned char random_bytes[JOB_ID_LEN / 2];
+    if (id_size < JOB_ID_LEN + 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (getrandom(random_bytes, sizeof(random_bytes), 0) != (ssize_t)sizeof(random_bytes)) return -1;
+    char *command_copy = strdup(command);
+    void *context_copy = malloc(g_context_size > 0 ? g_context_size : 1);
+    if (command_copy == NULL || context_copy == NULL) {
+        free(command_copy);
+        free(context_copy);
+        return -1;
+    }
+    memcpy(context_copy, context, g_context_size);
+
+    pthread_mutex_lock(&g_job_lock);
+    if (!g_started) {
+        pthread_mutex_unlock(&g_job_lock);
+        free(command_copy);
+        free(context_copy);
+        errno = ENOSYS;
+        return -1;
+    }
+    expire_jobs(time(NULL));
+    job_t *job = NULL;
+    for (size_t i = 0; i < JOB_MAX_JOBS && job == NULL; i++) {
+        if (!g_jobs[i].in_use) job = &g_jobs[i];
+    }
+    if (job == NULL) {
+        pthread_mutex_unlock(&g_job_lock);
+        free(command_copy);
+        free(context_copy);
+        errno = EAGAIN;
+        return -1;
+    }
+    memset(job, 0, sizeof(*job));
+    job->in_use = 1;
+    for (size_t i = 0; i < sizeof(random_bytes); i++) {
+        snprintf(job->id + 2 * i, 3, "%02x", random_bytes[i]);
+    }
+    job->command = command_copy;
+    job->context = context_copy;
+    job->sequence = g_next_sequence++;
+    job->state = JOB_QUEUED;
+    job->spool_fd = -1;
+    job->control_fd = -1;
+    job->runner_fd = -1;
+    snprintf(id_out, id_size, "%s", job->id);
+    pthread_cond_signal(&g_job_queued);
+    pthread_mutex_unlock(&g_job_lock);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Reports the state of a job.
+ *
+ * Parameters:
+ *   id: The job id.
+ *   status: Receives the state.
+ *
+ * Returns:
+ *   0 on success, or -1 if there is no such job.
+ */
+int job_queue_status(const char *id, job_status_t *status) {
+    pthread_mutex_lock(&g_job_lock);
+    expire_jobs(time(NULL));
+    job_t *job = find_job(id);
+    if (job != NULL) {
+        status->state = job->state;
+        status->bytes = job->output_len;
+        status->truncated = job->truncated;
+        status->spooled = (job->spool_fd != -1);
+    }
+    pthread_mutex_unlock(&g_job_lock);
+    return (job != NULL) ? 0 : -1;
+}
+
+/*
+ * Purpose:
+ *   Copies part of a job's output. The output of a running job can be read
+ *   while it grows.
+ *
+ * Parameters:
+ *   id: The job id.
+ *   offset: The first byte to copy.
+ *   buffer: The destination buffer.
+ *   length: The maximum number of bytes to copy.
+ *
+ * Returns:
+ *   The number of bytes copied (0 at the end of the output), or -1 on error
+ *   (errno ENOENT if there is no such job).
+ */
+ssize_t job_queue_read(const char *id, size_t offset, char *buffer, size_t length) {
+    ssize_t copied = -1;
+    int spool_fd = -1;
+    pthread_mutex_lock(&g_job_lock);
+    job_t *job = find_job(id);
+    if (job != NULL) {
+        size_t available = (offset < job->output_len) ? job->output_len - offset : 0;
+        if (length > available) length = available;
+        copied = 0;
+        if (job->spool_fd == -1) {
+            if (length > 0) memcpy(buffer, job->output + offset, length);
+            copied = (ssize_t)length;
+        } else if (length > 0) {
+            // A copy of the descriptor stays valid if the job is deleted meanwhile.
+            spool_fd = dup(job->spool_fd);
+            if (spool_fd == -1) {
+                perror("dup of job spool file failed");
+                copied = -1;
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_job_lock);
+    if (job == NULL) errno = ENOENT;
+    if (spool_fd == -1) return copied;
+
+    while ((size_t)copied < length) {
+        ssize_t nbytes = pread(spool_fd, buffer + copied, length - (size_t)copied, (off_t)(offset + (size_t)copied));
+        if (nbytes == -1 && errno == EINTR) continue;
+        if (nbytes <= 0) {
+            if (nbytes == -1) perror("Reading job spool file failed");
+            break;
+        }
+        copied += nbytes;
+    }
+    close(spool_fd);
+    return copied;
+}
+
+/*
+ * Purpose:
+ *   Cancels a job. A queued job will not run; a running job is sent a
+ *   "CANCEL" line and stops at its next cancellation check. The output
+ *   collected so far is kept.
+ *
+ * Parameters:
+ *   id: The job id.
+ *
+ * Returns:
+ *   0 on success (also if the job had finished already), or -1 if there is
+ *   no such job.
+ */
+int job_queue_cancel(const char *id) {
+    pthread_mutex_lock(&g_job_lock);
+    job_t *job = find_job(id);
+    if (job != NULL) {
+        if (job->state == JOB_QUEUED) {
+            job->state = JOB_CANCELLED;
+            job->finished = time(NULL);
+        } else if (job->state == JOB_RUNNING) {
+            job->cancel_requested = 1;
+            send_stop(job);
+        }
+    }
+    pthread_mutex_unlock(&g_job_lock);
+    return (job != NULL) ? 0 : -1;
+}
+
+/*
+ * Purpose:
+ *   Forgets a finished job and frees its output.
+ *
+ * Parameters:
+ *   id: The job id.
+ *
+ * Returns:
+ *   0 on success, or -1 if there is no such job (errno ENOENT) or it has
+ *   not finished (errno EBUSY).
+ */
+int job_queue_delete(const char *id) {
+    int result = 0;
+    pthread_mutex_lock(&g_job_lock);
+    job_t *job = find_job(id);
+    if (job == NULL) {
+        errno = ENOENT;
+        result = -1;
+    } else if (job->state == JOB_QUEUED || job->state == JOB_RUNNING) {
+        errno = EBUSY;
+        result = -1;
+    } else {
+        free_job(job);
+    }
+    pthread_mutex_unlock(&g_job_lock);
+    return result;
+}
+
+/*
+ * Purpose:
+ *   Returns the name of a job state.
+ *
+ * Parameters:
+ *   state: The state (JOB_*).
+ *
+ * Returns:
+ *   The name, e.g. "RUNNING".
+ */
+const char *job_state_name(int state) {
+    switch (state) {
+        case JOB_QUEUED: return "QUEUED";
+        case JOB_RUNNING: return "RUNNING";
+        case JOB_DONE: return "DONE";
+        case JOB_CANCELLED: return "CANCELLED";
+        default: return "UNKNOWN";
+    }
+}
@@ -0,0 +1,171 @@
+/*
+ * src/job_queue.h
+ *
+ * This header file declares the background job queue. A client submits an
+ * expensive command as a job and gets an id back; a fixed pool of threads runs
+ * the queued jobs, each through a socketpair as if it were a session of its
+ * own, and keeps what the command replied. The submitter (or anyone else who
+ * knows the id) can disconnect and later ask for the job's state and fetch
+ * its output from any offset, so an interrupted transfer can be resumed
+ * without running the command again. The pool size bounds the background
+ * load on the server, and the number of jobs kept is limited as well.
+ *
+ * Output is kept in memory up to JOB_SPOOL_THRESHOLD. With a spool directory
+ * configured, a job whose output grows beyond that moves it to a file there.
+ */
+#ifndef JOB_QUEUE_H
+#define JOB_QUEUE_H
+
+#include <stddef.h>     // For size_t
+#include <sys/types.h>  // For ssize_t
+
+#define JOB_DEFAULT_THREADS 2
+#define JOB_MAX_JOBS 64                         // Jobs kept at once, queued, running or finished
+#define JOB_MAX_OUTPUT (16 * 1024 * 1024)       // Output kept in memory; the job is stopped beyond it
+#define JOB_SPOOL_THRESHOLD (1024 * 1024)       // Output moves to a spool file beyond this, if possible
+#define JOB_MAX_SPOOLED_OUTPUT (1024L * 1024 * 1024) // Output kept in a spool file
+#define JOB_RESULT_TTL_SEC 3600                 // Finished jobs are forgotten after this long
+#define JOB_ID_LEN 16                           // Hex digits of a job id
+
+// States of a job.
+enum {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_DONE,
+    JOB_CANCELLED
+};
+
+typedef struct job_status_s {
+    int state;       // JOB_*
+    size_t bytes;    // Output collected so far
+    int truncated;   // The output reached its limit and the job was stopped
+    int spooled;     // The output is kept in a spool file
+} job_status_t;
+
+/*
+ * Purpose:
+ *   Runs one job's command. Called on a thread of its own; the reply is
+ *   written to output_fd, and input arriving on it (a "CANCEL" line when the
+ *   job is cancelled) is handled like a session's.
+ *
+ * Parameters:
+ *   output_fd: The runner's end of the job's socketpair.
+ *   command: The command line submitted.
+ *   context: The submitter's context as copied by job_queue_submit.
+ */
+typedef void (*job_runner_fn)(int output_fd, const char *command, const void *context);
+
+/*
+ * Purpose:
+ *   Sets the directory for spool files and removes the spool files left in
+ *   it by an earlier run. Must be called before job_queue_start.
+ *
+ * Parameters:
+ *   dir: The spool directory; it must exist and be writable.
+ *
+ * Returns:
+ *   0 on success, or -1 if the directory cannot be used.
+ */
+int job_queue_set_spool_dir(const char *dir);
+
+/*
+ * Purpose:
+ *   Starts the pool threads that run queued jobs.
+ *
+ * Parameters:
+ *   thread_count: The number of jobs that may run at once.
+ *   context_size: The size of the context copied with each job.
+ *   runner: The function that runs a job's command.
+ *
+ * Returns:
+ *   0 on success, or -1 if no thread could be started.
+ */
+int job_queue_start(unsigned int thread_count, size_t context_size, job_runner_fn runner);
+
+/*
+ * Purpose:
+ *   Queues a command as a new job.
+ *
+ * Parameters:
+ *   command: The command line.
+ *   context: The submitter's context (context_size bytes are copied).
+ *   id_out: Receives the job id.
+ *   id_size: The size of id_out (at least JOB_ID_LEN + 1).
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno EAGAIN if JOB_MAX_JOBS jobs are kept,
+ *   ENOSYS if the queue was not started).
+ */
+int job_queue_submit(const char *command, const void *context, char *id_out, size_t id_size);
+
+/*
+ * Purpose:
+ *   Reports the state of a job.
+ *
+ * Parameters:
+ *   id: The job id.
+ *   status: Receives the state.
+ *
+ * Returns:
+ *   0 on success, or -1 if there is no such job.
+ */
+int job_queue_status(const char *id, job_status_t *status);
+
+/*
+ * Purpose:
+ *   Copies part of a job's output. The output of a running job can be read
+ *   while it grows.
+ *
+ * Parameters:
+ *   id: The job id.
+ *   offset: The first byte to copy.
+ *   buffer: The destination buffer.
+ *   length: The maximum number of bytes to copy.
+ *
+ * Returns:
+ *   The number of bytes copied (0 at the end of the output), or -1 on error
+ *   (errno ENOENT if there is no such job).
+ */
+ssize_t job_queue_read(const char *id, size_t offset, char *buffer, size_t length);
+
+/*
+ * Purpose:
+ *   Cancels a job. A queued job will not run; a running job is sent a
+ *   "CANCEL" line and stops at its next cancellation check. The output
+ *   collected so far is kept.
+ *
+ * Parameters:
+ *   id: The job id.
+ *
+ * Returns:
+ *   0 on success (also if the job had finished already), or -1 if there is
+ *   no such job.
+ */
+int job_queue_cancel(const char *id);
+
+/*
+ * Purpose:
+ *   Forgets a finished job and frees its output.
+ *
+ * Parameters:
+ *   id: The job id.
+ *
+ * Returns:
+ *   0 on success, or -1 if there is no such job (errno ENOENT) or it has
+ *   not finished (errno EBUSY).
+ */
+int job_queue_delete(const char *id);
+
+/*
+ * Purpose:
+ *   Returns the name of a job state.
+ *
+ * Parameters:
+ *   state: The state (JOB_*).
+ *
+ * Returns:
+ *   The name, e.g. "RUNNING".
+ */
+const char *job_state_name(int state);
+
+#endif // JOB_QUEUE_H
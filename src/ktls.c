@@ -0,0 +1,187 @@
+/*
+ * src/ktls.c
+ *
+ * This file implements the TLS support declared in ktls.h. OpenSSL is
+ * configured with SSL_OP_ENABLE_KTLS, so once the handshake completes it
+ * installs the session keys on the socket (TCP_ULP "tls"). The SSL object
+ * is then freed without a shutdown: from here on the socket is used
+ * directly, and data sent with send() or sendfile() is encrypted by the
+ * kernel without passing through a userspace TLS buffer. A connection whose
+ * keys the kernel does not accept (no tls module, unsupported cipher) is
+ * refused rather than silently sent in the clear.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "ktls.h"
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+// Cipher suites the Linux kTLS implementation can offload.
+#define KTLS_CIPHERSUITES "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256"
+#define KTLS_CIPHER_LIST "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:" \
+                         "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384"
+
+static SSL_CTX *g_server_ctx = NULL;
+static SSL_CTX *g_client_ctx = NULL;
+
+/*
+ * Purpose:
+ *   Creates a TLS context restricted to protocol versions and ciphers the
+ *   kernel can take over.
+ *
+ * Parameters:
+ *   method: TLS_server_method() or TLS_client_method().
+ *
+ * Returns:
+ *   The new context, or NULL on error.
+ */
+static SSL_CTX *new_context(const SSL_METHOD *method) {
+    SSL_CTX *ctx = SSL_CTX_new(method);
+    if (ctx == NULL) return NULL;
+    if (SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION) != 1 ||
+        SSL_CTX_set_ciphersuites(ctx, KTLS_CIPHERSUITES) != 1 ||
+        SSL_CTX_set_cipher_list(ctx, KTLS_CIPHER_LIST) != 1) {
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    return ctx;
+}
+
+/*
+ * Purpose:
+ *   Prepares the server side: loads the certificate chain and private key.
+ *
+ * Parameters:
+ *   cert_file: The PEM certificate chain file.
+ *   key_file: The PEM private key file.
+ *
+ * Returns:
+ *   0 on success, or -1 on error (the reason is printed to stderr).
+ */
+int ktls_server_init(const char *cert_file, const char *key_file) {
+    g_server_ctx = new_context(TLS_server_method());
+    if (g_server_ctx == NULL ||
+        SSL_CTX_use_certificate_chain_file(g_server_ctx, cert_file) != 1 ||
+        SSL_CTX_use_PrivateKey_file(g_server_ctx, key_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(g_server_ctx) != 1) {
+        fprintf(stderr, "Error: Cannot set up TLS with certificate '%s' and key '%s':\n", cert_file, key_file);
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+    // Session tickets would arrive as records the kernel cannot hand to
+    // the client as data, and sessions are never resumed anyway.
+    SSL_CTX_set_num_tickets(g_server_ctx, 0);
+    SSL_CTX_set_session_cache_mode(g_server_ctx, SSL_SESS_CACHE_OFF);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Prepares the client side: loads the certificates the server's
+ *   certificate is verified against.
+ *
+ * Parameters:
+ *   ca_file: The PEM file of trusted certificates (for a self-signed server,
+ *            its own certificate).
+ *
+ * Returns:
+ *   0 on success, or -1 on error (the reason is printed to stderr).
+ */
+int ktls_client_init(const char *ca_file) {
+    g_client_ctx = new_context(TLS_client_method());
+    if (g_client_ctx == NULL || SSL_CTX_load_verify_locations(g_client_ctx, ca_file, NULL) != 1) {
+        fprintf(stderr, "Error: Cannot set up TLS with trusted certificates '%s':\n", ca_file);
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+    SSL_CTX_set_verify(g_client_ctx, SSL_VERIFY_PEER, NULL);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Runs a handshake on a socket and checks that the kernel took over both
+ *   directions of the session.
+ *
+ * Parameters:
+ *   ctx: The server or client context.
+ *   sockfd: The connected socket.
+ *   server_name: The name to verify the server against (client only), or NULL.
+ *
+ * Returns:
+ *   0 on success, or -1 on error (the reason is printed to stderr).
+ */
+static int handshake(SSL_CTX *ctx, int sockfd, const char *server_name) {
+    SSL *ssl = SSL_new(ctx);
+    if (ssl == NULL || SSL_set_fd(ssl, sockfd) != 1) {
+        ERR_print_errors_fp(stderr);
+        SSL_free(ssl);
+        return -1;
+    }
+    if (server_name != NULL) {
+        X509_VERIFY_PARAM *param = SSL_get0_param(ssl);
+        unsigned char address[sizeof(struct in6_addr)];
+        int is_address = inet_pton(AF_INET, server_name, address) == 1 || inet_pton(AF_INET6, server_name, address) == 1;
+        int ok = is_address ? X509_VERIFY_PARAM_set1_ip_asc(param, server_name)
+                            : (SSL_set_tlsext_host_name(ssl, server_name) && SSL_set1_host(ssl, server_name));
+        if (ok != 1) {
+            ERR_print_errors_fp(stderr);
+            SSL_free(ssl);
+            return -1;
+        }
+    }
+
+    int result = (server_name != NULL) ? SSL_connect(ssl) : SSL_accept(ssl);
+    if (result != 1) {
+        fprintf(stderr, "TLS handshake failed:\n");
+        ERR_print_errors_fp(stderr);
+        SSL_free(ssl);
+        return -1;
+    }
+    if (!BIO_get_ktls_send(SSL_get_wbio(ssl)) || !BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+        fprintf(stderr, "TLS handshake done with %s, but kernel TLS is not available for it "
+                "(is the 'tls' module loaded?); refusing an unencrypted connection.\n", SSL_get_cipher_name(ssl));
+        SSL_free(ssl);
+        return -1;
+    }
+    SSL_free(ssl); // Does not close the socket; the kernel keeps the keys
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Performs the server side of the handshake on an accepted connection and
+ *   moves record encryption into the kernel.
+ *
+ * Parameters:
+ *   sockfd: The connected socket.
+ *
+ * Returns:
+ *   0 on success, or -1 if the handshake failed or the kernel cannot take
+ *   over the session (the reason is printed to stderr).
+ */
+int ktls_accept(int sockfd) {
+    return handshake(g_server_ctx, sockfd, NULL);
+}
+
+/*
+ * Purpose:
+ *   Performs the client side of the handshake, verifying the server's
+ *   certificate against the given name, and moves record encryption into
+ *   the kernel.
+ *
+ * Parameters:
+ *   sockfd: The connected socket.
+ *   server_name: The host name or IP address the certificate must match.
+ *
+ * Returns:
+ *   0 on success, or -1 if the handshake failed or the kernel cannot take
+ *   over the session (the reason is printed to stderr).
+ */
+int ktls_connect(int sockfd, const char *server_name) {
+    return handshake(g_client_ctx, sockfd, server_name);
+}
@@ -0,0 +1,74 @@
+/*
+ * src/ktls.h
+ *
+ * This header file declares the optional TLS support (built with
+ * "make TLS=1"). The handshake is done with OpenSSL; afterwards the session
+ * keys are handed to the kernel (kTLS), which encrypts and decrypts records
+ * on the socket itself. The rest of the program keeps using plain send(),
+ * recv() and sendfile() on the socket descriptor.
+ */
+#ifndef KTLS_H
+#define KTLS_H
+
+#ifdef WITH_TLS
+
+/*
+ * Purpose:
+ *   Prepares the server side: loads the certificate chain and private key.
+ *
+ * Parameters:
+ *   cert_file: The PEM certificate chain file.
+ *   key_file: The PEM private key file.
+ *
+ * Returns:
+ *   0 on success, or -1 on error (the reason is printed to stderr).
+ */
+int ktls_server_init(const char *cert_file, const char *key_file);
+
+/*
+ * Purpose:
+ *   Prepares the client side: loads the certificates the server's
+ *   certificate is verified against.
+ *
+ * Parameters:
+ *   ca_file: The PEM file of trusted certificates (for a self-signed server,
+ *            its own certificate).
+ *
+ * Returns:
+ *   0 on success, or -1 on error (the reason is printed to stderr).
+ */
+int ktls_client_init(const char *ca_file);
+
+/*
+ * Purpose:
+ *   Performs the server side of the handshake on an accepted connection and
+ *   moves record encryption into the kernel.
+ *
+ * Parameters:
+ *   sockfd: The connected socket.
+ *
+ * Returns:
+ *   0 on success, or -1 if the handshake failed or the kernel cannot take
+ *   over the session (the reason is printed to stderr).
+ */
+int ktls_accept(int sockfd);
+
+/*
+ * Purpose:
+ *   Performs the client side of the handshake, verifying the server's
+ *   certificate against the given name, and moves record encryption into
+ *   the kernel.
+ *
+ * Parameters:
+ *   sockfd: The connected socket.
+ *   server_name: The host name or IP address the certificate must match.
+ *
+ * Returns:
+ *   0 on success, or -1 if the handshake failed or the kernel cannot take
+ *   over the session (the reason is printed to stderr).
+ */
+int ktls_connect(int sockfd, const char *server_name);
+
+#endif // WITH_TLS
+
+#endif // KTLS_H
@@ -0,0 +1,437 @@
+/*
+ * src/line_count.c
+ *
+ * This file implements the counting declared in line_count.h. Files are
+ * opened in rounds of at most MAX_OPEN_FILES; the chunks of a round are
+ * numbered across its files, and the threads share one counter of the next
+ * chunk to count, so faster threads take more chunks. Each chunk records
+ * whether its first and last bytes are inside a word; when the chunk counts
+ * of a file are added up, a word running across a boundary is subtracted
+ * once.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "line_count.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define LINE_COUNT_BLOCK_SIZE (256 * 1024) // Bytes read at a time
+#define MAX_OPEN_FILES 64                  // Files open at once; more are counted in later rounds
+
+typedef struct count_file_s {
+    int fd;
+    unsigned long long size;
+    size_t first_chunk;          // Number of the file's first chunk in the round
+    line_count_result_t *result;
+} count_file_t;
+
+typedef struct chunk_count_s {
+    unsigned long long lines;
+    unsigned long long words;
+    int error;
+    unsigned char starts_in_word; // The first byte is not white space
+    unsigned char ends_in_word;   // The last byte is not white space
+} chunk_count_t;
+
+typedef struct count_work_s {
+    count_file_t files[MAX_OPEN_FILES];
+    size_t file_count;
+    size_t chunk_count;
+    chunk_count_t *chunks;       // chunk_count counts, in file order
+    int count_words;
+    atomic_size_t next_chunk;
+    atomic_int stop;             // Set on a cancellation
+} count_work_t;
+
+/*
+ * Purpose:
+ *   Tells whether a byte is white space in the C locale.
+ *
+ * Parameters:
+ *   c: The byte.
+ *
+ * Returns:
+ *   Nonzero for space, \t, \n, \v, \f and \r.
+ */
+static int is_space(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+#if defined(__SSE2__)
+/*
+ * Purpose:
+ *   Counts the bits set in a 16-bit mask.
+ *
+ * Parameters:
+ *   mask: The mask.
+ *
+ * Returns:
+ *   The number of bits set.
+ */
+static unsigned int popcount16(unsigned int mask) {
+    mask = mask - ((mask >> 1) & 0x5555);
+    mask = (mask & 0x3333) + ((mask >> 2) & 0x3333);
+    mask = (mask + (mask >> 4)) & 0x0F0F;
+    return (mask + (mask >> 8)) & 0x1F;
+}
+#endif
+
+/*
+ * Purpose:
+ *   Counts the newlines in a block of bytes. With SSE2, 16 bytes are
+ *   compared at a time and the matches added up in per-byte counters, which
+ *   are summed every 255 rounds, before they can overflow.
+ *
+ * Parameters:
+ *   bytes: The block.
+ *   length: Its length.
+ *
+ * Returns:
+ *   The number of newlines.
+ */
+static unsigned long long count_newlines(const unsigned char *bytes, size_t length) {
+    unsigned long long count = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+    while (length - i >= 16) {
+        size_t rounds = (length - i) / 16;
+        if (rounds > 255) rounds = 255;
+        __m128i counters = zero;
+        for (size_t r = 0; r < rounds; r++, i += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i *)(const void *)(bytes + i));
+            counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(block, newline)); // A match is -1
+        }
+        __m128i sums = _mm_sad_epu8(counters, zero); // Two 64-bit sums of 8 counters each
+        count += (unsigned long long)_mm_cvtsi128_si32(sums) + (unsigned long long)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+    }
+#endif
+    for (; i < length; i++) count += (bytes[i] == '\n');
+    return count;
+}
+
+/*
+ * Purpose:
+ *   Counts the newlines and word starts in a block of bytes. A word starts
+ *   at a byte that is not white space and follows one that is. With SSE2,
+ *   16 bytes are classified at a time into a bit mask.
+ *
+ * Parameters:
+ *   bytes: The block.
+ *   length: Its length.
+ *   in_word: Nonzero if the byte before the block is part of a word;
+ *            updated for the block's last byte.
+ *   lines: Incremented by the number of newlines.
+ *   words: Incremented by the number of word starts.
+ *
+ * Returns:
+ *   void
+ */
+static void count_lines_words(const unsigned char *bytes, size_t length, int *in_word,
+                              unsigned long long *lines, unsigned long long *words) {
+    unsigned long long line_count = 0, word_count = 0;
+    int inside = *in_word;
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i blank = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i four = _mm_set1_epi8(4);
+    unsigned int previous_space = !inside;
+    for (; length - i >= 16; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(const void *)(bytes + i));
+        __m128i offset = _mm_sub_epi8(block, tab); // \t to \r become 0 to 4
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(block, blank), _mm_cmpeq_epi8(_mm_min_epu8(offset, four), offset));
+        unsigned int space_mask = (unsigned int)_mm_movemask_epi8(space);
+        unsigned int starts = ~space_mask & ((space_mask << 1) | previous_space) & 0xFFFF;
+        word_count += popcount16(starts);
+        line_count += popcount16((unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+        previous_space = space_mask >> 15;
+    }
+    inside = !previous_space;
+#endif
+    for (; i < length; i++) {
+        int space = is_space(bytes[i]);
+        line_count += (bytes[i] == '\n');
+        word_count += (!space && !inside);
+        inside = !space;
+    }
+    *in_word = inside;
+    *lines += line_count;
+    *words += word_count;
+}
+
+/*
+ * Purpose:
+ *   Finds the file a chunk belongs to.
+ *
+ * Parameters:
+ *   work: The round.
+ *   index: The chunk number.
+ *
+ * Returns:
+ *   The file.
+ */
+static count_file_t *chunk_file(count_work_t *work, size_t index) {
+    size_t low = 0, high = work->file_count;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (work->files[middle].first_chunk <= index) low = middle;
+        else high = middle;
+    }
+    return &work->files[low];
+}
+
+/*
+ * Purpose:
+ *   Reads and counts one chunk.
+ *
+ * Parameters:
+ *   work: The round.
+ *   index: The chunk number.
+ *   buffer: A buffer of LINE_COUNT_BLOCK_SIZE bytes.
+ *
+ * Returns:
+ *   void (a read error is stored in the chunk's count; EIO if the file got
+ *   shorter)
+ */
+static void count_chunk(count_work_t *work, size_t index, unsigned char *buffer) {
+    count_file_t *file = chunk_file(work, index);
+    chunk_count_t *chunk = &work->chunks[index];
+    unsigned long long start = (unsigned long long)(index - file->first_chunk) * LINE_COUNT_CHUNK_SIZE;
+    unsigned long long offset = start, end = start + LINE_COUNT_CHUNK_SIZE;
+    if (end > file->size) end = file->size;
+    int in_word = 0;
+
+    while (offset < end) {
+        size_t length = (end - offset > LINE_COUNT_BLOCK_SIZE) ? LINE_COUNT_BLOCK_SIZE : (size_t)(end - offset);
+        size_t done = 0;
+        while (done < length) {
+            ssize_t nbytes = pread(file->fd, buffer + done, length - done, (off_t)(offset + done));
+            if (nbytes == -1 && errno == EINTR) continue;
+            if (nbytes <= 0) {
+                chunk->error = (nbytes == 0) ? EIO : errno;
+                return;
+            }
+            done += (size_t)nbytes;
+        }
+        if (!work->count_words) {
+            chunk->lines += count_newlines(buffer, length);
+        } else {
+            if (offset == start) chunk->starts_in_word = !is_space(buffer[0]);
+            count_lines_words(buffer, length, &in_word, &chunk->lines, &chunk->words);
+        }
+        offset += length;
+    }
+    chunk->ends_in_word = (unsigned char)in_word;
+}
+
+/*
+ * Purpose:
+ *   Counts chunks until none are left or the round is stopped.
+ *
+ * Parameters:
+ *   work: The round.
+ *   buffer: A buffer of LINE_COUNT_BLOCK_SIZE bytes.
+ *   cancel: The cancellation check (only for the calling thread), or NULL.
+ *   cancel_ctx: Its context.
+ *
+ * Returns:
+ *   void
+ */
+static void count_chunks(count_work_t *work, unsigned char *buffer, line_count_cancel_fn cancel, void *cancel_ctx) {
+    while (!atomic_load(&work->stop)) {
+        if (cancel != NULL && cancel(cancel_ctx)) {
+            atomic_store(&work->stop, 1);
+            break;
+        }
+        size_t index = atomic_fetch_add(&work->next_chunk, 1);
+        if (index >= work->chunk_count) break;
+        count_chunk(work, index, buffer);
+    }
+}
+
+/*
+ * Purpose:
+ *   Thread function of a helper thread.
+ *
+ * Parameters:
+ *   arg: The round.
+ *
+ * Returns:
+ *   NULL
+ */
+static void *line_count_thread(void *arg) {
+    count_work_t *work = arg;
+    unsigned char *buffer = malloc(LINE_COUNT_BLOCK_SIZE);
+    if (buffer != NULL) {
+        count_chunks(work, buffer, NULL, NULL);
+        free(buffer);
+    }
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Opens a file to be counted and adds it to a round. Empty files and
+ *   files that cannot be counted get their result at once instead.
+ *
+ * Parameters:
+ *   work: The round.
+ *   path: The file's path, or NULL.
+ *   result: The file's result.
+ *
+ * Returns:
+ *   void
+ */
+static void add_file(count_work_t *work, const char *path, line_count_result_t *result) {
+    if (path == NULL) {
+        result->error = ENOENT;
+        return;
+    }
+    // O_NONBLOCK keeps a FIFO from blocking the open; it is rejected below.
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        result->error = (errno == ELOOP) ? EINVAL : errno;
+        if (fd != -1) close(fd);
+        return;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        result->error = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+        close(fd);
+        return;
+    }
+    result->bytes = (unsigned long long)st.st_size;
+    if (st.st_size == 0) {
+        close(fd);
+        return;
+    }
+    count_file_t *file = &work->files[work->file_count++];
+    file->fd = fd;
+    file->size = (unsigned long long)st.st_size;
+    file->first_chunk = work->chunk_count;
+    file->result = result;
+    work->chunk_count += (size_t)((file->size + LINE_COUNT_CHUNK_SIZE - 1) / LINE_COUNT_CHUNK_SIZE);
+}
+
+/*
+ * Purpose:
+ *   Adds up the chunk counts of each file of a finished round.
+ *
+ * Parameters:
+ *   work: The round.
+ *
+ * Returns:
+ *   void
+ */
+static void collect_results(count_work_t *work) {
+    for (size_t f = 0; f < work->file_count; f++) {
+        count_file_t *file = &work->files[f];
+        size_t end = (f + 1 < work->file_count) ? work->files[f + 1].first_chunk : work->chunk_count;
+        line_count_result_t *result = file->result;
+        for (size_t c = file->first_chunk; c < end; c++) {
+            const chunk_count_t *chunk = &work->chunks[c];
+            if (chunk->error != 0 && result->error == 0) result->error = chunk->error;
+            result->lines += chunk->lines;
+            result->words += chunk->words;
+            if (c > file->first_chunk && chunk->starts_in_word && work->chunks[c - 1].ends_in_word) result->words--;
+        }
+        if (result->error != 0) {
+            result->lines = 0;
+            result->words = 0;
+            result->bytes = 0;
+        }
+    }
+}
+
+/*
+ * Purpose:
+ *   Counts the lines, bytes and optionally words of regular files. Symbolic
+ *   links are not followed. The calling thread counts too, helped by up to
+ *   thread_count - 1 more threads. A file that cannot be counted gets an
+ *   error in its result (EISDIR for a directory, EINVAL for anything else
+ *   that is not a regular file) and does not affect the others.
+ *
+ * Parameters:
+ *   paths: The absolute paths of the files; a NULL path is reported as
+ *          ENOENT.
+ *   count: The number of paths.
+ *   count_words: Nonzero to count words as well.
+ *   thread_count: The number of threads, or 0 for one per online CPU (at
+ *                 most LINE_COUNT_MAX_THREADS).
+ *   cancel: An optional cancellation check; may be NULL.
+ *   cancel_ctx: The context passed to cancel.
+ *   results: Receives one result per path, in order.
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno ECANCELED if cancel asked to stop,
+ *   or ENOMEM).
+ */
+int line_count_files(const char *const *paths, size_t count, int count_words, unsigned int thread_count,
+                     line_count_cancel_fn cancel, void *cancel_ctx, line_count_result_t *results) {
+    memset(results, 0, count * sizeof(line_count_result_t));
+    if (thread_count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = (cpus > 0) ? (unsigned int)cpus : 1;
+    }
+    if (thread_count > LINE_COUNT_MAX_THREADS) thread_count = LINE_COUNT_MAX_THREADS;
+    unsigned char *buffer = malloc(LINE_COUNT_BLOCK_SIZE);
+    count_work_t *work = malloc(sizeof(count_work_t));
+    if (buffer == NULL || work == NULL) {
+        free(buffer);
+        free(work);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int error = 0;
+    size_t next = 0;
+    while (next < count && error == 0) {
+        work->file_count = 0;
+        work->chunk_count = 0;
+        work->count_words = count_words;
+        while (next < count && work->file_count < MAX_OPEN_FILES) {
+            add_file(work, paths[next], &results[next]);
+            next++;
+        }
+        work->chunks = calloc(work->chunk_count > 0 ? work->chunk_count : 1, sizeof(chunk_count_t));
+        if (work->chunks == NULL) {
+            error = ENOMEM;
+        } else {
+            atomic_init(&work->next_chunk, 0);
+            atomic_init(&work->stop, 0);
+            unsigned int round_threads = thread_count;
+            if (round_threads > work->chunk_count) round_threads = (work->chunk_count > 0) ? (unsigned int)work->chunk_count : 1;
+
+            pthread_t helpers[LINE_COUNT_MAX_THREADS];
+            unsigned int helper_count = 0;
+            for (unsigned int i = 1; i < round_threads; i++) {
+                if (pthread_create(&helpers[helper_count], NULL, line_count_thread, work) != 0) break;
+                helper_count++;
+            }
+            count_chunks(work, buffer, cancel, cancel_ctx);
+            for (unsigned int i = 0; i < helper_count; i++) pthread_join(helpers[i], NULL);
+            if (atomic_load(&work->stop)) error = ECANCELED;
+            else collect_results(work);
+            free(work->chunks);
+        }
+        for (size_t f = 0; f < work->file_count; f++) close(work->files[f].fd);
+    }
+    free(buffer);
+    free(work);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * src/line_editor.c
+ *
+ * This file implements the line editor declared in line_editor.h. Editing is
+ * deliberately simple: characters are appended at the end of the line,
+ * Backspace and Ctrl-U erase, and escape sequences (arrow keys) are ignored.
+ * Signals stay enabled, so Ctrl-C still interrupts the read.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "line_editor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <termios.h>
+
+#define KEY_CTRL_D 4
+#define KEY_TAB '\t'
+#define KEY_CTRL_U 21
+#define KEY_ESCAPE 27
+#define KEY_BACKSPACE 127
+#define KEY_CTRL_H 8
+
+// Function Prototypes
+static void complete_word(char *buffer, size_t size, size_t *len, const char *prompt, line_complete_fn complete, void *ctx);
+static void redraw_line(const char *prompt, const char *buffer);
+
+/*
+ * Purpose:
+ *   Prints a prompt and reads one line of input. In a terminal, Tab completes
+ *   the last word of the line (not the command itself) through the callback.
+ *
+ * Parameters:
+ *   prompt: The prompt to print.
+ *   buffer: The buffer that receives the line, without the newline.
+ *   size: The size of the buffer.
+ *   complete: The completion callback (may be NULL).
+ *   ctx: A pointer passed to the callback.
+ *
+ * Returns:
+ *   1 if a line was read, 0 on end of input, or -1 on error (errno is set;
+ *   EINTR if a signal interrupted the read).
+ */
+int line_editor_read(const char *prompt, char *buffer, size_t size, line_complete_fn complete, void *ctx) {
+    fputs(prompt, stdout);
+    fflush(stdout);
+
+    struct termios saved;
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved) == -1) {
+        if (fgets(buffer, (int)size, stdin) == NULL) {
+            return feof(stdin) ? 0 : -1;
+        }
+        buffer[strcspn(buffer, "\r\n")] = '\0';
+        return 1;
+    }
+
+    struct termios raw = saved;
+    raw.c_lflag &= ~(tcflag_t)(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) == -1) return -1;
+
+    size_t len = 0;
+    buffer[0] = '\0';
+    int status = 1;
+    for (;;) {
+        unsigned char c;
+        ssize_t got = read(STDIN_FILENO, &c, 1);
+        if (got == -1) {
+            status = -1;
+            break;
+        }
+        if (got == 0 || (c == KEY_CTRL_D && len == 0)) {
+            status = 0;
+            break;
+        }
+        if (c == '\n' || c == '\r') {
+            fputc('\n', stdout);
+            break;
+        } else if (c == KEY_TAB) {
+            if (complete != NULL) complete_word(buffer, size, &len, prompt, complete, ctx);
+        } else if (c == KEY_BACKSPACE || c == KEY_CTRL_H) {
+            if (len > 0) {
+                buffer[--len] = '\0';
+                fputs("\b \b", stdout);
+            }
+        } else if (c == KEY_CTRL_U) {
+            while (len > 0) {
+                buffer[--len] = '\0';
+                fputs("\b \b", stdout);
+            }
+        } else if (c == KEY_ESCAPE) {
+            unsigned char sequence[2];
+            if (read(STDIN_FILENO, sequence, sizeof(sequence)) == -1) { // Drop "[A" and similar
+                status = -1;
+                break;
+            }
+        } else if (c >= ' ' && len + 1 < size) {
+            buffer[len++] = (char)c;
+            buffer[len] = '\0';
+            fputc(c, stdout);
+        }
+        fflush(stdout);
+    }
+
+    int saved_errno = errno;
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+    fflush(stdout);
+    errno = saved_errno;
+    return status;
+}
+
+/*
+ * Purpose:
+ *   Reprints the prompt and the current line after a list of completions.
+ *
+ * Parameters:
+ *   prompt: The prompt.
+ *   buffer: The current line.
+ *
+ * Returns:
+ *   void
+ */
+static void redraw_line(const char *prompt, const char *buffer) {
+    fputs(prompt, stdout);
+    fputs(buffer, stdout);
+}
+
+/*
+ * Purpose:
+ *   Completes the last word of the line. A single match is inserted in full
+ *   (followed by a space unless it is a directory). With several matches the
+ *   longest common prefix is inserted; if that adds nothing, the matches are
+ *   listed below the line.
+ *
+ * Parameters:
+ *   buffer: The current line (updated).
+ *   size: The size of the buffer.
+ *   len: The length of the line (updated).
+ *   prompt: The prompt, for redrawing.
+ *   complete: The completion callback.
+ *   ctx: A pointer passed to the callback.
+ *
+ * Returns:
+ *   void
+ */
+static void complete_word(char *buffer, size_t size, size_t *len, const char *prompt, line_complete_fn complete, void *ctx) {
+    char *word = strrchr(buffer, ' ');
+    if (word == NULL) return; // The command itself is not completed
+    word++;
+
+    const char *const *matches;
+    size_t count;
+    if (complete(ctx, word, &matches, &count) == -1 || count == 0) {
+        fputc('\a', stdout);
+        return;
+    }
+
+    const char *name_prefix = strrchr(word, '/');
+    name_prefix = name_prefix ? name_prefix + 1 : word;
+    size_t typed = strlen(name_prefix);
+
+    size_t common = strlen(matches[0]);
+    for (size_t i = 1; i < count; i++) {
+        size_t j = 0;
+        while (j < common && matches[i][j] == matches[0][j]) j++;
+        common = j;
+    }
+
+    if (common > typed) {
+        for (size_t i = typed; i < common && *len + 1 < size; i++) {
+            buffer[(*len)++] = matches[0][i];
+            fputc(matches[0][i], stdout);
+        }
+        if (count == 1 && matches[0][common - 1] != '/' && *len + 1 < size) {
+            buffer[(*len)++] = ' ';
+            fputc(' ', stdout);
+        }
+        buffer[*len] = '\0';
+    } else if (count > 1) {
+        fputc('\n', stdout);
+        for (size_t i = 0; i < count; i++) {
+            fputs(matches[i], stdout);
+            fputs((i + 1 == count) ? "\n" : "  ", stdout);
+        }
+        redraw_line(prompt, buffer);
+    }
+}
@@ -0,0 +1,48 @@
+/*
+ * src/line_editor.h
+ *
+ * This header file declares the client's minimal line editor. When standard
+ * input is a terminal, it reads a command in raw mode so that the Tab key can
+ * complete the word before the cursor; otherwise it simply reads a line.
+ */
+#ifndef LINE_EDITOR_H
+#define LINE_EDITOR_H
+
+#include <stddef.h> // For size_t
+
+/*
+ * Purpose:
+ *   Looks up the completions of a word.
+ *
+ * Parameters:
+ *   ctx: The context pointer given to line_editor_read.
+ *   word: The word to complete (a path, possibly with directory components).
+ *   matches_out: Receives the matching names in the word's last directory
+ *                (directories end with '/'); the array stays valid until the
+ *                next call.
+ *   count_out: Receives the number of matches.
+ *
+ * Returns:
+ *   0 on success, or -1 if no completions are available.
+ */
+typedef int (*line_complete_fn)(void *ctx, const char *word, const char *const **matches_out, size_t *count_out);
+
+/*
+ * Purpose:
+ *   Prints a prompt and reads one line of input. In a terminal, Tab completes
+ *   the last word of the line (not the command itself) through the callback.
+ *
+ * Parameters:
+ *   prompt: The prompt to print.
+ *   buffer: The buffer that receives the line, without the newline.
+ *   size: The size of the buffer.
+ *   complete: The completion callback (may be NULL).
+ *   ctx: A pointer passed to the callback.
+ *
+ * Returns:
+ *   1 if a line was read, 0 on end of input, or -1 on error (errno is set;
+ *   EINTR if a signal interrupted the read).
+ */
+int line_editor_read(const char *prompt, char *buffer, size_t size, line_complete_fn complete, void *ctx);
+
+#endif // LINE_EDITOR_H
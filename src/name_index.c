@@ -0,0 +1,990 @@
+/*
+ * src/name_index.c
+ *
+ * This file implements the filename index declared in name_index.h.
+ *
+ * Nodes are stored in one array and never move; their names live in a single
+ * arena in node order, so a substring search can run memmem over the whole
+ * arena and map each hit back to its node by binary search. For prefix
+ * queries, node ids are kept in a name-sorted array; nodes added later go to
+ * a small unsorted "recent" list that is merged into the sorted array once it
+ * grows. Deleted nodes are only flagged; paths through a deleted directory
+ * are skipped when results are built.
+ */
+#define _GNU_SOURCE // For memmem and d_type
+#include "name_index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "protocol.h"
+
+#define NODE_NONE UINT32_MAX
+#define RECENT_MERGE_THRESHOLD 4096
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR)
+#define MAX_INDEXED_ROOTS 64
+
+typedef struct name_node_s {
+    uint32_t parent;    // NODE_NONE for roots
+    uint32_t name_off;  // Offset of the NUL-terminated name in the arena
+    uint32_t hash_next; // Next node in the same (parent, name) hash bucket
+    uint8_t is_dir;
+    uint8_t deleted;
+    uint8_t seen;       // Found by the latest crawl of its parent
+    uint8_t listed;     // Read completely by the latest crawl (directories)
+} name_node_t;
+
+typedef struct pending_entry_s {
+    size_t name_off; // Offset into the local name buffer
+    int is_dir;
+} pending_entry_t;
+
+// The index itself, protected by g_index_lock.
+static pthread_rwlock_t g_index_lock = PTHREAD_RWLOCK_INITIALIZER;
+static name_node_t *g_nodes = NULL;
+static uint32_t g_node_count = 0;
+static uint32_t g_node_capacity = 0;
+static char *g_arena = NULL;
+static size_t g_arena_used = 0;
+static size_t g_arena_capacity = 0;
+static uint32_t *g_buckets = NULL;
+static size_t g_bucket_count = 0;
+static uint32_t *g_sorted = NULL;
+static size_t g_sorted_count = 0;
+static uint32_t *g_recent = NULL;
+static size_t g_recent_count = 0;
+static size_t g_recent_capacity = 0;
+static uint32_t *g_wd_nodes = NULL; // Node watched by each inotify descriptor
+static size_t g_wd_capacity = 0;
+static uint32_t g_root_nodes[MAX_INDEXED_ROOTS];
+static const char *g_root_paths[MAX_INDEXED_ROOTS];
+static size_t g_root_count = 0;
+static int g_inotify_fd = -1;
+static int g_watch_limit_reported = 0;
+static int g_recrawl_pending = 0;   // Events were lost; only used by the index thread
+static volatile int g_ready = 0;
+
+// Work queue of directories for the initial parallel build.
+static pthread_mutex_t g_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_queue_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t *g_queue = NULL;
+static size_t g_queue_count = 0;
+static size_t g_queue_capacity = 0;
+static unsigned int g_busy_workers = 0;
+static unsigned int g_build_threads = NAME_INDEX_DEFAULT_THREADS;
+
+/*
+ * Purpose:
+ *   Checks whether a path is a directory or lies below it.
+ *
+ * Parameters:
+ *   path: The absolute path to check.
+ *   dir_path: The absolute directory path.
+ *
+ * Returns:
+ *   1 if path is dir_path or below it, 0 otherwise.
+ */
+static int path_below(const char *path, const char *dir_path) {
+    size_t len = strlen(dir_path);
+    if (strncmp(path, dir_path, len) != 0) return 0;
+    if (len == 1) return 1; // dir_path is "/"
+    return path[len] == '\0' || path[len] == '/';
+}
+
+/*
+ * Purpose:
+ *   Hashes a (parent, name) pair for the child lookup table.
+ *
+ * Parameters:
+ *   parent: The parent node id.
+ *   name: The child's name.
+ *
+ * Returns:
+ *   The hash value.
+ */
+static size_t hash_child(uint32_t parent, const char *name) {
+    uint64_t hash = 1469598103934665603ULL ^ ((uint64_t)parent * 0x9E3779B97F4A7C15ULL);
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return (size_t)hash;
+}
+
+/*
+ * Purpose:
+ *   Returns the name of a node. Must be called with the index lock held.
+ *
+ * Parameters:
+ *   id: The node id.
+ *
+ * Returns:
+ *   A pointer to the node's name in the arena.
+ */
+static const char *node_name(uint32_t id) {
+    return g_arena + g_nodes[id].name_off;
+}
+
+/*
+ * Purpose:
+ *   Finds the live child of a directory with the given name. Must be called
+ *   with the index lock held.
+ *
+ * Parameters:
+ *   parent: The directory's node id.
+ *   name: The child's name.
+ *
+ * Returns:
+ *   The child's node id, or NODE_NONE.
+ */
+static uint32_t find_child_locked(uint32_t parent, const char *name) {
+    uint32_t id = g_buckets[hash_child(parent, name) & (g_bucket_count - 1)];
+    while (id != NODE_NONE) {
+        if (g_nodes[id].parent == parent && !g_nodes[id].deleted && strcmp(node_name(id), name) == 0) return id;
+        id = g_nodes[id].hash_next;
+    }
+    return NODE_NONE;
+}
+
+/*
+ * Purpose:
+ *   Doubles the child lookup table and rehashes all nodes. Must be called
+ *   with the write lock held.
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   0 on success, or -1 on allocation failure.
+ */
+static int grow_buckets_locked(void) {
+    size_t new_count = g_bucket_count ? g_bucket_count * 2 : 1024;
+    uint32_t *buckets = malloc(new_count * sizeof(uint32_t));
+    if (buckets == NULL) return -1;
+    memset(buckets, 0xff, new_count * sizeof(uint32_t));
+    for (uint32_t id = 0; id < g_node_count; id++) {
+        size_t bucket = hash_child(g_nodes[id].parent, node_name(id)) & (new_count - 1);
+        g_nodes[id].hash_next = buckets[bucket];
+        buckets[bucket] = id;
+    }
+    free(g_buckets);
+    g_buckets = buckets;
+    g_bucket_count = new_count;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Adds a node for a name below a directory, unless a live node with that
+ *   name already exists. Must be called with the write lock held.
+ *
+ * Parameters:
+ *   parent: The parent directory's node id, or NODE_NONE for a root.
+ *   name: The entry's name (for roots, the absolute path).
+ *   is_dir: Non-zero if the entry is a directory.
+ *
+ * Returns:
+ *   The node id, or NODE_NONE on allocation failure.
+ */
+static uint32_t add_node_locked(uint32_t parent, const char *name, int is_dir) {
+    if (parent != NODE_NONE) {
+        uint32_t existing = find_child_locked(parent, name);
+        if (existing != NODE_NONE) return existing;
+    }
+
+    if (g_node_count == g_node_capacity) {
+        uint32_t new_capacity = g_node_capacity ? g_node_capacity * 2 : 4096;
+        name_node_t *grown = realloc(g_nodes, (size_t)new_capacity * sizeof(name_node_t));
+        if (grown == NULL) return NODE_NONE;
+        g_nodes = grown;
+        g_node_capacity = new_capacity;
+    }
+    size_t len = strlen(name) + 1;
+    if (g_arena_used + len > g_arena_capacity) {
+        size_t new_capacity = g_arena_capacity ? g_arena_capacity * 2 : 65536;
+        while (new_capacity < g_arena_used + len) new_capacity *= 2;
+        char *grown = realloc(g_arena, new_capacity);
+        if (grown == NULL) return NODE_NONE;
+        g_arena = grown;
+        g_arena_capacity = new_capacity;
+    }
+    if (parent != NODE_NONE && g_recent_count == g_recent_capacity) {
+        size_t new_capacity = g_recent_capacity ? g_recent_capacity * 2 : 4096;
+        uint32_t *grown = realloc(g_recent, new_capacity * sizeof(uint32_t));
+        if (grown == NULL) return NODE_NONE;
+        g_recent = grown;
+        g_recent_capacity = new_capacity;
+    }
+    if (g_node_count >= g_bucket_count && grow_buckets_locked() == -1) return NODE_NONE;
+
+    uint32_t id = g_node_count++;
+    name_node_t *node = &g_nodes[id];
+    node->parent = parent;
+    node->name_off = (uint32_t)g_arena_used;
+    node->is_dir = is_dir ? 1 : 0;
+    node->deleted = 0;
+    node->seen = 0;
+    node->listed = 0;
+    memcpy(g_arena + g_arena_used, name, len);
+    g_arena_used += len;
+
+    size_t bucket = hash_child(parent, name) & (g_bucket_count - 1);
+    node->hash_next = g_buckets[bucket];
+    g_buckets[bucket] = id;
+
+    if (parent != NODE_NONE) g_recent[g_recent_count++] = id; // Roots are never search results
+    return id;
+}
+
+/*
+ * Purpose:
+ *   Builds the path of a node, either absolute or relative to one of its
+ *   ancestors. The names are copied from the node upwards, ending at the end
+ *   of the buffer, and the result is moved to its start; so the depth of the
+ *   path is only limited by the buffer. Must be called with the index lock
+ *   held.
+ *
+ * Parameters:
+ *   id: The node id.
+ *   scope: The ancestor the path is relative to (the result then starts
+ *          with '/'), or NODE_NONE for an absolute path.
+ *   buffer: The destination buffer.
+ *   buf_len: The size of the buffer.
+ *
+ * Returns:
+ *   0 on success, or -1 with errno ENAMETOOLONG if the path does not fit,
+ *   or ENOENT if it passes through a deleted node or the node does not lie
+ *   below scope.
+ */
+static int build_path_locked(uint32_t id, uint32_t scope, char *buffer, size_t buf_len) {
+    if (buf_len < 2) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    size_t start = buf_len - 1;
+    buffer[start] = '\0';
+    uint32_t cur = id;
+    while (cur != scope) {
+        if (cur == NODE_NONE || g_nodes[cur].deleted) {
+            errno = ENOENT;
+            return -1;
+        }
+        const char *name = node_name(cur);
+        int is_root = (g_nodes[cur].parent == NODE_NONE && scope == NODE_NONE);
+        // A root is named by its absolute path.
+        size_t len = (is_root && strcmp(name, "/") == 0) ? 0 : strlen(name);
+        if (len + (is_root ? 0 : 1) > start) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        start -= len;
+        memcpy(buffer + start, name, len);
+        if (is_root) break;
+        buffer[--start] = '/';
+        cur = g_nodes[cur].parent;
+    }
+    if (buffer[start] == '\0') buffer[--start] = '/'; // The scope itself, or the root "/"
+    memmove(buffer, buffer + start, buf_len - start);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Records which node an inotify watch descriptor belongs to. Must be called
+ *   with the write lock held.
+ *
+ * Parameters:
+ *   wd: The watch descriptor.
+ *   id: The directory's node id.
+ *
+ * Returns:
+ *   void
+ */
+static void set_watch_node_locked(int wd, uint32_t id) {
+    if (wd < 0) return;
+    if ((size_t)wd >= g_wd_capacity) {
+        size_t new_capacity = g_wd_capacity ? g_wd_capacity : 1024;
+        while (new_capacity <= (size_t)wd) new_capacity *= 2;
+        uint32_t *grown = realloc(g_wd_nodes, new_capacity * sizeof(uint32_t));
+        if (grown == NULL) return;
+        memset(grown + g_wd_capacity, 0xff, (new_capacity - g_wd_capacity) * sizeof(uint32_t));
+        g_wd_nodes = grown;
+        g_wd_capacity = new_capacity;
+    }
+    g_wd_nodes[wd] = id;
+}
+
+/*
+ * Purpose:
+ *   Adds the entries of one directory to the index. The directory is put
+ *   under watch before it is read, so entries created meanwhile are reported
+ *   by inotify rather than lost. The entries found are marked seen, and the
+ *   directory listed if it was read completely, for recrawl_roots.
+ *
+ * Parameters:
+ *   dir_id: The directory's node id.
+ *   subdirs_out: Receives a malloc'ed array of the node ids of its subdirectories.
+ *   subdir_count_out: Receives the number of subdirectories.
+ *
+ * Returns:
+ *   void
+ */
+static void index_directory(uint32_t dir_id, uint32_t **subdirs_out, size_t *subdir_count_out) {
+    *subdirs_out = NULL;
+    *subdir_count_out = 0;
+
+    char path[MAX_PATH_LEN];
+    pthread_rwlock_rdlock(&g_index_lock);
+    int path_status = build_path_locked(dir_id, NODE_NONE, path, sizeof(path));
+    pthread_rwlock_unlock(&g_index_lock);
+    if (path_status == -1) return;
+
+    int wd = inotify_add_watch(g_inotify_fd, path, WATCH_MASK);
+    if (wd == -1 && errno == ENOSPC && !g_watch_limit_reported) {
+        g_watch_limit_reported = 1;
+        fprintf(stderr, "Name index: inotify watch limit reached; some directories will not be kept up to date.\n");
+    }
+
+    DIR *dirp = opendir(path);
+    if (dirp == NULL) return;
+
+    pending_entry_t *entries = NULL;
+    size_t entry_count = 0, entry_capacity = 0;
+    char *names = NULL;
+    size_t names_used = 0, names_capacity = 0;
+    int complete = 1;
+    struct dirent *entry;
+    while ((entry = readdir(dirp)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        int is_dir;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(dirfd(dirp), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+                complete = 0;
+                continue;
+            }
+            is_dir = S_ISDIR(st.st_mode);
+        } else {
+            is_dir = (entry->d_type == DT_DIR);
+        }
+
+        size_t len = strlen(entry->d_name) + 1;
+        if (entry_count == entry_capacity || names_used + len > names_capacity) {
+            size_t new_entries = entry_capacity ? entry_capacity * 2 : 256;
+            size_t new_names = names_capacity ? names_capacity * 2 : 8192;
+            while (new_names < names_used + len) new_names *= 2;
+            pending_entry_t *grown_entries = realloc(entries, new_entries * sizeof(pending_entry_t));
+            if (grown_entries != NULL) entries = grown_entries;
+            char *grown_names = realloc(names, new_names);
+            if (grown_names != NULL) names = grown_names;
+            if (grown_entries == NULL || grown_names == NULL) {
+                complete = 0;
+                break;
+            }
+            entry_capacity = new_entries;
+            names_capacity = new_names;
+        }
+        entries[entry_count].name_off = names_used;
+        entries[entry_count].is_dir = is_dir;
+        entry_count++;
+        memcpy(names + names_used, entry->d_name, len);
+        names_used += len;
+    }
+    closedir(dirp);
+
+    uint32_t *subdirs = NULL;
+    size_t subdir_count = 0;
+    pthread_rwlock_wrlock(&g_index_lock);
+    set_watch_node_locked(wd, dir_id);
+    for (size_t i = 0; i < entry_count; i++) {
+        uint32_t id = add_node_locked(dir_id, names + entries[i].name_off, entries[i].is_dir);
+        if (id == NODE_NONE) {
+            complete = 0;
+            continue;
+        }
+        g_nodes[id].seen = 1;
+        if (!entries[i].is_dir) continue;
+        uint32_t *grown = realloc(subdirs, (subdir_count + 1) * sizeof(uint32_t));
+        if (grown == NULL) continue;
+        subdirs = grown;
+        subdirs[subdir_count++] = id;
+    }
+    g_nodes[dir_id].listed = complete;
+    pthread_rwlock_unlock(&g_index_lock);
+
+    free(entries);
+    free(names);
+    *subdirs_out = subdirs;
+    *subdir_count_out = subdir_count;
+}
+
+/*
+ * Purpose:
+ *   Adds directories to the shared build queue. Must be called with the
+ *   queue lock held.
+ *
+ * Parameters:
+ *   ids: The directory node ids.
+ *   count: The number of ids.
+ *
+ * Returns:
+ *   void
+ */
+static void queue_push_locked(const uint32_t *ids, size_t count) {
+    if (g_queue_count + count > g_queue_capacity) {
+        size_t new_capacity = g_queue_capacity ? g_queue_capacity * 2 : 1024;
+        while (new_capacity < g_queue_count + count) new_capacity *= 2;
+        uint32_t *grown = realloc(g_queue, new_capacity * sizeof(uint32_t));
+        if (grown == NULL) return;
+        g_queue = grown;
+        g_queue_capacity = new_capacity;
+    }
+    memcpy(g_queue + g_queue_count, ids, count * sizeof(uint32_t));
+    g_queue_count += count;
+}
+
+/*
+ * Purpose:
+ *   The body of an initial-build worker: takes directories from the shared
+ *   queue, indexes them and queues their subdirectories, until no work is
+ *   left and no other worker can produce more.
+ *
+ * Parameters:
+ *   arg: Unused.
+ *
+ * Returns:
+ *   A void pointer (always NULL).
+ */
+static void *build_worker_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&g_queue_lock);
+    for (;;) {
+        while (g_queue_count == 0 && g_busy_workers > 0) {
+            pthread_cond_wait(&g_queue_cond, &g_queue_lock);
+        }
+        if (g_queue_count == 0) break;
+        uint32_t dir_id = g_queue[--g_queue_count];
+        g_busy_workers++;
+        pthread_mutex_unlock(&g_queue_lock);
+
+        uint32_t *subdirs;
+        size_t subdir_count;
+        index_directory(dir_id, &subdirs, &subdir_count);
+
+        pthread_mutex_lock(&g_queue_lock);
+        queue_push_locked(subdirs, subdir_count);
+        free(subdirs);
+        g_busy_workers--;
+        pthread_cond_broadcast(&g_queue_cond);
+    }
+    pthread_cond_broadcast(&g_queue_cond);
+    pthread_mutex_unlock(&g_queue_lock);
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Indexes a directory and everything below it on the calling thread. Used
+ *   for directories that appear after the initial build.
+ *
+ * Parameters:
+ *   dir_id: The directory's node id.
+ *
+ * Returns:
+ *   void
+ */
+static void index_subtree(uint32_t dir_id) {
+    uint32_t *stack = malloc(sizeof(uint32_t));
+    if (stack == NULL) return;
+    size_t stack_count = 0;
+    stack[stack_count++] = dir_id;
+    while (stack_count > 0) {
+        uint32_t current = stack[--stack_count];
+        uint32_t *subdirs;
+        size_t subdir_count;
+        index_directory(current, &subdirs, &subdir_count);
+        if (subdir_count > 0) {
+            uint32_t *grown = realloc(stack, (stack_count + subdir_count) * sizeof(uint32_t));
+            if (grown != NULL) {
+                stack = grown;
+                memcpy(stack + stack_count, subdirs, subdir_count * sizeof(uint32_t));
+                stack_count += subdir_count;
+            }
+        }
+        free(subdirs);
+    }
+    free(stack);
+}
+
+/*
+ * Purpose:
+ *   qsort comparator ordering node ids by name.
+ *
+ * Parameters:
+ *   a: The first node id.
+ *   b: The second node id.
+ *
+ * Returns:
+ *   A negative, zero or positive value, as required by qsort.
+ */
+static int compare_node_names(const void *a, const void *b) {
+    return strcmp(node_name(*(const uint32_t *)a), node_name(*(const uint32_t *)b));
+}
+
+/*
+ * Purpose:
+ *   Sorts the recently added nodes and merges them into the sorted array,
+ *   dropping deleted nodes on the way. Must be called with the write lock held.
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   void
+ */
+static void merge_recent_locked(void) {
+    if (g_recent_count == 0) return;
+    qsort(g_recent, g_recent_count, sizeof(uint32_t), compare_node_names);
+
+    uint32_t *merged = malloc((g_sorted_count + g_recent_count) * sizeof(uint32_t));
+    if (merged == NULL) return; // Keep serving from the unmerged lists
+    size_t i = 0, j = 0, out = 0;
+    while (i < g_sorted_count || j < g_recent_count) {
+        uint32_t id;
+        if (j == g_recent_count || (i < g_sorted_count && strcmp(node_name(g_sorted[i]), node_name(g_recent[j])) <= 0)) {
+            id = g_sorted[i++];
+        } else {
+            id = g_recent[j++];
+        }
+        if (!g_nodes[id].deleted) merged[out++] = id;
+    }
+    free(g_sorted);
+    g_sorted = merged;
+    g_sorted_count = out;
+    g_recent_count = 0;
+}
+
+/*
+ * Purpose:
+ *   Applies one inotify event to the index.
+ *
+ * Parameters:
+ *   event: The event read from the inotify descriptor.
+ *
+ * Returns:
+ *   void
+ */
+static void apply_event(const struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        // Events were dropped; the roots are crawled again after this batch.
+        g_recrawl_pending = 1;
+        return;
+    }
+    if (event->wd < 0 || (size_t)event->wd >= g_wd_capacity) return;
+
+    pthread_rwlock_wrlock(&g_index_lock);
+    uint32_t dir_id = g_wd_nodes[event->wd];
+    if (event->mask & IN_IGNORED) {
+        g_wd_nodes[event->wd] = NODE_NONE;
+        pthread_rwlock_unlock(&g_index_lock);
+        return;
+    }
+    if (dir_id == NODE_NONE || event->len == 0) {
+        pthread_rwlock_unlock(&g_index_lock);
+        return;
+    }
+
+    uint32_t new_dir = NODE_NONE;
+    if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+        uint32_t id = add_node_locked(dir_id, event->name, (event->mask & IN_ISDIR) != 0);
+        if (id != NODE_NONE && (event->mask & IN_ISDIR)) new_dir = id;
+    } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        uint32_t id = find_child_locked(dir_id, event->name);
+        if (id != NODE_NONE) g_nodes[id].deleted = 1;
+    }
+    if (g_recent_count >= RECENT_MERGE_THRESHOLD) merge_recent_locked();
+    pthread_rwlock_unlock(&g_index_lock);
+
+    // A new or moved-in directory may already contain entries.
+    if (new_dir != NODE_NONE) index_subtree(new_dir);
+}
+
+/*
+ * Purpose:
+ *   Indexes everything below the roots with the parallel build workers. Used
+ *   for the initial build and for re-crawls.
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   void
+ */
+static void crawl_roots(void) {
+    pthread_mutex_lock(&g_queue_lock);
+    queue_push_locked(g_root_nodes, g_root_count);
+    pthread_mutex_unlock(&g_queue_lock);
+
+    pthread_t workers[64];
+    unsigned int started = 0;
+    for (unsigned int i = 0; i < g_build_threads && i < 64; i++) {
+        if (pthread_create(&workers[started], NULL, build_worker_thread, NULL) == 0) started++;
+    }
+    if (started == 0) build_worker_thread(NULL);
+    for (unsigned int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+    free(g_queue);
+    g_queue = NULL;
+    g_queue_capacity = 0;
+}
+
+/*
+ * Purpose:
+ *   Brings the index back in line with the disk after inotify dropped
+ *   events. The roots are crawled again, which adds what was missed; then
+ *   every entry of a completely read directory that the crawl did not find
+ *   is deleted. Queries keep being answered meanwhile. Events that arrive
+ *   during the crawl wait in the inotify queue and are applied afterwards.
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   void
+ */
+static void recrawl_roots(void) {
+    fprintf(stderr, "Name index: inotify queue overflowed; crawling the indexed roots again.\n");
+    pthread_rwlock_wrlock(&g_index_lock);
+    for (uint32_t id = 0; id < g_node_count; id++) {
+        g_nodes[id].seen = 0;
+        g_nodes[id].listed = 0;
+    }
+    pthread_rwlock_unlock(&g_index_lock);
+
+    crawl_roots();
+
+    size_t removed = 0;
+    pthread_rwlock_wrlock(&g_index_lock);
+    for (uint32_t id = 0; id < g_node_count; id++) {
+        name_node_t *node = &g_nodes[id];
+        if (node->parent == NODE_NONE || node->deleted || node->seen || !g_nodes[node->parent].listed) continue;
+        node->deleted = 1;
+        removed++;
+    }
+    merge_recent_locked();
+    pthread_rwlock_unlock(&g_index_lock);
+    fprintf(stderr, "Name index: crawl done, %zu stale entries removed.\n", removed);
+}
+
+/*
+ * Purpose:
+ *   The background thread of the index: runs the parallel initial build,
+ *   then applies inotify events for the lifetime of the process, crawling
+ *   the roots again whenever the event queue overflowed.
+ *
+ * Parameters:
+ *   arg: Unused.
+ *
+ * Returns:
+ *   A void pointer (always NULL).
+ */
+static void *name_index_thread(void *arg) {
+    (void)arg;
+
+    crawl_roots();
+
+    pthread_rwlock_wrlock(&g_index_lock);
+    merge_recent_locked();
+    g_ready = 1;
+    pthread_rwlock_unlock(&g_index_lock);
+
+    char events[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t len = read(g_inotify_fd, events, sizeof(events));
+        if (len == -1) {
+            if (errno == EINTR) continue;
+            perror("read from inotify");
+            break;
+        }
+        for (char *ptr = events; ptr < events + len;) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            apply_event(event);
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+        if (g_recrawl_pending) {
+            g_recrawl_pending = 0;
+            recrawl_roots();
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Starts building the index for the given roots in the background. When
+ *   the build is complete the same background thread keeps the index up to
+ *   date from inotify events.
+ *
+ * Parameters:
+ *   root_paths: The absolute paths of the roots to index (must stay valid).
+ *   root_count: The number of roots.
+ *   thread_count: The number of threads used for the initial build.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+int name_index_start(const char *const *root_paths, size_t root_count, unsigned int thread_count) {
+    if (root_count == 0 || root_count > MAX_INDEXED_ROOTS) return -1;
+    g_inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (g_inotify_fd == -1) {
+        perror("inotify_init1 for name index");
+        return -1;
+    }
+    g_build_threads = thread_count > 0 ? thread_count : NAME_INDEX_DEFAULT_THREADS;
+
+    // A root nested inside another one is covered by the outer root's nodes.
+    pthread_rwlock_wrlock(&g_index_lock);
+    for (size_t i = 0; i < root_count; i++) {
+        size_t outer;
+        for (outer = 0; outer < root_count; outer++) {
+            if (outer != i && path_below(root_paths[i], root_paths[outer]) &&
+                (strcmp(root_paths[i], root_paths[outer]) != 0 || outer < i)) break;
+        }
+        if (outer < root_count) continue;
+        uint32_t id = add_node_locked(NODE_NONE, root_paths[i], 1);
+        if (id == NODE_NONE) {
+            pthread_rwlock_unlock(&g_index_lock);
+            fprintf(stderr, "Name index: out of memory.\n");
+            return -1;
+        }
+        g_root_paths[g_root_count] = root_paths[i];
+        g_root_nodes[g_root_count++] = id;
+    }
+    pthread_rwlock_unlock(&g_index_lock);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, name_index_thread, NULL) != 0) {
+        perror("pthread_create for name index failed");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Reports whether the initial build has completed.
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   1 if queries can be answered, 0 otherwise.
+ */
+int name_index_ready(void) {
+    return g_ready;
+}
+
+/*
+ * Purpose:
+ *   Finds the node whose name contains a given arena offset. Node names are
+ *   appended to the arena in id order, so this is a binary search.
+ *
+ * Parameters:
+ *   offset: The arena offset.
+ *
+ * Returns:
+ *   The node id.
+ */
+static uint32_t node_at_offset_locked(size_t offset) {
+    uint32_t low = 0, high = g_node_count - 1;
+    while (low < high) {
+        uint32_t mid = low + (high - low + 1) / 2;
+        if (g_nodes[mid].name_off <= offset) low = mid;
+        else high = mid - 1;
+    }
+    return low;
+}
+
+typedef struct query_state_s {
+    uint32_t scope_id; // Results must lie below this directory
+    size_t max_results;
+    char **results;
+    size_t count;
+    int error;         // errno of a match that could not be returned, or 0
+} query_state_t;
+
+/*
+ * Purpose:
+ *   Finds the directory node for an absolute path inside one of the indexed
+ *   roots. Must be called with the index lock held.
+ *
+ * Parameters:
+ *   path: The absolute, resolved directory path.
+ *
+ * Returns:
+ *   The node id, or NODE_NONE if the path is not indexed.
+ */
+static uint32_t find_directory_locked(const char *path) {
+    for (size_t i = 0; i < g_root_count; i++) {
+        if (!path_below(path, g_root_paths[i])) continue;
+        uint32_t id = g_root_nodes[i];
+        const char *rest = path + strlen(g_root_paths[i]);
+        while (*rest && id != NODE_NONE) {
+            while (*rest == '/') rest++;
+            size_t len = strcspn(rest, "/");
+            if (len == 0) break;
+            char component[MAX_PATH_LEN];
+            if (len >= sizeof(component)) return NODE_NONE;
+            memcpy(component, rest, len);
+            component[len] = '\0';
+            id = find_child_locked(id, component);
+            rest += len;
+        }
+        return id;
+    }
+    return NODE_NONE;
+}
+
+/*
+ * Purpose:
+ *   Adds a matching node to the query results if it is live and lies below
+ *   the queried directory. Must be called with the index lock held.
+ *
+ * Parameters:
+ *   state: The query state.
+ *   id: The matching node.
+ *
+ * Returns:
+ *   1 when the result limit has been reached or the match could not be
+ *   returned (state->error is then set), 0 otherwise.
+ */
+static int collect_match_locked(query_state_t *state, uint32_t id) {
+    char path[MAX_PATH_LEN];
+    if (id == state->scope_id) return 0;
+    if (build_path_locked(id, state->scope_id, path, sizeof(path) - 1) == -1) {
+        if (errno != ENAMETOOLONG) return 0; // Deleted, or outside the queried directory
+        state->error = ENAMETOOLONG;
+        return 1;
+    }
+    if (g_nodes[id].is_dir) strcat(path, "/");
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        state->error = ENOMEM;
+        return 1;
+    }
+    state->results[state->count++] = copy;
+    return state->count == state->max_results;
+}
+
+/*
+ * Purpose:
+ *   Returns the length of the literal prefix of a glob pattern.
+ *
+ * Parameters:
+ *   pattern: The glob pattern.
+ *
+ * Returns:
+ *   The number of leading characters without glob syntax.
+ */
+static size_t glob_literal_prefix(const char *pattern) {
+    return strcspn(pattern, "*?[\\");
+}
+
+/*
+ * Purpose:
+ *   Finds files and directories by name below a directory.
+ *
+ * Parameters:
+ *   root_path: The absolute path of the directory to search (an indexed root
+ *              or a directory below one).
+ *   mode: One of NAME_MATCH_*; the pattern is matched against base names.
+ *   pattern: The substring, prefix or glob pattern.
+ *   max_results: The maximum number of paths to return.
+ *   results_out: Receives a malloc'ed array of malloc'ed paths relative to
+ *                root_path (starting with '/'); directories end with '/'.
+ *   count_out: Receives the number of paths.
+ *
+ * Returns:
+ *   0 on success, or -1 if the index is not ready, the directory is not
+ *   indexed, or a match cannot be returned (errno ENAMETOOLONG if its path
+ *   does not fit in MAX_PATH_LEN, ENOMEM).
+ */
+int name_index_query(const char *root_path, int mode, const char *pattern, size_t max_results,
+                     char ***results_out, size_t *count_out) {
+    *results_out = NULL;
+    *count_out = 0;
+    if (!g_ready || max_results == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    query_state_t state;
+    memset(&state, 0, sizeof(state));
+    state.max_results = max_results;
+    state.results = malloc(max_results * sizeof(char *));
+    if (state.results == NULL) return -1;
+
+    pthread_rwlock_rdlock(&g_index_lock);
+    state.scope_id = find_directory_locked(root_path);
+    if (state.scope_id == NODE_NONE) {
+        pthread_rwlock_unlock(&g_index_lock);
+        free(state.results);
+        errno = ENOENT;
+        return -1;
+    }
+    size_t pattern_len = strlen(pattern);
+    if (mode == NAME_MATCH_SUBSTRING) {
+        size_t offset = 0;
+        while (offset < g_arena_used) {
+            const char *hit = memmem(g_arena + offset, g_arena_used - offset, pattern, pattern_len);
+            if (hit == NULL) break;
+            uint32_t id = node_at_offset_locked((size_t)(hit - g_arena));
+            if (collect_match_locked(&state, id)) break;
+            offset = (id + 1 < g_node_count) ? g_nodes[id + 1].name_off : g_arena_used;
+        }
+    } else {
+        // Prefix queries (and globs with a literal prefix) only visit the
+        // matching range of the sorted array plus the recent additions.
+        size_t prefix_len = (mode == NAME_MATCH_PREFIX) ? pattern_len : glob_literal_prefix(pattern);
+        size_t low = 0, high = g_sorted_count;
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            if (strncmp(node_name(g_sorted[mid]), pattern, prefix_len) < 0) low = mid + 1;
+            else high = mid;
+        }
+        int done = 0;
+        for (size_t i = low; i < g_sorted_count && !done; i++) {
+            const char *name = node_name(g_sorted[i]);
+            if (strncmp(name, pattern, prefix_len) != 0) break;
+            if (g_nodes[g_sorted[i]].deleted) continue;
+            if (mode == NAME_MATCH_GLOB && fnmatch(pattern, name, FNM_PERIOD) != 0) continue;
+            done = collect_match_locked(&state, g_sorted[i]);
+        }
+        for (size_t i = 0; i < g_recent_count && !done; i++) {
+            const char *name = node_name(g_recent[i]);
+            if (g_nodes[g_recent[i]].deleted || strncmp(name, pattern, prefix_len) != 0) continue;
+            if (mode == NAME_MATCH_GLOB && fnmatch(pattern, name, FNM_PERIOD) != 0) continue;
+            done = collect_match_locked(&state, g_recent[i]);
+        }
+    }
+    pthread_rwlock_unlock(&g_index_lock);
+
+    if (state.error != 0) {
+        for (size_t i = 0; i < state.count; i++) free(state.results[i]);
+        free(state.results);
+        errno = state.error;
+        return -1;
+    }
+    *results_out = state.results;
+    *count_out = state.count;
+    return 0;
+}
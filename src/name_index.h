@@ -0,0 +1,72 @@
+/*
+ * src/name_index.h
+ *
+ * This header file declares the filename index behind the LOCATE command.
+ * Every file and directory below the server roots is stored once as a node
+ * (its name in a shared arena plus a reference to its parent directory).
+ * The index is built by several threads at startup and kept current with
+ * inotify, so name lookups never have to walk the directory tree.
+ */
+#ifndef NAME_INDEX_H
+#define NAME_INDEX_H
+
+#include <stddef.h> // For size_t
+
+#define NAME_INDEX_DEFAULT_THREADS 4
+
+// Matching modes for name_index_query.
+#define NAME_MATCH_SUBSTRING 0
+#define NAME_MATCH_PREFIX 1
+#define NAME_MATCH_GLOB 2
+
+/*
+ * Purpose:
+ *   Starts building the index for the given roots in the background. When
+ *   the build is complete the same background thread keeps the index up to
+ *   date from inotify events.
+ *
+ * Parameters:
+ *   root_paths: The absolute paths of the roots to index (must stay valid).
+ *   root_count: The number of roots.
+ *   thread_count: The number of threads used for the initial build.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+int name_index_start(const char *const *root_paths, size_t root_count, unsigned int thread_count);
+
+/*
+ * Purpose:
+ *   Reports whether the initial build has completed.
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   1 if queries can be answered, 0 otherwise.
+ */
+int name_index_ready(void);
+
+/*
+ * Purpose:
+ *   Finds files and directories by name below a directory.
+ *
+ * Parameters:
+ *   root_path: The absolute path of the directory to search (an indexed root
+ *              or a directory below one).
+ *   mode: One of NAME_MATCH_*; the pattern is matched against base names.
+ *   pattern: The substring, prefix or glob pattern.
+ *   max_results: The maximum number of paths to return.
+ *   results_out: Receives a malloc'ed array of malloc'ed paths relative to
+ *                root_path (starting with '/'); directories end with '/'.
+ *   count_out: Receives the number of paths.
+ *
+ * Returns:
+ *   0 on success, or -1 if the index is not ready, the directory is not
+ *   indexed, or a match cannot be returned (errno ENAMETOOLONG if its path
+ *   does not fit in MAX_PATH_LEN, ENOMEM).
+ */
+int name_index_query(const char *root_path, int mode, const char *pattern, size_t max_results,
+                     char ***results_out, size_t *count_out);
+
+#endif // NAME_INDEX_H
@@ -0,0 +1,215 @@
+/*
+ * src/output_sink.c
+ *
+ * This file implements the client's buffered output sink declared in
+ * output_sink.h. Server output is gathered into a large block buffer and
+ * written with write/writev, so printing long listings is limited by the
+ * network rather than by per-line stdio calls.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "output_sink.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+#include "common.h"
+
+// Minimum free space kept in the buffer before receiving into it.
+#define OUTPUT_SINK_MIN_RECV_SPACE 4096
+
+/*
+ * Purpose:
+ *   Writes an I/O vector completely, handling partial writes and EINTR.
+ *
+ * Parameters:
+ *   fd: The destination file descriptor.
+ *   iov: The I/O vector; it is modified while the data is written.
+ *   iovcnt: The number of elements in the vector.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+static int writev_all(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t written = writev(fd, iov, iovcnt);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            perror("writev in output sink");
+            return -1;
+        }
+        size_t remaining = (size_t)written;
+        while (iovcnt > 0 && remaining >= iov->iov_len) {
+            remaining -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + remaining;
+            iov->iov_len -= remaining;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Initializes an output sink writing to the given file, or to standard
+ *   output if no path is provided.
+ *
+ * Parameters:
+ *   sink: The sink structure to initialize.
+ *   path: The file to create/truncate, or NULL for standard output.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+int output_sink_open(output_sink_t *sink, const char *path) {
+    if (sink == NULL) return -1;
+    memset(sink, 0, sizeof(*sink));
+
+    if (path != NULL) {
+        sink->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (sink->fd == -1) {
+            perror("open output file");
+            return -1;
+        }
+        sink->owns_fd = 1;
+    } else {
+        sink->fd = STDOUT_FILENO;
+    }
+
+    sink->buffer = malloc(OUTPUT_SINK_CAPACITY);
+    if (sink->buffer == NULL) {
+        perror("malloc for output sink buffer failed");
+        if (sink->owns_fd) close(sink->fd);
+        return -1;
+    }
+    sink->capacity = OUTPUT_SINK_CAPACITY;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Appends data to the sink. Small writes are copied into the block buffer;
+ *   writes that do not fit are sent together with the pending buffer in a
+ *   single writev call without an intermediate copy.
+ *
+ * Parameters:
+ *   sink: The output sink.
+ *   data: The bytes to output.
+ *   len: The number of bytes to output.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+int output_sink_write(output_sink_t *sink, const char *data, size_t len) {
+    if (sink == NULL || (data == NULL && len > 0)) return -1;
+
+    if (len <= sink->capacity - sink->used) {
+        memcpy(sink->buffer + sink->used, data, len);
+        sink->used += len;
+        return 0;
+    }
+
+    struct iovec iov[2];
+    int iovcnt = 0;
+    if (sink->used > 0) {
+        iov[iovcnt].iov_base = sink->buffer;
+        iov[iovcnt].iov_len = sink->used;
+        iovcnt++;
+    }
+    iov[iovcnt].iov_base = (void *)data;
+    iov[iovcnt].iov_len = len;
+    iovcnt++;
+
+    sink->used = 0;
+    return writev_all(sink->fd, iov, iovcnt);
+}
+
+/*
+ * Purpose:
+ *   Writes all buffered data to the underlying file descriptor.
+ *
+ * Parameters:
+ *   sink: The output sink.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+int output_sink_flush(output_sink_t *sink) {
+    if (sink == NULL || sink->used == 0) return 0;
+    struct iovec iov;
+    iov.iov_base = sink->buffer;
+    iov.iov_len = sink->used;
+    sink->used = 0;
+    return writev_all(sink->fd, &iov, 1);
+}
+
+/*
+ * Purpose:
+ *   Relays a server response straight from the socket into the sink buffer,
+ *   without splitting it into lines. Reading stops when the socket receive
+ *   timeout expires (end of the response) or the peer closes the connection,
+ *   and also when a signal interrupts it, so the caller can react.
+ *
+ * Parameters:
+ *   sink: The output sink.
+ *   sockfd: The connected server socket (with SO_RCVTIMEO set).
+ *   peer_closed: Set to 1 if the server closed the connection, 0 otherwise.
+ *
+ * Returns:
+ *   The number of bytes relayed, or -1 on a socket or output error (errno
+ *   is EINTR after a signal; the data relayed so far stays in the sink).
+ */
+ssize_t output_sink_recv_stream(output_sink_t *sink, int sockfd, int *peer_closed) {
+    if (sink == NULL || peer_closed == NULL) return -1;
+    *peer_closed = 0;
+    size_t total = 0;
+
+    for (;;) {
+        if (sink->capacity - sink->used < OUTPUT_SINK_MIN_RECV_SPACE) {
+            if (output_sink_flush(sink) == -1) return -1;
+        }
+        ssize_t nbytes = transport_recv(sockfd, sink->buffer + sink->used, sink->capacity - sink->used);
+        if (nbytes > 0) {
+            sink->used += (size_t)nbytes;
+            total += (size_t)nbytes;
+        } else if (nbytes == 0) {
+            *peer_closed = 1;
+            break;
+        } else {
+            if (errno == EINTR) return -1;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break; // End of response
+            perror("recv in output_sink_recv_stream");
+            return -1;
+        }
+    }
+    return (ssize_t)total;
+}
+
+/*
+ * Purpose:
+ *   Flushes the sink, releases its buffer and closes the descriptor if the
+ *   sink opened it.
+ *
+ * Parameters:
+ *   sink: The output sink.
+ *
+ * Returns:
+ *   void
+ */
+void output_sink_close(output_sink_t *sink) {
+    if (sink == NULL || sink->buffer == NULL) return;
+    output_sink_flush(sink);
+    free(sink->buffer);
+    sink->buffer = NULL;
+    if (sink->owns_fd && close(sink->fd) == -1) {
+        perror("close output file failed");
+    }
+    sink->fd = -1;
+}
@@ -0,0 +1,98 @@
+/*
+ * src/output_sink.h
+ *
+ * This header file declares the client's output sink: a large block buffer in
+ * front of a file descriptor (standard output or a file given with '-o'). Data
+ * received from the server is accumulated in the buffer and written out in big
+ * chunks with write/writev instead of going through stdio line by line.
+ */
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include <sys/types.h> // For ssize_t
+#include <stddef.h>    // For size_t
+
+#define OUTPUT_SINK_CAPACITY (256 * 1024)
+
+typedef struct output_sink_s {
+    int fd;
+    int owns_fd;     // Non-zero if the descriptor was opened by the sink
+    char *buffer;
+    size_t capacity;
+    size_t used;
+} output_sink_t;
+
+/*
+ * Purpose:
+ *   Initializes an output sink writing to the given file, or to standard
+ *   output if no path is provided.
+ *
+ * Parameters:
+ *   sink: The sink structure to initialize.
+ *   path: The file to create/truncate, or NULL for standard output.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+int output_sink_open(output_sink_t *sink, const char *path);
+
+/*
+ * Purpose:
+ *   Appends data to the sink. Small writes are copied into the block buffer;
+ *   writes that do not fit are sent together with the pending buffer in a
+ *   single writev call without an intermediate copy.
+ *
+ * Parameters:
+ *   sink: The output sink.
+ *   data: The bytes to output.
+ *   len: The number of bytes to output.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+int output_sink_write(output_sink_t *sink, const char *data, size_t len);
+
+/*
+ * Purpose:
+ *   Writes all buffered data to the underlying file descriptor.
+ *
+ * Parameters:
+ *   sink: The output sink.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+int output_sink_flush(output_sink_t *sink);
+
+/*
+ * Purpose:
+ *   Relays a server response straight from the socket into the sink buffer,
+ *   without splitting it into lines. Reading stops when the socket receive
+ *   timeout expires (end of the response) or the peer closes the connection,
+ *   and also when a signal interrupts it, so the caller can react.
+ *
+ * Parameters:
+ *   sink: The output sink.
+ *   sockfd: The connected server socket (with SO_RCVTIMEO set).
+ *   peer_closed: Set to 1 if the server closed the connection, 0 otherwise.
+ *
+ * Returns:
+ *   The number of bytes relayed, or -1 on a socket or output error (errno
+ *   is EINTR after a signal; the data relayed so far stays in the sink).
+ */
+ssize_t output_sink_recv_stream(output_sink_t *sink, int sockfd, int *peer_closed);
+
+/*
+ * Purpose:
+ *   Flushes the sink, releases its buffer and closes the descriptor if the
+ *   sink opened it.
+ *
+ * Parameters:
+ *   sink: The output sink.
+ *
+ * Returns:
+ *   void
+ */
+void output_sink_close(output_sink_t *sink);
+
+#endif // OUTPUT_SINK_H
@@ -0,0 +1,207 @@
+/*
+ * src/prewarm.c
+ *
+ * This file implements the cache prewarmer declared in prewarm.h. A small
+ * set of detached threads pull directories from a shared list and load them
+ * through dir_cache_get; the last thread to finish reports the result and
+ * frees the list.
+ */
+#define _POSIX_C_SOURCE 200809L
+#define _XOPEN_SOURCE 700 // For realpath
+#include "prewarm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "common.h"
+#include "dir_cache.h"
+#include "protocol.h"
+
+typedef struct prewarm_job_s {
+    pthread_mutex_t lock;
+    char **paths;
+    size_t count;
+    size_t next;          // Index of the next path to load
+    size_t warmed;
+    size_t failed;
+    unsigned int running; // Threads still working
+    prewarm_done_fn done;
+    struct timespec started;
+} prewarm_job_t;
+
+/*
+ * Purpose:
+ *   Reads a manifest of hot directories. Each non-empty line not starting
+ *   with '#' names a directory relative to the server root. Entries that do
+ *   not resolve to a directory inside the root are reported and skipped.
+ *
+ * Parameters:
+ *   manifest_path: The path of the manifest file.
+ *   root_path: The absolute path of the server root.
+ *   paths: The list to append absolute directory paths to (grown with realloc).
+ *   count: The number of paths in the list (updated).
+ *
+ * Returns:
+ *   0 on success, or -1 if the manifest could not be read.
+ */
+int prewarm_read_manifest(const char *manifest_path, const char *root_path, char ***paths, size_t *count) {
+    FILE *manifest = fopen(manifest_path, "r");
+    if (manifest == NULL) {
+        perror("Cannot open prewarm manifest");
+        return -1;
+    }
+
+    char line[MAX_PATH_LEN];
+    while (fgets(line, sizeof(line), manifest) != NULL) {
+        line[strcspn(line, "\r\n")] = 0;
+        char *entry = line;
+        while (*entry && isspace((unsigned char)*entry)) entry++;
+        if (*entry == '\0' || *entry == '#') continue;
+
+        char trial[MAX_PATH_LEN];
+        char resolved[MAX_PATH_LEN];
+        if (snprintf(trial, sizeof(trial), "%s/%s", root_path, entry) >= (int)sizeof(trial) ||
+            realpath(trial, resolved) == NULL) {
+            fprintf(stderr, "Prewarm manifest: cannot resolve '%s', skipping.\n", entry);
+            continue;
+        }
+        if (!path_within_root(resolved, root_path)) {
+            fprintf(stderr, "Prewarm manifest: '%s' is outside the server root, skipping.\n", entry);
+            continue;
+        }
+
+        char *copy = strdup(resolved);
+        char **grown = realloc(*paths, (*count + 1) * sizeof(char *));
+        if (copy == NULL || grown == NULL) {
+            perror("Allocating prewarm list failed");
+            free(copy);
+            if (grown != NULL) *paths = grown;
+            break;
+        }
+        *paths = grown;
+        (*paths)[(*count)++] = copy;
+    }
+
+    if (ferror(manifest)) perror("Error reading prewarm manifest");
+    fclose(manifest);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Frees a prewarm job and its path list.
+ *
+ * Parameters:
+ *   job: The job to free.
+ *
+ * Returns:
+ *   void
+ */
+static void prewarm_job_free(prewarm_job_t *job) {
+    for (size_t i = 0; i < job->count; i++) free(job->paths[i]);
+    free(job->paths);
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+}
+
+/*
+ * Purpose:
+ *   The body of a prewarm thread: loads directories until the list is done.
+ *
+ * Parameters:
+ *   arg: A pointer to the shared prewarm_job_t.
+ *
+ * Returns:
+ *   A void pointer (always NULL).
+ */
+static void *prewarm_thread(void *arg) {
+    prewarm_job_t *job = (prewarm_job_t *)arg;
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        if (job->next == job->count) break; // Leaves the lock held
+        const char *path = job->paths[job->next++];
+        pthread_mutex_unlock(&job->lock);
+
+        dir_listing_t *listing = dir_cache_get(path);
+        dir_cache_release(listing);
+
+        pthread_mutex_lock(&job->lock);
+        if (listing != NULL) job->warmed++;
+        else job->failed++;
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    int is_last = (--job->running == 0);
+    pthread_mutex_unlock(&job->lock);
+    if (is_last) {
+        if (job->done != NULL) {
+            struct timespec finished;
+            clock_gettime(CLOCK_MONOTONIC, &finished);
+            double seconds = (double)(finished.tv_sec - job->started.tv_sec) +
+                             (double)(finished.tv_nsec - job->started.tv_nsec) / 1e9;
+            job->done(job->warmed, job->failed, seconds);
+        }
+        prewarm_job_free(job);
+    }
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Starts background threads that load the given directories into the
+ *   directory cache. The function returns immediately.
+ *
+ * Parameters:
+ *   paths: A malloc'ed array of malloc'ed absolute paths; ownership passes
+ *          to the prewarmer.
+ *   count: The number of paths.
+ *   thread_count: The number of threads to use.
+ *   done: An optional callback invoked when all directories are processed.
+ *
+ * Returns:
+ *   0 on success, or -1 if no thread could be started (the paths are freed).
+ */
+int prewarm_start(char **paths, size_t count, unsigned int thread_count, prewarm_done_fn done) {
+    prewarm_job_t *job = calloc(1, sizeof(prewarm_job_t));
+    if (job == NULL) {
+        perror("calloc for prewarm job failed");
+        for (size_t i = 0; i < count; i++) free(paths[i]);
+        free(paths);
+        return -1;
+    }
+    pthread_mutex_init(&job->lock, NULL);
+    job->paths = paths;
+    job->count = count;
+    job->done = done;
+    clock_gettime(CLOCK_MONOTONIC, &job->started);
+
+    if (thread_count == 0) thread_count = PREWARM_DEFAULT_THREADS;
+    if (thread_count > count) thread_count = count > 0 ? (unsigned int)count : 1;
+
+    // Threads are counted as running before any of them starts, so an early
+    // finisher cannot mistake itself for the last one.
+    job->running = thread_count;
+    unsigned int started = 0;
+    pthread_mutex_lock(&job->lock);
+    for (unsigned int i = 0; i < thread_count; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, prewarm_thread, job) != 0) {
+            perror("pthread_create for prewarm failed");
+            break;
+        }
+        pthread_detach(tid);
+        started++;
+    }
+    job->running = started;
+    pthread_mutex_unlock(&job->lock);
+
+    if (started == 0) {
+        prewarm_job_free(job);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+/*
+ * src/prewarm.h
+ *
+ * This header file declares the cache prewarmer. Given a list of hot
+ * directories, it reads their listings into the directory cache on a few
+ * background threads, so the first client requests after startup do not have
+ * to wait for a cold disk.
+ */
+#ifndef PREWARM_H
+#define PREWARM_H
+
+#include <stddef.h> // For size_t
+
+#define PREWARM_DEFAULT_THREADS 4
+
+/*
+ * Purpose:
+ *   Called once when prewarming has finished.
+ *
+ * Parameters:
+ *   warmed: The number of directories read into the cache.
+ *   failed: The number of directories that could not be read.
+ *   seconds: The time the prewarm took.
+ */
+typedef void (*prewarm_done_fn)(size_t warmed, size_t failed, double seconds);
+
+/*
+ * Purpose:
+ *   Reads a manifest of hot directories. Each non-empty line not starting
+ *   with '#' names a directory relative to the server root. Entries that do
+ *   not resolve to a directory inside the root are reported and skipped.
+ *
+ * Parameters:
+ *   manifest_path: The path of the manifest file.
+ *   root_path: The absolute path of the server root.
+ *   paths: The list to append absolute directory paths to (grown with realloc).
+ *   count: The number of paths in the list (updated).
+ *
+ * Returns:
+ *   0 on success, or -1 if the manifest could not be read.
+ */
+int prewarm_read_manifest(const char *manifest_path, const char *root_path, char ***paths, size_t *count);
+
+/*
+ * Purpose:
+ *   Starts background threads that load the given directories into the
+ *   directory cache. The function returns immediately.
+ *
+ * Parameters:
+ *   paths: A malloc'ed array of malloc'ed absolute paths; ownership passes
+ *          to the prewarmer.
+ *   count: The number of paths.
+ *   thread_count: The number of threads to use.
+ *   done: An optional callback invoked when all directories are processed.
+ *
+ * Returns:
+ *   0 on success, or -1 if no thread could be started (the paths are freed).
+ */
+int prewarm_start(char **paths, size_t count, unsigned int thread_count, prewarm_done_fn done);
+
+#endif // PREWARM_H
@@ -25,9 +25,28 @@
 #define CMD_INFO "INFO"
 #define CMD_CD "CD"
 #define CMD_LIST "LIST"
+#define CMD_ROOT "ROOT"
+#define CMD_LOCATE "LOCATE"
+#define CMD_GREP "GREP"
+#define CMD_COMPLETE "COMPLETE"
+#define CMD_LISTDIFF "LISTDIFF"
+#define CMD_STATS "STATS"
+#define CMD_CANCEL "CANCEL"
+#define CMD_DU "DU"
+#define CMD_HASH "HASH"
+#define CMD_TREEHASH "TREEHASH"
+#define CMD_STAT "STAT"
+#define CMD_TOP "TOP"
+#define CMD_WC "WC"
+#define CMD_JOB "JOB"
 
 // Server responses
 #define RESP_BYE "BYE"
 #define RESP_ERROR_PREFIX "ERROR: "
+#define RESP_VERSION "VERSION"
+#define RESP_NOT_MODIFIED "NOTMODIFIED"
+#define RESP_DIFF "DIFF"
+#define RESP_CANCELLED "CANCELLED"
+#define RESP_RESULT "RESULT"
 
 #endif // PROTOCOL_H
@@ -0,0 +1,774 @@
+/*
+ * src/replay.c
+ *
+ * This file implements 'myreplay', a workload replay tool. It parses the log
+ * written by 'myserver' (lines produced by log_event), reconstructs one command
+ * stream per client session, and replays those sessions against a server with
+ * the original or scaled timing and a bounded number of concurrent sessions.
+ * At the end it reports the distribution of response latencies and the CPU
+ * time the server (from its STATS counters) and the tool itself used.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "common.h"
+#include "protocol.h"
+
+#define REPLAY_DEFAULT_CONCURRENCY 64
+#define REPLAY_RESPONSE_TIMEOUT_MS 5000 // Maximum wait for the first byte of a reply
+#define REPLAY_MAX_SESSIONS_LOOKUP 1024 // Open sessions tracked while parsing
+
+typedef struct replay_command_s {
+    long long offset_ms; // Time since the session started, as logged
+    char *text;
+} replay_command_t;
+
+typedef struct replay_session_s {
+    char client_key[INET_ADDRSTRLEN + 8]; // "ip:port" as logged
+    long long start_ms;                   // Absolute log time of the session start
+    replay_command_t *commands;
+    size_t command_count;
+    size_t command_capacity;
+} replay_session_t;
+
+typedef struct latency_sample_s {
+    char command[16];
+    long long latency_us;
+} latency_sample_t;
+
+typedef struct replay_context_s {
+    struct sockaddr_in server_addr;
+    double time_scale;       // 1.0 = original timing, 0 = no delays
+    int quiet_ms;            // Silence that marks the end of a response
+    long long log_start_ms;  // Log time of the earliest session
+    struct timespec replay_start;
+
+    pthread_mutex_t lock;
+    pthread_cond_t slot_cond;
+    int active_sessions;
+    int max_sessions;
+
+    latency_sample_t *samples;
+    size_t sample_count;
+    size_t sample_capacity;
+    size_t timeouts;
+    size_t failed_sessions;
+
+    long server_cpu_ms;    // Server CPU time used during the replay, or -1
+    double tool_cpu_seconds;
+} replay_context_t;
+
+typedef struct session_thread_arg_s {
+    replay_context_t *ctx;
+    replay_session_t *session;
+} session_thread_arg_t;
+
+// Function Prototypes
+static int parse_log_file(const char *path, replay_session_t **sessions_out, size_t *count_out);
+static int parse_log_timestamp(const char *line, long long *ms_out);
+static int append_command(replay_session_t *session, long long offset_ms, const char *text);
+static void *session_thread(void *arg);
+static int drain_response(int sockfd, int first_timeout_ms, int quiet_ms, long long *first_byte_us);
+static void record_sample(replay_context_t *ctx, const char *command_text, long long latency_us);
+static void print_report(replay_context_t *ctx, double wall_seconds);
+static int query_server_cpu(const replay_context_t *ctx, long *cpu_ms);
+static double process_cpu_seconds(void);
+static void sleep_until(const struct timespec *base, long long offset_ms);
+static long long elapsed_us(const struct timespec *from, const struct timespec *to);
+static int compare_samples(const void *a, const void *b);
+static int compare_latencies(const void *a, const void *b);
+static void print_distribution(const char *label, const long long *latencies, size_t count);
+
+/*
+ * Purpose:
+ *   The main entry point for the replay tool. It parses the options, loads the
+ *   server log, starts one thread per recorded session (bounded by the
+ *   concurrency limit), waits for all of them and prints the latency report.
+ *
+ * Parameters:
+ *   argc: The number of command-line arguments.
+ *   argv: An array of command-line argument strings. The expected usage is:
+ *         ./myreplay [-s scale] [-c max_sessions] [-w quiet_ms] <server_address> <port_number> <server_log>
+ *
+ * Returns:
+ *   0 on success, and 1 on error.
+ */
+int main(int argc, char *argv[]) {
+    initialize_static_memory();
+
+    replay_context_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.time_scale = 1.0;
+    ctx.quiet_ms = CLIENT_RECV_TIMEOUT_MS;
+    ctx.max_sessions = REPLAY_DEFAULT_CONCURRENCY;
+
+    int opt;
+    char *endptr;
+    while ((opt = getopt(argc, argv, "s:c:w:")) != -1) {
+        switch (opt) {
+            case 's':
+                ctx.time_scale = strtod(optarg, &endptr);
+                if (endptr == optarg || *endptr != '\0' || ctx.time_scale < 0) {
+                    fprintf(stderr, "Error: Invalid time scale '%s'.\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'c':
+                ctx.max_sessions = (int)strtol(optarg, &endptr, 10);
+                if (endptr == optarg || *endptr != '\0' || ctx.max_sessions <= 0) {
+                    fprintf(stderr, "Error: Invalid session limit '%s'.\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'w':
+                ctx.quiet_ms = (int)strtol(optarg, &endptr, 10);
+                if (endptr == optarg || *endptr != '\0' || ctx.quiet_ms <= 0) {
+                    fprintf(stderr, "Error: Invalid quiet period '%s'.\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s scale] [-c max_sessions] [-w quiet_ms] <server_address> <port_number> <server_log>\n", argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 3) {
+        fprintf(stderr, "Usage: %s [-s scale] [-c max_sessions] [-w quiet_ms] <server_address> <port_number> <server_log>\n", argv[0]);
+        return 1;
+    }
+
+    const char *server_ip = argv[optind];
+    long port_long = strtol(argv[optind + 1], &endptr, 10);
+    if (endptr == argv[optind + 1] || *endptr != '\0' || port_long <= 0 || port_long > 65535) {
+        fprintf(stderr, "Error: Invalid port number '%s'. Must be an integer between 1 and 65535.\n", argv[optind + 1]);
+        return 1;
+    }
+    ctx.server_addr.sin_family = AF_INET;
+    ctx.server_addr.sin_port = htons((uint16_t)port_long);
+    if (inet_pton(AF_INET, server_ip, &ctx.server_addr.sin_addr) <= 0) {
+        fprintf(stderr, "Error: Invalid server address '%s'.\n", server_ip);
+        return 1;
+    }
+
+    // A server closing a connection mid-send must not kill the whole replay.
+    signal(SIGPIPE, SIG_IGN);
+
+    replay_session_t *sessions = NULL;
+    size_t session_count = 0;
+    if (parse_log_file(argv[optind + 2], &sessions, &session_count) != 0) {
+        return 1;
+    }
+    if (session_count == 0) {
+        fprintf(stderr, "No client sessions found in '%s'.\n", argv[optind + 2]);
+        free(sessions);
+        return 1;
+    }
+
+    size_t total_commands = 0;
+    ctx.log_start_ms = sessions[0].start_ms;
+    for (size_t i = 0; i < session_count; i++) {
+        if (sessions[i].start_ms < ctx.log_start_ms) ctx.log_start_ms = sessions[i].start_ms;
+        total_commands += sessions[i].command_count;
+    }
+    printf("Replaying %zu sessions (%zu commands), time scale %.2f, up to %d concurrent sessions\n",
+           session_count, total_commands, ctx.time_scale, ctx.max_sessions);
+    fflush(stdout);
+
+    long server_cpu_before;
+    int have_server_cpu = query_server_cpu(&ctx, &server_cpu_before) == 0;
+    double tool_cpu_before = process_cpu_seconds();
+
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.slot_cond, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &ctx.replay_start);
+
+    pthread_t *threads = calloc(session_count, sizeof(pthread_t));
+    session_thread_arg_t *args = calloc(session_count, sizeof(session_thread_arg_t));
+    if (threads == NULL || args == NULL) {
+        perror("calloc for replay threads failed");
+        abort();
+    }
+
+    size_t started = 0;
+    for (size_t i = 0; i < session_count; i++) {
+        if (ctx.time_scale > 0) {
+            sleep_until(&ctx.replay_start, (long long)((double)(sessions[i].start_ms - ctx.log_start_ms) / ctx.time_scale));
+        }
+
+        pthread_mutex_lock(&ctx.lock);
+        while (ctx.active_sessions >= ctx.max_sessions) {
+            pthread_cond_wait(&ctx.slot_cond, &ctx.lock);
+        }
+        ctx.active_sessions++;
+        pthread_mutex_unlock(&ctx.lock);
+
+        args[i].ctx = &ctx;
+        args[i].session = &sessions[i];
+        if (pthread_create(&threads[started], NULL, session_thread, &args[i]) != 0) {
+            perror("pthread_create for replay session failed");
+            pthread_mutex_lock(&ctx.lock);
+            ctx.active_sessions--;
+            ctx.failed_sessions++;
+            pthread_mutex_unlock(&ctx.lock);
+            continue;
+        }
+        started++;
+    }
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    struct timespec replay_end;
+    clock_gettime(CLOCK_MONOTONIC, &replay_end);
+    ctx.tool_cpu_seconds = process_cpu_seconds() - tool_cpu_before;
+    long server_cpu_after;
+    ctx.server_cpu_ms = (have_server_cpu && query_server_cpu(&ctx, &server_cpu_after) == 0)
+                            ? server_cpu_after - server_cpu_before : -1;
+    print_report(&ctx, (double)elapsed_us(&ctx.replay_start, &replay_end) / 1e6);
+
+    for (size_t i = 0; i < session_count; i++) {
+        for (size_t j = 0; j < sessions[i].command_count; j++) free(sessions[i].commands[j].text);
+        free(sessions[i].commands);
+    }
+    free(sessions);
+    free(threads);
+    free(args);
+    free(ctx.samples);
+    pthread_cond_destroy(&ctx.slot_cond);
+    pthread_mutex_destroy(&ctx.lock);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Converts the timestamp at the start of a log line (YYYY.MM.DD-HH:MM:SS.sss,
+ *   as produced by get_timestamp) into milliseconds since the epoch.
+ *
+ * Parameters:
+ *   line: The log line.
+ *   ms_out: Receives the parsed time in milliseconds.
+ *
+ * Returns:
+ *   0 on success, or -1 if the line does not start with a timestamp.
+ */
+static int parse_log_timestamp(const char *line, long long *ms_out) {
+    struct tm tm_info;
+    int millis = 0;
+    memset(&tm_info, 0, sizeof(tm_info));
+    if (sscanf(line, "%d.%d.%d-%d:%d:%d.%d", &tm_info.tm_year, &tm_info.tm_mon, &tm_info.tm_mday,
+               &tm_info.tm_hour, &tm_info.tm_min, &tm_info.tm_sec, &millis) != 7) {
+        return -1;
+    }
+    tm_info.tm_year -= 1900;
+    tm_info.tm_mon -= 1;
+    tm_info.tm_isdst = -1;
+    time_t seconds = mktime(&tm_info);
+    if (seconds == (time_t)-1) return -1;
+    *ms_out = (long long)seconds * 1000 + millis;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Appends a command to a session's command stream.
+ *
+ * Parameters:
+ *   session: The session to extend.
+ *   offset_ms: The command's time relative to the session start.
+ *   text: The command text (copied).
+ *
+ * Returns:
+ *   0 on success, or -1 on allocation failure.
+ */
+static int append_command(replay_session_t *session, long long offset_ms, const char *text) {
+    if (session->command_count == session->command_capacity) {
+        size_t new_capacity = session->command_capacity ? session->command_capacity * 2 : 16;
+        replay_command_t *grown = realloc(session->commands, new_capacity * sizeof(*grown));
+        if (grown == NULL) return -1;
+        session->commands = grown;
+        session->command_capacity = new_capacity;
+    }
+    char *copy = strdup(text);
+    if (copy == NULL) return -1;
+    session->commands[session->command_count].offset_ms = offset_ms < 0 ? 0 : offset_ms;
+    session->commands[session->command_count].text = copy;
+    session->command_count++;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Reads a server log and groups the logged commands into per-session
+ *   streams. A session starts at "Connection request from <ip> accepted on
+ *   port <port>" and ends at "Closing connection for <ip>:<port>."; every
+ *   "Client <ip>:<port> sent command: '<cmd>'" line in between belongs to it.
+ *
+ * Parameters:
+ *   path: The path of the server log.
+ *   sessions_out: Receives a malloc'ed array of sessions, in start order.
+ *   count_out: Receives the number of sessions.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+static int parse_log_file(const char *path, replay_session_t **sessions_out, size_t *count_out) {
+    FILE *log_file = fopen(path, "r");
+    if (log_file == NULL) {
+        perror("Cannot open server log");
+        return -1;
+    }
+
+    replay_session_t *sessions = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    // Indices of sessions that are currently open, looked up by client key.
+    size_t open_sessions[REPLAY_MAX_SESSIONS_LOOKUP];
+    size_t open_count = 0;
+
+    char line[MAX_BUFFER_SIZE + 128];
+    while (fgets(line, sizeof(line), log_file) != NULL) {
+        line[strcspn(line, "\r\n")] = 0;
+        long long line_ms;
+        if (parse_log_timestamp(line, &line_ms) != 0) continue;
+        const char *message = strchr(line, ' ');
+        if (message == NULL) continue;
+        message++;
+
+        char ip[INET_ADDRSTRLEN];
+        int port;
+        char key[sizeof(sessions[0].client_key)];
+
+        if (sscanf(message, "Connection request from %15s accepted on port %d", ip, &port) == 2) {
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                replay_session_t *grown = realloc(sessions, capacity * sizeof(*grown));
+                if (grown == NULL) {
+                    perror("realloc for sessions failed");
+                    abort();
+                }
+                sessions = grown;
+            }
+            replay_session_t *session = &sessions[count];
+            memset(session, 0, sizeof(*session));
+            snprintf(session->client_key, sizeof(session->client_key), "%s:%d", ip, port);
+            session->start_ms = line_ms;
+            if (open_count < REPLAY_MAX_SESSIONS_LOOKUP) open_sessions[open_count++] = count;
+            count++;
+            continue;
+        }
+
+        const char *key_end = NULL;
+        int is_command = 0;
+        if (strncmp(message, "Client ", 7) == 0 && (key_end = strstr(message, " sent command: '")) != NULL) {
+            is_command = 1;
+            message += 7;
+        } else if (strncmp(message, "Closing connection for ", 23) == 0) {
+            message += 23;
+            key_end = message + strlen(message);
+            if (key_end > message && key_end[-1] == '.') key_end--;
+        } else {
+            continue;
+        }
+
+        size_t key_len = (size_t)(key_end - message);
+        if (key_len == 0 || key_len >= sizeof(key)) continue;
+        memcpy(key, message, key_len);
+        key[key_len] = '\0';
+
+        size_t slot;
+        for (slot = 0; slot < open_count; slot++) {
+            if (strcmp(sessions[open_sessions[slot]].client_key, key) == 0) break;
+        }
+        if (slot == open_count) continue; // Session started before the log did
+
+        replay_session_t *session = &sessions[open_sessions[slot]];
+        if (is_command) {
+            const char *text = key_end + strlen(" sent command: '");
+            size_t text_len = strlen(text);
+            if (text_len > 0 && text[text_len - 1] == '\'') text_len--;
+            char command[MAX_BUFFER_SIZE];
+            snprintf(command, sizeof(command), "%.*s", (int)text_len, text);
+            if (append_command(session, line_ms - session->start_ms, command) != 0) {
+                perror("Allocating replay command failed");
+                abort();
+            }
+        } else {
+            open_sessions[slot] = open_sessions[--open_count];
+        }
+    }
+
+    if (ferror(log_file)) perror("Error reading server log");
+    fclose(log_file);
+
+    *sessions_out = sessions;
+    *count_out = count;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Waits for the reply to a command. It measures the time until the first
+ *   byte arrives and then discards output until the connection has been
+ *   silent for the quiet period, mirroring how the client detects the end of
+ *   a multi-line response.
+ *
+ * Parameters:
+ *   sockfd: The connected server socket.
+ *   first_timeout_ms: The maximum wait for the first byte.
+ *   quiet_ms: The silence that ends the response.
+ *   first_byte_us: Receives the time to the first byte, or -1 if none arrived.
+ *
+ * Returns:
+ *   0 when the response ended, or -1 if the connection closed or failed.
+ */
+static int drain_response(int sockfd, int first_timeout_ms, int quiet_ms, long long *first_byte_us) {
+    char buffer[MAX_BUFFER_SIZE];
+    struct timespec sent_at;
+    clock_gettime(CLOCK_MONOTONIC, &sent_at);
+    *first_byte_us = -1;
+
+    struct pollfd pfd;
+    pfd.fd = sockfd;
+    pfd.events = POLLIN;
+    int timeout = first_timeout_ms;
+    for (;;) {
+        int ready = poll(&pfd, 1, timeout);
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (ready == 0) return 0;
+
+        ssize_t nbytes = recv(sockfd, buffer, sizeof(buffer), 0);
+        if (nbytes == 0) return -1;
+        if (nbytes < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return -1;
+        }
+        if (*first_byte_us < 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            *first_byte_us = elapsed_us(&sent_at, &now);
+        }
+        timeout = quiet_ms;
+    }
+}
+
+/*
+ * Purpose:
+ *   Replays one recorded session: connects, waits for the welcome message and
+ *   sends every command at its (scaled) original offset, recording latencies.
+ *
+ * Parameters:
+ *   arg: A pointer to a session_thread_arg_t.
+ *
+ * Returns:
+ *   A void pointer (always NULL).
+ */
+static void *session_thread(void *arg) {
+    session_thread_arg_t *thread_arg = (session_thread_arg_t *)arg;
+    replay_context_t *ctx = thread_arg->ctx;
+    replay_session_t *session = thread_arg->session;
+    long long ignored;
+
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd == -1 || connect(sockfd, (struct sockaddr *)&ctx->server_addr, sizeof(ctx->server_addr)) == -1) {
+        perror("replay session connect failed");
+        if (sockfd != -1) close(sockfd);
+        pthread_mutex_lock(&ctx->lock);
+        ctx->failed_sessions++;
+        goto release_slot;
+    }
+
+    struct timespec session_start;
+    clock_gettime(CLOCK_MONOTONIC, &session_start);
+    if (drain_response(sockfd, REPLAY_RESPONSE_TIMEOUT_MS, ctx->quiet_ms, &ignored) != 0) {
+        close(sockfd);
+        pthread_mutex_lock(&ctx->lock);
+        ctx->failed_sessions++;
+        goto release_slot;
+    }
+
+    for (size_t i = 0; i < session->command_count; i++) {
+        replay_command_t *command = &session->commands[i];
+        if (ctx->time_scale > 0) {
+            sleep_until(&session_start, (long long)((double)command->offset_ms / ctx->time_scale));
+        }
+
+        char line[MAX_BUFFER_SIZE + 1];
+        int len = snprintf(line, sizeof(line), "%s\n", command->text);
+        if (len < 0 || send_all(sockfd, line, strlen(line)) == -1) break;
+
+        long long latency_us;
+        int status = drain_response(sockfd, REPLAY_RESPONSE_TIMEOUT_MS, ctx->quiet_ms, &latency_us);
+        if (latency_us >= 0) {
+            record_sample(ctx, command->text, latency_us);
+        } else {
+            pthread_mutex_lock(&ctx->lock);
+            ctx->timeouts++;
+            pthread_mutex_unlock(&ctx->lock);
+        }
+        if (status != 0) break; // QUIT or a dropped connection
+    }
+    close(sockfd);
+    pthread_mutex_lock(&ctx->lock);
+
+    release_slot:
+    ctx->active_sessions--;
+    pthread_cond_signal(&ctx->slot_cond);
+    pthread_mutex_unlock(&ctx->lock);
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Stores one latency measurement, keyed by the command's first word.
+ *
+ * Parameters:
+ *   ctx: The replay context.
+ *   command_text: The command that was replayed.
+ *   latency_us: The time to the first response byte in microseconds.
+ *
+ * Returns:
+ *   void
+ */
+static void record_sample(replay_context_t *ctx, const char *command_text, long long latency_us) {
+    latency_sample_t sample;
+    memset(&sample, 0, sizeof(sample));
+    if (command_text[0] == '@') {
+        snprintf(sample.command, sizeof(sample.command), "@");
+    } else {
+        size_t word_len = strcspn(command_text, " \t");
+        if (word_len >= sizeof(sample.command)) word_len = sizeof(sample.command) - 1;
+        memcpy(sample.command, command_text, word_len);
+    }
+    sample.latency_us = latency_us;
+
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->sample_count == ctx->sample_capacity) {
+        size_t new_capacity = ctx->sample_capacity ? ctx->sample_capacity * 2 : 1024;
+        latency_sample_t *grown = realloc(ctx->samples, new_capacity * sizeof(*grown));
+        if (grown == NULL) {
+            perror("realloc for latency samples failed");
+            abort();
+        }
+        ctx->samples = grown;
+        ctx->sample_capacity = new_capacity;
+    }
+    ctx->samples[ctx->sample_count++] = sample;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+/*
+ * Purpose:
+ *   qsort comparator ordering samples by command name, then by latency.
+ *
+ * Parameters:
+ *   a: The first latency_sample_t.
+ *   b: The second latency_sample_t.
+ *
+ * Returns:
+ *   A negative, zero or positive value, as required by qsort.
+ */
+static int compare_samples(const void *a, const void *b) {
+    const latency_sample_t *sa = (const latency_sample_t *)a;
+    const latency_sample_t *sb = (const latency_sample_t *)b;
+    int by_name = strcmp(sa->command, sb->command);
+    if (by_name != 0) return by_name;
+    return (sa->latency_us > sb->latency_us) - (sa->latency_us < sb->latency_us);
+}
+
+/*
+ * Purpose:
+ *   qsort comparator ordering raw latencies ascending.
+ *
+ * Parameters:
+ *   a: The first latency (long long).
+ *   b: The second latency (long long).
+ *
+ * Returns:
+ *   A negative, zero or positive value, as required by qsort.
+ */
+static int compare_latencies(const void *a, const void *b) {
+    long long la = *(const long long *)a;
+    long long lb = *(const long long *)b;
+    return (la > lb) - (la < lb);
+}
+
+/*
+ * Purpose:
+ *   Prints one line of latency statistics for an ordered run of samples.
+ *
+ * Parameters:
+ *   label: The row label (command name or "ALL").
+ *   latencies: The latencies in microseconds, sorted ascending.
+ *   count: The number of latencies.
+ *
+ * Returns:
+ *   void
+ */
+static void print_distribution(const char *label, const long long *latencies, size_t count) {
+    if (count == 0) return;
+    long long sum = 0;
+    for (size_t i = 0; i < count; i++) sum += latencies[i];
+    printf("%-10s %8zu %10.1f %10lld %10lld %10lld %10lld\n", label, count, (double)sum / (double)count,
+           latencies[(count * 50 + 99) / 100 - 1], latencies[(count * 90 + 99) / 100 - 1],
+           latencies[(count * 99 + 99) / 100 - 1], latencies[count - 1]);
+}
+
+/*
+ * Purpose:
+ *   Prints the latency distribution per command type and overall.
+ *
+ * Parameters:
+ *   ctx: The replay context holding all samples.
+ *   wall_seconds: The wall-clock duration of the replay.
+ *
+ * Returns:
+ *   void
+ */
+static void print_report(replay_context_t *ctx, double wall_seconds) {
+    printf("\nReplay finished in %.3f s: %zu responses, %zu without response, %zu failed sessions\n",
+           wall_seconds, ctx->sample_count, ctx->timeouts, ctx->failed_sessions);
+    if (ctx->server_cpu_ms >= 0) {
+        printf("CPU time: server %.3f s (%.1f us per response), replay tool %.3f s\n", (double)ctx->server_cpu_ms / 1000.0,
+               ctx->sample_count > 0 ? (double)ctx->server_cpu_ms * 1000.0 / (double)ctx->sample_count : 0.0,
+               ctx->tool_cpu_seconds);
+    } else {
+        printf("CPU time: server unknown (no STATS), replay tool %.3f s\n", ctx->tool_cpu_seconds);
+    }
+    if (ctx->sample_count == 0) return;
+
+    long long *latencies = malloc(ctx->sample_count * sizeof(long long));
+    if (latencies == NULL) {
+        perror("malloc for latency report failed");
+        return;
+    }
+
+    qsort(ctx->samples, ctx->sample_count, sizeof(latency_sample_t), compare_samples);
+    printf("Latency to first response byte (us):\n");
+    printf("%-10s %8s %10s %10s %10s %10s %10s\n", "command", "count", "mean", "p50", "p90", "p99", "max");
+
+    size_t run_start = 0;
+    for (size_t i = 1; i <= ctx->sample_count; i++) {
+        if (i == ctx->sample_count || strcmp(ctx->samples[i].command, ctx->samples[run_start].command) != 0) {
+            size_t run_len = i - run_start;
+            for (size_t j = 0; j < run_len; j++) latencies[j] = ctx->samples[run_start + j].latency_us;
+            print_distribution(ctx->samples[run_start].command[0] ? ctx->samples[run_start].command : "(empty)",
+                               latencies, run_len);
+            run_start = i;
+        }
+    }
+
+    for (size_t i = 0; i < ctx->sample_count; i++) latencies[i] = ctx->samples[i].latency_us;
+    qsort(latencies, ctx->sample_count, sizeof(long long), compare_latencies);
+    print_distribution("ALL", latencies, ctx->sample_count);
+    free(latencies);
+}
+
+/*
+ * Purpose:
+ *   Reads the total CPU time of the server's session threads from the STATS
+ *   command, over a connection of its own.
+ *
+ * Parameters:
+ *   ctx: The replay context (for the server address).
+ *   cpu_ms: Receives the CPU time in milliseconds.
+ *
+ * Returns:
+ *   0 on success, or -1 if the server did not report it.
+ */
+static int query_server_cpu(const replay_context_t *ctx, long *cpu_ms) {
+    long long ignored;
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd == -1 || connect(sockfd, (const struct sockaddr *)&ctx->server_addr, sizeof(ctx->server_addr)) == -1 ||
+        drain_response(sockfd, REPLAY_RESPONSE_TIMEOUT_MS, ctx->quiet_ms, &ignored) != 0) {
+        if (sockfd != -1) close(sockfd);
+        return -1;
+    }
+    struct timeval tv = {REPLAY_RESPONSE_TIMEOUT_MS / 1000, (REPLAY_RESPONSE_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    int result = -1;
+    char line[MAX_BUFFER_SIZE];
+    if (send_all(sockfd, CMD_STATS "\n", strlen(CMD_STATS) + 1) == 0) {
+        while (recv_line(sockfd, line, sizeof(line)) > 0) {
+            if (strncmp(line, "total ", 6) != 0) continue;
+            const char *field = strstr(line, " cpu_ms ");
+            if (field != NULL && sscanf(field, " cpu_ms %ld", cpu_ms) == 1) result = 0;
+            break;
+        }
+    }
+    send_all(sockfd, CMD_QUIT "\n", strlen(CMD_QUIT) + 1);
+    close(sockfd);
+    return result;
+}
+
+/*
+ * Purpose:
+ *   Returns the user and system CPU time used so far by this process.
+ *
+ * Parameters:
+ *   None.
+ *
+ * Returns:
+ *   The CPU time in seconds.
+ */
+static double process_cpu_seconds(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == -1) return 0.0;
+    return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/*
+ * Purpose:
+ *   Sleeps until a given offset after a base time on the monotonic clock.
+ *
+ * Parameters:
+ *   base: The reference time.
+ *   offset_ms: The offset in milliseconds; non-positive offsets return at once.
+ *
+ * Returns:
+ *   void
+ */
+static void sleep_until(const struct timespec *base, long long offset_ms) {
+    if (offset_ms <= 0) return;
+    struct timespec target = *base;
+    target.tv_sec += (time_t)(offset_ms / 1000);
+    target.tv_nsec += (long)(offset_ms % 1000) * 1000000L;
+    if (target.tv_nsec >= 1000000000L) {
+        target.tv_sec++;
+        target.tv_nsec -= 1000000000L;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, NULL) == EINTR) {
+    }
+}
+
+/*
+ * Purpose:
+ *   Computes the number of microseconds between two monotonic time points.
+ *
+ * Parameters:
+ *   from: The earlier time.
+ *   to: The later time.
+ *
+ * Returns:
+ *   The difference in microseconds.
+ */
+static long long elapsed_us(const struct timespec *from, const struct timespec *to) {
+    return (long long)(to->tv_sec - from->tv_sec) * 1000000LL + (to->tv_nsec - from->tv_nsec) / 1000;
+}
@@ -5,7 +5,14 @@
  * connections, spawning a new thread for each one. The server restricts all
  * file operations to a specified root directory ("jail") for security. It
  * processes commands like LIST, CD, and executes server-side scripts requested
- * via the '@' command.
+ * via the '@' command. Directory listings are served from a cache that can be
+ * persisted to an on-disk index for a warm start after restarts. An optional
+ * filename index answers LOCATE queries without walking the tree, and an
+ * optional trigram index narrows GREP down to candidate files. Several named
+ * roots can be served by one process; a client picks one with ROOT at the start
+ * of its session and stays jailed inside it. Expensive commands can be
+ * submitted with JOB to run on a bounded pool of background threads, so a
+ * client can disconnect and collect the result later.
  */
 #define _POSIX_C_SOURCE 200809L
 #define _XOPEN_SOURCE 700 // For realpath, dirname
@@ -14,6 +21,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/un.h>     // For sockaddr_un
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <pthread.h>
@@ -21,19 +29,68 @@
 #include <limits.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <stdarg.h>
 #include <signal.h> // For signal handling
 #include <ctype.h>  // For isspace
+#include <sys/wait.h> // For waitpid
+#include <stdatomic.h>
 
 #include "common.h"
 #include "protocol.h"
+#include "dir_cache.h"
+#include "dir_changes.h"
+#include "dir_index.h"
+#include "prewarm.h"
+#include "name_index.h"
+#include "trigram_index.h"
+#include "ktls.h"
+#include "server_stats.h"
+#include "shm_channel.h"
+#include "job_queue.h"
+#include "sha256.h"
+#include "tree_hash.h"
+#include "tree_digest.h"
+#include "batch_stat.h"
+#include "glob_match.h"
+#include "entry_filter.h"
+#include "top_files.h"
+#include "line_count.h"
 
 #ifndef NAME_MAX
 #define NAME_MAX 255
 #endif
 
 #define MAX_SCRIPT_DEPTH 5 // Prevents infinite recursion in @ command
+#define REPLY_BLOCK_SIZE (16 * 1024) // Multi-line replies are sent in blocks of this size
+#define MAX_ROOTS 64
+#define MAX_ROOT_NAME_LEN 64
+#define DEFAULT_ROOT_NAME "default"
+#define LOCATE_DEFAULT_MAX_RESULTS 1000
+#define GREP_DEFAULT_MAX_MATCHES 1000
+#define COMPLETE_MAX_RESULTS 256
+#define MAX_GREP_SUBTREES 64
+#define MAX_WORKERS 64
+#define WORKER_RESPAWN_MIN_SEC 1 // A worker that dies sooner is restarted after this delay
+#define MAX_BUSY_POLL_USEC 100000
+#define CANCEL_CHECK_INTERVAL 256 // Loop iterations between looks at the client's input
+#define MAX_JOB_THREADS 64
+#define JOB_FETCH_MAX_BYTES (1024 * 1024) // Largest slice of job output sent by one FETCH
+#define HASH_READ_BLOCK (64 * 1024)
+#define MAX_LIST_PATTERNS 32
+#define TOP_DEFAULT_COUNT 10
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46 // Linux; not exposed by glibc under strict POSIX feature macros
+#endif
+
+#ifdef WITH_TLS
+#define TLS_OPTSTRING "S:K:"
+#define TLS_USAGE " [-S cert_file -K key_file]"
+#else
+#define TLS_OPTSTRING ""
+#define TLS_USAGE ""
+#endif
 
 typedef struct client_thread_data_s {
     int client_sockfd;
@@ -42,34 +99,167 @@ typedef struct client_thread_data_s {
     char server_root_abs[MAX_PATH_LEN];
     char current_wd_abs[MAX_PATH_LEN];
     int script_depth; // For tracking nested @ calls
+    int root_locked;  // Set after the first command; ROOT is no longer allowed
+    int local;        // Same-host session over a shared-memory channel
+    unsigned long request_id;  // Number of the running command; CANCEL lines are not counted
+    int cancel_state;          // CANCEL_* for the running command
+    unsigned int cancel_polls; // request_cancelled() calls since the input was last checked
+    int in_job;       // Running as a background job, whose output is collected by the job queue
 } client_thread_data_t;
 
+// Why a running command stops early.
+enum {
+    CANCEL_NONE,
+    CANCEL_REQUESTED, // CANCEL for the running request is waiting in the client's input
+    CANCEL_PEER_GONE  // The client closed the connection
+};
+
+typedef struct server_root_s {
+    char name[MAX_ROOT_NAME_LEN];
+    char path[MAX_PATH_LEN]; // Absolute, resolved path of the jail
+} server_root_t;
+
+// Accumulates a multi-line reply so it is sent in large blocks.
+typedef struct reply_buffer_s {
+    client_thread_data_t *data;
+    size_t used;
+    int failed; // Set once sending to the client failed
+    char block[REPLY_BLOCK_SIZE];
+} reply_buffer_t;
+
+// What a selective LIST sends: entries whose names match one of the patterns
+// (or any name if there are none) and whose metadata passes the predicate.
+typedef struct list_filter_s {
+    glob_pattern_t *globs[MAX_LIST_PATTERNS];
+    size_t count;
+    entry_filter_t *predicate; // NULL for none
+    int recursive;
+} list_filter_t;
+
+// A directory of a recursive LIST waiting to be listed.
+typedef struct list_pending_s {
+    char *path;   // Absolute
+    char *prefix; // Relative to the listed directory; "" or ending with '/'
+    struct list_pending_s *next;
+} list_pending_t;
+
+// State of one GREP request while files are searched.
+typedef struct grep_state_s {
+    reply_buffer_t *reply;
+    const char *root_path; // Paths are reported relative to this root
+    const char *needle;
+    size_t remaining;      // Matching lines that may still be sent
+    size_t files_searched;
+} grep_state_t;
+
+// Totals of one DU request.
+typedef struct du_totals_s {
+    unsigned long long bytes;      // Sum of the file sizes
+    unsigned long long disk_bytes; // Space allocated on disk
+    unsigned long files;
+    unsigned long dirs;
+    unsigned long unreadable;      // Entries that could not be examined
+} du_totals_t;
+
 // Global variables for handling graceful shutdown.
 static volatile sig_atomic_t g_shutdown_flag = 0;
 static int g_server_sockfd = -1;
-static char server_root_global[MAX_PATH_LEN];
+static server_root_t g_roots[MAX_ROOTS]; // g_roots[0] is the default root
+static size_t g_root_count = 0;
+static const char *g_index_path = NULL; // Persistent directory index, if enabled
+static int g_name_index_enabled = 0;    // Set by -L
+static char g_grep_subtrees[MAX_GREP_SUBTREES][MAX_PATH_LEN]; // Subtrees with a trigram index (-T)
+static size_t g_grep_subtree_count = 0;
+static unsigned int g_index_interval = DIR_INDEX_DEFAULT_INTERVAL_SEC;
+static size_t g_max_cached_dirs = DIR_CACHE_DEFAULT_MAX_LISTINGS;
+static const char *g_prewarm_manifest = NULL;
+static size_t g_prewarm_hottest = 0;
+static size_t g_worker_count = 0;       // Prefork workers (-P); 0 serves from this process
+static const char *g_local_socket_path = NULL; // Unix socket for same-host clients (-U)
+static int g_local_sockfd = -1;
+static long g_busy_poll_usec = 0;       // Spin budget before a session blocks (-B)
+static unsigned int g_job_threads = JOB_DEFAULT_THREADS; // Background job threads (-J); 0 (and -P) disables JOB
+static const char *g_spool_dir = NULL;  // Directory for large job results (-D)
+// Commands that may run as background jobs: those that only read the tree.
+static const char *const g_job_commands[] = { CMD_LIST, CMD_LOCATE, CMD_GREP, CMD_DU, CMD_HASH, CMD_TREEHASH, CMD_TOP, CMD_WC };
+#ifdef WITH_TLS
+static int g_tls_enabled = 0;           // Set by -S and -K
+#endif
 
 // Function Prototypes
 static void *client_handler_thread(void *arg);
 static int process_client_command(client_thread_data_t *data, char *command_line);
 static void log_event(const char *format, ...);
 static void handle_cd(client_thread_data_t *data, const char *path_arg);
-static void handle_list(client_thread_data_t *data);
+static void handle_list(client_thread_data_t *data, const char *args);
+static void handle_listdiff(client_thread_data_t *data, const char *token);
+static void list_matching(client_thread_data_t *data, const char *args);
+static int list_directory(client_thread_data_t *data, list_filter_t *filter, reply_buffer_t *reply, const list_pending_t *dir, list_pending_t **pending);
+static void list_tree(client_thread_data_t *data, list_filter_t *filter, reply_buffer_t *reply);
+static list_pending_t *list_pending_new(const char *path, const char *prefix);
+static void list_pending_free(list_pending_t *item);
+static int list_filter_accepts(const char *name, void *ctx);
 static void handle_at_command(client_thread_data_t *data, const char *filename);
+static void handle_root(client_thread_data_t *data, const char *name_arg);
+static void handle_locate(client_thread_data_t *data, const char *args);
+static void handle_grep(client_thread_data_t *data, const char *args);
+static void handle_complete(client_thread_data_t *data, const char *word);
+static void handle_stats(client_thread_data_t *data);
+static void handle_cancel(client_thread_data_t *data, const char *args);
+static void handle_du(client_thread_data_t *data, const char *path_arg);
+static void handle_hash(client_thread_data_t *data, const char *args);
+static int sha256_file(client_thread_data_t *data, int fd, unsigned char digest[SHA256_DIGEST_SIZE]);
+static void handle_treehash(client_thread_data_t *data, const char *args);
+static void handle_stat(client_thread_data_t *data, const char *args);
+static void handle_top(client_thread_data_t *data, const char *args);
+static void handle_wc(client_thread_data_t *data, const char *args);
+static int tree_digest_cancelled(void *ctx);
+static void handle_job(client_thread_data_t *data, const char *args);
+static void run_job_command(int output_fd, const char *command, const void *context);
+static int job_command_allowed(const char *command_line);
+static void job_command_names(char *buffer, size_t size);
+static void du_tree(client_thread_data_t *data, const char *dir_path, du_totals_t *totals);
+static int path_stack_push(char ***stack, size_t *count, size_t *capacity, const char *path);
+static int is_cancel_command(const char *line);
+static int poll_for_cancel(client_thread_data_t *data);
+static int request_cancelled(client_thread_data_t *data);
+static int session_cancel_check(void *ctx);
+static int start_services(int write_index);
+static int run_worker(size_t worker_index, int restarted);
+static int supervise_workers(void);
+static pid_t spawn_worker(size_t worker_index, int restarted);
+static int open_local_listener(const char *path);
+static void *local_accept_thread(void *arg);
+static void start_session(int client_sockfd, const char *client_ip, int client_port, int local);
+static void enable_socket_busy_poll(int sockfd);
+static long thread_cpu_usec(void);
+static int resolve_session_path(client_thread_data_t *data, const char *path_arg, char *resolved, size_t size);
+static void grep_file(grep_state_t *state, const char *path);
+static void grep_tree(grep_state_t *state, const char *dir_path);
+static int add_grep_subtree(const char *path);
+static int add_server_root(const char *name, const char *path);
 static char *get_relative_path(const char *abs_path, const char *root_path, char *rel_path_buf, size_t buf_len);
 static void format_list_item(char *buffer, size_t buf_size, const char *name, const char *middle, const char *target, const char *suffix);
+static void format_listing_entry(char *buffer, size_t buf_size, const dir_cache_entry_t *entry);
+static void reply_init(reply_buffer_t *reply, client_thread_data_t *data);
+static int reply_append(reply_buffer_t *reply, const char *text, size_t len);
+static int reply_flush(reply_buffer_t *reply);
 static void signal_handler(int signum);
+static void start_prewarm(const char *manifest_path, size_t hottest_count);
+static void prewarm_finished(size_t warmed, size_t failed, double seconds);
 
 /*
  * Purpose:
- *   The main entry point for the server application. It initializes the server,
- *   sets up a listening socket on a specified port, and enters an infinite
- *   loop to accept and handle incoming client connections, each in a new thread.
+ *   The main entry point for the server application. It initializes the server
+ *   and sets up a listening socket on a specified port. Connections are then
+ *   accepted by this process, or with -P by prefork worker processes that the
+ *   process supervises.
  *
  * Parameters:
  *   argc: The number of command-line arguments.
  *   argv: An array of command-line argument strings. The expected usage is:
- *         ./myserver <port_no> <root_directory>
+ *         ./myserver [-i index_file] [-I save_interval_sec] [-C max_cached_dirs] [-w prewarm_manifest] [-W hottest_count] [-r name=root_directory]... [-L] [-T grep_subtree]... [-P workers] [-U local_socket] [-B busy_poll_usec] [-J job_threads] [-D spool_dir] [-S cert_file -K key_file] <port_no> <root_directory>
+ *         (-S and -K only when built with TLS=1)
  *
  * Returns:
  *   0 on successful shutdown, and 1 on error.
@@ -77,10 +267,141 @@ static void signal_handler(int signum);
 int main(int argc, char *argv[]) {
     initialize_static_memory();
 
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <port_no> <root_directory>\n", argv[0]);
+    char *named_roots[MAX_ROOTS];
+    size_t named_root_count = 0;
+    const char *grep_subtrees[MAX_GREP_SUBTREES];
+    size_t grep_subtree_count = 0;
+    int job_threads_given = 0;
+#ifdef WITH_TLS
+    const char *tls_cert = NULL;
+    const char *tls_key = NULL;
+#endif
+    char *endptr;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:I:C:w:W:r:LT:P:U:B:J:D:" TLS_OPTSTRING)) != -1) {
+        switch (opt) {
+            case 'i':
+                g_index_path = optarg;
+                break;
+            case 'I': {
+                long value = strtol(optarg, &endptr, 10);
+                if (endptr == optarg || *endptr != '\0' || value <= 0 || value > 86400) {
+                    fprintf(stderr, "Error: Invalid index save interval '%s'.\n", optarg);
+                    return 1;
+                }
+                g_index_interval = (unsigned int)value;
+                break;
+            }
+            case 'C': {
+                long value = strtol(optarg, &endptr, 10);
+                if (endptr == optarg || *endptr != '\0' || value <= 0) {
+                    fprintf(stderr, "Error: Invalid directory cache size '%s'.\n", optarg);
+                    return 1;
+                }
+                g_max_cached_dirs = (size_t)value;
+                break;
+            }
+            case 'w':
+                g_prewarm_manifest = optarg;
+                break;
+            case 'W': {
+                long value = strtol(optarg, &endptr, 10);
+                if (endptr == optarg || *endptr != '\0' || value <= 0) {
+                    fprintf(stderr, "Error: Invalid number of hottest directories '%s'.\n", optarg);
+                    return 1;
+                }
+                g_prewarm_hottest = (size_t)value;
+                break;
+            }
+            case 'r':
+                if (named_root_count == MAX_ROOTS - 1) {
+                    fprintf(stderr, "Error: At most %d named roots are supported.\n", MAX_ROOTS - 1);
+                    return 1;
+                }
+                named_roots[named_root_count++] = optarg;
+                break;
+            case 'L':
+                g_name_index_enabled = 1;
+                break;
+            case 'T':
+                if (grep_subtree_count == MAX_GREP_SUBTREES) {
+                    fprintf(stderr, "Error: At most %d trigram-indexed subtrees are supported.\n", MAX_GREP_SUBTREES);
+                    return 1;
+                }
+                grep_subtrees[grep_subtree_count++] = optarg;
+                break;
+            case 'P': {
+                long value = strtol(optarg, &endptr, 10);
+                if (endptr == optarg || *endptr != '\0' || value <= 0 || value > MAX_WORKERS) {
+                    fprintf(stderr, "Error: Invalid number of worker processes '%s' (1 to %d).\n", optarg, MAX_WORKERS);
+                    return 1;
+                }
+                g_worker_count = (size_t)value;
+                break;
+            }
+            case 'U':
+                g_local_socket_path = optarg;
+                break;
+            case 'B': {
+                long value = strtol(optarg, &endptr, 10);
+                if (endptr == optarg || *endptr != '\0' || value < 0 || value > MAX_BUSY_POLL_USEC) {
+                    fprintf(stderr, "Error: Invalid busy-poll budget '%s' (0 to %d microseconds).\n", optarg, MAX_BUSY_POLL_USEC);
+                    return 1;
+                }
+                g_busy_poll_usec = value;
+                break;
+            }
+            case 'J': {
+                long value = strtol(optarg, &endptr, 10);
+                if (endptr == optarg || *endptr != '\0' || value < 0 || value > MAX_JOB_THREADS) {
+                    fprintf(stderr, "Error: Invalid number of job threads '%s' (0 to %d).\n", optarg, MAX_JOB_THREADS);
+                    return 1;
+                }
+                g_job_threads = (unsigned int)value;
+                job_threads_given = 1;
+                break;
+            }
+            case 'D':
+                g_spool_dir = optarg;
+                break;
+#ifdef WITH_TLS
+            case 'S':
+                tls_cert = optarg;
+                break;
+            case 'K':
+                tls_key = optarg;
+                break;
+#endif
+            default:
+                fprintf(stderr, "Usage: %s [-i index_file] [-I save_interval_sec] [-C max_cached_dirs] [-w prewarm_manifest] [-W hottest_count] [-r name=root_directory]... [-L] [-T grep_subtree]... [-P workers] [-U local_socket] [-B busy_poll_usec] [-J job_threads] [-D spool_dir]" TLS_USAGE " <port_no> <root_directory>\n", argv[0]);
+                return 1;
+        }
+    }
+    if (g_prewarm_hottest > 0 && g_index_path == NULL) {
+        fprintf(stderr, "Error: -W needs the request statistics of a directory index (-i).\n");
         return 1;
     }
+    if (g_worker_count > 0) {
+        // Each worker would keep its own job table, so a job could not be
+        // fetched from a connection that reaches another worker.
+        if ((job_threads_given && g_job_threads > 0) || g_spool_dir != NULL) {
+            fprintf(stderr, "Error: Background jobs (-J, -D) are not available in prefork mode (-P).\n");
+            return 1;
+        }
+        g_job_threads = 0;
+    }
+#ifdef WITH_TLS
+    if ((tls_cert == NULL) != (tls_key == NULL)) {
+        fprintf(stderr, "Error: TLS needs both a certificate (-S) and a private key (-K).\n");
+        return 1;
+    }
+#endif
+    if (argc - optind != 2) {
+        fprintf(stderr, "Usage: %s [-i index_file] [-I save_interval_sec] [-C max_cached_dirs] [-w prewarm_manifest] [-W hottest_count] [-r name=root_directory]... [-L] [-T grep_subtree]... [-P workers] [-U local_socket] [-B busy_poll_usec] [-J job_threads] [-D spool_dir]" TLS_USAGE " <port_no> <root_directory>\n", argv[0]);
+        return 1;
+    }
+    const char *port_arg = argv[optind];
+    const char *root_arg = argv[optind + 1];
 
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
@@ -96,29 +417,52 @@ int main(int argc, char *argv[]) {
         perror("sigaction for SIGTERM failed");
         return 1;
     }
+    // A client that disconnects in the middle of a reply must not kill the server.
+    sa.sa_handler = SIG_IGN;
+    if (sigaction(SIGPIPE, &sa, NULL) == -1) {
+        perror("sigaction for SIGPIPE failed");
+        return 1;
+    }
 
-    char *endptr;
-    long port_long = strtol(argv[1], &endptr, 10);
-    if (endptr == argv[1] || *endptr != '\0' || port_long <= 0 || port_long > 65535) {
-        fprintf(stderr, "Error: Invalid port number '%s'. Must be an integer between 1 and 65535.\n", argv[1]);
+    long port_long = strtol(port_arg, &endptr, 10);
+    if (endptr == port_arg || *endptr != '\0' || port_long <= 0 || port_long > 65535) {
+        fprintf(stderr, "Error: Invalid port number '%s'. Must be an integer between 1 and 65535.\n", port_arg);
         return 1;
     }
     uint16_t port = (uint16_t)port_long;
 
-    if (realpath(argv[2], server_root_global) == NULL) {
-        perror("Error resolving server root directory (realpath)");
+    if (add_server_root(DEFAULT_ROOT_NAME, root_arg) == -1) {
         return 1;
     }
-    struct stat root_stat;
-    if (stat(server_root_global, &root_stat) != 0) {
-        perror("Error stating server root directory (stat)");
-        return 1;
+    log_event("Server root set to: %s", g_roots[0].path);
+    for (size_t i = 0; i < named_root_count; i++) {
+        char *separator = strchr(named_roots[i], '=');
+        if (separator == NULL) {
+            fprintf(stderr, "Error: Named root '%s' must be given as name=directory.\n", named_roots[i]);
+            return 1;
+        }
+        *separator = '\0';
+        if (add_server_root(named_roots[i], separator + 1) == -1) {
+            return 1;
+        }
+        log_event("Named root '%s' set to: %s", g_roots[g_root_count - 1].name, g_roots[g_root_count - 1].path);
     }
-    if (!S_ISDIR(root_stat.st_mode)) {
-        fprintf(stderr, "Error: Server root '%s' is not a directory.\n", server_root_global);
-        return 1;
+
+#ifdef WITH_TLS
+    if (tls_cert != NULL) {
+        if (ktls_server_init(tls_cert, tls_key) == -1) {
+            return 1;
+        }
+        g_tls_enabled = 1;
+        log_event("TLS enabled with certificate '%s'", tls_cert);
+    }
+#endif
+
+    for (size_t i = 0; i < grep_subtree_count; i++) {
+        if (add_grep_subtree(grep_subtrees[i]) == -1) {
+            return 1;
+        }
     }
-    log_event("Server root set to: %s", server_root_global);
 
     g_server_sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (g_server_sockfd == -1) {
@@ -151,498 +495,2930 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    log_event("Ready. Listening on port %u", port);
-
-    while (!g_shutdown_flag) {
-        struct sockaddr_in client_addr;
-        socklen_t client_addr_len = sizeof(client_addr);
-        int client_sockfd = accept(g_server_sockfd, (struct sockaddr *)&client_addr, &client_addr_len);
-        if (client_sockfd == -1) {
-            if (errno == EINTR && g_shutdown_flag) break;
-            if (errno == EINTR) continue;
-            perror("accept failed");
-            continue;
-        }
-
-        client_thread_data_t *thread_data = malloc(sizeof(client_thread_data_t));
-        if (thread_data == NULL) {
-            perror("malloc for thread_data failed");
-            close(client_sockfd);
-            abort();
+    if (g_local_socket_path != NULL) {
+        g_local_sockfd = open_local_listener(g_local_socket_path);
+        if (g_local_sockfd == -1) {
+            close(g_server_sockfd);
+            return 1;
         }
+    }
 
-        thread_data->client_sockfd = client_sockfd;
-        inet_ntop(AF_INET, &client_addr.sin_addr, thread_data->client_ip, INET_ADDRSTRLEN);
-        thread_data->client_port = ntohs(client_addr.sin_port);
-        thread_data->script_depth = 0;
-
-        strncpy(thread_data->server_root_abs, server_root_global, MAX_PATH_LEN);
-        strncpy(thread_data->current_wd_abs, server_root_global, MAX_PATH_LEN);
-
-        log_event("Connection request from %s accepted on port %d", thread_data->client_ip, thread_data->client_port);
-
-        pthread_t tid;
-        if (pthread_create(&tid, NULL, client_handler_thread, thread_data) != 0) {
-            perror("pthread_create failed");
-            free(thread_data);
-            close(client_sockfd);
-        } else {
-            pthread_detach(tid);
+    if (g_spool_dir != NULL && g_job_threads > 0) {
+        if (job_queue_set_spool_dir(g_spool_dir) == -1) {
+            close(g_server_sockfd);
+            return 1;
         }
+        log_event("Job results over %d KiB are spooled to '%s'", JOB_SPOOL_THRESHOLD / 1024, g_spool_dir);
     }
 
-    log_event("Shutdown signal received. Closing listener socket.");
-    if (close(g_server_sockfd) == -1) perror("close server_sockfd failed");
-    log_event("Server shut down.");
-    return 0;
-}
+    if (server_stats_init(g_worker_count > 0 ? g_worker_count : 1) == -1) {
+        perror("mmap for statistics segment failed");
+        close(g_server_sockfd);
+        return 1;
+    }
+    log_event("Ready. Listening on port %u", port);
+    if (g_local_sockfd != -1) {
+        log_event("Same-host clients accepted on '%s'", g_local_socket_path);
+    }
+    if (g_busy_poll_usec > 0) {
+        transport_set_busy_poll(g_busy_poll_usec);
+        log_event("Busy-polling sessions for up to %ld us before blocking", g_busy_poll_usec);
+    }
 
-/*
- * Purpose:
- *   A signal handler that catches SIGINT and SIGTERM to set a global flag,
- *   allowing the main accept loop to terminate gracefully.
- *
- * Parameters:
- *   signum: The signal number that was caught.
- *
- * Returns:
- *   void
- */
-static void signal_handler(int signum) {
-    if (signum == SIGINT || signum == SIGTERM) {
-        g_shutdown_flag = 1;
+    if (g_worker_count > 0) {
+        return supervise_workers();
     }
+    return run_worker(0, 0);
 }
 
 /*
  * Purpose:
- *   The main function for each client thread. It handles all communication with
- *   a single connected client, reading commands and dispatching them for processing
- *   until the client disconnects or sends a QUIT command.
+ *   Starts the per-process services: the directory cache (loaded from the
+ *   index if one is configured), the filename and trigram indexes, the
+ *   background job pool and the prewarm. Each prefork worker runs this
+ *   after it is forked, because threads do not survive fork().
  *
  * Parameters:
- *   arg: A void pointer to a dynamically allocated client_thread_data_t struct
- *        containing connection-specific information.
+ *   write_index: Nonzero if this process saves the directory index; with
+ *                several workers only one of them may write the file.
  *
  * Returns:
- *   A void pointer (always NULL).
+ *   0 on success, or -1 on error.
  */
-static void *client_handler_thread(void *arg) {
-    client_thread_data_t *data = (client_thread_data_t *)arg;
-    char buffer[MAX_BUFFER_SIZE];
-    ssize_t nbytes;
-
-    if (send_all(data->client_sockfd, SERVER_DEFAULT_WELCOME_MSG, strlen(SERVER_DEFAULT_WELCOME_MSG)) == -1) {
-        log_event("Error sending welcome message to %s:%d.", data->client_ip, data->client_port);
-        goto cleanup;
+static int start_services(int write_index) {
+    if (dir_cache_init(g_max_cached_dirs) == -1) {
+        return -1;
+    }
+    if (g_index_path != NULL) {
+        size_t loaded = 0, stale = 0;
+        if (dir_index_load(g_index_path, &loaded, &stale) == 0) {
+            log_event("Directory index '%s': %zu listings loaded, %zu out of date", g_index_path, loaded, stale);
+        } else {
+            log_event("Directory index '%s' could not be loaded; starting with a cold cache", g_index_path);
+        }
+        if (write_index && dir_index_start_writer(g_index_path, g_index_interval) == -1) {
+            return -1;
+        }
     }
 
-    while ((nbytes = recv_line(data->client_sockfd, buffer, MAX_BUFFER_SIZE)) > 0) {
-        buffer[strcspn(buffer, "\r\n")] = 0;
-        log_event("Client %s:%d sent command: '%s'", data->client_ip, data->client_port, buffer);
-
-        if (process_client_command(data, buffer) != 0) {
-            break;
+    if (g_name_index_enabled) {
+        const char *root_paths[MAX_ROOTS];
+        for (size_t i = 0; i < g_root_count; i++) root_paths[i] = g_roots[i].path;
+        if (name_index_start(root_paths, g_root_count, NAME_INDEX_DEFAULT_THREADS) == -1) {
+            return -1;
+        }
+        log_event("Building filename index in the background");
+    }
+    if (g_grep_subtree_count > 0) {
+        const char *subtree_paths[MAX_GREP_SUBTREES];
+        for (size_t i = 0; i < g_grep_subtree_count; i++) subtree_paths[i] = g_grep_subtrees[i];
+        if (trigram_index_start(subtree_paths, g_grep_subtree_count, TRIGRAM_INDEX_DEFAULT_THREADS, TRIGRAM_INDEX_RESCAN_SEC) == -1) {
+            return -1;
         }
+        log_event("Building trigram index of %zu subtrees in the background", g_grep_subtree_count);
     }
 
-    if (nbytes == 0) {
-        log_event("Client %s:%d disconnected (received EOF).", data->client_ip, data->client_port);
-    } else if (nbytes == -1) {
-        log_event("Error receiving data from %s:%d.", data->client_ip, data->client_port);
+    if (tree_digest_init() == -1) {
+        log_event("Directory digests will not be cached");
     }
 
-    cleanup:
-    log_event("Closing connection for %s:%d.", data->client_ip, data->client_port);
-    if (close(data->client_sockfd) == -1) {
-        perror("close client_sockfd failed in client_handler_thread");
+    if (g_job_threads > 0) {
+        if (job_queue_start(g_job_threads, sizeof(client_thread_data_t), run_job_command) == -1) {
+            return -1;
+        }
+        log_event("Running background jobs on %u threads", g_job_threads);
     }
-    free(data);
-    pthread_exit(NULL);
+
+    start_prewarm(g_prewarm_manifest, g_prewarm_hottest);
+    return 0;
 }
 
 /*
  * Purpose:
- *   Acts as a central dispatcher for all client commands. It parses the command
- *   line, identifies the primary command, and calls the appropriate handler function.
+ *   Serves connections on the listening socket until a shutdown signal:
+ *   accepts each connection and handles it in a new thread. This is the
+ *   whole server without -P, and the body of each prefork worker with it.
  *
  * Parameters:
- *   data: A pointer to the client's thread-specific data structure.
- *   command_line: The raw command string received from the client.
+ *   worker_index: The worker number (0 without -P); selects the statistics
+ *                 slot, and worker 0 is the one that saves the index.
+ *   restarted: Nonzero if this worker replaces one that died.
  *
  * Returns:
- *   0 to continue the client session, or 1 to terminate it (e.g., on QUIT).
+ *   0 on shutdown, or 1 if the services could not be started.
  */
-static int process_client_command(client_thread_data_t *data, char *command_line) {
-    char command[MAX_CMD_LEN];
-    char cmd_arg[MAX_ARGS_LEN];
-    char response[MAX_BUFFER_SIZE];
-
-    char *cmd_start = command_line;
-    while (*cmd_start && isspace((unsigned char)*cmd_start)) {
-        cmd_start++;
+static int run_worker(size_t worker_index, int restarted) {
+    server_stats_attach(worker_index, restarted);
+    if (start_services(worker_index == 0) == -1) {
+        return 1;
     }
-
-    if (*cmd_start == '@') {
-        const char *filename = cmd_start + 1;
-        while (*filename && isspace((unsigned char)*filename)) {
-            filename++;
+    if (g_local_sockfd != -1) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, local_accept_thread, NULL) != 0) {
+            perror("pthread_create for local listener failed");
+            return 1;
         }
-        handle_at_command(data, filename);
-        return 0;
+        pthread_detach(tid);
     }
 
-    memset(command, 0, sizeof(command));
-    memset(cmd_arg, 0, sizeof(cmd_arg));
-    response[0] = '\0';
-
-    sscanf(cmd_start, "%s %[^\n]", command, cmd_arg);
-
-    if (strcmp(command, CMD_ECHO) == 0) {
-        snprintf(response, sizeof(response), "%s\n", cmd_arg);
-    } else if (strcmp(command, CMD_QUIT) == 0) {
-        snprintf(response, sizeof(response), "%s\n", RESP_BYE);
-        send_all(data->client_sockfd, response, strlen(response));
-        return 1;
-    } else if (strcmp(command, CMD_INFO) == 0) {
-        snprintf(response, sizeof(response), "%s", SERVER_DEFAULT_WELCOME_MSG);
-    } else if (strcmp(command, CMD_CD) == 0) {
-        handle_cd(data, cmd_arg);
-        return 0;
-    } else if (strcmp(command, CMD_LIST) == 0) {
-        handle_list(data);
-        return 0;
-    } else {
-        if (strlen(command) > 0) {
-            snprintf(response, sizeof(response), "%sUnknown command: %s\n", RESP_ERROR_PREFIX, command);
+    while (!g_shutdown_flag) {
+        struct sockaddr_in client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        int client_sockfd = accept(g_server_sockfd, (struct sockaddr *)&client_addr, &client_addr_len);
+        if (client_sockfd == -1) {
+            if (errno == EINTR && g_shutdown_flag) break;
+            if (errno == EINTR) continue;
+            perror("accept failed");
+            continue;
         }
+        char client_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
+        start_session(client_sockfd, client_ip, ntohs(client_addr.sin_port), 0);
     }
 
-    if (strlen(response) > 0) {
-        if (send_all(data->client_sockfd, response, strlen(response)) == -1) {
-            return 1;
-        }
+    if (g_worker_count > 0) {
+        log_event("Worker %zu stopping.", worker_index);
+    } else {
+        log_event("Shutdown signal received. Closing listener socket.");
+    }
+    if (close(g_server_sockfd) == -1) perror("close server_sockfd failed");
+    if (g_worker_count == 0 && g_local_sockfd != -1) unlink(g_local_socket_path);
+    if (worker_index == 0 && g_index_path != NULL && dir_index_save(g_index_path) == 0) {
+        log_event("Directory index saved to '%s'", g_index_path);
+    }
+    if (g_worker_count == 0) {
+        log_event("Server shut down.");
     }
     return 0;
 }
 
 /*
  * Purpose:
- *   Prints a formatted log message to standard output, prefixed with a timestamp.
- *   This function is variadic, accepting arguments like printf.
+ *   Starts the thread that handles a newly accepted connection.
  *
  * Parameters:
- *   format: A printf-style format string for the log message.
- *   ...: A variable number of arguments corresponding to the format string.
+ *   client_sockfd: The accepted socket.
+ *   client_ip: The client's address as text ("local" for same-host clients).
+ *   client_port: The client's port (a connection number for local clients).
+ *   local: Nonzero if the session uses a shared-memory channel.
  *
  * Returns:
  *   void
  */
-static void log_event(const char *format, ...) {
-    char timestamp[64];
-    char log_buffer[MAX_BUFFER_SIZE + 128];
-    va_list args;
-
-    get_timestamp(timestamp, sizeof(timestamp));
+static void start_session(int client_sockfd, const char *client_ip, int client_port, int local) {
+    server_stats_add(STATS_CONNECTIONS, 1);
+
+    client_thread_data_t *thread_data = malloc(sizeof(client_thread_data_t));
+    if (thread_data == NULL) {
+        perror("malloc for thread_data failed");
+        close(client_sockfd);
+        abort();
+    }
 
-    va_start(args, format);
-    int prefix_len = snprintf(log_buffer, sizeof(log_buffer), "%s ", timestamp);
-    if (prefix_len > 0 && (size_t)prefix_len < sizeof(log_buffer)) {
-        vsnprintf(log_buffer + prefix_len, sizeof(log_buffer) - prefix_len, format, args);
+    thread_data->client_sockfd = client_sockfd;
+    snprintf(thread_data->client_ip, sizeof(thread_data->client_ip), "%s", client_ip);
+    thread_data->client_port = client_port;
+    thread_data->script_depth = 0;
+    thread_data->root_locked = 0;
+    thread_data->local = local;
+    thread_data->request_id = 0;
+    thread_data->cancel_state = CANCEL_NONE;
+    thread_data->cancel_polls = 0;
+    thread_data->in_job = 0;
+
+    strncpy(thread_data->server_root_abs, g_roots[0].path, MAX_PATH_LEN);
+    strncpy(thread_data->current_wd_abs, g_roots[0].path, MAX_PATH_LEN);
+    if (g_busy_poll_usec > 0 && !local) {
+        enable_socket_busy_poll(client_sockfd);
     }
-    va_end(args);
 
-    printf("%s\n", log_buffer);
-    fflush(stdout);
+    log_event("Connection request from %s accepted on port %d", thread_data->client_ip, thread_data->client_port);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, client_handler_thread, thread_data) != 0) {
+        perror("pthread_create failed");
+        shm_channel_release(client_sockfd);
+        free(thread_data);
+        close(client_sockfd);
+    } else {
+        pthread_detach(tid);
+    }
 }
 
 /*
  * Purpose:
- *   Calculates a client-facing relative path from an absolute server path,
- *   based on the server's chroot-like root directory.
+ *   Asks the kernel to busy-poll the device queue of a TCP socket for up to
+ *   the configured budget when a read finds it empty (SO_BUSY_POLL). Raising
+ *   the value above net.core.busy_read needs CAP_NET_ADMIN; without it the
+ *   sessions still spin in userspace, and a warning is logged once.
  *
  * Parameters:
- *   abs_path: The absolute path on the server's filesystem.
- *   root_path: The absolute path of the server's root jail.
- *   rel_path_buf: The buffer to store the resulting relative path.
- *   buf_len: The size of the rel_path_buf.
+ *   sockfd: The accepted socket.
  *
  * Returns:
- *   A pointer to rel_path_buf on success, or NULL on failure.
+ *   void
  */
-static char *get_relative_path(const char *abs_path, const char *root_path, char *rel_path_buf, size_t buf_len) {
-    if (rel_path_buf == NULL || buf_len == 0) return NULL;
-    rel_path_buf[0] = '\0';
-
-    size_t root_len = strlen(root_path);
-    if (strncmp(abs_path, root_path, root_len) != 0) return NULL;
-
-    if (strlen(abs_path) == root_len) {
-        if (buf_len < 2) return NULL;
-        strcpy(rel_path_buf, "/");
-        return rel_path_buf;
-    }
-
-    if (abs_path[root_len] != '/' && strcmp(root_path, "/") != 0) return NULL;
-
-    const char *path_after_root = (strcmp(root_path, "/") == 0) ? abs_path : (abs_path + root_len);
-
-    if (strlen(path_after_root) + 1 > buf_len) return NULL;
-    strcpy(rel_path_buf, path_after_root);
-
-    if (rel_path_buf[0] == '\0') {
-        if (buf_len < 2) return NULL;
-        strcpy(rel_path_buf, "/");
-    } else if (rel_path_buf[0] != '/') {
-        if (strlen(rel_path_buf) + 2 > buf_len) return NULL;
-        memmove(rel_path_buf + 1, rel_path_buf, strlen(rel_path_buf) + 1);
-        rel_path_buf[0] = '/';
+static void enable_socket_busy_poll(int sockfd) {
+    static atomic_int warned = 0;
+    int usec = (int)g_busy_poll_usec;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) == -1 && !atomic_exchange(&warned, 1)) {
+        log_event("SO_BUSY_POLL not available (%s); polling in userspace only.", strerror(errno));
     }
-    return rel_path_buf;
 }
 
 /*
  * Purpose:
- *   Handles the CD (Change Directory) command. It resolves the requested path,
- *   performs security checks to prevent escaping the root jail, and updates
- *   the client's current working directory if successful.
+ *   Returns the CPU time used so far by the calling thread.
  *
  * Parameters:
- *   data: A pointer to the client's thread-specific data structure.
- *   path_arg: The directory path argument provided by the client.
+ *   None.
  *
  * Returns:
- *   void
+ *   The CPU time in microseconds, or 0 if the clock is not available.
  */
-static void handle_cd(client_thread_data_t *data, const char *path_arg) {
+static long thread_cpu_usec(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == -1) return 0;
+    return (long)ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/*
+ * Purpose:
+ *   Creates the Unix socket that same-host clients connect to. A stale
+ *   socket file left by a previous run is replaced.
+ *
+ * Parameters:
+ *   path: The socket path.
+ *
+ * Returns:
+ *   The listening socket, or -1 on error.
+ */
+static int open_local_listener(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Local socket path '%s' is too long.\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd == -1) {
+        perror("socket creation for local listener failed");
+        return -1;
+    }
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror("bind of local listener failed");
+        close(sockfd);
+        return -1;
+    }
+    if (listen(sockfd, 10) == -1) {
+        perror("listen on local listener failed");
+        close(sockfd);
+        unlink(path);
+        return -1;
+    }
+    return sockfd;
+}
+
+/*
+ * Purpose:
+ *   Accepts same-host clients on the Unix socket. Each connection is given
+ *   a shared-memory channel and then handled like a TCP session.
+ *
+ * Parameters:
+ *   arg: Unused.
+ *
+ * Returns:
+ *   A void pointer (always NULL).
+ */
+static void *local_accept_thread(void *arg) {
+    (void)arg;
+    int connection_number = 0;
+    while (!g_shutdown_flag) {
+        int client_sockfd = accept(g_local_sockfd, NULL, NULL);
+        if (client_sockfd == -1) {
+            if (errno == EINTR) continue;
+            perror("accept on local listener failed");
+            continue;
+        }
+        if (shm_channel_offer(client_sockfd) == -1) {
+            perror("setting up shared-memory channel failed");
+            close(client_sockfd);
+            continue;
+        }
+        start_session(client_sockfd, "local", ++connection_number, 1);
+    }
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Forks one prefork worker, which serves connections until it is stopped.
+ *
+ * Parameters:
+ *   worker_index: The worker number.
+ *   restarted: Nonzero if the worker replaces one that died.
+ *
+ * Returns:
+ *   The worker's process ID, or -1 if fork failed.
+ */
+static pid_t spawn_worker(size_t worker_index, int restarted) {
+    fflush(stdout); // Buffered log output must not be written twice
+    pid_t pid = fork();
+    if (pid == 0) {
+        exit(run_worker(worker_index, restarted));
+    }
+    if (pid == -1) {
+        perror("fork for worker failed");
+    } else {
+        log_event("Worker %zu started (pid %d)", worker_index, (int)pid);
+    }
+    return pid;
+}
+
+/*
+ * Purpose:
+ *   Runs the prefork master: starts the workers, which share the listening
+ *   socket, and restarts any worker that exits until a shutdown signal
+ *   arrives. A crashing worker only takes its own sessions down. On
+ *   shutdown the workers are stopped with SIGTERM and waited for.
+ *
+ * Parameters:
+ *   None.
+ *
+ * Returns:
+ *   0 on shutdown, or 1 if the workers could not be started.
+ */
+static int supervise_workers(void) {
+    pid_t pids[MAX_WORKERS];
+    time_t started[MAX_WORKERS];
+    int status = 0;
+    for (size_t i = 0; i < g_worker_count; i++) {
+        pids[i] = spawn_worker(i, 0);
+        started[i] = time(NULL);
+        if (pids[i] == -1) {
+            g_shutdown_flag = 1;
+            status = 1;
+            g_worker_count = i;
+            break;
+        }
+    }
+
+    while (!g_shutdown_flag) {
+        int wait_status;
+        pid_t pid = waitpid(-1, &wait_status, 0);
+        if (pid == -1) {
+            if (errno == EINTR) continue;
+            perror("waitpid failed");
+            break;
+        }
+        size_t i = 0;
+        while (i < g_worker_count && pids[i] != pid) i++;
+        if (i == g_worker_count) continue;
+        server_stats_detach(i);
+        pids[i] = -1;
+        if (WIFSIGNALED(wait_status)) {
+            log_event("Worker %zu (pid %d) killed by signal %d", i, (int)pid, WTERMSIG(wait_status));
+        } else {
+            log_event("Worker %zu (pid %d) exited with status %d", i, (int)pid, WEXITSTATUS(wait_status));
+        }
+        if (g_shutdown_flag) break;
+        if (time(NULL) - started[i] < WORKER_RESPAWN_MIN_SEC) {
+            sleep(WORKER_RESPAWN_MIN_SEC); // Keep a worker that fails at startup from spinning
+        }
+        pids[i] = spawn_worker(i, 1);
+        started[i] = time(NULL);
+    }
+
+    log_event("Shutdown signal received. Stopping workers.");
+    for (size_t i = 0; i < g_worker_count; i++) {
+        if (pids[i] > 0) kill(pids[i], SIGTERM);
+    }
+    while (waitpid(-1, NULL, 0) != -1 || errno == EINTR) {
+        // Reap every worker
+    }
+    if (close(g_server_sockfd) == -1) perror("close server_sockfd failed");
+    if (g_local_sockfd != -1) unlink(g_local_socket_path);
+    log_event("Server shut down.");
+    return status;
+}
+
+/*
+ * Purpose:
+ *   Collects the directories to prewarm (from the manifest and/or the hottest
+ *   directories recorded in the index) and starts loading them into the
+ *   directory cache in the background.
+ *
+ * Parameters:
+ *   manifest_path: The prewarm manifest, or NULL.
+ *   hottest_count: The number of most requested directories of the previous
+ *                  run to prewarm, or 0.
+ *
+ * Returns:
+ *   void
+ */
+static void start_prewarm(const char *manifest_path, size_t hottest_count) {
+    char **paths = NULL;
+    size_t count = 0;
+
+    if (hottest_count > 0) {
+        if (dir_index_hottest(g_index_path, hottest_count, &paths, &count) == -1) {
+            log_event("Could not read request statistics from directory index '%s'", g_index_path);
+        }
+        // The index may predate a change of the configured roots.
+        size_t kept = 0;
+        for (size_t i = 0; i < count; i++) {
+            size_t root;
+            for (root = 0; root < g_root_count; root++) {
+                if (path_within_root(paths[i], g_roots[root].path)) break;
+            }
+            if (root < g_root_count) {
+                paths[kept++] = paths[i];
+            } else {
+                free(paths[i]);
+            }
+        }
+        count = kept;
+    }
+    if (manifest_path != NULL) {
+        prewarm_read_manifest(manifest_path, g_roots[0].path, &paths, &count);
+    }
+    if (count == 0) {
+        free(paths);
+        return;
+    }
+
+    log_event("Prewarming %zu directories in the background", count);
+    prewarm_start(paths, count, PREWARM_DEFAULT_THREADS, prewarm_finished);
+}
+
+/*
+ * Purpose:
+ *   Logs the outcome of the background prewarm.
+ *
+ * Parameters:
+ *   warmed: The number of directories read into the cache.
+ *   failed: The number of directories that could not be read.
+ *   seconds: The time the prewarm took.
+ *
+ * Returns:
+ *   void
+ */
+static void prewarm_finished(size_t warmed, size_t failed, double seconds) {
+    log_event("Prewarm finished: %zu directories cached, %zu failed, %.3f s", warmed, failed, seconds);
+}
+
+/*
+ * Purpose:
+ *   Resolves a root directory and adds it to the table of served roots.
+ *
+ * Parameters:
+ *   name: The name clients use to select the root.
+ *   path: The directory path as given on the command line.
+ *
+ * Returns:
+ *   0 on success, or -1 on error (a message has been printed).
+ */
+static int add_server_root(const char *name, const char *path) {
+    if (strlen(name) == 0 || strlen(name) >= MAX_ROOT_NAME_LEN || strpbrk(name, " \t") != NULL) {
+        fprintf(stderr, "Error: Invalid root name '%s'.\n", name);
+        return -1;
+    }
+    for (size_t i = 0; i < g_root_count; i++) {
+        if (strcmp(g_roots[i].name, name) == 0) {
+            fprintf(stderr, "Error: Root name '%s' is used more than once.\n", name);
+            return -1;
+        }
+    }
+
+    server_root_t *root = &g_roots[g_root_count];
+    if (realpath(path, root->path) == NULL) {
+        perror("Error resolving server root directory (realpath)");
+        return -1;
+    }
+    struct stat root_stat;
+    if (stat(root->path, &root_stat) != 0) {
+        perror("Error stating server root directory (stat)");
+        return -1;
+    }
+    if (!S_ISDIR(root_stat.st_mode)) {
+        fprintf(stderr, "Error: Server root '%s' is not a directory.\n", root->path);
+        return -1;
+    }
+    snprintf(root->name, sizeof(root->name), "%s", name);
+    g_root_count++;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Resolves a directory given with -T and adds it to the subtrees covered by
+ *   the trigram index. It must lie inside one of the served roots.
+ *
+ * Parameters:
+ *   path: The directory path as given on the command line.
+ *
+ * Returns:
+ *   0 on success, or -1 on error (a message has been printed).
+ */
+static int add_grep_subtree(const char *path) {
+    char *resolved = g_grep_subtrees[g_grep_subtree_count];
+    if (realpath(path, resolved) == NULL) {
+        perror("Error resolving trigram index subtree (realpath)");
+        return -1;
+    }
+    struct stat st;
+    if (stat(resolved, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "Error: Trigram index subtree '%s' is not a directory.\n", resolved);
+        return -1;
+    }
+    size_t root;
+    for (root = 0; root < g_root_count; root++) {
+        if (path_within_root(resolved, g_roots[root].path)) break;
+    }
+    if (root == g_root_count) {
+        fprintf(stderr, "Error: Trigram index subtree '%s' is not inside a served root.\n", resolved);
+        return -1;
+    }
+    g_grep_subtree_count++;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   A signal handler that catches SIGINT and SIGTERM to set a global flag,
+ *   allowing the main accept loop to terminate gracefully.
+ *
+ * Parameters:
+ *   signum: The signal number that was caught.
+ *
+ * Returns:
+ *   void
+ */
+static void signal_handler(int signum) {
+    if (signum == SIGINT || signum == SIGTERM) {
+        g_shutdown_flag = 1;
+    }
+}
+
+/*
+ * Purpose:
+ *   The main function for each client thread. It handles all communication with
+ *   a single connected client, reading commands and dispatching them for processing
+ *   until the client disconnects or sends a QUIT command.
+ *
+ * Parameters:
+ *   arg: A void pointer to a dynamically allocated client_thread_data_t struct
+ *        containing connection-specific information.
+ *
+ * Returns:
+ *   A void pointer (always NULL).
+ */
+static void *client_handler_thread(void *arg) {
+    client_thread_data_t *data = (client_thread_data_t *)arg;
+    char buffer[MAX_BUFFER_SIZE];
+    ssize_t nbytes;
+    long cpu_mark = thread_cpu_usec();
+
+    server_stats_add(STATS_ACTIVE_SESSIONS, 1);
+#ifdef WITH_TLS
+    if (g_tls_enabled && !data->local && ktls_accept(data->client_sockfd) == -1) {
+        log_event("TLS handshake with %s:%d failed.", data->client_ip, data->client_port);
+        goto cleanup;
+    }
+#endif
+    if (send_all(data->client_sockfd, SERVER_DEFAULT_WELCOME_MSG, strlen(SERVER_DEFAULT_WELCOME_MSG)) == -1) {
+        log_event("Error sending welcome message to %s:%d.", data->client_ip, data->client_port);
+        goto cleanup;
+    }
+
+    while ((nbytes = recv_line(data->client_sockfd, buffer, MAX_BUFFER_SIZE)) > 0) {
+        buffer[strcspn(buffer, "\r\n")] = 0;
+        log_event("Client %s:%d sent command: '%s'", data->client_ip, data->client_port, buffer);
+        if (!is_cancel_command(buffer)) data->request_id++;
+
+        int quit = process_client_command(data, buffer);
+        if (data->cancel_state == CANCEL_REQUESTED) {
+            char cancelled_line[MAX_CMD_LEN];
+            snprintf(cancelled_line, sizeof(cancelled_line), "%s %lu\n", RESP_CANCELLED, data->request_id);
+            send_all(data->client_sockfd, cancelled_line, strlen(cancelled_line));
+            log_event("Client %s:%d cancelled request %lu.", data->client_ip, data->client_port, data->request_id);
+        } else if (data->cancel_state == CANCEL_PEER_GONE) {
+            log_event("Client %s:%d left during request %lu; stopped it.", data->client_ip, data->client_port, data->request_id);
+        }
+        data->cancel_state = CANCEL_NONE;
+        data->cancel_polls = 0;
+        // Charged per command, so STATS also covers sessions still open.
+        long cpu_now = thread_cpu_usec();
+        server_stats_add(STATS_CPU_USEC, cpu_now - cpu_mark);
+        cpu_mark = cpu_now;
+        if (quit != 0) {
+            break;
+        }
+    }
+
+    if (nbytes == 0) {
+        log_event("Client %s:%d disconnected (received EOF).", data->client_ip, data->client_port);
+    } else if (nbytes == -1) {
+        log_event("Error receiving data from %s:%d.", data->client_ip, data->client_port);
+    }
+
+    cleanup:
+    log_event("Closing connection for %s:%d.", data->client_ip, data->client_port);
+    server_stats_add(STATS_ACTIVE_SESSIONS, -1);
+    server_stats_add(STATS_CPU_USEC, thread_cpu_usec() - cpu_mark);
+    shm_channel_release(data->client_sockfd);
+    if (close(data->client_sockfd) == -1) {
+        perror("close client_sockfd failed in client_handler_thread");
+    }
+    free(data);
+    pthread_exit(NULL);
+}
+
+/*
+ * Purpose:
+ *   Acts as a central dispatcher for all client commands. It parses the command
+ *   line, identifies the primary command, and calls the appropriate handler function.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   command_line: The raw command string received from the client.
+ *
+ * Returns:
+ *   0 to continue the client session, or 1 to terminate it (e.g., on QUIT).
+ */
+static int process_client_command(client_thread_data_t *data, char *command_line) {
+    char command[MAX_CMD_LEN];
+    char cmd_arg[MAX_ARGS_LEN];
+    char response[MAX_BUFFER_SIZE];
+
+    server_stats_add(STATS_COMMANDS, 1);
+
+    char *cmd_start = command_line;
+    while (*cmd_start && isspace((unsigned char)*cmd_start)) {
+        cmd_start++;
+    }
+
+    if (*cmd_start == '@') {
+        data->root_locked = 1;
+        const char *filename = cmd_start + 1;
+        while (*filename && isspace((unsigned char)*filename)) {
+            filename++;
+        }
+        handle_at_command(data, filename);
+        return 0;
+    }
+
+    memset(command, 0, sizeof(command));
+    memset(cmd_arg, 0, sizeof(cmd_arg));
+    response[0] = '\0';
+
+    sscanf(cmd_start, "%s %[^\n]", command, cmd_arg);
+
+    if (strcmp(command, CMD_ROOT) == 0) {
+        handle_root(data, cmd_arg);
+        return 0;
+    }
+    data->root_locked = 1;
+
+    if (strcmp(command, CMD_ECHO) == 0) {
+        snprintf(response, sizeof(response), "%s\n", cmd_arg);
+    } else if (strcmp(command, CMD_QUIT) == 0) {
+        snprintf(response, sizeof(response), "%s\n", RESP_BYE);
+        send_all(data->client_sockfd, response, strlen(response));
+        return 1;
+    } else if (strcmp(command, CMD_INFO) == 0) {
+        snprintf(response, sizeof(response), "%s", SERVER_DEFAULT_WELCOME_MSG);
+    } else if (strcmp(command, CMD_CD) == 0) {
+        handle_cd(data, cmd_arg);
+        return 0;
+    } else if (strcmp(command, CMD_LIST) == 0) {
+        handle_list(data, cmd_arg);
+        return 0;
+    } else if (strcmp(command, CMD_LISTDIFF) == 0) {
+        handle_listdiff(data, cmd_arg);
+        return 0;
+    } else if (strcmp(command, CMD_LOCATE) == 0) {
+        handle_locate(data, cmd_arg);
+        return 0;
+    } else if (strcmp(command, CMD_GREP) == 0) {
+        handle_grep(data, cmd_arg);
+        return 0;
+    } else if (strcmp(command, CMD_COMPLETE) == 0) {
+        handle_complete(data, cmd_arg);
+        return 0;
+    } else if (strcmp(command, CMD_STATS) == 0) {
+        handle_stats(data);
+        return 0;
+    } else if (strcmp(command, CMD_CANCEL) == 0) {
+        handle_cancel(data, cmd_arg);
+        return 0;
+    } else if (strcmp(command, CMD_DU) == 0) {
+        handle_du(data, cmd_arg);
+        return 0;
+    } else if (strcmp(command, CMD_HASH) == 0) {
+        handle_hash(data, cmd_arg);
+        return 0;
+    } else if (strcmp(command, CMD_TREEHASH) == 0) {
+        handle_treehash(data, cmd_arg);
+        return 0;
+    } else if (strcmp(command, CMD_STAT) == 0) {
+        handle_stat(data, cmd_arg);
+        return 0;
+    } else if (strcmp(command, CMD_TOP) == 0) {
+        handle_top(data, cmd_arg);
+        return 0;
+    } else if (strcmp(command, CMD_WC) == 0) {
+        handle_wc(data, cmd_arg);
+        return 0;
+    } else if (strcmp(command, CMD_JOB) == 0) {
+        handle_job(data, cmd_arg);
+        return 0;
+    } else {
+        if (strlen(command) > 0) {
+            snprintf(response, sizeof(response), "%sUnknown command: %s\n", RESP_ERROR_PREFIX, command);
+        }
+    }
+
+    if (strlen(response) > 0) {
+        if (send_all(data->client_sockfd, response, strlen(response)) == -1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Prints a formatted log message to standard output, prefixed with a timestamp.
+ *   This function is variadic, accepting arguments like printf.
+ *
+ * Parameters:
+ *   format: A printf-style format string for the log message.
+ *   ...: A variable number of arguments corresponding to the format string.
+ *
+ * Returns:
+ *   void
+ */
+static void log_event(const char *format, ...) {
+    char timestamp[64];
+    char log_buffer[MAX_BUFFER_SIZE + 128];
+    va_list args;
+
+    get_timestamp(timestamp, sizeof(timestamp));
+
+    va_start(args, format);
+    int prefix_len = snprintf(log_buffer, sizeof(log_buffer), "%s ", timestamp);
+    if (prefix_len > 0 && (size_t)prefix_len < sizeof(log_buffer)) {
+        vsnprintf(log_buffer + prefix_len, sizeof(log_buffer) - prefix_len, format, args);
+    }
+    va_end(args);
+
+    printf("%s\n", log_buffer);
+    fflush(stdout);
+}
+
+/*
+ * Purpose:
+ *   Calculates a client-facing relative path from an absolute server path,
+ *   based on the server's chroot-like root directory.
+ *
+ * Parameters:
+ *   abs_path: The absolute path on the server's filesystem.
+ *   root_path: The absolute path of the server's root jail.
+ *   rel_path_buf: The buffer to store the resulting relative path.
+ *   buf_len: The size of the rel_path_buf.
+ *
+ * Returns:
+ *   A pointer to rel_path_buf on success, or NULL on failure.
+ */
+static char *get_relative_path(const char *abs_path, const char *root_path, char *rel_path_buf, size_t buf_len) {
+    if (rel_path_buf == NULL || buf_len == 0) return NULL;
+    rel_path_buf[0] = '\0';
+
+    size_t root_len = strlen(root_path);
+    if (strncmp(abs_path, root_path, root_len) != 0) return NULL;
+
+    if (strlen(abs_path) == root_len) {
+        if (buf_len < 2) return NULL;
+        strcpy(rel_path_buf, "/");
+        return rel_path_buf;
+    }
+
+    if (abs_path[root_len] != '/' && strcmp(root_path, "/") != 0) return NULL;
+
+    const char *path_after_root = (strcmp(root_path, "/") == 0) ? abs_path : (abs_path + root_len);
+
+    if (strlen(path_after_root) + 1 > buf_len) return NULL;
+    strcpy(rel_path_buf, path_after_root);
+
+    if (rel_path_buf[0] == '\0') {
+        if (buf_len < 2) return NULL;
+        strcpy(rel_path_buf, "/");
+    } else if (rel_path_buf[0] != '/') {
+        if (strlen(rel_path_buf) + 2 > buf_len) return NULL;
+        memmove(rel_path_buf + 1, rel_path_buf, strlen(rel_path_buf) + 1);
+        rel_path_buf[0] = '/';
+    }
+    return rel_path_buf;
+}
+
+/*
+ * Purpose:
+ *   Handles the CD (Change Directory) command. It resolves the requested path,
+ *   performs security checks to prevent escaping the root jail, and updates
+ *   the client's current working directory if successful.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   path_arg: The directory path argument provided by the client.
+ *
+ * Returns:
+ *   void
+ */
+static void handle_cd(client_thread_data_t *data, const char *path_arg) {
     char response_buffer[MAX_BUFFER_SIZE];
     response_buffer[0] = '\0';
 
-    if (path_arg == NULL || strlen(path_arg) == 0) {
-        snprintf(response_buffer, sizeof(response_buffer), "%sCD: Missing argument\n", RESP_ERROR_PREFIX);
-        send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+    if (path_arg == NULL || strlen(path_arg) == 0) {
+        snprintf(response_buffer, sizeof(response_buffer), "%sCD: Missing argument\n", RESP_ERROR_PREFIX);
+        send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+        return;
+    }
+
+    char target_path_trial[MAX_PATH_LEN];
+    if (path_arg[0] == '/') {
+        snprintf(target_path_trial, sizeof(target_path_trial), "%s%s", data->server_root_abs, (strcmp(path_arg, "/") == 0) ? "" : path_arg);
+    } else {
+        if (strlen(data->current_wd_abs) + 1 + strlen(path_arg) >= sizeof(target_path_trial)) {
+            snprintf(response_buffer, sizeof(response_buffer), "%sCD: Resulting path is too long\n", RESP_ERROR_PREFIX);
+            send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+            return;
+        }
+        strcpy(target_path_trial, data->current_wd_abs);
+        strcat(target_path_trial, "/");
+        strcat(target_path_trial, path_arg);
+    }
+
+    char resolved_path[MAX_PATH_LEN];
+    if (realpath(target_path_trial, resolved_path) == NULL) {
+        snprintf(response_buffer, sizeof(response_buffer), "%sCD: Invalid path: %s\n", RESP_ERROR_PREFIX, path_arg);
+    } else {
+        struct stat st;
+        if (stat(resolved_path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            snprintf(response_buffer, sizeof(response_buffer), "%sCD: Not a directory: %s\n", RESP_ERROR_PREFIX, path_arg);
+        } else if (!path_within_root(resolved_path, data->server_root_abs)) {
+            snprintf(response_buffer, sizeof(response_buffer), "%sCD: Operation not permitted\n", RESP_ERROR_PREFIX);
+        } else {
+            strncpy(data->current_wd_abs, resolved_path, sizeof(data->current_wd_abs) - 1);
+            data->current_wd_abs[sizeof(data->current_wd_abs) - 1] = '\0';
+            char rel_path[MAX_PATH_LEN];
+            if (get_relative_path(data->current_wd_abs, data->server_root_abs, rel_path, sizeof(rel_path))) {
+                snprintf(response_buffer, sizeof(response_buffer), "%s\n", (strcmp(rel_path, "/") == 0) ? "/" : rel_path + 1);
+            } else {
+                snprintf(response_buffer, sizeof(response_buffer), "%sCD: Error determining relative path\n", RESP_ERROR_PREFIX);
+            }
+        }
+    }
+    send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+}
+
+/*
+ * Purpose:
+ *   Handles the ROOT command, which selects one of the server's named roots.
+ *   It is only accepted before any other command of the session, so a
+ *   client cannot move between jails once it has started working.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   name_arg: The name of the root to select.
+ *
+ * Returns:
+ *   void
+ */
+static void handle_root(client_thread_data_t *data, const char *name_arg) {
+    char response_buffer[MAX_BUFFER_SIZE];
+
+    if (data->root_locked) {
+        snprintf(response_buffer, sizeof(response_buffer), "%sROOT: Root can only be selected at the start of a session\n", RESP_ERROR_PREFIX);
+    } else if (name_arg == NULL || strlen(name_arg) == 0) {
+        snprintf(response_buffer, sizeof(response_buffer), "%sROOT: Missing argument\n", RESP_ERROR_PREFIX);
+    } else {
+        size_t i;
+        for (i = 0; i < g_root_count; i++) {
+            if (strcmp(g_roots[i].name, name_arg) == 0) break;
+        }
+        if (i == g_root_count) {
+            snprintf(response_buffer, sizeof(response_buffer), "%sROOT: Unknown root: %s\n", RESP_ERROR_PREFIX, name_arg);
+        } else {
+            snprintf(data->server_root_abs, sizeof(data->server_root_abs), "%s", g_roots[i].path);
+            snprintf(data->current_wd_abs, sizeof(data->current_wd_abs), "%s", g_roots[i].path);
+            data->root_locked = 1;
+            log_event("Client %s:%d selected root '%s'", data->client_ip, data->client_port, g_roots[i].name);
+            snprintf(response_buffer, sizeof(response_buffer), "%s %s\n", CMD_ROOT, g_roots[i].name);
+        }
+    }
+    send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+}
+
+/*
+ * Purpose:
+ *   Handles the server-side script execution triggered by the '@' command. It
+ *   validates the script path, opens the file, and processes each line as a
+ *   new command, with protection against infinite recursion.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   filename: The name of the script file to execute.
+ *
+ * Returns:
+ *   void
+ */
+static void handle_at_command(client_thread_data_t *data, const char *filename) {
+    char response_buffer[MAX_BUFFER_SIZE];
+
+    if (filename == NULL || strlen(filename) == 0) {
+        snprintf(response_buffer, sizeof(response_buffer), "%s@: Missing filename\n", RESP_ERROR_PREFIX);
+        send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+        return;
+    }
+
+    if (data->script_depth >= MAX_SCRIPT_DEPTH) {
+        snprintf(response_buffer, sizeof(response_buffer), "%s@: Maximum script recursion depth (%d) exceeded\n", RESP_ERROR_PREFIX, MAX_SCRIPT_DEPTH);
+        send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+        return;
+    }
+
+    char script_path_trial[MAX_PATH_LEN];
+    if (strlen(data->current_wd_abs) + 1 + strlen(filename) >= sizeof(script_path_trial)) {
+        snprintf(response_buffer, sizeof(response_buffer), "%s@: Resulting script path is too long\n", RESP_ERROR_PREFIX);
+        send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+        return;
+    }
+    strcpy(script_path_trial, data->current_wd_abs);
+    strcat(script_path_trial, "/");
+    strcat(script_path_trial, filename);
+
+    char resolved_path[MAX_PATH_LEN];
+    if (realpath(script_path_trial, resolved_path) == NULL) {
+        snprintf(response_buffer, sizeof(response_buffer), "%s@: Script not found: %s\n", RESP_ERROR_PREFIX, filename);
+        send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+        return;
+    }
+
+    if (!path_within_root(resolved_path, data->server_root_abs)) {
+        snprintf(response_buffer, sizeof(response_buffer), "%s@: Access to script denied: %s\n", RESP_ERROR_PREFIX, filename);
+        send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+        return;
+    }
+
+    FILE *script_file = fopen(resolved_path, "r");
+    if (script_file == NULL) {
+        snprintf(response_buffer, sizeof(response_buffer), "%s@: Cannot open script '%s': %s\n", RESP_ERROR_PREFIX, filename, strerror(errno));
+        send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+        return;
+    }
+
+    data->script_depth++;
+    log_event("Client %s:%d starting script '%s' (depth %d)", data->client_ip, data->client_port, filename, data->script_depth);
+
+    char line_buffer[MAX_BUFFER_SIZE];
+    while (!poll_for_cancel(data) && fgets(line_buffer, sizeof(line_buffer), script_file) != NULL) {
+        line_buffer[strcspn(line_buffer, "\r\n")] = 0;
+        if (strlen(line_buffer) == 0) continue;
+
+        snprintf(response_buffer, sizeof(response_buffer), "script> %.4080s\n", line_buffer);
+        if (send_all(data->client_sockfd, response_buffer, strlen(response_buffer)) == -1) break;
+
+        if (process_client_command(data, line_buffer) != 0) break;
+    }
+
+    if (ferror(script_file)) perror("Error reading from script file");
+    fclose(script_file);
+
+    log_event("Client %s:%d finished script '%s' (depth %d)", data->client_ip, data->client_port, filename, data->script_depth);
+    data->script_depth--;
+}
+
+/*
+ * Purpose:
+ *   Safely constructs a single line of output for the LIST command.
+ *
+ * Parameters:
+ *   buffer: The destination buffer for the formatted string.
+ *   buf_size: The size of the destination buffer.
+ *   name: The name of the file or directory.
+ *   middle: An optional string to place after the name (e.g., " -> ").
+ *   target: An optional target for symlinks.
+ *   suffix: An optional suffix (e.g., "/" for directories or "\n").
+ *
+ * Returns:
+ *   void
+ */
+static void format_list_item(char *buffer, size_t buf_size, const char *name, const char *middle, const char *target, const char *suffix) {
+    if (buffer == NULL || buf_size == 0) return;
+    buffer[0] = '\0';
+    size_t current_pos = 0;
+    int written;
+
+    written = snprintf(buffer + current_pos, buf_size - current_pos, "%s", name);
+    if (written < 0 || (size_t)written >= (buf_size - current_pos)) return;
+    current_pos += written;
+
+    if (middle) {
+        written = snprintf(buffer + current_pos, buf_size - current_pos, "%s", middle);
+        if (written < 0 || (size_t)written >= (buf_size - current_pos)) return;
+        current_pos += written;
+    }
+    if (target) {
+        written = snprintf(buffer + current_pos, buf_size - current_pos, "%s", target);
+        if (written < 0 || (size_t)written >= (buf_size - current_pos)) return;
+        current_pos += written;
+    }
+    if (suffix) {
+        written = snprintf(buffer + current_pos, buf_size - current_pos, "%s", suffix);
+        if (written < 0 || (size_t)written >= (buf_size - current_pos)) return;
+    }
+}
+
+/*
+ * Purpose:
+ *   Formats one cached directory entry as a LIST output line: directories get
+ *   a trailing '/', symbolic links show their target.
+ *
+ * Parameters:
+ *   buffer: The destination buffer for the formatted line.
+ *   buf_size: The size of the destination buffer.
+ *   entry: The directory entry to format.
+ *
+ * Returns:
+ *   void
+ */
+static void format_listing_entry(char *buffer, size_t buf_size, const dir_cache_entry_t *entry) {
+    if (entry->type == DIR_ENTRY_DIR) {
+        format_list_item(buffer, buf_size, entry->name, NULL, NULL, "/\n");
+    } else if (entry->type == DIR_ENTRY_LINK) {
+        format_list_item(buffer, buf_size, entry->name, " -> ", entry->link_target ? entry->link_target : "[broken link]", "\n");
+    } else {
+        format_list_item(buffer, buf_size, entry->name, NULL, NULL, "\n");
+    }
+}
+
+/*
+ * Purpose:
+ *   Prepares an empty reply buffer for a client.
+ *
+ * Parameters:
+ *   reply: The reply buffer to initialize.
+ *   data: The client the reply will be sent to.
+ *
+ * Returns:
+ *   void
+ */
+static void reply_init(reply_buffer_t *reply, client_thread_data_t *data) {
+    reply->data = data;
+    reply->used = 0;
+    reply->failed = 0;
+}
+
+/*
+ * Purpose:
+ *   Sends everything accumulated in a reply buffer to the client.
+ *
+ * Parameters:
+ *   reply: The reply buffer.
+ *
+ * Returns:
+ *   0 on success, or -1 if sending failed (now or earlier).
+ */
+static int reply_flush(reply_buffer_t *reply) {
+    if (reply->failed) return -1;
+    if (reply->used > 0 && send_all(reply->data->client_sockfd, reply->block, reply->used) == -1) {
+        reply->failed = 1;
+    }
+    reply->used = 0;
+    return reply->failed ? -1 : 0;
+}
+
+/*
+ * Purpose:
+ *   Appends text to a reply buffer, sending the buffered block first when
+ *   the text does not fit.
+ *
+ * Parameters:
+ *   reply: The reply buffer.
+ *   text: The text to append.
+ *   len: The length of the text.
+ *
+ * Returns:
+ *   0 on success, or -1 if sending to the client failed.
+ */
+static int reply_append(reply_buffer_t *reply, const char *text, size_t len) {
+    if (reply->failed) return -1;
+    if (len > sizeof(reply->block) - reply->used) {
+        if (reply_flush(reply) == -1) return -1;
+        if (len > sizeof(reply->block)) {
+            if (send_all(reply->data->client_sockfd, text, len) == -1) reply->failed = 1;
+            return reply->failed ? -1 : 0;
+        }
+    }
+    memcpy(reply->block + reply->used, text, len);
+    reply->used += len;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Handles the LIST command. The listing of the client's current directory
+ *   comes from the directory cache (read from disk only if the directory
+ *   changed), and the formatted entries are sent in large blocks.
+ *
+ *   "LIST -v" precedes the listing with a "VERSION <token> <bytes>" line.
+ *   "LIST -c <token>" replies "NOTMODIFIED <token>" if the token still
+ *   matches the directory, and with a versioned listing otherwise; the check
+ *   does not depend on the size of the directory.
+ *   "LIST [-R] [-w <filter>] [pattern...]" lists only selected entries,
+ *   optionally of the whole tree (see list_matching).
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   args: The command's arguments (may be empty).
+ *
+ * Returns:
+ *   void
+ */
+static void handle_list(client_thread_data_t *data, const char *args) {
+    char response_line[MAX_BUFFER_SIZE];
+    int versioned = 0;
+    const char *known_token = NULL;
+    if (strcmp(args, "-v") == 0) {
+        versioned = 1;
+    } else if (strncmp(args, "-c ", 3) == 0) {
+        versioned = 1;
+        known_token = args + 3;
+    } else if (strlen(args) > 0 && (args[0] != '-' || strncmp(args, "-R", 2) == 0 || strncmp(args, "-w", 2) == 0)) {
+        list_matching(data, args);
+        return;
+    } else if (strlen(args) > 0) {
+        snprintf(response_line, sizeof(response_line), "%sLIST: Invalid arguments\n", RESP_ERROR_PREFIX);
+        send_all(data->client_sockfd, response_line, strlen(response_line));
+        return;
+    }
+
+    dir_listing_t *listing = dir_cache_get(data->current_wd_abs);
+    if (listing == NULL) {
+        snprintf(response_line, sizeof(response_line), "%sLIST: Cannot open directory: %s\n", RESP_ERROR_PREFIX, strerror(errno));
+        send_all(data->client_sockfd, response_line, strlen(response_line));
+        return;
+    }
+
+    char token[DIR_TOKEN_SIZE];
+    if (versioned) {
+        dir_listing_token(listing, token, sizeof(token));
+        if (known_token != NULL && strcmp(known_token, token) == 0) {
+            snprintf(response_line, sizeof(response_line), "%s %s\n", RESP_NOT_MODIFIED, token);
+            send_all(data->client_sockfd, response_line, strlen(response_line));
+            dir_cache_release(listing);
+            return;
+        }
+    }
+
+    reply_buffer_t *reply = malloc(sizeof(reply_buffer_t));
+    if (reply == NULL) {
+        perror("malloc for reply buffer failed");
+        dir_cache_release(listing);
+        return;
+    }
+    reply_init(reply, data);
+    if (versioned) {
+        // The byte count lets the client read the listing without waiting
+        // for the end-of-response timeout.
+        size_t total = 0;
+        for (size_t i = 0; i < listing->count; i++) {
+            format_listing_entry(response_line, sizeof(response_line), &listing->entries[i]);
+            total += strlen(response_line);
+        }
+        snprintf(response_line, sizeof(response_line), "%s %s %zu\n", RESP_VERSION, token, total);
+        reply_append(reply, response_line, strlen(response_line));
+    }
+    for (size_t i = 0; i < listing->count; i++) {
+        // A versioned listing announced its size, so it is always sent whole.
+        if (!versioned && request_cancelled(data)) break;
+        format_listing_entry(response_line, sizeof(response_line), &listing->entries[i]);
+        if (reply_append(reply, response_line, strlen(response_line)) == -1) break;
+    }
+    reply_flush(reply);
+
+    free(reply);
+    dir_cache_release(listing);
+}
+
+/*
+ * Purpose:
+ *   Filter callback for dir_cache_get_filtered: accepts the names matching
+ *   one of a LIST's patterns.
+ *
+ * Parameters:
+ *   name: The entry's name.
+ *   ctx: The list_filter_t.
+ *
+ * Returns:
+ *   Nonzero if the name matches.
+ */
+static int list_filter_accepts(const char *name, void *ctx) {
+    const list_filter_t *filter = ctx;
+    for (size_t i = 0; i < filter->count; i++) {
+        if (glob_match(filter->globs[i], name)) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Creates a directory waiting to be listed by a recursive LIST.
+ *
+ * Parameters:
+ *   path: The absolute path of the directory.
+ *   prefix: Its path relative to the listed directory ("" or ending with '/').
+ *
+ * Returns:
+ *   The item (free with list_pending_free), or NULL on allocation failure.
+ */
+static list_pending_t *list_pending_new(const char *path, const char *prefix) {
+    list_pending_t *item = malloc(sizeof(list_pending_t));
+    if (item == NULL) return NULL;
+    item->path = strdup(path);
+    item->prefix = strdup(prefix);
+    item->next = NULL;
+    if (item->path == NULL || item->prefix == NULL) {
+        list_pending_free(item);
+        return NULL;
+    }
+    return item;
+}
+
+/*
+ * Purpose:
+ *   Frees a directory waiting to be listed.
+ *
+ * Parameters:
+ *   item: The item (may be NULL).
+ *
+ * Returns:
+ *   void
+ */
+static void list_pending_free(list_pending_t *item) {
+    if (item == NULL) return;
+    free(item->path);
+    free(item->prefix);
+    free(item);
+}
+
+/*
+ * Purpose:
+ *   Sends the selected entries of one directory. For a recursive listing,
+ *   its subdirectories (not symbolic links to them) are pushed onto the
+ *   pending stack in name order, to be listed after it. The directory is
+ *   taken from the cache if it is current there; otherwise it is read
+ *   without being cached, so a large tree does not push the hot directories
+ *   out of the cache. In a flat listing without a metadata filter, names
+ *   are matched as the directory is read, so entries that do not match are
+ *   never inspected. If the filter needs metadata and the directory cannot
+ *   be opened to look it up, none of its entries are selected.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   filter: The request's patterns and metadata filter.
+ *   reply: The reply buffer.
+ *   dir: The directory.
+ *   pending: The stack of directories waiting to be listed.
+ *
+ * Returns:
+ *   0 to go on, or -1 if the request must stop.
+ */
+static int list_directory(client_thread_data_t *data, list_filter_t *filter, reply_buffer_t *reply, const list_pending_t *dir, list_pending_t **pending) {
+    char response_line[MAX_BUFFER_SIZE];
+    char formatted[MAX_BUFFER_SIZE];
+    char child_path[MAX_PATH_LEN];
+    char child_prefix[MAX_PATH_LEN];
+    int prefilter = (filter->count > 0 && !filter->recursive);
+    dir_listing_t *listing = dir_cache_get_filtered(dir->path, prefilter ? list_filter_accepts : NULL, filter);
+    if (listing == NULL) return 0;
+    int needs_stat = (filter->predicate != NULL && entry_filter_needs_stat(filter->predicate));
+    int dir_fd = needs_stat ? open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+
+    // Subdirectories are collected in order and pushed as one run, so they
+    // come off the stack in name order.
+    list_pending_t *children = NULL, **last_child = &children;
+    int result = 0;
+    for (size_t i = 0; i < listing->count && result == 0; i++) {
+        const dir_cache_entry_t *entry = &listing->entries[i];
+        if (request_cancelled(data)) {
+            result = -1;
+            break;
+        }
+        int selected = (filter->count == 0 || list_filter_accepts(entry->name, filter));
+        if (selected && filter->predicate != NULL) {
+            entry_info_t info = { entry->type, 0, 0 };
+            if (needs_stat) {
+                selected = (dir_fd != -1 && entry_filter_stat(filter->predicate, dir_fd, entry->name, &info) == 0);
+            }
+            selected = selected && entry_filter_match(filter->predicate, &info);
+        }
+        if (selected) {
+            format_listing_entry(formatted, sizeof(formatted), entry);
+            int len = snprintf(response_line, sizeof(response_line), "%s%s", dir->prefix, formatted);
+            if (len > 0 && (size_t)len < sizeof(response_line) && reply_append(reply, response_line, (size_t)len) == -1) result = -1;
+        }
+        if (filter->recursive && entry->type == DIR_ENTRY_DIR &&
+            snprintf(child_path, sizeof(child_path), "%s/%s", strcmp(dir->path, "/") == 0 ? "" : dir->path, entry->name) < (int)sizeof(child_path) &&
+            snprintf(child_prefix, sizeof(child_prefix), "%s%s/", dir->prefix, entry->name) < (int)sizeof(child_prefix)) {
+            list_pending_t *child = list_pending_new(child_path, child_prefix);
+            if (child == NULL) {
+                perror("malloc for LIST -R directory failed");
+                result = -1;
+                break;
+            }
+            *last_child = child;
+            last_child = &child->next;
+        }
+    }
+    if (dir_fd != -1) close(dir_fd);
+    dir_cache_release(listing);
+    *last_child = *pending;
+    *pending = children;
+    return result;
+}
+
+/*
+ * Purpose:
+ *   Sends the selected entries of the current directory and, for a
+ *   recursive listing, of every directory below it. The directories waiting
+ *   to be listed are kept on a heap-allocated stack rather than the call
+ *   stack, so the depth of the tree is not limited by the thread's stack,
+ *   and no listing is held while another directory is read. Each directory's
+ *   entries are sent together, followed by its subdirectories in name order.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   filter: The request's patterns and metadata filter.
+ *   reply: The reply buffer.
+ *
+ * Returns:
+ *   void
+ */
+static void list_tree(client_thread_data_t *data, list_filter_t *filter, reply_buffer_t *reply) {
+    list_pending_t *pending = list_pending_new(data->current_wd_abs, "");
+    if (pending == NULL) {
+        perror("malloc for LIST directory failed");
+        return;
+    }
+    int result = 0;
+    while (pending != NULL) {
+        list_pending_t *dir = pending;
+        pending = dir->next;
+        if (result == 0) result = list_directory(data, filter, reply, dir, &pending);
+        list_pending_free(dir);
+    }
+}
+
+/*
+ * Purpose:
+ *   Handles the selective forms of LIST: LIST [-R] [-w <filter>] [pattern...].
+ *   Sends, in LIST format, the entries of the current directory whose names
+ *   match one of the glob patterns (see glob_match.h) and whose metadata
+ *   passes the filter (see entry_filter.h). With -R, the directories below
+ *   are listed as well, each entry with its path relative to the current
+ *   directory. The patterns and the filter are compiled once per request.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   args: The options and patterns, separated by white space.
+ *
+ * Returns:
+ *   void
+ */
+static void list_matching(client_thread_data_t *data, const char *args) {
+    char response_line[MAX_BUFFER_SIZE];
+    char words[MAX_BUFFER_SIZE];
+    const char *error = NULL;
+    list_filter_t filter;
+    filter.count = 0;
+    filter.recursive = 0;
+    filter.predicate = NULL;
+
+    snprintf(words, sizeof(words), "%s", args);
+    char *saveptr = NULL;
+    int options = 1;
+    for (char *word = strtok_r(words, " \t", &saveptr); word != NULL && error == NULL; word = strtok_r(NULL, " \t", &saveptr)) {
+        if (options && strcmp(word, "-R") == 0) {
+            filter.recursive = 1;
+        } else if (options && strcmp(word, "-w") == 0) {
+            const char *expression = strtok_r(NULL, " \t", &saveptr);
+            entry_filter_free(filter.predicate);
+            if (expression == NULL || (filter.predicate = entry_filter_compile(expression, time(NULL))) == NULL) {
+                error = "Invalid filter";
+            }
+        } else if (options && word[0] == '-') {
+            error = "Invalid arguments";
+        } else if (filter.count == MAX_LIST_PATTERNS) {
+            error = "Too many patterns";
+        } else if ((filter.globs[filter.count] = glob_compile(word)) == NULL) {
+            error = "Invalid pattern";
+        } else {
+            options = 0;
+            filter.count++;
+        }
+    }
+
+    reply_buffer_t *reply = NULL;
+    if (error == NULL && (reply = malloc(sizeof(reply_buffer_t))) == NULL) {
+        perror("malloc for reply buffer failed");
+    } else if (error == NULL && access(data->current_wd_abs, R_OK | X_OK) == -1) {
+        error = "Cannot open directory";
+    }
+    if (error != NULL) {
+        snprintf(response_line, sizeof(response_line), "%sLIST: %s\n", RESP_ERROR_PREFIX, error);
+        send_all(data->client_sockfd, response_line, strlen(response_line));
+    } else if (reply != NULL) {
+        reply_init(reply, data);
+        list_tree(data, &filter, reply);
+        reply_flush(reply);
+    }
+    free(reply);
+    entry_filter_free(filter.predicate);
+    for (size_t i = 0; i < filter.count; i++) glob_free(filter.globs[i]);
+}
+
+/*
+ * Purpose:
+ *   Handles the LISTDIFF command: LISTDIFF <token>. Instead of the whole
+ *   listing, sends the entries of the current directory that changed since
+ *   the version the client has (from "LIST -v" or a previous LISTDIFF):
+ *   a "DIFF <token> <count>" line with the current version, then one line
+ *   per change: "+ " for an added entry, "- " for a removed one and "~ " for
+ *   one whose type or link target changed, followed by the entry as LIST
+ *   formats it. An old version that is no longer in the directory's change
+ *   log is an error, and the client falls back to LIST.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   token: The version token the client has.
+ *
+ * Returns:
+ *   void
+ */
+static void handle_listdiff(client_thread_data_t *data, const char *token) {
+    char response_line[MAX_BUFFER_SIZE];
+    if (strlen(token) == 0 || strchr(token, ' ') != NULL) {
+        snprintf(response_line, sizeof(response_line), "%sLISTDIFF: Usage: LISTDIFF <version>\n", RESP_ERROR_PREFIX);
+        send_all(data->client_sockfd, response_line, strlen(response_line));
+        return;
+    }
+
+    dir_listing_t *listing = dir_cache_get(data->current_wd_abs);
+    if (listing == NULL) {
+        snprintf(response_line, sizeof(response_line), "%sLISTDIFF: Cannot open directory: %s\n", RESP_ERROR_PREFIX, strerror(errno));
+        send_all(data->client_sockfd, response_line, strlen(response_line));
+        return;
+    }
+
+    char current_token[DIR_TOKEN_SIZE];
+    dir_listing_token(listing, current_token, sizeof(current_token));
+    if (strcmp(token, current_token) == 0) {
+        snprintf(response_line, sizeof(response_line), "%s %s 0\n", RESP_DIFF, current_token);
+        send_all(data->client_sockfd, response_line, strlen(response_line));
+        dir_cache_release(listing);
         return;
     }
 
-    char target_path_trial[MAX_PATH_LEN];
-    if (path_arg[0] == '/') {
-        snprintf(target_path_trial, sizeof(target_path_trial), "%s%s", data->server_root_abs, (strcmp(path_arg, "/") == 0) ? "" : path_arg);
+    const dir_changeset_t *changes = dir_changes_find(listing, token);
+    if (changes == NULL) {
+        snprintf(response_line, sizeof(response_line), "%sLISTDIFF: Version not available, use LIST\n", RESP_ERROR_PREFIX);
+        send_all(data->client_sockfd, response_line, strlen(response_line));
+        dir_cache_release(listing);
+        return;
+    }
+
+    reply_buffer_t *reply = malloc(sizeof(reply_buffer_t));
+    if (reply == NULL) {
+        perror("malloc for reply buffer failed");
+        dir_cache_release(listing);
+        return;
+    }
+    reply_init(reply, data);
+    snprintf(response_line, sizeof(response_line), "%s %s %zu\n", RESP_DIFF, current_token, changes->count);
+    reply_append(reply, response_line, strlen(response_line));
+    for (size_t i = 0; i < changes->count; i++) {
+        const dir_change_t *change = &changes->changes[i];
+        const char *marker = (change->before.type == 0) ? "+ " : (change->after.type == 0) ? "- " : "~ ";
+        const dir_cache_entry_t *entry = (change->after.type == 0) ? &change->before : &change->after;
+        format_listing_entry(response_line + 2, sizeof(response_line) - 2, entry);
+        memcpy(response_line, marker, 2);
+        if (reply_append(reply, response_line, strlen(response_line)) == -1) break;
+    }
+    reply_flush(reply);
+    log_event("LISTDIFF sent %zu changes instead of %zu entries", changes->count, listing->count);
+
+    free(reply);
+    dir_cache_release(listing);
+}
+
+/*
+ * Purpose:
+ *   Handles the LOCATE command: LOCATE [-p|-g] [-n max_results] <pattern>.
+ *   Files and directories below the session's root whose names contain the
+ *   pattern (or start with it with -p, or match it as a glob with -g) are
+ *   looked up in the filename index and sent one path per line.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   args: The command's arguments.
+ *
+ * Returns:
+ *   void
+ */
+static void handle_locate(client_thread_data_t *data, const char *args) {
+    char response_line[MAX_BUFFER_SIZE];
+    int mode = NAME_MATCH_SUBSTRING;
+    size_t max_results = LOCATE_DEFAULT_MAX_RESULTS;
+
+    const char *pattern = args;
+    while (pattern[0] == '-' && pattern[1] != '\0' && (pattern[2] == ' ' || pattern[2] == '\0')) {
+        char option = pattern[1];
+        pattern += 2;
+        while (isspace((unsigned char)*pattern)) pattern++;
+        if (option == 'p') {
+            mode = NAME_MATCH_PREFIX;
+        } else if (option == 'g') {
+            mode = NAME_MATCH_GLOB;
+        } else if (option == 'n') {
+            char *endptr;
+            long value = strtol(pattern, &endptr, 10);
+            if (endptr == pattern || (*endptr != ' ' && *endptr != '\0') || value <= 0) {
+                snprintf(response_line, sizeof(response_line), "%sLOCATE: Invalid result limit\n", RESP_ERROR_PREFIX);
+                send_all(data->client_sockfd, response_line, strlen(response_line));
+                return;
+            }
+            max_results = (size_t)value;
+            pattern = endptr;
+            while (isspace((unsigned char)*pattern)) pattern++;
+        } else {
+            snprintf(response_line, sizeof(response_line), "%sLOCATE: Unknown option -%c\n", RESP_ERROR_PREFIX, option);
+            send_all(data->client_sockfd, response_line, strlen(response_line));
+            return;
+        }
+    }
+
+    char **results = NULL;
+    size_t count = 0;
+    if (strlen(pattern) == 0) {
+        snprintf(response_line, sizeof(response_line), "%sLOCATE: Missing pattern\n", RESP_ERROR_PREFIX);
+    } else if (!g_name_index_enabled) {
+        snprintf(response_line, sizeof(response_line), "%sLOCATE: Filename index is not enabled on this server\n", RESP_ERROR_PREFIX);
+    } else if (!name_index_ready()) {
+        snprintf(response_line, sizeof(response_line), "%sLOCATE: Filename index is still being built, try again later\n", RESP_ERROR_PREFIX);
+    } else if (name_index_query(data->server_root_abs, mode, pattern, max_results, &results, &count) == -1) {
+        snprintf(response_line, sizeof(response_line), "%sLOCATE: %s\n", RESP_ERROR_PREFIX,
+                 errno == ENAMETOOLONG ? "A matching path is too long to send" : "Search failed");
     } else {
-        if (strlen(data->current_wd_abs) + 1 + strlen(path_arg) >= sizeof(target_path_trial)) {
-            snprintf(response_buffer, sizeof(response_buffer), "%sCD: Resulting path is too long\n", RESP_ERROR_PREFIX);
-            send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+        response_line[0] = '\0';
+    }
+    if (response_line[0] != '\0') {
+        send_all(data->client_sockfd, response_line, strlen(response_line));
+        return;
+    }
+
+    reply_buffer_t *reply = malloc(sizeof(reply_buffer_t));
+    if (reply == NULL) perror("malloc for reply buffer failed");
+    else reply_init(reply, data);
+    for (size_t i = 0; i < count; i++) {
+        if (reply != NULL && !request_cancelled(data) && reply_append(reply, results[i], strlen(results[i])) == 0) {
+            reply_append(reply, "\n", 1);
+        }
+        free(results[i]);
+    }
+    if (reply != NULL) {
+        reply_flush(reply);
+        free(reply);
+    }
+    free(results);
+}
+
+/*
+ * Purpose:
+ *   Searches one file for the GREP string and sends each matching line as
+ *   "path:line_number:text". Files containing NUL bytes are treated as binary
+ *   and skipped.
+ *
+ * Parameters:
+ *   state: The state of the GREP request.
+ *   path: The absolute path of the file.
+ *
+ * Returns:
+ *   void
+ */
+static void grep_file(grep_state_t *state, const char *path) {
+    char rel_path[MAX_PATH_LEN];
+    if (get_relative_path(path, state->root_path, rel_path, sizeof(rel_path)) == NULL) return;
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) return;
+    FILE *file = fdopen(fd, "r");
+    if (file == NULL) {
+        close(fd);
+        return;
+    }
+    state->files_searched++;
+
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t line_len;
+    unsigned long line_number = 0;
+    char response_line[MAX_BUFFER_SIZE];
+    while (state->remaining > 0 && !request_cancelled(state->reply->data) &&
+           (line_len = getline(&line, &line_capacity, file)) != -1) {
+        line_number++;
+        if (strlen(line) != (size_t)line_len) break; // Binary file
+        if (strstr(line, state->needle) == NULL) continue;
+        line[strcspn(line, "\r\n")] = '\0';
+        int prefix_len = snprintf(response_line, sizeof(response_line), "%s:%lu:", rel_path, line_number);
+        if (prefix_len < 0 || (size_t)prefix_len >= sizeof(response_line) - 1) continue;
+        snprintf(response_line + prefix_len, sizeof(response_line) - prefix_len, "%.*s\n",
+                 (int)(sizeof(response_line) - prefix_len - 2), line);
+        if (reply_append(state->reply, response_line, strlen(response_line)) == -1) break;
+        state->remaining--;
+    }
+    free(line);
+    fclose(file);
+}
+
+/*
+ * Purpose:
+ *   Searches all regular files below a directory. Symbolic links are not
+ *   followed, so the search cannot leave the jail. The directories waiting
+ *   to be searched are kept on a heap-allocated stack, so the depth of the
+ *   tree is not limited by the thread's stack, and only one directory is
+ *   open at a time.
+ *
+ * Parameters:
+ *   state: The state of the GREP request.
+ *   dir_path: The absolute path of the directory.
+ *
+ * Returns:
+ *   void
+ */
+static void grep_tree(grep_state_t *state, const char *dir_path) {
+    char **pending = NULL;
+    size_t pending_count = 0, pending_capacity = 0;
+    if (path_stack_push(&pending, &pending_count, &pending_capacity, dir_path) == -1) {
+        perror("malloc for GREP directory failed");
+        return;
+    }
+
+    while (pending_count > 0) {
+        char *current = pending[--pending_count];
+        size_t first_child = pending_count;
+        int searching = (state->remaining > 0 && !state->reply->failed && !request_cancelled(state->reply->data));
+        DIR *dirp = searching ? opendir(current) : NULL;
+        struct dirent *entry;
+        while (dirp != NULL && state->remaining > 0 && !state->reply->failed && !request_cancelled(state->reply->data) &&
+               (entry = readdir(dirp)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            struct stat st;
+            if (fstatat(dirfd(dirp), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) continue;
+            char path[MAX_PATH_LEN];
+            if (snprintf(path, sizeof(path), "%s/%s", strcmp(current, "/") == 0 ? "" : current, entry->d_name) >= (int)sizeof(path)) continue;
+            if (S_ISREG(st.st_mode)) {
+                grep_file(state, path);
+                continue;
+            }
+            if (S_ISDIR(st.st_mode) && path_stack_push(&pending, &pending_count, &pending_capacity, path) == -1) {
+                perror("malloc for GREP directory failed");
+            }
+        }
+        if (dirp != NULL) closedir(dirp);
+        free(current);
+
+        // Search the subdirectories in the order they were read.
+        for (size_t low = first_child, high = pending_count; low + 1 < high; low++, high--) {
+            char *swap = pending[low];
+            pending[low] = pending[high - 1];
+            pending[high - 1] = swap;
+        }
+    }
+    free(pending);
+}
+
+/*
+ * Purpose:
+ *   Handles the GREP command: GREP [-n max_matches] <text>. All text files
+ *   below the client's current directory are searched for the literal text.
+ *   If the directory lies in a subtree covered by the trigram index, only
+ *   the index's candidate files are opened; otherwise the tree is walked.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   args: The command's arguments.
+ *
+ * Returns:
+ *   void
+ */
+static void handle_grep(client_thread_data_t *data, const char *args) {
+    char response_line[MAX_BUFFER_SIZE];
+    size_t max_matches = GREP_DEFAULT_MAX_MATCHES;
+
+    const char *needle = args;
+    if (strncmp(needle, "-n", 2) == 0 && (needle[2] == ' ' || needle[2] == '\0')) {
+        char *endptr;
+        long value = strtol(needle + 2, &endptr, 10);
+        if (endptr == needle + 2 || (*endptr != ' ' && *endptr != '\0') || value <= 0) {
+            snprintf(response_line, sizeof(response_line), "%sGREP: Invalid match limit\n", RESP_ERROR_PREFIX);
+            send_all(data->client_sockfd, response_line, strlen(response_line));
             return;
         }
-        strcpy(target_path_trial, data->current_wd_abs);
-        strcat(target_path_trial, "/");
-        strcat(target_path_trial, path_arg);
+        max_matches = (size_t)value;
+        needle = endptr;
+        while (isspace((unsigned char)*needle)) needle++;
+    }
+    if (strlen(needle) == 0) {
+        snprintf(response_line, sizeof(response_line), "%sGREP: Missing search text\n", RESP_ERROR_PREFIX);
+        send_all(data->client_sockfd, response_line, strlen(response_line));
+        return;
     }
 
-    char resolved_path[MAX_PATH_LEN];
-    if (realpath(target_path_trial, resolved_path) == NULL) {
-        snprintf(response_buffer, sizeof(response_buffer), "%sCD: Invalid path: %s\n", RESP_ERROR_PREFIX, path_arg);
+    reply_buffer_t *reply = malloc(sizeof(reply_buffer_t));
+    if (reply == NULL) {
+        perror("malloc for reply buffer failed");
+        return;
+    }
+    reply_init(reply, data);
+    grep_state_t state;
+    memset(&state, 0, sizeof(state));
+    state.reply = reply;
+    state.root_path = data->server_root_abs;
+    state.needle = needle;
+    state.remaining = max_matches;
+
+    char **candidates = NULL;
+    size_t candidate_count = 0;
+    int indexed = (g_grep_subtree_count > 0 &&
+                   trigram_index_candidates(data->current_wd_abs, needle, strlen(needle), &candidates, &candidate_count) == 0);
+    if (indexed) {
+        for (size_t i = 0; i < candidate_count; i++) {
+            if (state.remaining > 0 && !reply->failed && !request_cancelled(data)) grep_file(&state, candidates[i]);
+            free(candidates[i]);
+        }
+        free(candidates);
     } else {
-        struct stat st;
-        if (stat(resolved_path, &st) != 0 || !S_ISDIR(st.st_mode)) {
-            snprintf(response_buffer, sizeof(response_buffer), "%sCD: Not a directory: %s\n", RESP_ERROR_PREFIX, path_arg);
-        } else if (strncmp(resolved_path, data->server_root_abs, strlen(data->server_root_abs)) != 0) {
-            snprintf(response_buffer, sizeof(response_buffer), "%sCD: Operation not permitted\n", RESP_ERROR_PREFIX);
-        } else {
-            strncpy(data->current_wd_abs, resolved_path, sizeof(data->current_wd_abs) - 1);
-            data->current_wd_abs[sizeof(data->current_wd_abs) - 1] = '\0';
-            char rel_path[MAX_PATH_LEN];
-            if (get_relative_path(data->current_wd_abs, data->server_root_abs, rel_path, sizeof(rel_path))) {
-                snprintf(response_buffer, sizeof(response_buffer), "%s\n", (strcmp(rel_path, "/") == 0) ? "/" : rel_path + 1);
-            } else {
-                snprintf(response_buffer, sizeof(response_buffer), "%sCD: Error determining relative path\n", RESP_ERROR_PREFIX);
+        grep_tree(&state, data->current_wd_abs);
+    }
+    reply_flush(reply);
+    free(reply);
+
+    log_event("Client %s:%d GREP searched %zu files (%s), %zu matches", data->client_ip, data->client_port,
+              state.files_searched, indexed ? "trigram index" : "full scan", max_matches - state.remaining);
+}
+
+/*
+ * Purpose:
+ *   Resolves a path given by the client (absolute paths are relative to the
+ *   session's root, others to its current directory) and checks that it
+ *   stays inside the root.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   path_arg: The path as given by the client.
+ *   resolved: The buffer that receives the resolved absolute path.
+ *   size: The size of the buffer.
+ *
+ * Returns:
+ *   0 on success, or -1 with errno set: realpath's error if the path cannot
+ *   be resolved, ENOENT if it leaves the root (so it looks missing), or
+ *   ENAMETOOLONG if it does not fit.
+ */
+static int resolve_session_path(client_thread_data_t *data, const char *path_arg, char *resolved, size_t size) {
+    char trial[MAX_PATH_LEN];
+    int written;
+    if (path_arg[0] == '/') {
+        written = snprintf(trial, sizeof(trial), "%s%s", data->server_root_abs, path_arg);
+    } else {
+        written = snprintf(trial, sizeof(trial), "%s/%s", data->current_wd_abs, path_arg);
+    }
+    if (written < 0 || (size_t)written >= sizeof(trial) || size < MAX_PATH_LEN) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (realpath(trial, resolved) == NULL) return -1;
+    if (!path_within_root(resolved, data->server_root_abs)) {
+        errno = ENOENT;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Handles the COMPLETE command, which lists the entries of a directory
+ *   whose names start with a prefix. The word's directory part (up to the
+ *   last '/') selects the directory; the rest is the prefix. The matches are
+ *   found by binary search in the directory's cached, sorted listing. The
+ *   reply is a "COMPLETE <count>" line (with " MORE" if matches were left
+ *   out) followed by one name per line; directories end with '/'.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   word: The word to complete (may be empty).
+ *
+ * Returns:
+ *   void
+ */
+static void handle_complete(client_thread_data_t *data, const char *word) {
+    char response_line[MAX_BUFFER_SIZE];
+    char dir_path[MAX_PATH_LEN];
+    const char *prefix = strrchr(word, '/');
+    int resolved;
+    if (prefix == NULL) {
+        prefix = word;
+        snprintf(dir_path, sizeof(dir_path), "%s", data->current_wd_abs);
+        resolved = 0;
+    } else {
+        char dir_arg[MAX_PATH_LEN];
+        snprintf(dir_arg, sizeof(dir_arg), "%.*s", (int)(prefix - word + 1), word);
+        prefix++;
+        resolved = resolve_session_path(data, dir_arg, dir_path, sizeof(dir_path));
+    }
+
+    dir_listing_t *listing = (resolved == 0) ? dir_cache_get(dir_path) : NULL;
+    if (listing == NULL) {
+        snprintf(response_line, sizeof(response_line), "%sCOMPLETE: Invalid directory\n", RESP_ERROR_PREFIX);
+        send_all(data->client_sockfd, response_line, strlen(response_line));
+        return;
+    }
+
+    size_t prefix_len = strlen(prefix);
+    size_t low = 0, high = listing->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (strncmp(listing->entries[mid].name, prefix, prefix_len) < 0) low = mid + 1;
+        else high = mid;
+    }
+    size_t end = low;
+    while (end < listing->count && strncmp(listing->entries[end].name, prefix, prefix_len) == 0) end++;
+    size_t count = end - low;
+    int truncated = (count > COMPLETE_MAX_RESULTS);
+    if (truncated) count = COMPLETE_MAX_RESULTS;
+
+    reply_buffer_t *reply = malloc(sizeof(reply_buffer_t));
+    if (reply == NULL) {
+        perror("malloc for reply buffer failed");
+        dir_cache_release(listing);
+        return;
+    }
+    reply_init(reply, data);
+    snprintf(response_line, sizeof(response_line), "%s %zu%s\n", CMD_COMPLETE, count, truncated ? " MORE" : "");
+    reply_append(reply, response_line, strlen(response_line));
+    for (size_t i = low; i < low + count; i++) {
+        const dir_cache_entry_t *entry = &listing->entries[i];
+        format_list_item(response_line, sizeof(response_line), entry->name, NULL, NULL, entry->type == DIR_ENTRY_DIR ? "/\n" : "\n");
+        if (reply_append(reply, response_line, strlen(response_line)) == -1) break;
+    }
+    reply_flush(reply);
+    free(reply);
+    dir_cache_release(listing);
+}
+
+/*
+ * Purpose:
+ *   Handles the STATS command: reports the counters of every server process
+ *   from the shared statistics segment, one line per process (each prefork
+ *   worker, or the single server process) and a total line, preceded by
+ *   "STATS <lines>".
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *
+ * Returns:
+ *   void
+ */
+static void handle_stats(client_thread_data_t *data) {
+    char response_line[MAX_BUFFER_SIZE];
+    reply_buffer_t *reply = malloc(sizeof(reply_buffer_t));
+    if (reply == NULL) {
+        perror("malloc for reply buffer failed");
+        return;
+    }
+    reply_init(reply, data);
+
+    size_t slot_count = server_stats_slot_count();
+    snprintf(response_line, sizeof(response_line), "%s %zu\n", CMD_STATS, slot_count + 1);
+    reply_append(reply, response_line, strlen(response_line));
+
+    long totals[STATS_COUNTER_COUNT] = {0};
+    unsigned long total_restarts = 0;
+    time_t now = time(NULL);
+    for (size_t i = 0; i < slot_count; i++) {
+        server_stats_snapshot_t snapshot;
+        server_stats_read(i, &snapshot);
+        for (int c = 0; c < STATS_COUNTER_COUNT; c++) totals[c] += snapshot.counters[c];
+        total_restarts += snapshot.restarts;
+        snprintf(response_line, sizeof(response_line),
+                 "worker %zu pid %d up %lds restarts %lu connections %ld active %ld commands %ld cpu_ms %ld\n",
+                 i, (int)snapshot.pid, snapshot.pid > 0 ? (long)(now - snapshot.started) : 0L, snapshot.restarts,
+                 snapshot.counters[STATS_CONNECTIONS], snapshot.counters[STATS_ACTIVE_SESSIONS], snapshot.counters[STATS_COMMANDS],
+                 snapshot.counters[STATS_CPU_USEC] / 1000);
+        reply_append(reply, response_line, strlen(response_line));
+    }
+    snprintf(response_line, sizeof(response_line), "total restarts %lu connections %ld active %ld commands %ld cpu_ms %ld\n",
+             total_restarts, totals[STATS_CONNECTIONS], totals[STATS_ACTIVE_SESSIONS], totals[STATS_COMMANDS],
+             totals[STATS_CPU_USEC] / 1000);
+    reply_append(reply, response_line, strlen(response_line));
+    reply_flush(reply);
+    free(reply);
+}
+
+/*
+ * Purpose:
+ *   Handles a CANCEL command that arrives between commands, when nothing is
+ *   running: a CANCEL meant for a running command is taken from the input
+ *   by poll_for_cancel instead.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   args: The optional request id.
+ *
+ * Returns:
+ *   void
+ */
+static void handle_cancel(client_thread_data_t *data, const char *args) {
+    char response_line[MAX_BUFFER_SIZE];
+    if (strlen(args) > 0) {
+        snprintf(response_line, sizeof(response_line), "%sCANCEL: Request %.64s is not running\n", RESP_ERROR_PREFIX, args);
+    } else {
+        snprintf(response_line, sizeof(response_line), "%sCANCEL: No request is running\n", RESP_ERROR_PREFIX);
+    }
+    send_all(data->client_sockfd, response_line, strlen(response_line));
+}
+
+/*
+ * Purpose:
+ *   Tells whether a command line is a CANCEL command.
+ *
+ * Parameters:
+ *   line: The command line.
+ *
+ * Returns:
+ *   Nonzero for CANCEL, zero otherwise.
+ */
+static int is_cancel_command(const char *line) {
+    while (isspace((unsigned char)*line)) line++;
+    size_t len = strlen(CMD_CANCEL);
+    return strncmp(line, CMD_CANCEL, len) == 0 && (line[len] == '\0' || isspace((unsigned char)line[len]));
+}
+
+/*
+ * Purpose:
+ *   Looks, without waiting, at the input the client sent while its command
+ *   runs. "CANCEL [<request_id>]" for the running request is consumed and
+ *   cancels it (a CANCEL for another id is consumed and ignored); a closed
+ *   connection also stops the request, since nobody will read the rest of
+ *   its reply. Other lines, QUIT included, wait until the request is done.
+ *   Only the first pending line is examined.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *
+ * Returns:
+ *   Nonzero if the running request must stop.
+ */
+static int poll_for_cancel(client_thread_data_t *data) {
+    if (data->cancel_state != CANCEL_NONE) return 1;
+    data->cancel_polls = 0;
+
+    char pending[MAX_CMD_LEN];
+    ssize_t nbytes = transport_peek(data->client_sockfd, pending, sizeof(pending) - 1);
+    if (nbytes == 0) {
+        data->cancel_state = CANCEL_PEER_GONE;
+        return 1;
+    }
+    if (nbytes < 0) return 0;
+    pending[nbytes] = '\0';
+    char *newline = strchr(pending, '\n');
+    if (newline == NULL) return 0; // Incomplete (or too long to be a CANCEL)
+    size_t line_len = (size_t)(newline - pending) + 1;
+    *newline = '\0';
+    pending[strcspn(pending, "\r")] = '\0';
+
+    char *word = pending;
+    while (isspace((unsigned char)*word)) word++;
+    if (!is_cancel_command(word)) return 0;
+
+    char discard[MAX_CMD_LEN];
+    if (recv_all(data->client_sockfd, discard, line_len) != (ssize_t)line_len) return 0;
+    const char *id_arg = word + strlen(CMD_CANCEL);
+    while (isspace((unsigned char)*id_arg)) id_arg++;
+    char *endptr;
+    unsigned long id = (*id_arg == '\0') ? data->request_id : strtoul(id_arg, &endptr, 10);
+    if (*id_arg != '\0' && (endptr == id_arg || *endptr != '\0')) id = 0;
+    if (id != data->request_id) {
+        log_event("Client %s:%d sent CANCEL for request '%s', but request %lu is running; ignored.",
+                  data->client_ip, data->client_port, id_arg, data->request_id);
+        return 0;
+    }
+    data->cancel_state = CANCEL_REQUESTED;
+    return 1;
+}
+
+/*
+ * Purpose:
+ *   Checks in a handler loop whether the running request was cancelled. The
+ *   client's input is only looked at every CANCEL_CHECK_INTERVAL calls, so
+ *   the check is cheap enough for per-entry loops.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *
+ * Returns:
+ *   Nonzero if the request must stop.
+ */
+static int request_cancelled(client_thread_data_t *data) {
+    if (data->cancel_state != CANCEL_NONE) return 1;
+    if (++data->cancel_polls < CANCEL_CHECK_INTERVAL) return 0;
+    return poll_for_cancel(data);
+}
+
+/*
+ * Purpose:
+ *   Cancellation check passed to tree_hash_file, top_files_scan and
+ *   line_count_files, which call it seldom enough to look at the client's
+ *   input every time.
+ *
+ * Parameters:
+ *   ctx: The client_thread_data_t of the request.
+ *
+ * Returns:
+ *   Nonzero if the request must stop.
+ */
+static int session_cancel_check(void *ctx) {
+    return poll_for_cancel((client_thread_data_t *)ctx);
+}
+
+/*
+ * Purpose:
+ *   Pushes a copy of a path onto a heap-allocated stack of directories
+ *   waiting to be walked, growing the stack as needed.
+ *
+ * Parameters:
+ *   stack: The stack (NULL when empty and never grown).
+ *   count: The number of paths on the stack.
+ *   capacity: The number of slots allocated.
+ *   path: The path to push.
+ *
+ * Returns:
+ *   0 on success, or -1 on allocation failure.
+ */
+static int path_stack_push(char ***stack, size_t *count, size_t *capacity, const char *path) {
+    if (*count == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 16;
+        char **grown = realloc(*stack, new_capacity * sizeof(char *));
+        if (grown == NULL) return -1;
+        *stack = grown;
+        *capacity = new_capacity;
+    }
+    char *copy = strdup(path);
+    if (copy == NULL) return -1;
+    (*stack)[(*count)++] = copy;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Adds up the sizes of everything below a directory. Symbolic links are
+ *   counted but not followed, so the walk cannot leave the jail. The
+ *   directories waiting to be read are kept on a heap-allocated stack and
+ *   only one is open at a time, so a deep tree neither exhausts the
+ *   thread's stack nor the process's descriptors. Entries that cannot be
+ *   examined (other than ones removed during the walk) are counted in
+ *   totals->unreadable.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   dir_path: The absolute path of the directory.
+ *   totals: The totals to add to.
+ *
+ * Returns:
+ *   void
+ */
+static void du_tree(client_thread_data_t *data, const char *dir_path, du_totals_t *totals) {
+    char **pending = NULL;
+    size_t pending_count = 0, pending_capacity = 0;
+    if (path_stack_push(&pending, &pending_count, &pending_capacity, dir_path) == -1) {
+        perror("malloc for DU directory failed");
+        totals->unreadable++;
+        return;
+    }
+
+    while (pending_count > 0) {
+        char *current = pending[--pending_count];
+        if (request_cancelled(data)) {
+            free(current);
+            continue;
+        }
+        int dir_fd = open(current, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        DIR *dirp = (dir_fd == -1) ? NULL : fdopendir(dir_fd);
+        if (dirp == NULL) {
+            if (errno != ENOENT) totals->unreadable++;
+            if (dir_fd != -1) close(dir_fd);
+            free(current);
+            continue;
+        }
+        while (!request_cancelled(data)) {
+            errno = 0;
+            struct dirent *entry = readdir(dirp);
+            if (entry == NULL) {
+                if (errno != 0) totals->unreadable++;
+                break;
+            }
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            struct stat st;
+            if (fstatat(dirfd(dirp), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+                if (errno != ENOENT) totals->unreadable++;
+                continue;
+            }
+            totals->bytes += (unsigned long long)st.st_size;
+            totals->disk_bytes += (unsigned long long)st.st_blocks * 512;
+            if (!S_ISDIR(st.st_mode)) {
+                totals->files++;
+                continue;
+            }
+            totals->dirs++;
+            char path[MAX_PATH_LEN];
+            if (snprintf(path, sizeof(path), "%s/%s", strcmp(current, "/") == 0 ? "" : current, entry->d_name) >= (int)sizeof(path) ||
+                path_stack_push(&pending, &pending_count, &pending_capacity, path) == -1) {
+                totals->unreadable++;
             }
         }
+        closedir(dirp);
+        free(current);
     }
-    send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+    free(pending);
 }
 
 /*
  * Purpose:
- *   Handles the server-side script execution triggered by the '@' command. It
- *   validates the script path, opens the file, and processes each line as a
- *   new command, with protection against infinite recursion.
+ *   Handles the DU command: DU [path]. Replies with one line
+ *   "DU <path> bytes <n> disk <n> files <n> dirs <n>" for the given file or
+ *   directory tree (the current directory by default). Nothing is sent if
+ *   the request is cancelled, and an error replaces the totals if some
+ *   entries could not be examined, since partial totals would be misleading.
  *
  * Parameters:
  *   data: A pointer to the client's thread-specific data structure.
- *   filename: The name of the script file to execute.
+ *   path_arg: The path (may be empty).
  *
  * Returns:
  *   void
  */
-static void handle_at_command(client_thread_data_t *data, const char *filename) {
-    char response_buffer[MAX_BUFFER_SIZE];
-
-    if (filename == NULL || strlen(filename) == 0) {
-        snprintf(response_buffer, sizeof(response_buffer), "%s@: Missing filename\n", RESP_ERROR_PREFIX);
-        send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+static void handle_du(client_thread_data_t *data, const char *path_arg) {
+    char response_line[MAX_BUFFER_SIZE];
+    char path[MAX_PATH_LEN];
+    char rel_path[MAX_PATH_LEN];
+    struct stat st;
+    if (resolve_session_path(data, strlen(path_arg) > 0 ? path_arg : ".", path, sizeof(path)) == -1 ||
+        lstat(path, &st) == -1 || get_relative_path(path, data->server_root_abs, rel_path, sizeof(rel_path)) == NULL) {
+        snprintf(response_line, sizeof(response_line), "%sDU: Invalid path\n", RESP_ERROR_PREFIX);
+        send_all(data->client_sockfd, response_line, strlen(response_line));
         return;
     }
 
-    if (data->script_depth >= MAX_SCRIPT_DEPTH) {
-        snprintf(response_buffer, sizeof(response_buffer), "%s@: Maximum script recursion depth (%d) exceeded\n", RESP_ERROR_PREFIX, MAX_SCRIPT_DEPTH);
-        send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+    du_totals_t totals = {
+        .bytes = (unsigned long long)st.st_size,
+        .disk_bytes = (unsigned long long)st.st_blocks * 512,
+        .files = S_ISDIR(st.st_mode) ? 0 : 1,
+        .dirs = S_ISDIR(st.st_mode) ? 1 : 0
+    };
+    if (S_ISDIR(st.st_mode)) du_tree(data, path, &totals);
+    if (data->cancel_state != CANCEL_NONE) return;
+
+    if (totals.unreadable > 0) {
+        snprintf(response_line, sizeof(response_line), "%sDU: %lu entries below %.3000s could not be read\n",
+                 RESP_ERROR_PREFIX, totals.unreadable, rel_path);
+        send_all(data->client_sockfd, response_line, strlen(response_line));
+        log_event("Client %s:%d DU %s: %lu entries could not be read", data->client_ip, data->client_port,
+                  rel_path, totals.unreadable);
         return;
     }
 
-    char script_path_trial[MAX_PATH_LEN];
-    if (strlen(data->current_wd_abs) + 1 + strlen(filename) >= sizeof(script_path_trial)) {
-        snprintf(response_buffer, sizeof(response_buffer), "%s@: Resulting script path is too long\n", RESP_ERROR_PREFIX);
-        send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+    snprintf(response_line, sizeof(response_line), "%s %.3000s bytes %llu disk %llu files %lu dirs %lu\n",
+             CMD_DU, rel_path, totals.bytes, totals.disk_bytes, totals.files, totals.dirs);
+    send_all(data->client_sockfd, response_line, strlen(response_line));
+}
+
+/*
+ * Purpose:
+ *   Computes the SHA-256 digest of a file, read sequentially. A block takes
+ *   long enough to hash that the client's input is checked before each one.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   fd: The open file.
+ *   digest: Receives the digest.
+ *
+ * Returns:
+ *   0 on success, or -1 on a read error or if the request was cancelled.
+ */
+static int sha256_file(client_thread_data_t *data, int fd, unsigned char digest[SHA256_DIGEST_SIZE]) {
+    char *block = malloc(HASH_READ_BLOCK);
+    if (block == NULL) {
+        perror("malloc for hash block failed");
+        return -1;
+    }
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    ssize_t nbytes = 0;
+    while (!poll_for_cancel(data) && (nbytes = read(fd, block, HASH_READ_BLOCK)) != 0) {
+        if (nbytes == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        sha256_update(&ctx, block, (size_t)nbytes);
+    }
+    free(block);
+    if (nbytes != 0) return -1;
+    sha256_final(&ctx, digest);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Handles the HASH command: HASH [-t [-l]] <file>. Replies with the SHA-256
+ *   digest of a regular file as "<hex digest>  <path>", the format of
+ *   sha256sum. With -t, the digest is the root of the file's tree hash (see
+ *   tree_hash.h), whose chunks are hashed on several threads at once; -l
+ *   adds a "CHUNKS <count> <chunk_size>" line and the digest of each chunk,
+ *   one per line, for checking byte ranges of the file.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   args: The command's arguments.
+ *
+ * Returns:
+ *   void
+ */
+static void handle_hash(client_thread_data_t *data, const char *args) {
+    char response_line[MAX_BUFFER_SIZE];
+    char path[MAX_PATH_LEN];
+    char rel_path[MAX_PATH_LEN];
+    const char *error = NULL;
+    int tree = 0, list_chunks = 0;
+    int fd = -1;
+    struct stat st;
+
+    const char *path_arg = args;
+    while (path_arg[0] == '-' && (path_arg[1] == 't' || path_arg[1] == 'l') && (path_arg[2] == ' ' || path_arg[2] == '\0')) {
+        if (path_arg[1] == 't') tree = 1;
+        else list_chunks = 1;
+        path_arg += 2;
+        while (isspace((unsigned char)*path_arg)) path_arg++;
+    }
+    if (list_chunks && !tree) {
+        error = "-l needs -t";
+    } else if (strlen(path_arg) == 0) {
+        error = "Missing file name";
+    } else if (resolve_session_path(data, path_arg, path, sizeof(path)) == -1 ||
+               get_relative_path(path, data->server_root_abs, rel_path, sizeof(rel_path)) == NULL ||
+               (fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) == -1) {
+        error = "Invalid path";
+    } else if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        error = "Not a regular file";
+    }
+    if (error != NULL) {
+        if (fd != -1) close(fd);
+        snprintf(response_line, sizeof(response_line), "%sHASH: %s\n", RESP_ERROR_PREFIX, error);
+        send_all(data->client_sockfd, response_line, strlen(response_line));
         return;
     }
-    strcpy(script_path_trial, data->current_wd_abs);
-    strcat(script_path_trial, "/");
-    strcat(script_path_trial, filename);
 
-    char resolved_path[MAX_PATH_LEN];
-    if (realpath(script_path_trial, resolved_path) == NULL) {
-        snprintf(response_buffer, sizeof(response_buffer), "%s@: Script not found: %s\n", RESP_ERROR_PREFIX, filename);
-        send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    unsigned char *leaves = NULL;
+    size_t leaf_count = 0;
+    int result;
+    if (tree) {
+        result = tree_hash_file(fd, st.st_size, 0, session_cancel_check, data, digest,
+                                list_chunks ? &leaves : NULL, &leaf_count);
+    } else {
+        result = sha256_file(data, fd, digest);
+    }
+    close(fd);
+    if (data->cancel_state != CANCEL_NONE) return;
+    if (result == -1) {
+        snprintf(response_line, sizeof(response_line), "%sHASH: Read error\n", RESP_ERROR_PREFIX);
+        send_all(data->client_sockfd, response_line, strlen(response_line));
         return;
     }
 
-    if (strncmp(resolved_path, data->server_root_abs, strlen(data->server_root_abs)) != 0) {
-        snprintf(response_buffer, sizeof(response_buffer), "%s@: Access to script denied: %s\n", RESP_ERROR_PREFIX, filename);
-        send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+    char hex[SHA256_HEX_SIZE];
+    sha256_to_hex(digest, hex);
+    snprintf(response_line, sizeof(response_line), "%s  %.3000s\n", hex, rel_path);
+    if (leaves == NULL) {
+        send_all(data->client_sockfd, response_line, strlen(response_line));
+        return;
+    }
+    reply_buffer_t *reply = malloc(sizeof(reply_buffer_t));
+    if (reply == NULL) {
+        perror("malloc for reply buffer failed");
+        free(leaves);
         return;
     }
+    reply_init(reply, data);
+    reply_append(reply, response_line, strlen(response_line));
+    snprintf(response_line, sizeof(response_line), "CHUNKS %zu %d\n", leaf_count, TREE_HASH_CHUNK_SIZE);
+    reply_append(reply, response_line, strlen(response_line));
+    for (size_t i = 0; i < leaf_count; i++) {
+        sha256_to_hex(leaves + i * SHA256_DIGEST_SIZE, hex);
+        hex[SHA256_HEX_SIZE - 1] = '\n';
+        if (reply_append(reply, hex, SHA256_HEX_SIZE) == -1) break;
+    }
+    reply_flush(reply);
+    free(reply);
+    free(leaves);
+}
 
-    FILE *script_file = fopen(resolved_path, "r");
-    if (script_file == NULL) {
-        snprintf(response_buffer, sizeof(response_buffer), "%s@: Cannot open script '%s': %s\n", RESP_ERROR_PREFIX, filename, strerror(errno));
-        send_all(data->client_sockfd, response_buffer, strlen(response_buffer));
+/*
+ * Purpose:
+ *   Cancellation check passed to tree_digest_dir.
+ *
+ * Parameters:
+ *   ctx: The client_thread_data_t of the request.
+ *
+ * Returns:
+ *   Nonzero if the request must stop.
+ */
+static int tree_digest_cancelled(void *ctx) {
+    return request_cancelled((client_thread_data_t *)ctx);
+}
+
+/*
+ * Purpose:
+ *   Handles the TREEHASH command: TREEHASH [-l] [path]. Replies with
+ *   "TREEHASH <hex digest> <path>", the Merkle digest of a directory tree
+ *   (the current directory by default; see tree_digest.h). With -l, an
+ *   "ENTRIES <n>" line follows with one "<hex digest> <type> <name>" line per
+ *   entry, so a client comparing a mirror descends only into the entries
+ *   whose digests differ from its own.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   args: The command's arguments.
+ *
+ * Returns:
+ *   void
+ */
+static void handle_treehash(client_thread_data_t *data, const char *args) {
+    char response_line[MAX_BUFFER_SIZE];
+    char path[MAX_PATH_LEN];
+    char rel_path[MAX_PATH_LEN];
+    const char *error = NULL;
+    int list_entries = 0;
+    struct stat st;
+
+    const char *path_arg = args;
+    if (path_arg[0] == '-' && path_arg[1] == 'l' && (path_arg[2] == ' ' || path_arg[2] == '\0')) {
+        list_entries = 1;
+        path_arg += 2;
+        while (isspace((unsigned char)*path_arg)) path_arg++;
+    }
+    if (resolve_session_path(data, strlen(path_arg) > 0 ? path_arg : ".", path, sizeof(path)) == -1 ||
+        get_relative_path(path, data->server_root_abs, rel_path, sizeof(rel_path)) == NULL || lstat(path, &st) == -1) {
+        error = "Invalid path";
+    } else if (!S_ISDIR(st.st_mode)) {
+        error = "Not a directory";
+    }
+    if (error != NULL) {
+        snprintf(response_line, sizeof(response_line), "%sTREEHASH: %s\n", RESP_ERROR_PREFIX, error);
+        send_all(data->client_sockfd, response_line, strlen(response_line));
         return;
     }
 
-    data->script_depth++;
-    log_event("Client %s:%d starting script '%s' (depth %d)", data->client_ip, data->client_port, filename, data->script_depth);
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    tree_digest_entry_t *entries = NULL;
+    size_t entry_count = 0;
+    tree_digest_stats_t stats;
+    int result = tree_digest_dir(path, tree_digest_cancelled, data, digest, list_entries ? &entries : NULL, &entry_count, &stats);
+    if (data->cancel_state != CANCEL_NONE) return;
+    if (result == -1) {
+        snprintf(response_line, sizeof(response_line), "%sTREEHASH: Read error\n", RESP_ERROR_PREFIX);
+        send_all(data->client_sockfd, response_line, strlen(response_line));
+        return;
+    }
+    log_event("Client %s:%d: TREEHASH %s (%zu directories hashed, %zu cached)",
+              data->client_ip, data->client_port, rel_path, stats.computed, stats.cached);
 
-    char line_buffer[MAX_BUFFER_SIZE];
-    while (fgets(line_buffer, sizeof(line_buffer), script_file) != NULL) {
-        line_buffer[strcspn(line_buffer, "\r\n")] = 0;
-        if (strlen(line_buffer) == 0) continue;
+    char hex[SHA256_HEX_SIZE];
+    sha256_to_hex(digest, hex);
+    snprintf(response_line, sizeof(response_line), "%s %s %.3000s\n", CMD_TREEHASH, hex, rel_path);
+    if (!list_entries) {
+        send_all(data->client_sockfd, response_line, strlen(response_line));
+        return;
+    }
+    reply_buffer_t *reply = malloc(sizeof(reply_buffer_t));
+    if (reply == NULL) {
+        perror("malloc for reply buffer failed");
+        tree_digest_free_entries(entries, entry_count);
+        return;
+    }
+    reply_init(reply, data);
+    reply_append(reply, response_line, strlen(response_line));
+    snprintf(response_line, sizeof(response_line), "ENTRIES %zu\n", entry_count);
+    reply_append(reply, response_line, strlen(response_line));
+    for (size_t i = 0; i < entry_count; i++) {
+        if (entries[i].name == NULL) continue;
+        sha256_to_hex(entries[i].digest, hex);
+        snprintf(response_line, sizeof(response_line), "%s %c %.3000s\n", hex, entries[i].type, entries[i].name);
+        if (reply_append(reply, response_line, strlen(response_line)) == -1) break;
+    }
+    reply_flush(reply);
+    free(reply);
+    tree_digest_free_entries(entries, entry_count);
+}
 
-        snprintf(response_buffer, sizeof(response_buffer), "script> %.4080s\n", line_buffer);
-        if (send_all(data->client_sockfd, response_buffer, strlen(response_buffer)) == -1) break;
+/*
+ * Purpose:
+ *   Handles the STAT command: STAT <path> [<path>...]. Looks up all paths of
+ *   the line in one batch (see batch_stat.h) and replies with a
+ *   "STAT <count>" line and one record per path, in order:
+ *     "<type> <size> <mtime> <path>"  type f, d, l or o (other)
+ *     "- <reason> <path>"             reason missing, denied or error
+ *   Paths are separated by white space and resolved like those of other
+ *   commands, but a symbolic link is reported itself, not followed.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   args: The paths.
+ *
+ * Returns:
+ *   void
+ */
+static void handle_stat(client_thread_data_t *data, const char *args) {
+    char response_line[MAX_BUFFER_SIZE];
+    char cwd_rel[MAX_PATH_LEN];
+    size_t args_len = strlen(args);
+    if (args_len == 0 || get_relative_path(data->current_wd_abs, data->server_root_abs, cwd_rel, sizeof(cwd_rel)) == NULL) {
+        snprintf(response_line, sizeof(response_line), "%sSTAT: %s\n", RESP_ERROR_PREFIX, args_len == 0 ? "Missing path" : "Invalid path");
+        send_all(data->client_sockfd, response_line, strlen(response_line));
+        return;
+    }
 
-        if (process_client_command(data, line_buffer) != 0) break;
+    // At most one path per two characters of the line; each gets the
+    // current directory as a prefix.
+    size_t max_paths = args_len / 2 + 1;
+    size_t cwd_len = strlen(cwd_rel);
+    char *words = strdup(args);
+    char *joined = malloc(args_len + 1 + max_paths * (cwd_len + 2));
+    const char **names = malloc(max_paths * sizeof(char *));
+    const char **paths = malloc(max_paths * sizeof(char *));
+    batch_stat_result_t *results = malloc(max_paths * sizeof(batch_stat_result_t));
+    reply_buffer_t *reply = malloc(sizeof(reply_buffer_t));
+    if (words == NULL || joined == NULL || names == NULL || paths == NULL || results == NULL || reply == NULL) {
+        perror("malloc for STAT batch failed");
+        free(words);
+        free(joined);
+        free(names);
+        free(paths);
+        free(results);
+        free(reply);
+        return;
     }
 
-    if (ferror(script_file)) perror("Error reading from script file");
-    fclose(script_file);
+    size_t count = 0;
+    char *next = joined;
+    char *saveptr = NULL;
+    for (char *word = strtok_r(words, " \t", &saveptr); word != NULL; word = strtok_r(NULL, " \t", &saveptr)) {
+        names[count] = word;
+        paths[count] = next;
+        if (word[0] == '/') {
+            next += sprintf(next, "%s", word) + 1;
+        } else {
+            next += sprintf(next, "%s%s%s", cwd_rel, cwd_len > 1 ? "/" : "", word) + 1;
+        }
+        count++;
+    }
 
-    log_event("Client %s:%d finished script '%s' (depth %d)", data->client_ip, data->client_port, filename, data->script_depth);
-    data->script_depth--;
+    if (batch_stat(data->server_root_abs, paths, count, results) == -1) {
+        snprintf(response_line, sizeof(response_line), "%sSTAT: Root not accessible\n", RESP_ERROR_PREFIX);
+        send_all(data->client_sockfd, response_line, strlen(response_line));
+    } else {
+        reply_init(reply, data);
+        snprintf(response_line, sizeof(response_line), "%s %zu\n", CMD_STAT, count);
+        reply_append(reply, response_line, strlen(response_line));
+        for (size_t i = 0; i < count; i++) {
+            const batch_stat_result_t *result = &results[i];
+            if (result->error == 0) {
+                snprintf(response_line, sizeof(response_line), "%c %llu %lld %.3000s\n",
+                         result->type, result->size, result->mtime, names[i]);
+            } else {
+                const char *reason = "error";
+                if (result->error == ENOENT || result->error == ENOTDIR) reason = "missing";
+                else if (result->error == EACCES || result->error == EPERM) reason = "denied";
+                snprintf(response_line, sizeof(response_line), "- %s %.3000s\n", reason, names[i]);
+            }
+            if (reply_append(reply, response_line, strlen(response_line)) == -1) break;
+        }
+        reply_flush(reply);
+    }
+    free(words);
+    free(joined);
+    free(names);
+    free(paths);
+    free(results);
+    free(reply);
 }
 
 /*
  * Purpose:
- *   Safely constructs a single line of output for the LIST command.
+ *   Handles the TOP command: TOP [-m] [-n count] [path]. Replies with a
+ *   "TOP <count>" line and the largest regular files below the directory
+ *   (the current one by default), or with -m the most recently modified
+ *   ones, one "<size> <mtime> <path>" line each, best first; paths are
+ *   relative to the root. At most 'count' files (default TOP_DEFAULT_COUNT)
+ *   are sent. The tree is scanned on several threads (see top_files.h).
  *
  * Parameters:
- *   buffer: The destination buffer for the formatted string.
- *   buf_size: The size of the destination buffer.
- *   name: The name of the file or directory.
- *   middle: An optional string to place after the name (e.g., " -> ").
- *   target: An optional target for symlinks.
- *   suffix: An optional suffix (e.g., "/" for directories or "\n").
+ *   data: A pointer to the client's thread-specific data structure.
+ *   args: The command's arguments.
  *
  * Returns:
  *   void
  */
-static void format_list_item(char *buffer, size_t buf_size, const char *name, const char *middle, const char *target, const char *suffix) {
-    if (buffer == NULL || buf_size == 0) return;
-    buffer[0] = '\0';
-    size_t current_pos = 0;
-    int written;
-
-    written = snprintf(buffer + current_pos, buf_size - current_pos, "%s", name);
-    if (written < 0 || (size_t)written >= (buf_size - current_pos)) return;
-    current_pos += written;
-
-    if (middle) {
-        written = snprintf(buffer + current_pos, buf_size - current_pos, "%s", middle);
-        if (written < 0 || (size_t)written >= (buf_size - current_pos)) return;
-        current_pos += written;
+static void handle_top(client_thread_data_t *data, const char *args) {
+    char response_line[MAX_PATH_LEN + 64]; // Room for rel_path and the numbers
+    char path[MAX_PATH_LEN];
+    char rel_path[MAX_PATH_LEN];
+    const char *error = NULL;
+    int rank_by = TOP_BY_SIZE;
+    size_t count = TOP_DEFAULT_COUNT;
+    struct stat st;
+
+    const char *path_arg = args;
+    while (path_arg[0] == '-' && error == NULL) {
+        if (path_arg[1] == 'm' && (path_arg[2] == ' ' || path_arg[2] == '\0')) {
+            rank_by = TOP_BY_MTIME;
+            path_arg += 2;
+        } else if (path_arg[1] == 'n' && path_arg[2] == ' ') {
+            char *endptr;
+            unsigned long value = strtoul(path_arg + 3, &endptr, 10);
+            if (endptr == path_arg + 3 || (*endptr != ' ' && *endptr != '\0') || value == 0 || value > TOP_MAX_COUNT) {
+                error = "Invalid count";
+            }
+            count = (size_t)value;
+            path_arg = endptr;
+        } else {
+            error = "Invalid arguments";
+        }
+        while (isspace((unsigned char)*path_arg)) path_arg++;
     }
-    if (target) {
-        written = snprintf(buffer + current_pos, buf_size - current_pos, "%s", target);
-        if (written < 0 || (size_t)written >= (buf_size - current_pos)) return;
-        current_pos += written;
+    if (error == NULL &&
+        (resolve_session_path(data, strlen(path_arg) > 0 ? path_arg : ".", path, sizeof(path)) == -1 ||
+         get_relative_path(path, data->server_root_abs, rel_path, sizeof(rel_path)) == NULL || stat(path, &st) == -1)) {
+        error = "Invalid path";
+    } else if (error == NULL && !S_ISDIR(st.st_mode)) {
+        error = "Not a directory";
     }
-    if (suffix) {
-        written = snprintf(buffer + current_pos, buf_size - current_pos, "%s", suffix);
-        if (written < 0 || (size_t)written >= (buf_size - current_pos)) return;
+    top_file_t *files = NULL;
+    size_t file_count = 0;
+    if (error == NULL && top_files_scan(path, rank_by, count, 0, session_cancel_check, data, &files, &file_count) == -1) {
+        if (data->cancel_state != CANCEL_NONE) return;
+        error = "Scan failed";
+    }
+    reply_buffer_t *reply = (error == NULL) ? malloc(sizeof(reply_buffer_t)) : NULL;
+    if (error != NULL) {
+        snprintf(response_line, sizeof(response_line), "%sTOP: %s\n", RESP_ERROR_PREFIX, error);
+        send_all(data->client_sockfd, response_line, strlen(response_line));
+        return;
+    }
+    if (reply == NULL) {
+        perror("malloc for reply buffer failed");
+        top_files_free(files, file_count);
+        return;
+    }
+
+    // rel_path is "/" or "/dir"; file paths are relative to it.
+    const char *dir_prefix = (strcmp(rel_path, "/") == 0) ? "" : rel_path;
+    reply_init(reply, data);
+    snprintf(response_line, sizeof(response_line), "%s %zu\n", CMD_TOP, file_count);
+    reply_append(reply, response_line, strlen(response_line));
+    for (size_t i = 0; i < file_count; i++) {
+        // The path is appended as is, since it may not fit in response_line.
+        snprintf(response_line, sizeof(response_line), "%llu %lld %s/", files[i].size, files[i].mtime, dir_prefix);
+        if (reply_append(reply, response_line, strlen(response_line)) == -1 ||
+            reply_append(reply, files[i].path, strlen(files[i].path)) == -1 || reply_append(reply, "\n", 1) == -1) break;
     }
+    reply_flush(reply);
+    free(reply);
+    top_files_free(files, file_count);
 }
 
 /*
  * Purpose:
- *   Handles the LIST command by reading the contents of the client's current
- *   directory on the server, formatting each entry, and sending it to the client.
+ *   Handles the WC command: WC [-w] <path> [<path>...]. Counts the lines and
+ *   bytes of the files (with -w, words too; see line_count.h) and replies
+ *   with a "WC <count>" line, one record per path in order and a total:
+ *     "<lines> [<words>] <bytes> <path>"
+ *     "- <reason> <path>"             reason missing, denied, directory,
+ *                                     notfile or error
+ *     "TOTAL <lines> [<words>] <bytes>"
+ *   Paths are separated by white space and resolved like those of other
+ *   commands.
  *
  * Parameters:
  *   data: A pointer to the client's thread-specific data structure.
+ *   args: The command's arguments.
  *
  * Returns:
  *   void
  */
-static void handle_list(client_thread_data_t *data) {
+static void handle_wc(client_thread_data_t *data, const char *args) {
     char response_line[MAX_BUFFER_SIZE];
-    DIR *dirp = opendir(data->current_wd_abs);
-    if (dirp == NULL) {
-        snprintf(response_line, sizeof(response_line), "%sLIST: Cannot open directory: %s\n", RESP_ERROR_PREFIX, strerror(errno));
+    char resolved[MAX_PATH_LEN];
+    int count_words = 0;
+
+    const char *path_arg = args;
+    if (path_arg[0] == '-' && path_arg[1] == 'w' && (path_arg[2] == ' ' || path_arg[2] == '\0')) {
+        count_words = 1;
+        path_arg += 2;
+        while (isspace((unsigned char)*path_arg)) path_arg++;
+    }
+    size_t args_len = strlen(path_arg);
+    if (args_len == 0) {
+        snprintf(response_line, sizeof(response_line), "%sWC: Missing path\n", RESP_ERROR_PREFIX);
         send_all(data->client_sockfd, response_line, strlen(response_line));
         return;
     }
 
-    struct dirent *entry;
-    errno = 0;
-    while ((entry = readdir(dirp)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
-
-        char item_path_abs[MAX_PATH_LEN];
-        if (strlen(data->current_wd_abs) + 1 + strlen(entry->d_name) >= sizeof(item_path_abs)) {
-            log_event("Path too long for item, skipping: %s/%s", data->current_wd_abs, entry->d_name);
-            continue;
+    // At most one path per two characters of the line.
+    size_t max_paths = args_len / 2 + 1;
+    char *words = strdup(path_arg);
+    const char **names = malloc(max_paths * sizeof(char *));
+    char **paths = calloc(max_paths, sizeof(char *));
+    int *resolve_errors = calloc(max_paths, sizeof(int));
+    line_count_result_t *results = malloc(max_paths * sizeof(line_count_result_t));
+    reply_buffer_t *reply = malloc(sizeof(reply_buffer_t));
+    size_t count = 0;
+    int failed = (words == NULL || names == NULL || paths == NULL || resolve_errors == NULL || results == NULL || reply == NULL);
+    char *saveptr = NULL;
+    for (char *word = failed ? NULL : strtok_r(words, " \t", &saveptr); word != NULL; word = strtok_r(NULL, " \t", &saveptr)) {
+        names[count] = word;
+        if (resolve_session_path(data, word, resolved, sizeof(resolved)) == -1) {
+            resolve_errors[count] = (errno == EACCES) ? EACCES : ENOENT;
+        } else if ((paths[count] = strdup(resolved)) == NULL) {
+            failed = 1;
+            break;
         }
-        strcpy(item_path_abs, data->current_wd_abs);
-        strcat(item_path_abs, "/");
-        strcat(item_path_abs, entry->d_name);
-
-        struct stat st;
-        if (lstat(item_path_abs, &st) == -1) continue;
-
-        if (S_ISDIR(st.st_mode)) {
-            format_list_item(response_line, sizeof(response_line), entry->d_name, NULL, NULL, "/\n");
-        } else if (S_ISLNK(st.st_mode)) {
-            char target_buf[MAX_PATH_LEN];
-            ssize_t len = readlink(item_path_abs, target_buf, sizeof(target_buf) - 1);
-            if (len != -1) {
-                target_buf[len] = '\0';
-                format_list_item(response_line, sizeof(response_line), entry->d_name, " -> ", target_buf, "\n");
+        count++;
+    }
+    if (failed) {
+        perror("malloc for WC batch failed");
+    } else if (line_count_files((const char *const *)paths, count, count_words, 0, session_cancel_check, data, results) == -1) {
+        if (data->cancel_state == CANCEL_NONE) {
+            snprintf(response_line, sizeof(response_line), "%sWC: Count failed\n", RESP_ERROR_PREFIX);
+            send_all(data->client_sockfd, response_line, strlen(response_line));
+        }
+    } else {
+        unsigned long long total_lines = 0, total_words = 0, total_bytes = 0;
+        reply_init(reply, data);
+        snprintf(response_line, sizeof(response_line), "%s %zu\n", CMD_WC, count);
+        reply_append(reply, response_line, strlen(response_line));
+        for (size_t i = 0; i < count; i++) {
+            const line_count_result_t *result = &results[i];
+            int error = (resolve_errors[i] != 0) ? resolve_errors[i] : result->error;
+            if (error != 0) {
+                const char *reason = "error";
+                if (error == ENOENT || error == ENOTDIR) reason = "missing";
+                else if (error == EACCES || error == EPERM) reason = "denied";
+                else if (error == EISDIR) reason = "directory";
+                else if (error == EINVAL) reason = "notfile";
+                snprintf(response_line, sizeof(response_line), "- %s %.3000s\n", reason, names[i]);
+            } else if (count_words) {
+                snprintf(response_line, sizeof(response_line), "%llu %llu %llu %.3000s\n", result->lines, result->words, result->bytes, names[i]);
             } else {
-                format_list_item(response_line, sizeof(response_line), entry->d_name, " -> ", "[broken link]", "\n");
+                snprintf(response_line, sizeof(response_line), "%llu %llu %.3000s\n", result->lines, result->bytes, names[i]);
             }
+            total_lines += result->lines;
+            total_words += result->words;
+            total_bytes += result->bytes;
+            if (reply_append(reply, response_line, strlen(response_line)) == -1) break;
+        }
+        if (count_words) {
+            snprintf(response_line, sizeof(response_line), "TOTAL %llu %llu %llu\n", total_lines, total_words, total_bytes);
         } else {
-            format_list_item(response_line, sizeof(response_line), entry->d_name, NULL, NULL, "\n");
+            snprintf(response_line, sizeof(response_line), "TOTAL %llu %llu\n", total_lines, total_bytes);
         }
-
-        if (send_all(data->client_sockfd, response_line, strlen(response_line)) == -1) break;
-        errno = 0;
+        reply_append(reply, response_line, strlen(response_line));
+        reply_flush(reply);
     }
+    for (size_t i = 0; paths != NULL && i < count; i++) free(paths[i]);
+    free(words);
+    free(names);
+    free(paths);
+    free(resolve_errors);
+    free(results);
+    free(reply);
+}
 
-    if (errno != 0 && entry == NULL) {
-        snprintf(response_line, sizeof(response_line), "%sLIST: Error reading directory: %s\n", RESP_ERROR_PREFIX, strerror(errno));
+/*
+ * Purpose:
+ *   Handles the JOB command, which runs expensive commands in the background:
+ *     JOB SUBMIT <command>          -> "JOB <id> QUEUED"
+ *     JOB STATUS <id>               -> "JOB <id> <state> <bytes> [TRUNCATED] [SPOOLED]"
+ *     JOB FETCH <id> [offset [max]] -> "RESULT <id> <offset> <n>", then n bytes
+ *     JOB CANCEL <id>               -> the job's status line
+ *     JOB DELETE <id>               -> "JOB <id> DELETED"
+ *   The job runs in the submitter's root and current directory. Its output
+ *   is kept (large outputs in a spool file, with -D) until it is deleted or
+ *   expires, whether or not the submitter stays connected, and FETCH can
+ *   resume reading it at any offset.
+ *
+ * Parameters:
+ *   data: A pointer to the client's thread-specific data structure.
+ *   args: The command's arguments.
+ *
+ * Returns:
+ *   void
+ */
+static void handle_job(client_thread_data_t *data, const char *args) {
+    char response_line[MAX_BUFFER_SIZE];
+    char subcommand[MAX_CMD_LEN];
+    char id[JOB_ID_LEN + 2];
+    int consumed = 0;
+    subcommand[0] = '\0';
+    sscanf(args, "%255s %n", subcommand, &consumed);
+    const char *rest = args + consumed;
+    // One character more than an id is kept, so an over-long id matches no job.
+    size_t id_len = strcspn(rest, " \t");
+    snprintf(id, sizeof(id), "%.*s", (int)id_len, rest);
+    const char *after_id = rest + id_len;
+    while (isspace((unsigned char)*after_id)) after_id++;
+
+    response_line[0] = '\0';
+    if (data->in_job) {
+        snprintf(response_line, sizeof(response_line), "%sJOB: Not available inside a job\n", RESP_ERROR_PREFIX);
+    } else if (g_job_threads == 0) {
+        snprintf(response_line, sizeof(response_line), "%sJOB: Background jobs are disabled\n", RESP_ERROR_PREFIX);
+    } else if (strcmp(subcommand, "SUBMIT") == 0) {
+        char new_id[JOB_ID_LEN + 1];
+        if (*rest == '\0') {
+            snprintf(response_line, sizeof(response_line), "%sJOB: Missing command\n", RESP_ERROR_PREFIX);
+        } else if (!job_command_allowed(rest)) {
+            char names[MAX_CMD_LEN];
+            job_command_names(names, sizeof(names));
+            snprintf(response_line, sizeof(response_line), "%sJOB: Only %s can run as jobs\n", RESP_ERROR_PREFIX, names);
+        } else if (job_queue_submit(rest, data, new_id, sizeof(new_id)) == -1) {
+            snprintf(response_line, sizeof(response_line), "%sJOB: %s\n", RESP_ERROR_PREFIX,
+                     errno == EAGAIN ? "Too many jobs; delete finished ones first" : "Cannot queue the job");
+        } else {
+            snprintf(response_line, sizeof(response_line), "%s %s %s\n", CMD_JOB, new_id, job_state_name(JOB_QUEUED));
+            log_event("Client %s:%d submitted job %s: '%s'", data->client_ip, data->client_port, new_id, rest);
+        }
+    } else if (strcmp(subcommand, "FETCH") == 0) {
+        char *endptr;
+        unsigned long long offset = 0, max_bytes = JOB_FETCH_MAX_BYTES;
+        int valid = 1;
+        if (*after_id != '\0') {
+            offset = strtoull(after_id, &endptr, 10);
+            valid = (endptr != after_id && (*endptr == '\0' || *endptr == ' '));
+            while (valid && *endptr == ' ') endptr++;
+            if (valid && *endptr != '\0') {
+                const char *max_arg = endptr;
+                max_bytes = strtoull(max_arg, &endptr, 10);
+                valid = (endptr != max_arg && *endptr == '\0' && max_bytes > 0);
+            }
+        }
+        if (max_bytes > JOB_FETCH_MAX_BYTES) max_bytes = JOB_FETCH_MAX_BYTES;
+        char *slice = valid ? malloc((size_t)max_bytes) : NULL;
+        ssize_t copied = (slice != NULL) ? job_queue_read(id, (size_t)offset, slice, (size_t)max_bytes) : -1;
+        if (!valid) {
+            snprintf(response_line, sizeof(response_line), "%sJOB: Invalid offset or length\n", RESP_ERROR_PREFIX);
+        } else if (copied == -1 && errno == ENOENT) {
+            snprintf(response_line, sizeof(response_line), "%sJOB: No job '%s'\n", RESP_ERROR_PREFIX, id);
+        } else if (copied == -1) {
+            snprintf(response_line, sizeof(response_line), "%sJOB: Cannot read the output of job '%s'\n", RESP_ERROR_PREFIX, id);
+        } else {
+            snprintf(response_line, sizeof(response_line), "%s %s %llu %zd\n", RESP_RESULT, id, offset, copied);
+            if (send_all(data->client_sockfd, response_line, strlen(response_line)) == 0 && copied > 0) {
+                send_all(data->client_sockfd, slice, (size_t)copied);
+            }
+            response_line[0] = '\0';
+        }
+        free(slice);
+    } else if (strcmp(subcommand, "STATUS") == 0 || strcmp(subcommand, "CANCEL") == 0) {
+        job_status_t status;
+        int cancel = (strcmp(subcommand, "CANCEL") == 0);
+        if ((cancel && job_queue_cancel(id) == -1) || job_queue_status(id, &status) == -1) {
+            snprintf(response_line, sizeof(response_line), "%sJOB: No job '%s'\n", RESP_ERROR_PREFIX, id);
+        } else {
+            snprintf(response_line, sizeof(response_line), "%s %s %s %zu%s%s\n", CMD_JOB, id, job_state_name(status.state),
+                     status.bytes, status.truncated ? " TRUNCATED" : "", status.spooled ? " SPOOLED" : "");
+            if (cancel) log_event("Client %s:%d cancelled job %s", data->client_ip, data->client_port, id);
+        }
+    } else if (strcmp(subcommand, "DELETE") == 0) {
+        if (job_queue_delete(id) == -1) {
+            snprintf(response_line, sizeof(response_line), "%sJOB: %s '%s'\n", RESP_ERROR_PREFIX,
+                     errno == EBUSY ? "Cancel or wait for the job first:" : "No job", id);
+        } else {
+            snprintf(response_line, sizeof(response_line), "%s %s DELETED\n", CMD_JOB, id);
+        }
+    } else {
+        snprintf(response_line, sizeof(response_line), "%sJOB: Unknown subcommand '%.64s' (SUBMIT, STATUS, FETCH, CANCEL or DELETE)\n",
+                 RESP_ERROR_PREFIX, subcommand);
+    }
+    if (response_line[0] != '\0') {
         send_all(data->client_sockfd, response_line, strlen(response_line));
     }
+}
+
+/*
+ * Purpose:
+ *   Tells whether a command may run as a background job. Only commands that
+ *   read the tree are allowed; session state (CD, ROOT) would be lost anyway.
+ *
+ * Parameters:
+ *   command_line: The submitted command line.
+ *
+ * Returns:
+ *   Nonzero if the command is allowed.
+ */
+static int job_command_allowed(const char *command_line) {
+    char command[MAX_CMD_LEN];
+    if (sscanf(command_line, "%255s", command) != 1) return 0;
+    for (size_t i = 0; i < sizeof(g_job_commands) / sizeof(g_job_commands[0]); i++) {
+        if (strcmp(command, g_job_commands[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Lists the commands that may run as background jobs, for error messages,
+ *   e.g. "LIST, LOCATE and GREP".
+ *
+ * Parameters:
+ *   buffer: Receives the list; truncated if too small.
+ *   size: The size of buffer.
+ *
+ * Returns:
+ *   void
+ */
+static void job_command_names(char *buffer, size_t size) {
+    size_t count = sizeof(g_job_commands) / sizeof(g_job_commands[0]);
+    size_t used = 0;
+    buffer[0] = '\0';
+    for (size_t i = 0; i < count && used < size; i++) {
+        const char *separator = i == 0 ? "" : (i + 1 == count ? " and " : ", ");
+        int written = snprintf(buffer + used, size - used, "%s%s", separator, g_job_commands[i]);
+        if (written < 0) break;
+        used += (size_t)written;
+    }
+}
 
-    if (closedir(dirp) == -1) {
-        perror("closedir in handle_list");
+/*
+ * Purpose:
+ *   Runs a background job's command (the job queue's runner). The command is
+ *   processed like a session's, with a copy of the submitter's session taken
+ *   at submission, and its reply goes to the job queue's socket.
+ *
+ * Parameters:
+ *   output_fd: The socket the job queue collects the reply from.
+ *   command: The submitted command line.
+ *   context: The submitter's client_thread_data_t.
+ *
+ * Returns:
+ *   void
+ */
+static void run_job_command(int output_fd, const char *command, const void *context) {
+    client_thread_data_t data;
+    char command_line[MAX_BUFFER_SIZE];
+    long cpu_mark = thread_cpu_usec();
+
+    memcpy(&data, context, sizeof(data));
+    data.client_sockfd = output_fd;
+    data.script_depth = 0;
+    data.root_locked = 1;
+    data.local = 0;
+    data.request_id = 1;
+    data.cancel_state = CANCEL_NONE;
+    data.cancel_polls = 0;
+    data.in_job = 1;
+    snprintf(command_line, sizeof(command_line), "%s", command);
+
+    process_client_command(&data, command_line);
+    if (data.cancel_state == CANCEL_REQUESTED) {
+        char cancelled_line[MAX_CMD_LEN];
+        snprintf(cancelled_line, sizeof(cancelled_line), "%s %lu\n", RESP_CANCELLED, data.request_id);
+        send_all(output_fd, cancelled_line, strlen(cancelled_line));
     }
+    server_stats_add(STATS_CPU_USEC, thread_cpu_usec() - cpu_mark);
 }
@@ -0,0 +1,146 @@
+/*
+ * src/server_stats.c
+ *
+ * This file implements the shared statistics segment declared in
+ * server_stats.h. The segment is a MAP_SHARED | MAP_ANONYMOUS mapping, so it
+ * is inherited by forked workers and survives their crashes. Counters are
+ * lock-free atomics: a worker that dies in the middle of an update cannot
+ * leave a lock held.
+ */
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // For MAP_ANONYMOUS
+#include "server_stats.h"
+#include <stdatomic.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+typedef struct stats_slot_s {
+    _Alignas(SERVER_STATS_CACHE_LINE) atomic_long counters[STATS_COUNTER_COUNT];
+    atomic_long pid;
+    atomic_long started;
+    atomic_ulong restarts;
+} stats_slot_t;
+
+static stats_slot_t *g_slots = NULL;
+static size_t g_slot_count = 0;
+static stats_slot_t *g_own_slot = NULL; // Slot of the calling process
+
+/*
+ * Purpose:
+ *   Creates the shared statistics segment. Must be called before any worker
+ *   is forked.
+ *
+ * Parameters:
+ *   slot_count: The number of server processes (at least 1).
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno is set).
+ */
+int server_stats_init(size_t slot_count) {
+    if (slot_count == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    void *segment = mmap(NULL, slot_count * sizeof(stats_slot_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (segment == MAP_FAILED) return -1;
+    g_slots = segment;
+    g_slot_count = slot_count;
+    for (size_t i = 0; i < slot_count; i++) {
+        for (int c = 0; c < STATS_COUNTER_COUNT; c++) atomic_init(&g_slots[i].counters[c], 0);
+        atomic_init(&g_slots[i].pid, 0);
+        atomic_init(&g_slots[i].started, 0);
+        atomic_init(&g_slots[i].restarts, 0);
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Makes the calling process the owner of a slot: later updates go to it.
+ *   The slot's active session count is reset, since the sessions of a
+ *   previous owner died with it.
+ *
+ * Parameters:
+ *   slot: The slot index (the worker number).
+ *   restarted: Nonzero if the slot's previous process died and this one
+ *              replaces it.
+ *
+ * Returns:
+ *   void
+ */
+void server_stats_attach(size_t slot, int restarted) {
+    if (slot >= g_slot_count) return;
+    g_own_slot = &g_slots[slot];
+    atomic_store(&g_own_slot->counters[STATS_ACTIVE_SESSIONS], 0);
+    atomic_store(&g_own_slot->started, (long)time(NULL));
+    atomic_store(&g_own_slot->pid, (long)getpid());
+    if (restarted) atomic_fetch_add(&g_own_slot->restarts, 1);
+}
+
+/*
+ * Purpose:
+ *   Marks a slot as having no running process.
+ *
+ * Parameters:
+ *   slot: The slot index.
+ *
+ * Returns:
+ *   void
+ */
+void server_stats_detach(size_t slot) {
+    if (slot >= g_slot_count) return;
+    atomic_store(&g_slots[slot].pid, 0);
+    atomic_store(&g_slots[slot].counters[STATS_ACTIVE_SESSIONS], 0);
+}
+
+/*
+ * Purpose:
+ *   Adds to one of the calling process's counters.
+ *
+ * Parameters:
+ *   counter: One of STATS_*.
+ *   delta: The amount to add (may be negative).
+ *
+ * Returns:
+ *   void
+ */
+void server_stats_add(int counter, long delta) {
+    if (g_own_slot == NULL || counter < 0 || counter >= STATS_COUNTER_COUNT) return;
+    atomic_fetch_add_explicit(&g_own_slot->counters[counter], delta, memory_order_relaxed);
+}
+
+/*
+ * Purpose:
+ *   Returns the number of slots.
+ *
+ * Parameters:
+ *   None.
+ *
+ * Returns:
+ *   The slot count given to server_stats_init.
+ */
+size_t server_stats_slot_count(void) {
+    return g_slot_count;
+}
+
+/*
+ * Purpose:
+ *   Reads the counters of one slot.
+ *
+ * Parameters:
+ *   slot: The slot index.
+ *   snapshot: Receives the values.
+ *
+ * Returns:
+ *   void
+ */
+void server_stats_read(size_t slot, server_stats_snapshot_t *snapshot) {
+    const stats_slot_t *source = &g_slots[slot];
+    snapshot->pid = (pid_t)atomic_load(&source->pid);
+    snapshot->started = (time_t)atomic_load(&source->started);
+    snapshot->restarts = atomic_load(&source->restarts);
+    for (int c = 0; c < STATS_COUNTER_COUNT; c++) {
+        snapshot->counters[c] = atomic_load_explicit(&source->counters[c], memory_order_relaxed);
+    }
+}
@@ -0,0 +1,115 @@
+/*
+ * src/server_stats.h
+ *
+ * This header file declares the server's shared statistics segment. Every
+ * server process (the single process, or each prefork worker) owns one slot
+ * of counters in a shared anonymous mapping created before the workers are
+ * forked, so any process can report the totals of all of them. Slots are
+ * aligned to cache lines so that workers updating their own counters never
+ * contend for the same line.
+ */
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+
+#include <stddef.h>    // For size_t
+#include <sys/types.h> // For pid_t
+#include <time.h>      // For time_t
+
+#define SERVER_STATS_CACHE_LINE 64
+
+// Counters kept per process.
+enum {
+    STATS_CONNECTIONS,     // Connections accepted
+    STATS_ACTIVE_SESSIONS, // Sessions currently open
+    STATS_COMMANDS,        // Commands processed
+    STATS_CPU_USEC,        // CPU time of session threads, in microseconds
+    STATS_COUNTER_COUNT
+};
+
+typedef struct server_stats_snapshot_s {
+    pid_t pid;             // 0 if the slot's process is not running
+    time_t started;        // When the slot's current process started
+    unsigned long restarts;
+    long counters[STATS_COUNTER_COUNT];
+} server_stats_snapshot_t;
+
+/*
+ * Purpose:
+ *   Creates the shared statistics segment. Must be called before any worker
+ *   is forked.
+ *
+ * Parameters:
+ *   slot_count: The number of server processes (at least 1).
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno is set).
+ */
+int server_stats_init(size_t slot_count);
+
+/*
+ * Purpose:
+ *   Makes the calling process the owner of a slot: later updates go to it.
+ *   The slot's active session count is reset, since the sessions of a
+ *   previous owner died with it.
+ *
+ * Parameters:
+ *   slot: The slot index (the worker number).
+ *   restarted: Nonzero if the slot's previous process died and this one
+ *              replaces it.
+ *
+ * Returns:
+ *   void
+ */
+void server_stats_attach(size_t slot, int restarted);
+
+/*
+ * Purpose:
+ *   Marks a slot as having no running process.
+ *
+ * Parameters:
+ *   slot: The slot index.
+ *
+ * Returns:
+ *   void
+ */
+void server_stats_detach(size_t slot);
+
+/*
+ * Purpose:
+ *   Adds to one of the calling process's counters.
+ *
+ * Parameters:
+ *   counter: One of STATS_*.
+ *   delta: The amount to add (may be negative).
+ *
+ * Returns:
+ *   void
+ */
+void server_stats_add(int counter, long delta);
+
+/*
+ * Purpose:
+ *   Returns the number of slots.
+ *
+ * Parameters:
+ *   None.
+ *
+ * Returns:
+ *   The slot count given to server_stats_init.
+ */
+size_t server_stats_slot_count(void);
+
+/*
+ * Purpose:
+ *   Reads the counters of one slot.
+ *
+ * Parameters:
+ *   slot: The slot index.
+ *   snapshot: Receives the values.
+ *
+ * Returns:
+ *   void
+ */
+void server_stats_read(size_t slot, server_stats_snapshot_t *snapshot);
+
+#endif // SERVER_STATS_H
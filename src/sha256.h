@@ -0,0 +1,77 @@
+/*
+ * src/sha256.h
+ *
+ * This header file declares a self-contained SHA-256 implementation (FIPS
+ * 180-4), used by the HASH command. It does not depend on OpenSSL, so the
+ * server has it in every build.
+ */
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h> // For size_t
+#include <stdint.h> // For uint32_t, uint64_t
+
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_HEX_SIZE (2 * SHA256_DIGEST_SIZE + 1)
+
+typedef struct sha256_ctx_s {
+    uint32_t state[8];
+    uint64_t total_len; // Bytes hashed so far
+    unsigned char block[SHA256_BLOCK_SIZE];
+    size_t block_len;   // Bytes waiting in block
+} sha256_ctx_t;
+
+/*
+ * Purpose:
+ *   Starts a new hash computation.
+ *
+ * Parameters:
+ *   ctx: The context to initialize.
+ *
+ * Returns:
+ *   void
+ */
+void sha256_init(sha256_ctx_t *ctx);
+
+/*
+ * Purpose:
+ *   Adds data to the hash.
+ *
+ * Parameters:
+ *   ctx: The context.
+ *   data: The data.
+ *   len: The number of bytes.
+ *
+ * Returns:
+ *   void
+ */
+void sha256_update(sha256_ctx_t *ctx, const void *data, size_t len);
+
+/*
+ * Purpose:
+ *   Finishes the computation and writes the digest.
+ *
+ * Parameters:
+ *   ctx: The context (unusable afterwards until sha256_init).
+ *   digest: Receives SHA256_DIGEST_SIZE bytes.
+ *
+ * Returns:
+ *   void
+ */
+void sha256_final(sha256_ctx_t *ctx, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+/*
+ * Purpose:
+ *   Formats a digest as lowercase hexadecimal.
+ *
+ * Parameters:
+ *   digest: The SHA256_DIGEST_SIZE digest bytes.
+ *   hex: Receives SHA256_HEX_SIZE characters including the terminator.
+ *
+ * Returns:
+ *   void
+ */
+void sha256_to_hex(const unsigned char digest[SHA256_DIGEST_SIZE], char hex[SHA256_HEX_SIZE]);
+
+#endif // SHA256_H
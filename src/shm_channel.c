@@ -0,0 +1,590 @@
+/*
+ * src/shm_channel.c
+ *
+ * This file implements the shared-memory transport declared in
+ * shm_channel.h. Each ring has a head (bytes written, advanced only by the
+ * producer) and a tail (bytes read, advanced only by the consumer) on their
+ * own cache lines, so the two sides never write the same line. A side that
+ * finds its ring empty (or full) spins for a while, then raises a waiting
+ * flag and sleeps in poll() on its eventfd and the Unix socket; the other
+ * side signals the eventfd only when that flag is set, so a busy exchange
+ * makes no system calls at all.
+ */
+#define _GNU_SOURCE // For memfd_create
+#include "shm_channel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/eventfd.h>
+
+#define SHM_MAGIC 0x53484d31u // "SHM1"
+#define SHM_MAX_FD 65536      // Channels are looked up by descriptor
+#define SHM_CACHE_LINE 64
+#define SHM_FD_COUNT 3        // memfd, server eventfd, client eventfd
+#define SHM_OFFER_PREFIX "SHM "
+
+typedef struct shm_ring_s {
+    _Alignas(SHM_CACHE_LINE) atomic_size_t head; // Written by the producer
+    _Alignas(SHM_CACHE_LINE) atomic_size_t tail; // Written by the consumer
+    _Alignas(SHM_CACHE_LINE) atomic_int reader_waiting;
+    atomic_int writer_waiting;
+} shm_ring_t;
+
+// Start of the shared segment; the ring data follows at data_offset.
+typedef struct shm_header_s {
+    uint32_t magic;
+    uint32_t ring_size;
+    uint64_t data_offset;
+    shm_ring_t rings[2]; // [0]: client to server, [1]: server to client
+} shm_header_t;
+
+struct shm_channel_s {
+    int sockfd;
+    void *segment;
+    size_t segment_size;
+    size_t ring_size;
+    shm_ring_t *in;
+    shm_ring_t *out;
+    unsigned char *in_data;
+    unsigned char *out_data;
+    int own_event_fd;  // Signalled when 'in' has data or 'out' has space
+    int peer_event_fd;
+    int broken;        // Set once the peer left a ring inconsistent
+};
+
+static shm_channel_t *_Atomic g_channels[SHM_MAX_FD];
+static atomic_int g_spin_iterations = -1; // Set on first use; 0 on a single CPU
+
+/*
+ * Purpose:
+ *   Returns the size of the shared segment for a ring size.
+ *
+ * Parameters:
+ *   ring_size: Bytes per ring.
+ *   data_offset: Receives the offset of the first ring's data.
+ *
+ * Returns:
+ *   The segment size in bytes.
+ */
+static size_t segment_size_for(size_t ring_size, size_t *data_offset) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t page = (page_size > 0) ? (size_t)page_size : 4096;
+    *data_offset = (sizeof(shm_header_t) + page - 1) / page * page;
+    return *data_offset + 2 * ring_size;
+}
+
+/*
+ * Purpose:
+ *   Maps a segment and fills in a channel for one side of it, then
+ *   registers the channel under its socket.
+ *
+ * Parameters:
+ *   sockfd: The Unix socket.
+ *   memfd: The segment's memfd.
+ *   size: The segment size.
+ *   is_server: Nonzero for the server side.
+ *   own_event_fd: This side's eventfd.
+ *   peer_event_fd: The other side's eventfd.
+ *   initialize: Nonzero to initialize the header (server side).
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno is set).
+ */
+static int attach_channel(int sockfd, int memfd, size_t size, int is_server, int own_event_fd, int peer_event_fd, int initialize) {
+    if (sockfd < 0 || sockfd >= SHM_MAX_FD) {
+        errno = EMFILE;
+        return -1;
+    }
+    void *segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (segment == MAP_FAILED) return -1;
+
+    shm_header_t *header = segment;
+    size_t data_offset;
+    if (initialize) {
+        memset(header, 0, sizeof(*header));
+        header->magic = SHM_MAGIC;
+        header->ring_size = SHM_RING_SIZE;
+        segment_size_for(SHM_RING_SIZE, &data_offset);
+        header->data_offset = data_offset;
+        for (int i = 0; i < 2; i++) {
+            atomic_init(&header->rings[i].head, 0);
+            atomic_init(&header->rings[i].tail, 0);
+            atomic_init(&header->rings[i].reader_waiting, 0);
+            atomic_init(&header->rings[i].writer_waiting, 0);
+        }
+    }
+    size_t ring_size = header->ring_size;
+    if (header->magic != SHM_MAGIC || ring_size == 0 || (ring_size & (ring_size - 1)) != 0 ||
+        segment_size_for(ring_size, &data_offset) != size || header->data_offset != data_offset) {
+        munmap(segment, size);
+        errno = EPROTO;
+        return -1;
+    }
+
+    shm_channel_t *channel = malloc(sizeof(shm_channel_t));
+    if (channel == NULL) {
+        munmap(segment, size);
+        return -1;
+    }
+    unsigned char *data = (unsigned char *)segment + data_offset;
+    channel->sockfd = sockfd;
+    channel->segment = segment;
+    channel->segment_size = size;
+    channel->ring_size = ring_size;
+    channel->in = &header->rings[is_server ? 0 : 1];
+    channel->out = &header->rings[is_server ? 1 : 0];
+    channel->in_data = data + (is_server ? 0 : ring_size);
+    channel->out_data = data + (is_server ? ring_size : 0);
+    channel->own_event_fd = own_event_fd;
+    channel->peer_event_fd = peer_event_fd;
+    channel->broken = 0;
+    atomic_store_explicit(&g_channels[sockfd], channel, memory_order_release);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Server side: creates a channel for a connection accepted on the Unix
+ *   socket, sends its descriptors to the client and registers it under the
+ *   socket.
+ *
+ * Parameters:
+ *   sockfd: The accepted Unix socket.
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno is set).
+ */
+int shm_channel_offer(int sockfd) {
+    size_t data_offset;
+    size_t size = segment_size_for(SHM_RING_SIZE, &data_offset);
+    int fds[SHM_FD_COUNT] = {-1, -1, -1};
+    fds[0] = memfd_create("myserver-session", MFD_CLOEXEC);
+    fds[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK); // Server's wakeups
+    fds[2] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK); // Client's wakeups
+    if (fds[0] == -1 || fds[1] == -1 || fds[2] == -1 || ftruncate(fds[0], (off_t)size) == -1 ||
+        attach_channel(sockfd, fds[0], size, 1, fds[1], fds[2], 1) == -1) {
+        int saved_errno = errno;
+        for (int i = 0; i < SHM_FD_COUNT; i++) {
+            if (fds[i] != -1) close(fds[i]);
+        }
+        errno = saved_errno;
+        return -1;
+    }
+
+    char line[64];
+    snprintf(line, sizeof(line), "%s%zu\n", SHM_OFFER_PREFIX, size);
+    struct iovec iov = {.iov_base = line, .iov_len = strlen(line)};
+    union {
+        char buffer[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+    close(fds[0]); // The mapping keeps the segment alive
+    if (sent != (ssize_t)iov.iov_len) {
+        int saved_errno = (sent == -1) ? errno : EPROTO;
+        shm_channel_release(sockfd);
+        errno = saved_errno;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Client side: receives the channel the server offers on a freshly
+ *   connected Unix socket, maps it and registers it under the socket.
+ *
+ * Parameters:
+ *   sockfd: The connected Unix socket.
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno is set).
+ */
+int shm_channel_accept(int sockfd) {
+    char line[64];
+    struct iovec iov = {.iov_base = line, .iov_len = sizeof(line) - 1};
+    union {
+        char buffer[CMSG_SPACE(SHM_FD_COUNT * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    ssize_t got;
+    do {
+        got = recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC);
+    } while (got == -1 && errno == EINTR);
+    if (got <= 0) {
+        if (got == 0) errno = ECONNRESET;
+        return -1;
+    }
+    line[got] = '\0';
+
+    int fds[SHM_FD_COUNT] = {-1, -1, -1};
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(sizeof(fds))) {
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    }
+
+    char *endptr;
+    unsigned long long size = 0;
+    if (strncmp(line, SHM_OFFER_PREFIX, strlen(SHM_OFFER_PREFIX)) == 0) {
+        size = strtoull(line + strlen(SHM_OFFER_PREFIX), &endptr, 10);
+        if (*endptr != '\n') size = 0;
+    }
+    struct stat st;
+    errno = EPROTO; // Unless a system call below fails with its own error
+    int ok = fds[0] != -1 && size > 0 && fstat(fds[0], &st) == 0 && (unsigned long long)st.st_size == size &&
+             attach_channel(sockfd, fds[0], (size_t)size, 0, fds[2], fds[1], 0) == 0;
+    int saved_errno = errno;
+    if (fds[0] != -1) close(fds[0]);
+    if (!ok) {
+        if (fds[1] != -1) close(fds[1]);
+        if (fds[2] != -1) close(fds[2]);
+        errno = saved_errno;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Looks up the channel registered under a socket.
+ *
+ * Parameters:
+ *   sockfd: A socket descriptor.
+ *
+ * Returns:
+ *   The channel, or NULL if the socket carries its data itself.
+ */
+shm_channel_t *shm_channel_find(int sockfd) {
+    if (sockfd < 0 || sockfd >= SHM_MAX_FD) return NULL;
+    return atomic_load_explicit(&g_channels[sockfd], memory_order_acquire);
+}
+
+/*
+ * Purpose:
+ *   Tells whether a ring is ready for the waiting side.
+ *
+ * Parameters:
+ *   channel: The channel.
+ *   ring: The ring waited on.
+ *   want_data: Nonzero to wait for data, zero to wait for space.
+ *
+ * Returns:
+ *   Nonzero if the ring has data (or space).
+ */
+static int ring_ready(const shm_channel_t *channel, shm_ring_t *ring, int want_data) {
+    // Sequentially consistent loads: this check follows the raising of the
+    // waiting flag, and the peer checks the flag after moving head or tail.
+    size_t used = atomic_load(&ring->head) - atomic_load(&ring->tail);
+    if (used > channel->ring_size) return 1; // Corrupt; the caller reports it
+    return want_data ? used > 0 : used < channel->ring_size;
+}
+
+/*
+ * Purpose:
+ *   Computes how many bytes a ring holds. Head and tail live in memory the
+ *   peer can write, so they are checked before they are used to index the
+ *   ring; a peer that left them inconsistent breaks the channel for good.
+ *
+ * Parameters:
+ *   channel: The channel.
+ *   head: The ring's head.
+ *   tail: The ring's tail.
+ *   used: Receives the number of bytes in the ring.
+ *
+ * Returns:
+ *   0 on success, or -1 with errno EPROTO if the ring is corrupt.
+ */
+static int ring_used(shm_channel_t *channel, size_t head, size_t tail, size_t *used) {
+    if (!channel->broken && head - tail > channel->ring_size) {
+        fprintf(stderr, "Shared-memory peer on socket %d corrupted a ring, dropping the channel.\n", channel->sockfd);
+        channel->broken = 1;
+    }
+    if (channel->broken) {
+        errno = EPROTO;
+        return -1;
+    }
+    *used = head - tail;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Returns how long to spin before sleeping. On a single CPU the peer
+ *   cannot make progress while we spin, so we sleep at once.
+ *
+ * Parameters:
+ *   None.
+ *
+ * Returns:
+ *   The number of polls of the ring.
+ */
+static int spin_iterations(void) {
+    int iterations = atomic_load_explicit(&g_spin_iterations, memory_order_relaxed);
+    if (iterations < 0) {
+        iterations = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? SHM_SPIN_ITERATIONS : 0;
+        atomic_store_explicit(&g_spin_iterations, iterations, memory_order_relaxed);
+    }
+    return iterations;
+}
+
+/*
+ * Purpose:
+ *   Reads the socket's SO_RCVTIMEO as a poll() timeout.
+ *
+ * Parameters:
+ *   sockfd: The socket.
+ *
+ * Returns:
+ *   The timeout in milliseconds, or -1 if none is set.
+ */
+static int socket_timeout_ms(int sockfd) {
+    struct timeval tv = {0, 0};
+    socklen_t tv_len = sizeof(tv);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, &tv_len) == 0 && (tv.tv_sec > 0 || tv.tv_usec > 0)) {
+        return (int)(tv.tv_sec * 1000 + tv.tv_usec / 1000);
+    }
+    return -1;
+}
+
+/*
+ * Purpose:
+ *   Waits until a ring has data (or space): spins first, then sleeps on the
+ *   eventfd with the waiting flag raised. The Unix socket is watched too, so
+ *   a peer that exits ends the wait.
+ *
+ * Parameters:
+ *   channel: The channel.
+ *   ring: The ring waited on.
+ *   want_data: Nonzero to wait for data (honouring the socket's
+ *              SO_RCVTIMEO), zero to wait for space (without a limit).
+ *
+ * Returns:
+ *   0 when the ring is (probably) ready, 1 if the peer closed the
+ *   connection, or -1 on error (errno is EAGAIN on timeout).
+ */
+static int wait_for_ring(shm_channel_t *channel, shm_ring_t *ring, int want_data) {
+    int iterations = spin_iterations();
+    for (int i = 0; i < iterations; i++) {
+        if (ring_ready(channel, ring, want_data)) return 0;
+    }
+    int timeout_ms = want_data ? socket_timeout_ms(channel->sockfd) : -1;
+
+    atomic_int *flag = want_data ? &ring->reader_waiting : &ring->writer_waiting;
+    atomic_store(flag, 1);
+    if (ring_ready(channel, ring, want_data)) { // Raced with the peer
+        atomic_store(flag, 0);
+        return 0;
+    }
+    struct pollfd fds[2] = {
+        {.fd = channel->own_event_fd, .events = POLLIN, .revents = 0},
+        {.fd = channel->sockfd, .events = POLLIN, .revents = 0},
+    };
+    int result = poll(fds, 2, timeout_ms);
+    atomic_store(flag, 0);
+    if (result == -1) return -1;
+    if (result == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (fds[0].revents & POLLIN) {
+        uint64_t count;
+        if (read(channel->own_event_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) return -1;
+    }
+    if (fds[1].revents != 0 && !ring_ready(channel, ring, want_data)) {
+        return 1; // The socket only becomes readable when the peer closes it
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Wakes the peer if it sleeps waiting on a ring.
+ *
+ * Parameters:
+ *   channel: The channel.
+ *   flag: The ring's waiting flag for the peer.
+ *
+ * Returns:
+ *   void
+ */
+static void wake_peer(shm_channel_t *channel, atomic_int *flag) {
+    if (atomic_load(flag)) {
+        uint64_t one = 1;
+        if (write(channel->peer_event_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+            perror("write to eventfd failed");
+        }
+    }
+}
+
+/*
+ * Purpose:
+ *   Writes all of a buffer into the channel's outgoing ring, waiting for
+ *   space while the ring is full.
+ *
+ * Parameters:
+ *   channel: The channel.
+ *   buffer: The data.
+ *   length: The number of bytes.
+ *
+ * Returns:
+ *   length on success, or -1 on error (errno is EPIPE if the peer is gone,
+ *   EPROTO if it corrupted the ring).
+ */
+ssize_t shm_channel_send(shm_channel_t *channel, const void *buffer, size_t length) {
+    const unsigned char *source = buffer;
+    shm_ring_t *ring = channel->out;
+    size_t done = 0;
+    while (done < length) {
+        size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        size_t used;
+        if (ring_used(channel, head, tail, &used) == -1) return -1;
+        size_t space = channel->ring_size - used;
+        if (space == 0) {
+            int result = wait_for_ring(channel, ring, 0);
+            if (result == 1) errno = EPIPE;
+            if (result == 1 || (result == -1 && errno != EINTR)) return -1;
+            continue;
+        }
+        size_t count = length - done < space ? length - done : space;
+        size_t offset = head & (channel->ring_size - 1);
+        size_t first = count < channel->ring_size - offset ? count : channel->ring_size - offset;
+        memcpy(channel->out_data + offset, source + done, first);
+        memcpy(channel->out_data, source + done + first, count - first);
+        atomic_store(&ring->head, head + count);
+        done += count;
+        wake_peer(channel, &ring->reader_waiting);
+    }
+    return (ssize_t)length;
+}
+
+/*
+ * Purpose:
+ *   Reads available bytes from the channel's incoming ring, with the
+ *   semantics of recv(): waits for data, honouring the socket's
+ *   SO_RCVTIMEO.
+ *
+ * Parameters:
+ *   channel: The channel.
+ *   buffer: The destination buffer.
+ *   length: The size of the buffer.
+ *
+ * Returns:
+ *   The number of bytes read, 0 if the peer closed the connection, or -1 on
+ *   error (errno is EAGAIN on timeout, EINTR if a signal arrived, EPROTO if
+ *   the peer corrupted the ring).
+ */
+ssize_t shm_channel_recv(shm_channel_t *channel, void *buffer, size_t length) {
+    unsigned char *destination = buffer;
+    shm_ring_t *ring = channel->in;
+    for (;;) {
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t available;
+        if (ring_used(channel, head, tail, &available) == -1) return -1;
+        if (available > 0) {
+            size_t count = length < available ? length : available;
+            size_t offset = tail & (channel->ring_size - 1);
+            size_t first = count < channel->ring_size - offset ? count : channel->ring_size - offset;
+            memcpy(destination, channel->in_data + offset, first);
+            memcpy(destination + first, channel->in_data, count - first);
+            atomic_store(&ring->tail, tail + count);
+            wake_peer(channel, &ring->writer_waiting);
+            return (ssize_t)count;
+        }
+
+        int result = wait_for_ring(channel, ring, 1);
+        if (result == 1) return 0;
+        if (result == -1) return -1;
+    }
+}
+
+/*
+ * Purpose:
+ *   Copies the bytes waiting in the channel's incoming ring without
+ *   consuming them and without waiting, like recv() with MSG_PEEK and
+ *   MSG_DONTWAIT.
+ *
+ * Parameters:
+ *   channel: The channel.
+ *   buffer: The destination buffer.
+ *   length: The size of the buffer.
+ *
+ * Returns:
+ *   The number of bytes copied, 0 if the peer closed the connection and
+ *   nothing is left, or -1 with errno EAGAIN if nothing is waiting (EPROTO
+ *   if the peer corrupted the ring).
+ */
+ssize_t shm_channel_peek(shm_channel_t *channel, void *buffer, size_t length) {
+    shm_ring_t *ring = channel->in;
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t available;
+    if (ring_used(channel, head, tail, &available) == -1) return -1;
+    if (available == 0) {
+        struct pollfd pfd = {.fd = channel->sockfd, .events = POLLIN, .revents = 0};
+        if (poll(&pfd, 1, 0) == 1 && atomic_load(&ring->head) == head) return 0; // Peer gone
+        errno = EAGAIN;
+        return -1;
+    }
+    size_t count = length < available ? length : available;
+    size_t offset = tail & (channel->ring_size - 1);
+    size_t first = count < channel->ring_size - offset ? count : channel->ring_size - offset;
+    memcpy(buffer, channel->in_data + offset, first);
+    memcpy((unsigned char *)buffer + first, channel->in_data, count - first);
+    return (ssize_t)count;
+}
+
+/*
+ * Purpose:
+ *   Unregisters and unmaps the channel of a socket, if any. Must be called
+ *   before the socket is closed.
+ *
+ * Parameters:
+ *   sockfd: The socket descriptor.
+ *
+ * Returns:
+ *   void
+ */
+void shm_channel_release(int sockfd) {
+    if (sockfd < 0 || sockfd >= SHM_MAX_FD) return;
+    shm_channel_t *channel = atomic_exchange(&g_channels[sockfd], NULL);
+    if (channel == NULL) return;
+    munmap(channel->segment, channel->segment_size);
+    close(channel->own_event_fd);
+    close(channel->peer_event_fd);
+    free(channel);
+}
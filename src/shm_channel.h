@@ -0,0 +1,127 @@
+/*
+ * src/shm_channel.h
+ *
+ * This header file declares the same-host shared-memory transport. A client
+ * connects to the server's Unix socket and receives, as SCM_RIGHTS
+ * ancillary data, a memfd holding two single-producer/single-consumer ring
+ * buffers (one per direction) and an eventfd for each side's wakeups. The
+ * Unix socket then carries no data; it only tells each side when the other
+ * one has gone away.
+ *
+ * A channel is registered under the Unix socket's descriptor, and the I/O
+ * functions of common.c use it for that descriptor instead of send() and
+ * recv(), so the code above them works unchanged on either transport.
+ */
+#ifndef SHM_CHANNEL_H
+#define SHM_CHANNEL_H
+
+#include <sys/types.h> // For ssize_t
+#include <stddef.h>    // For size_t
+
+#define SHM_RING_SIZE (256 * 1024) // Bytes per direction; a power of two
+#define SHM_SPIN_ITERATIONS 20000  // Polls of an empty or full ring before sleeping (multi-CPU only)
+
+typedef struct shm_channel_s shm_channel_t;
+
+/*
+ * Purpose:
+ *   Server side: creates a channel for a connection accepted on the Unix
+ *   socket, sends its descriptors to the client and registers it under the
+ *   socket.
+ *
+ * Parameters:
+ *   sockfd: The accepted Unix socket.
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno is set).
+ */
+int shm_channel_offer(int sockfd);
+
+/*
+ * Purpose:
+ *   Client side: receives the channel the server offers on a freshly
+ *   connected Unix socket, maps it and registers it under the socket.
+ *
+ * Parameters:
+ *   sockfd: The connected Unix socket.
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno is set).
+ */
+int shm_channel_accept(int sockfd);
+
+/*
+ * Purpose:
+ *   Looks up the channel registered under a socket.
+ *
+ * Parameters:
+ *   sockfd: A socket descriptor.
+ *
+ * Returns:
+ *   The channel, or NULL if the socket carries its data itself.
+ */
+shm_channel_t *shm_channel_find(int sockfd);
+
+/*
+ * Purpose:
+ *   Writes all of a buffer into the channel's outgoing ring, waiting for
+ *   space while the ring is full.
+ *
+ * Parameters:
+ *   channel: The channel.
+ *   buffer: The data.
+ *   length: The number of bytes.
+ *
+ * Returns:
+ *   length on success, or -1 on error (errno is EPIPE if the peer is gone).
+ */
+ssize_t shm_channel_send(shm_channel_t *channel, const void *buffer, size_t length);
+
+/*
+ * Purpose:
+ *   Reads available bytes from the channel's incoming ring, with the
+ *   semantics of recv(): waits for data, honouring the socket's
+ *   SO_RCVTIMEO.
+ *
+ * Parameters:
+ *   channel: The channel.
+ *   buffer: The destination buffer.
+ *   length: The size of the buffer.
+ *
+ * Returns:
+ *   The number of bytes read, 0 if the peer closed the connection, or -1 on
+ *   error (errno is EAGAIN on timeout, EINTR if a signal arrived).
+ */
+ssize_t shm_channel_recv(shm_channel_t *channel, void *buffer, size_t length);
+
+/*
+ * Purpose:
+ *   Copies the bytes waiting in the channel's incoming ring without
+ *   consuming them and without waiting, like recv() with MSG_PEEK and
+ *   MSG_DONTWAIT.
+ *
+ * Parameters:
+ *   channel: The channel.
+ *   buffer: The destination buffer.
+ *   length: The size of the buffer.
+ *
+ * Returns:
+ *   The number of bytes copied, 0 if the peer closed the connection and
+ *   nothing is left, or -1 with errno EAGAIN if nothing is waiting.
+ */
+ssize_t shm_channel_peek(shm_channel_t *channel, void *buffer, size_t length);
+
+/*
+ * Purpose:
+ *   Unregisters and unmaps the channel of a socket, if any. Must be called
+ *   before the socket is closed.
+ *
+ * Parameters:
+ *   sockfd: The socket descriptor.
+ *
+ * Returns:
+ *   void
+ */
+void shm_channel_release(int sockfd);
+
+#endif // SHM_CHANNEL_H
@@ -0,0 +1,479 @@
+/*
+ * src/top_files.c
+ *
+ * This file implements the subtree scan declared in top_files.h. Directories
+ * waiting to be read are kept on a stack shared by the threads; a thread
+ * reads one directory at a time, pushes its subdirectories in one go, and
+ * offers its regular files to its own heap. The scan is over when the stack
+ * is empty and no thread is reading a directory, since only a reading thread
+ * can push more.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "top_files.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define CANCEL_CHECK_ENTRIES 256 // Entries between cancellation checks
+#define CANCEL_WAIT_MSEC 100     // Cancellation check interval while the caller waits for work
+
+// A directory waiting to be read.
+typedef struct dir_item_s {
+    char *path; // Relative to the root; "" for the root itself
+    struct dir_item_s *next;
+} dir_item_t;
+
+typedef struct top_scan_s {
+    int root_fd;
+    int rank_by;
+    size_t wanted;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    dir_item_t *stack;  // Protected by lock
+    size_t busy;        // Threads reading a directory; protected by lock
+    atomic_int stop;
+    atomic_int error;   // errno of the first error
+} top_scan_t;
+
+typedef struct top_worker_s {
+    top_scan_t *scan;
+    top_file_t *heap;   // Min-heap of the scan's wanted size: the worst file kept is on top
+    size_t heap_count;
+    top_cancel_fn cancel; // Only for the calling thread
+    void *cancel_ctx;
+    unsigned int entries_since_check;
+} top_worker_t;
+
+/*
+ * Purpose:
+ *   Ranks two files. Files with equal sizes (or times) are ranked by path,
+ *   so the result does not depend on the order the threads found them in.
+ *
+ * Parameters:
+ *   rank_by: TOP_BY_SIZE or TOP_BY_MTIME.
+ *   a: The first file.
+ *   b: The second file.
+ *
+ * Returns:
+ *   Positive if a ranks higher, negative if lower, zero for the same file.
+ */
+static int rank_compare(int rank_by, const top_file_t *a, const top_file_t *b) {
+    int rank = (rank_by == TOP_BY_MTIME) ? (a->mtime > b->mtime) - (a->mtime < b->mtime)
+                                         : (a->size > b->size) - (a->size < b->size);
+    return rank != 0 ? rank : -strcmp(a->path, b->path);
+}
+
+/*
+ * Purpose:
+ *   Restores the heap order below a position.
+ *
+ * Parameters:
+ *   worker: The worker owning the heap.
+ *   pos: The position.
+ *
+ * Returns:
+ *   void
+ */
+static void heap_sift_down(top_worker_t *worker, size_t pos) {
+    top_file_t *heap = worker->heap;
+    for (;;) {
+        size_t lowest = pos, left = 2 * pos + 1, right = left + 1;
+        int rank_by = worker->scan->rank_by;
+        if (left < worker->heap_count && rank_compare(rank_by, &heap[left], &heap[lowest]) < 0) lowest = left;
+        if (right < worker->heap_count && rank_compare(rank_by, &heap[right], &heap[lowest]) < 0) lowest = right;
+        if (lowest == pos) return;
+        top_file_t swap = heap[pos];
+        heap[pos] = heap[lowest];
+        heap[lowest] = swap;
+        pos = lowest;
+    }
+}
+
+/*
+ * Purpose:
+ *   Restores the heap order above a position.
+ *
+ * Parameters:
+ *   worker: The worker owning the heap.
+ *   pos: The position.
+ *
+ * Returns:
+ *   void
+ */
+static void heap_sift_up(top_worker_t *worker, size_t pos) {
+    top_file_t *heap = worker->heap;
+    while (pos > 0) {
+        size_t parent = (pos - 1) / 2;
+        if (rank_compare(worker->scan->rank_by, &heap[pos], &heap[parent]) >= 0) return;
+        top_file_t swap = heap[pos];
+        heap[pos] = heap[parent];
+        heap[parent] = swap;
+        pos = parent;
+    }
+}
+
+/*
+ * Purpose:
+ *   Joins a directory path relative to the root and a name.
+ *
+ * Parameters:
+ *   dir_path: The directory's relative path ("" for the root).
+ *   name: The name.
+ *
+ * Returns:
+ *   A malloc'ed path, or NULL on allocation failure.
+ */
+static char *join_path(const char *dir_path, const char *name) {
+    size_t dir_len = strlen(dir_path), name_len = strlen(name);
+    char *path = malloc(dir_len + name_len + 2);
+    if (path == NULL) return NULL;
+    if (dir_len > 0) {
+        memcpy(path, dir_path, dir_len);
+        path[dir_len++] = '/';
+    }
+    memcpy(path + dir_len, name, name_len + 1);
+    return path;
+}
+
+/*
+ * Purpose:
+ *   Offers a file to a worker's heap. The path is only built if the file is
+ *   kept.
+ *
+ * Parameters:
+ *   worker: The worker.
+ *   dir_path: The relative path of the file's directory.
+ *   name: The file's name.
+ *   st: The file's status.
+ *
+ * Returns:
+ *   0 on success, or -1 on allocation failure.
+ */
+static int heap_offer(top_worker_t *worker, const char *dir_path, const char *name, const struct stat *st) {
+    top_scan_t *scan = worker->scan;
+    top_file_t candidate = { NULL, (unsigned long long)st->st_size, (long long)st->st_mtim.tv_sec };
+    int full = (worker->heap_count == scan->wanted);
+    if (full) {
+        const top_file_t *worst = &worker->heap[0];
+        int rank = (scan->rank_by == TOP_BY_MTIME) ? (candidate.mtime > worst->mtime) - (candidate.mtime < worst->mtime)
+                                                         : (candidate.size > worst->size) - (candidate.size < worst->size);
+        if (rank < 0) return 0;
+    }
+    candidate.path = join_path(dir_path, name);
+    if (candidate.path == NULL) return -1;
+    if (!full) {
+        worker->heap[worker->heap_count] = candidate;
+        heap_sift_up(worker, worker->heap_count++);
+    } else if (rank_compare(scan->rank_by, &candidate, &worker->heap[0]) > 0) {
+        free(worker->heap[0].path);
+        worker->heap[0] = candidate;
+        heap_sift_down(worker, 0);
+    } else {
+        free(candidate.path); // A tie lost on the path
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Stops the scan, recording the first error.
+ *
+ * Parameters:
+ *   scan: The scan.
+ *   error: The errno value.
+ *
+ * Returns:
+ *   void
+ */
+static void stop_scan(top_scan_t *scan, int error) {
+    int expected = 0;
+    atomic_compare_exchange_strong(&scan->error, &expected, error);
+    atomic_store(&scan->stop, 1);
+    pthread_mutex_lock(&scan->lock);
+    pthread_cond_broadcast(&scan->cond);
+    pthread_mutex_unlock(&scan->lock);
+}
+
+/*
+ * Purpose:
+ *   Asks the calling thread's cancellation check, every
+ *   CANCEL_CHECK_ENTRIES entries, whether to stop.
+ *
+ * Parameters:
+ *   worker: The worker.
+ *   force: Nonzero to check regardless of the count.
+ *
+ * Returns:
+ *   Nonzero if the scan must stop.
+ */
+static int check_cancel(top_worker_t *worker, int force) {
+    if (atomic_load(&worker->scan->stop)) return 1;
+    if (worker->cancel == NULL) return 0;
+    if (!force && ++worker->entries_since_check < CANCEL_CHECK_ENTRIES) return 0;
+    worker->entries_since_check = 0;
+    if (!worker->cancel(worker->cancel_ctx)) return 0;
+    stop_scan(worker->scan, ECANCELED);
+    return 1;
+}
+
+/*
+ * Purpose:
+ *   Reads one directory: offers its regular files to the worker's heap and
+ *   pushes its subdirectories onto the shared stack.
+ *
+ * Parameters:
+ *   worker: The worker.
+ *   dir_path: The directory's path relative to the root.
+ *
+ * Returns:
+ *   void
+ */
+static void scan_directory(top_worker_t *worker, const char *dir_path) {
+    top_scan_t *scan = worker->scan;
+    int fd = openat(scan->root_fd, dir_path[0] != '\0' ? dir_path : ".", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) return;
+    DIR *dirp = fdopendir(fd);
+    if (dirp == NULL) {
+        close(fd);
+        return;
+    }
+
+    dir_item_t *children = NULL, *last_child = NULL;
+    struct dirent *entry;
+    while (!check_cancel(worker, 0) && (entry = readdir(dirp)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        struct stat st;
+        if (fstatat(dirfd(dirp), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) continue;
+        if (S_ISREG(st.st_mode)) {
+            if (heap_offer(worker, dir_path, entry->d_name, &st) == -1) {
+                stop_scan(scan, ENOMEM);
+                break;
+            }
+        } else if (S_ISDIR(st.st_mode)) {
+            dir_item_t *child = malloc(sizeof(dir_item_t));
+            char *child_path = join_path(dir_path, entry->d_name);
+            if (child == NULL || child_path == NULL) {
+                free(child);
+                free(child_path);
+                stop_scan(scan, ENOMEM);
+                break;
+            }
+            child->path = child_path;
+            child->next = children;
+            if (children == NULL) last_child = child;
+            children = child;
+        }
+    }
+    closedir(dirp);
+
+    if (children != NULL) {
+        pthread_mutex_lock(&scan->lock);
+        last_child->next = scan->stack;
+        scan->stack = children;
+        pthread_cond_broadcast(&scan->cond);
+        pthread_mutex_unlock(&scan->lock);
+    }
+}
+
+/*
+ * Purpose:
+ *   Takes directories from the stack and reads them until the scan is over.
+ *   Run by every thread, including the calling one.
+ *
+ * Parameters:
+ *   arg: The worker.
+ *
+ * Returns:
+ *   NULL
+ */
+static void *top_worker_thread(void *arg) {
+    top_worker_t *worker = arg;
+    top_scan_t *scan = worker->scan;
+    for (;;) {
+        pthread_mutex_lock(&scan->lock);
+        while (scan->stack == NULL && scan->busy > 0 && !atomic_load(&scan->stop)) {
+            if (worker->cancel == NULL) {
+                pthread_cond_wait(&scan->cond, &scan->lock);
+                continue;
+            }
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += CANCEL_WAIT_MSEC * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&scan->cond, &scan->lock, &deadline);
+            pthread_mutex_unlock(&scan->lock);
+            check_cancel(worker, 1);
+            pthread_mutex_lock(&scan->lock);
+        }
+        dir_item_t *item = atomic_load(&scan->stop) ? NULL : scan->stack;
+        if (item == NULL) {
+            pthread_mutex_unlock(&scan->lock);
+            return NULL;
+        }
+        scan->stack = item->next;
+        scan->busy++;
+        pthread_mutex_unlock(&scan->lock);
+
+        scan_directory(worker, item->path);
+        free(item->path);
+        free(item);
+
+        pthread_mutex_lock(&scan->lock);
+        scan->busy--;
+        if (scan->busy == 0 && scan->stack == NULL) pthread_cond_broadcast(&scan->cond);
+        pthread_mutex_unlock(&scan->lock);
+    }
+}
+
+/*
+ * Purpose:
+ *   qsort comparators ordering files best first.
+ *
+ * Parameters:
+ *   a: The first file.
+ *   b: The second file.
+ *
+ * Returns:
+ *   Negative if a comes first, positive if b does.
+ */
+static int compare_by_size(const void *a, const void *b) {
+    return -rank_compare(TOP_BY_SIZE, a, b);
+}
+
+static int compare_by_mtime(const void *a, const void *b) {
+    return -rank_compare(TOP_BY_MTIME, a, b);
+}
+
+/*
+ * Purpose:
+ *   Finds the largest or newest regular files below a directory. Symbolic
+ *   links are not followed. The calling thread scans too, helped by up to
+ *   thread_count - 1 more threads.
+ *
+ * Parameters:
+ *   root_path: The absolute path of the directory.
+ *   rank_by: TOP_BY_SIZE or TOP_BY_MTIME.
+ *   count: The number of files wanted (1 to TOP_MAX_COUNT).
+ *   thread_count: The number of threads, or 0 for one per online CPU (at
+ *                 most TOP_MAX_THREADS).
+ *   cancel: An optional cancellation check; may be NULL.
+ *   cancel_ctx: The context passed to cancel.
+ *   files_out: Receives a malloc'ed array of the files, best first (free
+ *              with top_files_free).
+ *   count_out: Receives the number of files (fewer than count if the tree
+ *              has fewer).
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno ECANCELED if cancel asked to stop).
+ */
+int top_files_scan(const char *root_path, int rank_by, size_t count, unsigned int thread_count,
+                   top_cancel_fn cancel, void *cancel_ctx, top_file_t **files_out, size_t *count_out) {
+    if (count == 0 || count > TOP_MAX_COUNT) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (thread_count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = (cpus > 0) ? (unsigned int)cpus : 1;
+    }
+    if (thread_count > TOP_MAX_THREADS) thread_count = TOP_MAX_THREADS;
+
+    top_scan_t scan;
+    scan.root_fd = open(root_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (scan.root_fd == -1) return -1;
+    scan.rank_by = rank_by;
+    scan.wanted = count;
+    pthread_mutex_init(&scan.lock, NULL);
+    pthread_cond_init(&scan.cond, NULL);
+    scan.stack = calloc(1, sizeof(dir_item_t));
+    scan.busy = 0;
+    atomic_init(&scan.stop, 0);
+    atomic_init(&scan.error, 0);
+
+    top_worker_t workers[TOP_MAX_THREADS];
+    top_file_t *heaps = malloc((size_t)thread_count * count * sizeof(top_file_t));
+    if (scan.stack != NULL) scan.stack->path = strdup("");
+    if (heaps == NULL || scan.stack == NULL || scan.stack->path == NULL) {
+        if (scan.stack != NULL) free(scan.stack->path);
+        free(scan.stack);
+        free(heaps);
+        close(scan.root_fd);
+        pthread_mutex_destroy(&scan.lock);
+        pthread_cond_destroy(&scan.cond);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (unsigned int i = 0; i < thread_count; i++) {
+        workers[i].scan = &scan;
+        workers[i].heap = heaps + (size_t)i * count;
+        workers[i].heap_count = 0;
+        workers[i].cancel = (i == 0) ? cancel : NULL;
+        workers[i].cancel_ctx = cancel_ctx;
+        workers[i].entries_since_check = 0;
+    }
+
+    pthread_t helpers[TOP_MAX_THREADS];
+    unsigned int helper_count = 0;
+    for (unsigned int i = 1; i < thread_count; i++) {
+        if (pthread_create(&helpers[helper_count], NULL, top_worker_thread, &workers[i]) != 0) break;
+        helper_count++;
+    }
+    top_worker_thread(&workers[0]);
+    for (unsigned int i = 0; i < helper_count; i++) pthread_join(helpers[i], NULL);
+
+    while (scan.stack != NULL) { // Left over after a stop
+        dir_item_t *item = scan.stack;
+        scan.stack = item->next;
+        free(item->path);
+        free(item);
+    }
+    close(scan.root_fd);
+    pthread_mutex_destroy(&scan.lock);
+    pthread_cond_destroy(&scan.cond);
+
+    // Merge: move every heap's files together, sort and keep the best.
+    size_t total = 0;
+    for (unsigned int i = 0; i <= helper_count; i++) {
+        memmove(heaps + total, workers[i].heap, workers[i].heap_count * sizeof(top_file_t));
+        total += workers[i].heap_count;
+    }
+    int error = atomic_load(&scan.error);
+    if (error != 0) {
+        top_files_free(heaps, total);
+        errno = error;
+        return -1;
+    }
+    qsort(heaps, total, sizeof(top_file_t), rank_by == TOP_BY_MTIME ? compare_by_mtime : compare_by_size);
+    for (size_t i = count; i < total; i++) free(heaps[i].path);
+    *files_out = heaps;
+    *count_out = (total < count) ? total : count;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Frees files returned by top_files_scan.
+ *
+ * Parameters:
+ *   files: The files (may be NULL).
+ *   count: Their number.
+ *
+ * Returns:
+ *   void
+ */
+void top_files_free(top_file_t *files, size_t count) {
+    if (files == NULL) return;
+    for (size_t i = 0; i < count; i++) free(files[i].path);
+    free(files);
+}
@@ -0,0 +1,84 @@
+/*
+ * src/top_files.h
+ *
+ * This header file declares the subtree scan behind the TOP command, which
+ * finds the largest or most recently modified regular files below a
+ * directory. Several threads take directories from a shared stack; each keeps
+ * its own min-heap of the best N files seen so far, so a file that does not
+ * beat the smallest of them is dropped without its path ever being built.
+ * When the stack is empty, the heaps are merged into the result. Memory is
+ * bounded by N per thread plus the directories waiting to be read, however
+ * many files the tree holds.
+ */
+#ifndef TOP_FILES_H
+#define TOP_FILES_H
+
+#include <stddef.h> // For size_t
+
+#define TOP_MAX_COUNT 1000
+#define TOP_MAX_THREADS 8
+
+// What files are ranked by.
+enum {
+    TOP_BY_SIZE,
+    TOP_BY_MTIME
+};
+
+typedef struct top_file_s {
+    char *path;              // Relative to the scanned directory, without a leading '/'
+    unsigned long long size;
+    long long mtime;         // Seconds since the epoch
+} top_file_t;
+
+/*
+ * Purpose:
+ *   Called by the thread that started the scan, between entries, to ask
+ *   whether the scan should be abandoned.
+ *
+ * Parameters:
+ *   ctx: The caller's context.
+ *
+ * Returns:
+ *   Nonzero to stop.
+ */
+typedef int (*top_cancel_fn)(void *ctx);
+
+/*
+ * Purpose:
+ *   Finds the largest or newest regular files below a directory. Symbolic
+ *   links are not followed. The calling thread scans too, helped by up to
+ *   thread_count - 1 more threads.
+ *
+ * Parameters:
+ *   root_path: The absolute path of the directory.
+ *   rank_by: TOP_BY_SIZE or TOP_BY_MTIME.
+ *   count: The number of files wanted (1 to TOP_MAX_COUNT).
+ *   thread_count: The number of threads, or 0 for one per online CPU (at
+ *                 most TOP_MAX_THREADS).
+ *   cancel: An optional cancellation check; may be NULL.
+ *   cancel_ctx: The context passed to cancel.
+ *   files_out: Receives a malloc'ed array of the files, best first (free
+ *              with top_files_free).
+ *   count_out: Receives the number of files (fewer than count if the tree
+ *              has fewer).
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno ECANCELED if cancel asked to stop).
+ */
+int top_files_scan(const char *root_path, int rank_by, size_t count, unsigned int thread_count,
+                   top_cancel_fn cancel, void *cancel_ctx, top_file_t **files_out, size_t *count_out);
+
+/*
+ * Purpose:
+ *   Frees files returned by top_files_scan.
+ *
+ * Parameters:
+ *   files: The files (may be NULL).
+ *   count: Their number.
+ *
+ * Returns:
+ *   void
+ */
+void top_files_free(top_file_t *files, size_t count);
+
+#endif // TOP_FILES_H
@@ -0,0 +1,486 @@
+/*
+ * src/tree_digest.c
+ *
+ * This file implements the directory tree digests declared in tree_digest.h.
+ * Cached digests are kept per directory inode, so a renamed subtree keeps its
+ * digest, together with the inode of the parent it was last computed under.
+ * A private inotify instance watches every cached directory; its events are
+ * not read by a thread of their own but drained before each lookup. An event
+ * marks the directory and its chain of cached parents out of date and bumps a
+ * change counter; a digest computed while a change to its subtree arrived is
+ * returned but not cached.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "tree_digest.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "dir_cache.h"
+#include "protocol.h"
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_ONLYDIR)
+#define NODE_NONE UINT32_MAX
+#define HASH_BUCKETS 131072
+#define MAX_PARENT_WALK 4096 // Guards the walk up the parents against cycles
+#define EVENT_BUFFER_SIZE (64 * 1024)
+
+typedef struct digest_node_s {
+    dev_t dev;
+    ino_t ino;
+    dev_t parent_dev;
+    ino_t parent_ino;
+    int has_parent;
+    int wd;
+    int in_use;
+    int valid;               // digest is current
+    unsigned long dirty_seq; // g_change_seq when the subtree last changed
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    uint32_t hash_next;      // Next node in the bucket, or in the free list
+} digest_node_t;
+
+static pthread_mutex_t g_digest_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_inotify_fd = -1;
+static digest_node_t *g_nodes = NULL; // TREE_DIGEST_MAX_DIRS slots
+static uint32_t g_node_count = 0;     // Slots ever used
+static uint32_t g_free_nodes = NODE_NONE;
+static uint32_t *g_buckets = NULL;
+static uint32_t *g_wd_nodes = NULL;   // Node watched by each watch descriptor
+static size_t g_wd_capacity = 0;
+static unsigned long g_change_seq = 0;
+static int g_limit_reported = 0;
+static _Alignas(struct inotify_event) char g_event_buffer[EVENT_BUFFER_SIZE];
+
+/*
+ * Purpose:
+ *   Returns the hash bucket of a directory inode.
+ *
+ * Parameters:
+ *   dev: The device.
+ *   ino: The inode number.
+ *
+ * Returns:
+ *   The bucket index.
+ */
+static size_t bucket_of(dev_t dev, ino_t ino) {
+    uint64_t key = ((uint64_t)dev * 0x9E3779B97F4A7C15ULL) ^ (uint64_t)ino;
+    key ^= key >> 29;
+    return (size_t)(key % HASH_BUCKETS);
+}
+
+/*
+ * Purpose:
+ *   Finds the node of a directory. The caller holds g_digest_lock.
+ *
+ * Parameters:
+ *   dev: The device.
+ *   ino: The inode number.
+ *
+ * Returns:
+ *   The node index, or NODE_NONE.
+ */
+static uint32_t find_node_locked(dev_t dev, ino_t ino) {
+    if (g_nodes == NULL) return NODE_NONE;
+    for (uint32_t id = g_buckets[bucket_of(dev, ino)]; id != NODE_NONE; id = g_nodes[id].hash_next) {
+        if (g_nodes[id].dev == dev && g_nodes[id].ino == ino) return id;
+    }
+    return NODE_NONE;
+}
+
+/*
+ * Purpose:
+ *   Removes a node whose directory is gone. The caller holds g_digest_lock.
+ *
+ * Parameters:
+ *   id: The node index.
+ *
+ * Returns:
+ *   void
+ */
+static void remove_node_locked(uint32_t id) {
+    digest_node_t *node = &g_nodes[id];
+    uint32_t *link = &g_buckets[bucket_of(node->dev, node->ino)];
+    while (*link != NODE_NONE && *link != id) link = &g_nodes[*link].hash_next;
+    if (*link == id) *link = node->hash_next;
+    if (node->wd >= 0 && (size_t)node->wd < g_wd_capacity && g_wd_nodes[node->wd] == id) g_wd_nodes[node->wd] = NODE_NONE;
+    memset(node, 0, sizeof(*node));
+    node->hash_next = g_free_nodes;
+    g_free_nodes = id;
+}
+
+/*
+ * Purpose:
+ *   Records which node a watch descriptor belongs to. The caller holds
+ *   g_digest_lock.
+ *
+ * Parameters:
+ *   wd: The watch descriptor.
+ *   id: The node index.
+ *
+ * Returns:
+ *   0 on success, or -1 on allocation failure.
+ */
+static int set_watch_node_locked(int wd, uint32_t id) {
+    if ((size_t)wd >= g_wd_capacity) {
+        size_t new_capacity = g_wd_capacity ? g_wd_capacity : 1024;
+        while (new_capacity <= (size_t)wd) new_capacity *= 2;
+        uint32_t *grown = realloc(g_wd_nodes, new_capacity * sizeof(uint32_t));
+        if (grown == NULL) return -1;
+        memset(grown + g_wd_capacity, 0xff, (new_capacity - g_wd_capacity) * sizeof(uint32_t));
+        g_wd_nodes = grown;
+        g_wd_capacity = new_capacity;
+    }
+    g_wd_nodes[wd] = id;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Creates the node of a directory and puts the directory under watch. The
+ *   caller holds g_digest_lock.
+ *
+ * Parameters:
+ *   path: The absolute path of the directory.
+ *   dev: Its device.
+ *   ino: Its inode number.
+ *
+ * Returns:
+ *   The node index, or NODE_NONE if the directory cannot be watched (its
+ *   digest is then not cached).
+ */
+static uint32_t add_node_locked(const char *path, dev_t dev, ino_t ino) {
+    if (g_free_nodes == NODE_NONE && g_node_count == TREE_DIGEST_MAX_DIRS) {
+        if (!g_limit_reported) {
+            fprintf(stderr, "Tree digests: cache full (%d directories); further digests are not cached.\n", TREE_DIGEST_MAX_DIRS);
+            g_limit_reported = 1;
+        }
+        return NODE_NONE;
+    }
+    int wd = inotify_add_watch(g_inotify_fd, path, WATCH_MASK);
+    if (wd == -1) {
+        if (errno == ENOSPC && !g_limit_reported) {
+            fprintf(stderr, "Tree digests: inotify watch limit reached; further digests are not cached.\n");
+            g_limit_reported = 1;
+        }
+        return NODE_NONE;
+    }
+    // A stale node may still hold the descriptor if its directory was replaced.
+    if ((size_t)wd < g_wd_capacity && g_wd_nodes[wd] != NODE_NONE) remove_node_locked(g_wd_nodes[wd]);
+
+    uint32_t id;
+    if (g_free_nodes != NODE_NONE) {
+        id = g_free_nodes;
+        g_free_nodes = g_nodes[id].hash_next;
+    } else {
+        id = g_node_count++;
+    }
+    if (set_watch_node_locked(wd, id) == -1) {
+        g_nodes[id].hash_next = g_free_nodes;
+        g_free_nodes = id;
+        return NODE_NONE;
+    }
+    digest_node_t *node = &g_nodes[id];
+    memset(node, 0, sizeof(*node));
+    node->dev = dev;
+    node->ino = ino;
+    node->wd = wd;
+    node->in_use = 1;
+    node->dirty_seq = ++g_change_seq;
+    size_t bucket = bucket_of(dev, ino);
+    node->hash_next = g_buckets[bucket];
+    g_buckets[bucket] = id;
+    return id;
+}
+
+/*
+ * Purpose:
+ *   Marks a directory and all its cached parents out of date. The caller
+ *   holds g_digest_lock.
+ *
+ * Parameters:
+ *   id: The node of the changed directory.
+ *
+ * Returns:
+ *   void
+ */
+static void mark_changed_locked(uint32_t id) {
+    unsigned long seq = ++g_change_seq;
+    for (int steps = 0; id != NODE_NONE && steps < MAX_PARENT_WALK; steps++) {
+        digest_node_t *node = &g_nodes[id];
+        node->valid = 0;
+        node->dirty_seq = seq;
+        id = node->has_parent ? find_node_locked(node->parent_dev, node->parent_ino) : NODE_NONE;
+    }
+}
+
+/*
+ * Purpose:
+ *   Applies all pending inotify events. The caller holds g_digest_lock.
+ *
+ * Parameters:
+ *   None.
+ *
+ * Returns:
+ *   void
+ */
+static void drain_events_locked(void) {
+    if (g_inotify_fd == -1) return;
+    for (;;) {
+        ssize_t len = read(g_inotify_fd, g_event_buffer, sizeof(g_event_buffer));
+        if (len <= 0) {
+            if (len == -1 && errno == EINTR) continue;
+            return;
+        }
+        for (char *ptr = g_event_buffer; ptr < g_event_buffer + len;) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                unsigned long seq = ++g_change_seq;
+                for (uint32_t id = 0; id < g_node_count; id++) {
+                    g_nodes[id].valid = 0;
+                    g_nodes[id].dirty_seq = seq;
+                }
+                continue;
+            }
+            if (event->wd < 0 || (size_t)event->wd >= g_wd_capacity) continue;
+            uint32_t id = g_wd_nodes[event->wd];
+            if (id == NODE_NONE) continue;
+            mark_changed_locked(id);
+            if (event->mask & IN_IGNORED) remove_node_locked(id);
+        }
+    }
+}
+
+/*
+ * Purpose:
+ *   Computes the digest of a directory tree, taking subtrees from the cache
+ *   where they are current, and caches the result.
+ *
+ * Parameters:
+ *   path: The absolute path of the directory.
+ *   parent: The parent's status, or NULL for the top of the request.
+ *   cancel: The cancellation check, or NULL.
+ *   cancel_ctx: Its context.
+ *   digest: Receives the digest.
+ *   entries_out: If not NULL, receives the entries (and the digest is then
+ *                computed even if cached).
+ *   entry_count_out: Receives the number of entries.
+ *   stats: The request's statistics.
+ *   cacheable_out: Receives nonzero if the whole subtree is watched, so a
+ *                  digest built on this one may be cached.
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno is set).
+ */
+static int compute_dir(const char *path, const struct stat *parent, tree_digest_cancel_fn cancel, void *cancel_ctx,
+                       unsigned char digest[SHA256_DIGEST_SIZE], tree_digest_entry_t **entries_out, size_t *entry_count_out,
+                       tree_digest_stats_t *stats, int *cacheable_out) {
+    struct stat st;
+    *cacheable_out = 0;
+    if (lstat(path, &st) == -1) return -1;
+    if (!S_ISDIR(st.st_mode)) {
+        errno = ENOTDIR;
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_digest_lock);
+    drain_events_locked();
+    uint32_t id = find_node_locked(st.st_dev, st.st_ino);
+    if (id == NODE_NONE && g_inotify_fd != -1) id = add_node_locked(path, st.st_dev, st.st_ino);
+    if (id != NODE_NONE && parent != NULL) {
+        g_nodes[id].parent_dev = parent->st_dev;
+        g_nodes[id].parent_ino = parent->st_ino;
+        g_nodes[id].has_parent = 1;
+    }
+    if (id != NODE_NONE && g_nodes[id].valid && entries_out == NULL) {
+        memcpy(digest, g_nodes[id].digest, SHA256_DIGEST_SIZE);
+        pthread_mutex_unlock(&g_digest_lock);
+        stats->cached++;
+        *cacheable_out = 1;
+        return 0;
+    }
+    unsigned long start_seq = g_change_seq;
+    pthread_mutex_unlock(&g_digest_lock);
+
+    dir_listing_t *listing = dir_cache_get(path);
+    if (listing == NULL) return -1;
+    int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    char *child_path = malloc(MAX_PATH_LEN);
+    tree_digest_entry_t *entries = (entries_out != NULL) ? calloc(listing->count > 0 ? listing->count : 1, sizeof(tree_digest_entry_t)) : NULL;
+    if (dir_fd == -1 || child_path == NULL || (entries_out != NULL && entries == NULL)) {
+        int saved_errno = (dir_fd == -1) ? errno : ENOMEM;
+        if (dir_fd != -1) close(dir_fd);
+        free(child_path);
+        free(entries);
+        dir_cache_release(listing);
+        errno = saved_errno;
+        return -1;
+    }
+
+    int cacheable = (id != NODE_NONE);
+    int result = 0;
+    sha256_ctx_t dir_ctx;
+    sha256_init(&dir_ctx);
+    for (size_t i = 0; i < listing->count; i++) {
+        if (cancel != NULL && cancel(cancel_ctx)) {
+            errno = ECANCELED;
+            result = -1;
+            break;
+        }
+        const dir_cache_entry_t *entry = &listing->entries[i];
+        unsigned char payload[SHA256_DIGEST_SIZE];
+        size_t payload_len = 0;
+        const void *payload_ptr = payload;
+        if (entry->type == DIR_ENTRY_DIR) {
+            int child_cacheable = 0;
+            payload_len = SHA256_DIGEST_SIZE;
+            if (snprintf(child_path, MAX_PATH_LEN, "%s/%s", strcmp(path, "/") == 0 ? "" : path, entry->name) >= MAX_PATH_LEN ||
+                compute_dir(child_path, &st, cancel, cancel_ctx, payload, NULL, NULL, stats, &child_cacheable) == -1) {
+                if (errno == ECANCELED) {
+                    result = -1;
+                    break;
+                }
+                memset(payload, 0, sizeof(payload)); // Unreadable; a change to it is reported in this directory
+                child_cacheable = 1;
+            }
+            cacheable = cacheable && child_cacheable;
+        } else if (entry->type == DIR_ENTRY_LINK) {
+            payload_ptr = entry->link_target;
+            payload_len = (entry->link_target != NULL) ? strlen(entry->link_target) : 0;
+        } else {
+            struct stat file_st;
+            uint64_t size = 0, mtime = 0;
+            if (fstatat(dir_fd, entry->name, &file_st, AT_SYMLINK_NOFOLLOW) == 0) {
+                size = (uint64_t)file_st.st_size;
+                mtime = (uint64_t)file_st.st_mtim.tv_sec;
+            }
+            for (int b = 0; b < 8; b++) {
+                payload[b] = (unsigned char)(size >> (56 - 8 * b));
+                payload[8 + b] = (unsigned char)(mtime >> (56 - 8 * b));
+            }
+            payload_len = 16;
+        }
+
+        unsigned char entry_digest[SHA256_DIGEST_SIZE];
+        sha256_ctx_t entry_ctx;
+        sha256_init(&entry_ctx);
+        sha256_update(&entry_ctx, &entry->type, 1);
+        sha256_update(&entry_ctx, entry->name, strlen(entry->name) + 1);
+        if (payload_len > 0) sha256_update(&entry_ctx, payload_ptr, payload_len);
+        sha256_final(&entry_ctx, entry_digest);
+        sha256_update(&dir_ctx, entry_digest, sizeof(entry_digest));
+        if (entries != NULL) {
+            entries[i].name = strdup(entry->name);
+            entries[i].type = entry->type;
+            memcpy(entries[i].digest, entry_digest, sizeof(entry_digest));
+        }
+    }
+    size_t entry_count = listing->count;
+    close(dir_fd);
+    free(child_path);
+    dir_cache_release(listing);
+    if (result == -1) {
+        tree_digest_free_entries(entries, entry_count);
+        return -1;
+    }
+    sha256_final(&dir_ctx, digest);
+    stats->computed++;
+
+    pthread_mutex_lock(&g_digest_lock);
+    drain_events_locked();
+    id = find_node_locked(st.st_dev, st.st_ino);
+    if (cacheable && id != NODE_NONE && g_nodes[id].dirty_seq <= start_seq) {
+        memcpy(g_nodes[id].digest, digest, SHA256_DIGEST_SIZE);
+        g_nodes[id].valid = 1;
+    }
+    pthread_mutex_unlock(&g_digest_lock);
+
+    *cacheable_out = cacheable;
+    if (entries_out != NULL) {
+        *entries_out = entries;
+        *entry_count_out = entry_count;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Sets up the change notification for the digest cache. Without it (or if
+ *   it fails), digests are computed but never cached.
+ *
+ * Parameters:
+ *   None.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+int tree_digest_init(void) {
+    g_nodes = calloc(TREE_DIGEST_MAX_DIRS, sizeof(digest_node_t));
+    g_buckets = malloc(HASH_BUCKETS * sizeof(uint32_t));
+    if (g_nodes == NULL || g_buckets == NULL) {
+        perror("Allocating tree digest cache failed");
+        free(g_nodes);
+        free(g_buckets);
+        g_nodes = NULL;
+        g_buckets = NULL;
+        return -1;
+    }
+    memset(g_buckets, 0xff, HASH_BUCKETS * sizeof(uint32_t));
+    g_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (g_inotify_fd == -1) {
+        perror("inotify_init1 for tree digests");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Returns the digest of a directory tree, and optionally the digests of
+ *   the directory's entries. Symbolic links are not followed.
+ *
+ * Parameters:
+ *   path: The absolute path of the directory.
+ *   cancel: An optional cancellation check; may be NULL.
+ *   cancel_ctx: The context passed to cancel.
+ *   digest: Receives the directory's digest.
+ *   entries_out: If not NULL, receives a malloc'ed array of the entries in
+ *                name order (free with tree_digest_free_entries).
+ *   entry_count_out: Receives the number of entries if entries_out is set.
+ *   stats: Receives the work done (may be NULL).
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno ECANCELED if cancel asked to stop).
+ */
+int tree_digest_dir(const char *path, tree_digest_cancel_fn cancel, void *cancel_ctx, unsigned char digest[SHA256_DIGEST_SIZE],
+                    tree_digest_entry_t **entries_out, size_t *entry_count_out, tree_digest_stats_t *stats) {
+    tree_digest_stats_t local_stats = {0, 0};
+    int cacheable;
+    int result = compute_dir(path, NULL, cancel, cancel_ctx, digest, entries_out, entry_count_out, &local_stats, &cacheable);
+    if (stats != NULL) *stats = local_stats;
+    return result;
+}
+
+/*
+ * Purpose:
+ *   Frees entries returned by tree_digest_dir.
+ *
+ * Parameters:
+ *   entries: The entries (may be NULL).
+ *   count: Their number.
+ *
+ * Returns:
+ *   void
+ */
+void tree_digest_free_entries(tree_digest_entry_t *entries, size_t count) {
+    if (entries == NULL) return;
+    for (size_t i = 0; i < count; i++) free(entries[i].name);
+    free(entries);
+}
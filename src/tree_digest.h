@@ -0,0 +1,103 @@
+/*
+ * src/tree_digest.h
+ *
+ * This header file declares the directory tree digests behind the TREEHASH
+ * command. The digest of a directory covers the names, types, sizes and
+ * modification times of everything below it, so two trees with equal digests
+ * have the same shape and metadata, and comparing two trees is a walk from
+ * the top that only descends into subdirectories whose digests differ:
+ *
+ *   entry digest = SHA-256(type || name || 0x00 || payload), with payload
+ *                  'f': size and mtime in seconds, 8 bytes big-endian each
+ *                  'd': the subdirectory's digest
+ *                  'l': the link target (empty for a broken link)
+ *   dir digest   = SHA-256 of its entry digests in name order
+ *
+ * Digests are cached per directory. Each cached directory is watched with
+ * inotify; a change marks its digest and those of its cached ancestors out
+ * of date, so the next request recomputes only the changed path while
+ * unchanged sibling subtrees are answered from the cache.
+ */
+#ifndef TREE_DIGEST_H
+#define TREE_DIGEST_H
+
+#include <stddef.h> // For size_t
+
+#include "sha256.h"
+
+#define TREE_DIGEST_MAX_DIRS 65536 // Directories whose digests are cached
+
+// One entry of a directory, as reported with its digest.
+typedef struct tree_digest_entry_s {
+    char *name;
+    char type; // One of DIR_ENTRY_*
+    unsigned char digest[SHA256_DIGEST_SIZE];
+} tree_digest_entry_t;
+
+// Work done for one request.
+typedef struct tree_digest_stats_s {
+    size_t computed; // Directories read and hashed
+    size_t cached;   // Directory digests taken from the cache
+} tree_digest_stats_t;
+
+/*
+ * Purpose:
+ *   Called between entries to ask whether the computation should be
+ *   abandoned.
+ *
+ * Parameters:
+ *   ctx: The caller's context.
+ *
+ * Returns:
+ *   Nonzero to stop.
+ */
+typedef int (*tree_digest_cancel_fn)(void *ctx);
+
+/*
+ * Purpose:
+ *   Sets up the change notification for the digest cache. Without it (or if
+ *   it fails), digests are computed but never cached.
+ *
+ * Parameters:
+ *   None.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+int tree_digest_init(void);
+
+/*
+ * Purpose:
+ *   Returns the digest of a directory tree, and optionally the digests of
+ *   the directory's entries. Symbolic links are not followed.
+ *
+ * Parameters:
+ *   path: The absolute path of the directory.
+ *   cancel: An optional cancellation check; may be NULL.
+ *   cancel_ctx: The context passed to cancel.
+ *   digest: Receives the directory's digest.
+ *   entries_out: If not NULL, receives a malloc'ed array of the entries in
+ *                name order (free with tree_digest_free_entries).
+ *   entry_count_out: Receives the number of entries if entries_out is set.
+ *   stats: Receives the work done (may be NULL).
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno ECANCELED if cancel asked to stop).
+ */
+int tree_digest_dir(const char *path, tree_digest_cancel_fn cancel, void *cancel_ctx, unsigned char digest[SHA256_DIGEST_SIZE],
+                    tree_digest_entry_t **entries_out, size_t *entry_count_out, tree_digest_stats_t *stats);
+
+/*
+ * Purpose:
+ *   Frees entries returned by tree_digest_dir.
+ *
+ * Parameters:
+ *   entries: The entries (may be NULL).
+ *   count: Their number.
+ *
+ * Returns:
+ *   void
+ */
+void tree_digest_free_entries(tree_digest_entry_t *entries, size_t count);
+
+#endif // TREE_DIGEST_H
@@ -0,0 +1,222 @@
+/*
+ * src/tree_hash.c
+ *
+ * This file implements the tree hash declared in tree_hash.h. The threads
+ * share one counter of the next chunk to hash, so faster threads take more
+ * chunks, and each writes its leaf digests into its own slots of a shared
+ * array. Once all chunks are hashed, the calling thread combines the leaves
+ * into the root.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "tree_hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+typedef struct tree_hash_work_s {
+    int fd;
+    off_t size;
+    size_t chunk_count;
+    unsigned char *leaves;   // chunk_count digests
+    atomic_size_t next_chunk;
+    atomic_int stop;         // Set on an error or a cancellation
+    atomic_int error;        // errno of the first error
+} tree_hash_work_t;
+
+/*
+ * Purpose:
+ *   Reads one chunk and stores its leaf digest.
+ *
+ * Parameters:
+ *   work: The shared state.
+ *   index: The chunk number.
+ *   buffer: A buffer of TREE_HASH_CHUNK_SIZE bytes.
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno is set; EIO if the file got shorter).
+ */
+static int hash_chunk(tree_hash_work_t *work, size_t index, unsigned char *buffer) {
+    off_t offset = (off_t)index * TREE_HASH_CHUNK_SIZE;
+    size_t length = TREE_HASH_CHUNK_SIZE;
+    if ((off_t)length > work->size - offset) length = (size_t)(work->size - offset);
+    size_t done = 0;
+    while (done < length) {
+        ssize_t nbytes = pread(work->fd, buffer + done, length - done, offset + (off_t)done);
+        if (nbytes == -1 && errno == EINTR) continue;
+        if (nbytes <= 0) {
+            if (nbytes == 0) errno = EIO;
+            return -1;
+        }
+        done += (size_t)nbytes;
+    }
+
+    static const unsigned char leaf_prefix = 0x00;
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, &leaf_prefix, 1);
+    sha256_update(&ctx, buffer, length);
+    sha256_final(&ctx, work->leaves + index * SHA256_DIGEST_SIZE);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Hashes chunks until none are left or the work is stopped.
+ *
+ * Parameters:
+ *   work: The shared state.
+ *   buffer: A buffer of TREE_HASH_CHUNK_SIZE bytes.
+ *   cancel: The cancellation check (only for the calling thread), or NULL.
+ *   cancel_ctx: Its context.
+ *
+ * Returns:
+ *   void
+ */
+static void hash_chunks(tree_hash_work_t *work, unsigned char *buffer, tree_hash_cancel_fn cancel, void *cancel_ctx) {
+    while (!atomic_load(&work->stop)) {
+        if (cancel != NULL && cancel(cancel_ctx)) {
+            atomic_store(&work->error, ECANCELED);
+            atomic_store(&work->stop, 1);
+            break;
+        }
+        size_t index = atomic_fetch_add(&work->next_chunk, 1);
+        if (index >= work->chunk_count) break;
+        if (hash_chunk(work, index, buffer) == -1) {
+            int expected = 0;
+            atomic_compare_exchange_strong(&work->error, &expected, errno);
+            atomic_store(&work->stop, 1);
+        }
+    }
+}
+
+/*
+ * Purpose:
+ *   Thread function of a helper thread.
+ *
+ * Parameters:
+ *   arg: The shared state.
+ *
+ * Returns:
+ *   NULL
+ */
+static void *tree_hash_thread(void *arg) {
+    tree_hash_work_t *work = arg;
+    unsigned char *buffer = malloc(TREE_HASH_CHUNK_SIZE);
+    if (buffer != NULL) {
+        hash_chunks(work, buffer, NULL, NULL);
+        free(buffer);
+    }
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Computes the Merkle tree hash of a list of leaf digests (RFC 6962).
+ *
+ * Parameters:
+ *   leaves: The leaf digests.
+ *   count: The number of leaves (at least 1).
+ *   out: Receives the digest.
+ *
+ * Returns:
+ *   void
+ */
+static void merkle_root(const unsigned char *leaves, size_t count, unsigned char out[SHA256_DIGEST_SIZE]) {
+    if (count == 1) {
+        memcpy(out, leaves, SHA256_DIGEST_SIZE);
+        return;
+    }
+    size_t split = 1;
+    while (split * 2 < count) split *= 2;
+    unsigned char left[SHA256_DIGEST_SIZE], right[SHA256_DIGEST_SIZE];
+    merkle_root(leaves, split, left);
+    merkle_root(leaves + split * SHA256_DIGEST_SIZE, count - split, right);
+
+    static const unsigned char node_prefix = 0x01;
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, &node_prefix, 1);
+    sha256_update(&ctx, left, sizeof(left));
+    sha256_update(&ctx, right, sizeof(right));
+    sha256_final(&ctx, out);
+}
+
+/*
+ * Purpose:
+ *   Computes the tree hash of an open file. The calling thread hashes chunks
+ *   itself, helped by up to thread_count - 1 more threads.
+ *
+ * Parameters:
+ *   fd: The file, open for reading (read with pread; the offset is unused).
+ *   size: The number of bytes to hash.
+ *   thread_count: The number of threads, or 0 for one per online CPU (at
+ *                 most TREE_HASH_MAX_THREADS).
+ *   cancel: An optional cancellation check; may be NULL.
+ *   cancel_ctx: The context passed to cancel.
+ *   root: Receives the root digest.
+ *   leaves_out: If not NULL, receives a malloc'ed array of the chunk
+ *               digests (SHA256_DIGEST_SIZE bytes each, in file order).
+ *   leaf_count_out: If not NULL, receives the number of chunks.
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno ECANCELED if cancel asked to stop).
+ */
+int tree_hash_file(int fd, off_t size, unsigned int thread_count, tree_hash_cancel_fn cancel, void *cancel_ctx,
+                   unsigned char root[SHA256_DIGEST_SIZE], unsigned char **leaves_out, size_t *leaf_count_out) {
+    tree_hash_work_t work;
+    work.fd = fd;
+    work.size = size;
+    work.chunk_count = (size_t)((size + TREE_HASH_CHUNK_SIZE - 1) / TREE_HASH_CHUNK_SIZE);
+    work.leaves = malloc(work.chunk_count > 0 ? work.chunk_count * SHA256_DIGEST_SIZE : 1);
+    unsigned char *buffer = malloc(TREE_HASH_CHUNK_SIZE);
+    if (work.leaves == NULL || buffer == NULL) {
+        free(work.leaves);
+        free(buffer);
+        return -1;
+    }
+    atomic_init(&work.next_chunk, 0);
+    atomic_init(&work.stop, 0);
+    atomic_init(&work.error, 0);
+
+    if (thread_count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = (cpus > 0) ? (unsigned int)cpus : 1;
+    }
+    if (thread_count > TREE_HASH_MAX_THREADS) thread_count = TREE_HASH_MAX_THREADS;
+    if (thread_count > work.chunk_count) thread_count = (work.chunk_count > 0) ? (unsigned int)work.chunk_count : 1;
+
+    pthread_t helpers[TREE_HASH_MAX_THREADS];
+    unsigned int helper_count = 0;
+    for (unsigned int i = 1; i < thread_count; i++) {
+        if (pthread_create(&helpers[helper_count], NULL, tree_hash_thread, &work) != 0) break;
+        helper_count++;
+    }
+    hash_chunks(&work, buffer, cancel, cancel_ctx);
+    for (unsigned int i = 0; i < helper_count; i++) pthread_join(helpers[i], NULL);
+    free(buffer);
+
+    int error = atomic_load(&work.error);
+    if (error != 0) {
+        free(work.leaves);
+        errno = error;
+        return -1;
+    }
+    if (work.chunk_count == 0) {
+        sha256_ctx_t ctx;
+        sha256_init(&ctx);
+        sha256_final(&ctx, root);
+    } else {
+        merkle_root(work.leaves, work.chunk_count, root);
+    }
+    if (leaf_count_out != NULL) *leaf_count_out = work.chunk_count;
+    if (leaves_out != NULL) {
+        *leaves_out = work.leaves;
+    } else {
+        free(work.leaves);
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * src/tree_hash.h
+ *
+ * This header file declares the tree hash of a file used by "HASH -t". The
+ * file is cut into TREE_HASH_CHUNK_SIZE chunks that are hashed with SHA-256
+ * on several threads at once, and the chunk digests are combined into one
+ * root digest with the Merkle tree hash of RFC 6962:
+ *
+ *   leaf(chunk)   = SHA-256(0x00 || chunk)
+ *   node(l, r)    = SHA-256(0x01 || l || r)
+ *   MTH(leaves)   = leaf for one leaf, SHA-256("") for none, otherwise
+ *                   node(MTH(first k), MTH(rest)) with k the largest power
+ *                   of two smaller than the number of leaves.
+ *
+ * The root depends only on the file's content and the chunk size. With the
+ * chunk digests, a byte range can be checked by hashing just the chunks it
+ * covers.
+ */
+#ifndef TREE_HASH_H
+#define TREE_HASH_H
+
+#include <stddef.h>     // For size_t
+#include <sys/types.h>  // For off_t
+
+#include "sha256.h"
+
+#define TREE_HASH_CHUNK_SIZE (1024 * 1024)
+#define TREE_HASH_MAX_THREADS 16
+
+/*
+ * Purpose:
+ *   Called between chunks by the thread that started the hash, to ask
+ *   whether the hash should be abandoned.
+ *
+ * Parameters:
+ *   ctx: The caller's context.
+ *
+ * Returns:
+ *   Nonzero to stop.
+ */
+typedef int (*tree_hash_cancel_fn)(void *ctx);
+
+/*
+ * Purpose:
+ *   Computes the tree hash of an open file. The calling thread hashes chunks
+ *   itself, helped by up to thread_count - 1 more threads.
+ *
+ * Parameters:
+ *   fd: The file, open for reading (read with pread; the offset is unused).
+ *   size: The number of bytes to hash.
+ *   thread_count: The number of threads, or 0 for one per online CPU (at
+ *                 most TREE_HASH_MAX_THREADS).
+ *   cancel: An optional cancellation check; may be NULL.
+ *   cancel_ctx: The context passed to cancel.
+ *   root: Receives the root digest.
+ *   leaves_out: If not NULL, receives a malloc'ed array of the chunk
+ *               digests (SHA256_DIGEST_SIZE bytes each, in file order).
+ *   leaf_count_out: If not NULL, receives the number of chunks.
+ *
+ * Returns:
+ *   0 on success, or -1 on error (errno ECANCELED if cancel asked to stop).
+ */
+int tree_hash_file(int fd, off_t size, unsigned int thread_count, tree_hash_cancel_fn cancel, void *cancel_ctx,
+                   unsigned char root[SHA256_DIGEST_SIZE], unsigned char **leaves_out, size_t *leaf_count_out);
+
+#endif // TREE_HASH_H
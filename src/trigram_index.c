@@ -0,0 +1,1172 @@
+/*
+ * src/trigram_index.c
+ *
+ * This file implements the trigram content index declared in trigram_index.h.
+ *
+ * Every indexed version of a file gets a new, increasing file id, and ids are
+ * appended to the posting lists under the write lock, so each posting list is
+ * sorted and lists can be intersected with a simple merge. When a file
+ * changes, its old record is marked dead and a new record is added; dead ids
+ * are filtered out of the posting lists once they outnumber the live ones.
+ *
+ * Between rescans, an inotify instance watching every indexed directory
+ * records the files (and new directories) that changed. Its events are
+ * drained by the background thread while it waits and before each query; a
+ * query adds the changed files below the searched directory to the index's
+ * candidates, so a file edited since the last rescan is still searched. A
+ * rescan re-reads those files and forgets the changes that happened before
+ * it started. If changes were lost (the event queue overflowed, too many
+ * piled up, or a directory could not be watched), queries are refused until
+ * a rescan, started at once, has caught up.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "trigram_index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "protocol.h"
+
+#define FILE_NONE UINT32_MAX
+#define TRIGRAM_COUNT (1u << 24)
+#define BINARY_CHECK_LEN 8192      // A NUL byte in this prefix marks a binary file
+#define COMPACT_MIN_DEAD_FILES 1024
+#define MAX_SUBTREES 64
+#define WATCH_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_ONLYDIR)
+#define EVENT_BUFFER_SIZE (64 * 1024)
+#define MAX_CHANGED_PATHS 4096 // More changes between rescans count as lost
+
+typedef struct indexed_file_s {
+    char *path;           // Absolute path; NULL once the record is dead
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    uint32_t hash_next;   // Next record in the same path hash bucket
+    unsigned int seen_pass; // Last rescan that found the file
+    uint8_t always;       // Too large to index; always a candidate
+} indexed_file_t;
+
+typedef struct posting_list_s {
+    uint32_t key;      // Trigram + 1; 0 marks an empty slot
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *ids;     // Sorted file ids
+} posting_list_t;
+
+typedef struct scan_item_s {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+} scan_item_t;
+
+// A file, or a directory with everything below it, changed since a rescan.
+typedef struct changed_path_s {
+    char *path;
+    unsigned long seq; // Change counter at the latest event
+    int is_dir;
+} changed_path_t;
+
+// The index, protected by g_index_lock.
+static pthread_rwlock_t g_index_lock = PTHREAD_RWLOCK_INITIALIZER;
+static indexed_file_t *g_files = NULL;
+static uint32_t g_file_count = 0;
+static uint32_t g_file_capacity = 0;
+static size_t g_live_files = 0;
+static size_t g_dead_in_postings = 0; // Dead records still referenced by posting lists
+static uint32_t *g_path_buckets = NULL;
+static size_t g_path_bucket_count = 0;
+static posting_list_t *g_postings = NULL;
+static size_t g_posting_slots = 0;
+static size_t g_posting_used = 0;
+static uint32_t *g_always = NULL; // Ids of files too large to index
+static size_t g_always_count = 0;
+static size_t g_always_capacity = 0;
+static volatile int g_ready = 0;
+
+// Configuration, fixed after trigram_index_start.
+static const char *g_subtrees[MAX_SUBTREES];
+static size_t g_subtree_count = 0;
+static unsigned int g_thread_count = TRIGRAM_INDEX_DEFAULT_THREADS;
+static unsigned int g_rescan_interval = TRIGRAM_INDEX_RESCAN_SEC;
+
+// Files to (re)index in the current pass, shared by the reader threads.
+static pthread_mutex_t g_work_lock = PTHREAD_MUTEX_INITIALIZER;
+static scan_item_t *g_work = NULL;
+static size_t g_work_count = 0;
+static size_t g_work_next = 0;
+
+// Changes since the last rescan, protected by g_change_lock.
+static pthread_mutex_t g_change_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_inotify_fd = -1;
+static char **g_watch_paths = NULL;      // Directory of each watch descriptor
+static size_t g_watch_capacity = 0;
+static changed_path_t *g_changed = NULL;
+static size_t g_changed_count = 0;
+static size_t g_changed_capacity = 0;
+static unsigned long g_change_seq = 0;   // Bumped by every change and every rescan start
+static unsigned long g_lost_seq = 0;     // Counter when changes were last lost
+static unsigned long g_indexed_seq = 0;  // Counter when the last complete rescan started
+static int g_unwatched = 0;              // The last rescan could not watch some directory
+static int g_watch_limit_reported = 0;
+static _Alignas(struct inotify_event) char g_event_buffer[EVENT_BUFFER_SIZE];
+
+/*
+ * Purpose:
+ *   Checks whether a path is a directory or lies below it.
+ *
+ * Parameters:
+ *   path: The absolute path to check.
+ *   dir_path: The absolute directory path.
+ *
+ * Returns:
+ *   1 if path is dir_path or below it, 0 otherwise.
+ */
+static int path_below(const char *path, const char *dir_path) {
+    size_t len = strlen(dir_path);
+    if (strncmp(path, dir_path, len) != 0) return 0;
+    if (len == 1) return 1; // dir_path is "/"
+    return path[len] == '\0' || path[len] == '/';
+}
+
+/*
+ * Purpose:
+ *   Hashes a path for the path lookup table.
+ *
+ * Parameters:
+ *   path: The path.
+ *
+ * Returns:
+ *   The hash value.
+ */
+static size_t hash_path(const char *path) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return (size_t)hash;
+}
+
+/*
+ * Purpose:
+ *   Finds the live record of a path. Must be called with the index lock held.
+ *
+ * Parameters:
+ *   path: The absolute path.
+ *
+ * Returns:
+ *   The file id, or FILE_NONE.
+ */
+static uint32_t find_file_locked(const char *path) {
+    if (g_path_bucket_count == 0) return FILE_NONE;
+    uint32_t id = g_path_buckets[hash_path(path) & (g_path_bucket_count - 1)];
+    while (id != FILE_NONE) {
+        if (g_files[id].path != NULL && strcmp(g_files[id].path, path) == 0) return id;
+        id = g_files[id].hash_next;
+    }
+    return FILE_NONE;
+}
+
+/*
+ * Purpose:
+ *   Doubles the path lookup table and rehashes the live records. Must be
+ *   called with the write lock held.
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   0 on success, or -1 on allocation failure.
+ */
+static int grow_path_buckets_locked(void) {
+    size_t new_count = g_path_bucket_count ? g_path_bucket_count * 2 : 1024;
+    uint32_t *buckets = malloc(new_count * sizeof(uint32_t));
+    if (buckets == NULL) return -1;
+    memset(buckets, 0xff, new_count * sizeof(uint32_t));
+    for (uint32_t id = 0; id < g_file_count; id++) {
+        g_files[id].hash_next = FILE_NONE;
+        if (g_files[id].path == NULL) continue;
+        size_t bucket = hash_path(g_files[id].path) & (new_count - 1);
+        g_files[id].hash_next = buckets[bucket];
+        buckets[bucket] = id;
+    }
+    free(g_path_buckets);
+    g_path_buckets = buckets;
+    g_path_bucket_count = new_count;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Finds the posting list slot of a trigram. Must be called with the index
+ *   lock held.
+ *
+ * Parameters:
+ *   key: The trigram.
+ *
+ * Returns:
+ *   The slot holding the trigram, or the empty slot where it would be inserted.
+ */
+static posting_list_t *find_posting_slot(uint32_t key) {
+    size_t mask = g_posting_slots - 1;
+    size_t slot = (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+    while (g_postings[slot].key != 0 && g_postings[slot].key != key + 1) {
+        slot = (slot + 1) & mask;
+    }
+    return &g_postings[slot];
+}
+
+/*
+ * Purpose:
+ *   Doubles the posting list table. Must be called with the write lock held.
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   0 on success, or -1 on allocation failure.
+ */
+static int grow_postings_locked(void) {
+    size_t old_slots = g_posting_slots;
+    posting_list_t *old = g_postings;
+    size_t new_slots = old_slots ? old_slots * 2 : 65536;
+    posting_list_t *grown = calloc(new_slots, sizeof(posting_list_t));
+    if (grown == NULL) return -1;
+    g_postings = grown;
+    g_posting_slots = new_slots;
+    for (size_t i = 0; i < old_slots; i++) {
+        if (old[i].key != 0) *find_posting_slot(old[i].key - 1) = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Marks a file record dead. Must be called with the write lock held.
+ *
+ * Parameters:
+ *   id: The file id.
+ *
+ * Returns:
+ *   void
+ */
+static void kill_file_locked(uint32_t id) {
+    free(g_files[id].path);
+    g_files[id].path = NULL;
+    g_live_files--;
+    g_dead_in_postings++;
+}
+
+/*
+ * Purpose:
+ *   Adds a new version of a file to the index, replacing the previous one.
+ *   Must be called with the write lock held.
+ *
+ * Parameters:
+ *   item: The file as found by the scan (the path is taken over).
+ *   keys: The distinct trigrams of the file.
+ *   key_count: The number of trigrams.
+ *   always: Non-zero if the file was too large to index.
+ *
+ * Returns:
+ *   0 on success, or -1 on allocation failure.
+ */
+static int add_file_locked(scan_item_t *item, const uint32_t *keys, size_t key_count, int always) {
+    uint32_t old_id = find_file_locked(item->path);
+    if (old_id != FILE_NONE) kill_file_locked(old_id);
+
+    if (g_file_count == g_file_capacity) {
+        uint32_t new_capacity = g_file_capacity ? g_file_capacity * 2 : 1024;
+        indexed_file_t *grown = realloc(g_files, (size_t)new_capacity * sizeof(indexed_file_t));
+        if (grown == NULL) return -1;
+        g_files = grown;
+        g_file_capacity = new_capacity;
+    }
+    if (g_file_count >= g_path_bucket_count && grow_path_buckets_locked() == -1) return -1;
+    if (always && g_always_count == g_always_capacity) {
+        size_t new_capacity = g_always_capacity ? g_always_capacity * 2 : 64;
+        uint32_t *grown = realloc(g_always, new_capacity * sizeof(uint32_t));
+        if (grown == NULL) return -1;
+        g_always = grown;
+        g_always_capacity = new_capacity;
+    }
+
+    uint32_t id = g_file_count++;
+    indexed_file_t *file = &g_files[id];
+    file->path = item->path;
+    item->path = NULL;
+    file->dev = item->dev;
+    file->ino = item->ino;
+    file->size = item->size;
+    file->mtime = item->mtime;
+    file->seen_pass = 0;
+    file->always = always ? 1 : 0;
+    size_t bucket = hash_path(file->path) & (g_path_bucket_count - 1);
+    file->hash_next = g_path_buckets[bucket];
+    g_path_buckets[bucket] = id;
+    g_live_files++;
+    if (always) g_always[g_always_count++] = id;
+
+    for (size_t i = 0; i < key_count; i++) {
+        if ((g_posting_used + 1) * 2 > g_posting_slots && grow_postings_locked() == -1) return -1;
+        posting_list_t *list = find_posting_slot(keys[i]);
+        if (list->key == 0) {
+            list->key = keys[i] + 1;
+            g_posting_used++;
+        }
+        if (list->count == list->capacity) {
+            uint32_t new_capacity = list->capacity ? list->capacity * 2 : 4;
+            uint32_t *grown = realloc(list->ids, (size_t)new_capacity * sizeof(uint32_t));
+            if (grown == NULL) return -1;
+            list->ids = grown;
+            list->capacity = new_capacity;
+        }
+        list->ids[list->count++] = id;
+    }
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Removes dead file ids from all posting lists. Must be called with the
+ *   write lock held.
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   void
+ */
+static void compact_postings_locked(void) {
+    for (size_t i = 0; i < g_posting_slots; i++) {
+        posting_list_t *list = &g_postings[i];
+        if (list->key == 0) continue;
+        uint32_t kept = 0;
+        for (uint32_t j = 0; j < list->count; j++) {
+            if (g_files[list->ids[j]].path != NULL) list->ids[kept++] = list->ids[j];
+        }
+        list->count = kept;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < g_always_count; i++) {
+        if (g_files[g_always[i]].path != NULL) g_always[kept++] = g_always[i];
+    }
+    g_always_count = kept;
+    g_dead_in_postings = 0;
+}
+
+/*
+ * Purpose:
+ *   qsort comparator for trigrams.
+ *
+ * Parameters:
+ *   a: The first trigram.
+ *   b: The second trigram.
+ *
+ * Returns:
+ *   A negative, zero or positive value, as required by qsort.
+ */
+static int compare_keys(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Purpose:
+ *   Forgets the recorded changes. The caller holds g_change_lock.
+ *
+ * Parameters:
+ *   before_seq: Changes with a lower counter are forgotten; 0 for all.
+ *
+ * Returns:
+ *   void
+ */
+static void forget_changes_locked(unsigned long before_seq) {
+    size_t kept = 0;
+    for (size_t i = 0; i < g_changed_count; i++) {
+        if (before_seq != 0 && g_changed[i].seq > before_seq) {
+            g_changed[kept++] = g_changed[i];
+        } else {
+            free(g_changed[i].path);
+        }
+    }
+    g_changed_count = kept;
+}
+
+/*
+ * Purpose:
+ *   Records that a file or directory changed. If too many changes piled up,
+ *   they are all dropped and counted as lost. The caller holds
+ *   g_change_lock.
+ *
+ * Parameters:
+ *   path: The absolute path.
+ *   is_dir: Nonzero for a new directory, whose whole subtree is changed.
+ *
+ * Returns:
+ *   void
+ */
+static void record_change_locked(const char *path, int is_dir) {
+    unsigned long seq = ++g_change_seq;
+    for (size_t i = g_changed_count; i-- > 0;) { // Recent changes are the likeliest repeats
+        if (strcmp(g_changed[i].path, path) == 0) {
+            g_changed[i].seq = seq;
+            g_changed[i].is_dir |= is_dir;
+            return;
+        }
+    }
+    char *copy = NULL;
+    if (g_changed_count == g_changed_capacity && g_changed_count < MAX_CHANGED_PATHS) {
+        size_t new_capacity = g_changed_capacity ? g_changed_capacity * 2 : 64;
+        changed_path_t *grown = realloc(g_changed, new_capacity * sizeof(changed_path_t));
+        if (grown != NULL) {
+            g_changed = grown;
+            g_changed_capacity = new_capacity;
+        }
+    }
+    if (g_changed_count == g_changed_capacity || (copy = strdup(path)) == NULL) {
+        forget_changes_locked(0);
+        g_lost_seq = seq;
+        return;
+    }
+    g_changed[g_changed_count].path = copy;
+    g_changed[g_changed_count].seq = seq;
+    g_changed[g_changed_count].is_dir = is_dir;
+    g_changed_count++;
+}
+
+/*
+ * Purpose:
+ *   Records the directory an inotify watch descriptor belongs to. The caller
+ *   holds g_change_lock.
+ *
+ * Parameters:
+ *   wd: The watch descriptor.
+ *   path: The directory's absolute path, or NULL once the watch is gone.
+ *
+ * Returns:
+ *   0 on success, or -1 on allocation failure.
+ */
+static int set_watch_path_locked(int wd, const char *path) {
+    if ((size_t)wd >= g_watch_capacity) {
+        if (path == NULL) return 0;
+        size_t new_capacity = g_watch_capacity ? g_watch_capacity : 1024;
+        while (new_capacity <= (size_t)wd) new_capacity *= 2;
+        char **grown = realloc(g_watch_paths, new_capacity * sizeof(char *));
+        if (grown == NULL) return -1;
+        memset(grown + g_watch_capacity, 0, (new_capacity - g_watch_capacity) * sizeof(char *));
+        g_watch_paths = grown;
+        g_watch_capacity = new_capacity;
+    }
+    char *copy = NULL;
+    if (path != NULL && (copy = strdup(path)) == NULL) return -1;
+    free(g_watch_paths[wd]);
+    g_watch_paths[wd] = copy;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Records the changes reported by all pending inotify events. The caller
+ *   holds g_change_lock.
+ *
+ * Parameters:
+ *   None.
+ *
+ * Returns:
+ *   void
+ */
+static void drain_events_locked(void) {
+    if (g_inotify_fd == -1) return;
+    for (;;) {
+        ssize_t len = read(g_inotify_fd, g_event_buffer, sizeof(g_event_buffer));
+        if (len <= 0) {
+            if (len == -1 && errno == EINTR) continue;
+            return;
+        }
+        for (char *ptr = g_event_buffer; ptr < g_event_buffer + len;) {
+            const struct inotify_event *event = (const struct inotify_event *)(const void *)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                forget_changes_locked(0);
+                g_lost_seq = ++g_change_seq;
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                set_watch_path_locked(event->wd, NULL);
+                continue;
+            }
+            if (event->len == 0 || event->wd < 0 || (size_t)event->wd >= g_watch_capacity || g_watch_paths[event->wd] == NULL) continue;
+            char path[MAX_PATH_LEN];
+            if (snprintf(path, sizeof(path), "%s/%s", g_watch_paths[event->wd], event->name) >= (int)sizeof(path)) continue;
+            record_change_locked(path, (event->mask & IN_ISDIR) != 0);
+        }
+    }
+}
+
+/*
+ * Purpose:
+ *   Watches a directory for changes (again, if it moved since it was last
+ *   watched).
+ *
+ * Parameters:
+ *   path: The directory's absolute path.
+ *
+ * Returns:
+ *   0 on success, or -1 if the directory could not be watched.
+ */
+static int watch_directory(const char *path) {
+    if (g_inotify_fd == -1) return -1;
+    pthread_mutex_lock(&g_change_lock);
+    int wd = inotify_add_watch(g_inotify_fd, path, WATCH_MASK);
+    int result = 0;
+    if (wd == -1) {
+        if (errno == ENOSPC && !g_watch_limit_reported) {
+            fprintf(stderr, "Trigram index: inotify watch limit reached; GREP falls back to full scans.\n");
+            g_watch_limit_reported = 1;
+        }
+        result = (errno == ENOENT || errno == ENOTDIR) ? 0 : -1; // A vanished directory needs no watch
+    } else if (set_watch_path_locked(wd, path) == -1) {
+        result = -1;
+    }
+    pthread_mutex_unlock(&g_change_lock);
+    return result;
+}
+
+/*
+ * Purpose:
+ *   The body of a reader thread: reads files from the work list, extracts
+ *   their distinct trigrams and adds them to the index. A bitmap of all
+ *   trigrams removes duplicates without sorting the whole file.
+ *
+ * Parameters:
+ *   arg: Unused.
+ *
+ * Returns:
+ *   A void pointer (always NULL).
+ */
+static void *reader_thread(void *arg) {
+    (void)arg;
+    uint64_t *seen = calloc(TRIGRAM_COUNT / 64, sizeof(uint64_t));
+    uint32_t *keys = NULL;
+    size_t keys_capacity = 0;
+    unsigned char *content = NULL;
+    size_t content_capacity = 0;
+    if (seen == NULL) {
+        perror("calloc for trigram bitmap failed");
+        return NULL;
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&g_work_lock);
+        scan_item_t *item = (g_work_next < g_work_count) ? &g_work[g_work_next++] : NULL;
+        pthread_mutex_unlock(&g_work_lock);
+        if (item == NULL) break;
+
+        size_t key_count = 0;
+        int always = (item->size > TRIGRAM_INDEX_MAX_FILE_SIZE);
+        if (!always) {
+            int fd = open(item->path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+            if (fd == -1) continue; // Gone or unreadable; the next rescan retries
+            size_t len = 0;
+            for (;;) {
+                if (len == content_capacity) {
+                    size_t new_capacity = content_capacity ? content_capacity * 2 : 65536;
+                    unsigned char *grown = realloc(content, new_capacity);
+                    if (grown == NULL) break;
+                    content = grown;
+                    content_capacity = new_capacity;
+                }
+                ssize_t got = read(fd, content + len, content_capacity - len);
+                if (got == -1 && errno == EINTR) continue;
+                if (got <= 0 || len + (size_t)got > TRIGRAM_INDEX_MAX_FILE_SIZE) {
+                    if (got > 0) always = 1; // Grew past the limit while being read
+                    break;
+                }
+                len += (size_t)got;
+            }
+            close(fd);
+
+            int binary = (memchr(content, 0, len < BINARY_CHECK_LEN ? len : BINARY_CHECK_LEN) != NULL);
+            if (!always && !binary && len >= 3) {
+                if (keys_capacity < len) {
+                    uint32_t *grown = realloc(keys, len * sizeof(uint32_t));
+                    if (grown == NULL) continue;
+                    keys = grown;
+                    keys_capacity = len;
+                }
+                uint32_t key = ((uint32_t)content[0] << 8) | content[1];
+                for (size_t i = 2; i < len; i++) {
+                    key = ((key << 8) | content[i]) & (TRIGRAM_COUNT - 1);
+                    uint64_t bit = 1ULL << (key & 63);
+                    if (!(seen[key >> 6] & bit)) {
+                        seen[key >> 6] |= bit;
+                        keys[key_count++] = key;
+                    }
+                }
+                for (size_t i = 0; i < key_count; i++) seen[keys[i] >> 6] = 0;
+                qsort(keys, key_count, sizeof(uint32_t), compare_keys);
+            }
+        }
+
+        pthread_rwlock_wrlock(&g_index_lock);
+        if (add_file_locked(item, keys, key_count, always) == -1) {
+            fprintf(stderr, "Trigram index: out of memory while adding '%s'.\n", item->path ? item->path : "?");
+        }
+        pthread_rwlock_unlock(&g_index_lock);
+    }
+
+    free(seen);
+    free(keys);
+    free(content);
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Walks one subtree and appends all regular files found to a scan list.
+ *   Symbolic links are not followed, so the scan cannot leave the subtree.
+ *   Optionally, each directory is watched before it is read, so no change
+ *   after its files were listed goes unnoticed.
+ *
+ * Parameters:
+ *   subtree: The absolute path of the subtree.
+ *   items: The scan list (grown with realloc).
+ *   count: The number of items in the list (updated).
+ *   capacity: The capacity of the list (updated).
+ *   unwatched: If not NULL, directories are watched, and this is set to 1
+ *              if one could not be.
+ *
+ * Returns:
+ *   void
+ */
+static void scan_subtree(const char *subtree, scan_item_t **items, size_t *count, size_t *capacity, int *unwatched) {
+    char **stack = malloc(sizeof(char *));
+    size_t stack_count = 0;
+    if (stack == NULL) return;
+    stack[stack_count++] = strdup(subtree);
+
+    while (stack_count > 0) {
+        char *dir_path = stack[--stack_count];
+        if (dir_path != NULL && unwatched != NULL && watch_directory(dir_path) == -1) *unwatched = 1;
+        DIR *dirp = dir_path ? opendir(dir_path) : NULL;
+        if (dirp == NULL) {
+            free(dir_path);
+            continue;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dirp)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            struct stat st;
+            if (fstatat(dirfd(dirp), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) continue;
+            if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)) continue;
+
+            char path[MAX_PATH_LEN];
+            if (snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name) >= (int)sizeof(path)) continue;
+            char *copy = strdup(path);
+            if (copy == NULL) continue;
+
+            if (S_ISDIR(st.st_mode)) {
+                char **grown = realloc(stack, (stack_count + 1) * sizeof(char *));
+                if (grown == NULL) {
+                    free(copy);
+                    continue;
+                }
+                stack = grown;
+                stack[stack_count++] = copy;
+                continue;
+            }
+            if (*count == *capacity) {
+                size_t new_capacity = *capacity ? *capacity * 2 : 1024;
+                scan_item_t *grown = realloc(*items, new_capacity * sizeof(scan_item_t));
+                if (grown == NULL) {
+                    free(copy);
+                    continue;
+                }
+                *items = grown;
+                *capacity = new_capacity;
+            }
+            scan_item_t *item = &(*items)[(*count)++];
+            item->path = copy;
+            item->dev = st.st_dev;
+            item->ino = st.st_ino;
+            item->size = st.st_size;
+            item->mtime = st.st_mtim;
+        }
+        closedir(dirp);
+        free(dir_path);
+    }
+    free(stack);
+}
+
+/*
+ * Purpose:
+ *   Runs one pass over all subtrees: files that are new or changed since the
+ *   last pass are read on the reader threads, and files that disappeared are
+ *   removed from the index. Once done, the changes recorded before the pass
+ *   started are forgotten, since the index now covers them.
+ *
+ * Parameters:
+ *   pass: The number of this pass (starting at 1).
+ *
+ * Returns:
+ *   The number of files read in this pass.
+ */
+static size_t rescan_pass(unsigned int pass) {
+    pthread_mutex_lock(&g_change_lock);
+    drain_events_locked();
+    unsigned long start_seq = ++g_change_seq;
+    pthread_mutex_unlock(&g_change_lock);
+
+    scan_item_t *items = NULL;
+    size_t count = 0, capacity = 0;
+    int unwatched = (g_inotify_fd == -1);
+    for (size_t i = 0; i < g_subtree_count; i++) {
+        scan_subtree(g_subtrees[i], &items, &count, &capacity, &unwatched);
+    }
+
+    size_t changed = 0;
+    pthread_rwlock_wrlock(&g_index_lock);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t id = find_file_locked(items[i].path);
+        if (id != FILE_NONE) {
+            indexed_file_t *file = &g_files[id];
+            file->seen_pass = pass; // Kept until the new version replaces it
+            if (file->dev == items[i].dev && file->ino == items[i].ino && file->size == items[i].size &&
+                file->mtime.tv_sec == items[i].mtime.tv_sec && file->mtime.tv_nsec == items[i].mtime.tv_nsec) {
+                free(items[i].path);
+                continue;
+            }
+        }
+        items[changed++] = items[i];
+    }
+    for (uint32_t id = 0; id < g_file_count; id++) {
+        if (g_files[id].path != NULL && g_files[id].seen_pass != pass) kill_file_locked(id);
+    }
+    pthread_rwlock_unlock(&g_index_lock);
+
+    if (changed > 0) {
+        g_work = items;
+        g_work_count = changed;
+        g_work_next = 0;
+        pthread_t threads[64];
+        unsigned int started = 0;
+        for (unsigned int i = 0; i < g_thread_count && i < 64 && i < changed; i++) {
+            if (pthread_create(&threads[started], NULL, reader_thread, NULL) == 0) started++;
+        }
+        if (started == 0) reader_thread(NULL);
+        for (unsigned int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+        for (size_t i = 0; i < changed; i++) free(items[i].path); // Paths not taken over
+        g_work = NULL;
+        g_work_count = 0;
+    }
+    free(items);
+
+    pthread_rwlock_wrlock(&g_index_lock);
+    if (g_dead_in_postings > COMPACT_MIN_DEAD_FILES && g_dead_in_postings > g_live_files) {
+        compact_postings_locked();
+    }
+    pthread_rwlock_unlock(&g_index_lock);
+
+    pthread_mutex_lock(&g_change_lock);
+    drain_events_locked();
+    forget_changes_locked(start_seq);
+    g_indexed_seq = start_seq;
+    g_unwatched = unwatched;
+    pthread_mutex_unlock(&g_change_lock);
+    return changed;
+}
+
+/*
+ * Purpose:
+ *   Waits for the next rescan, recording changes meanwhile. The wait ends
+ *   early if changes were lost, so queries are refused only briefly.
+ *
+ * Parameters:
+ *   None.
+ *
+ * Returns:
+ *   void
+ */
+static void wait_for_rescan(void) {
+    struct timespec now, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += g_rescan_interval;
+    for (;;) {
+        pthread_mutex_lock(&g_change_lock);
+        drain_events_locked();
+        int lost = (g_lost_seq > g_indexed_seq);
+        pthread_mutex_unlock(&g_change_lock);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long remaining_ms = (long long)(deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+        if (lost || remaining_ms <= 0) return;
+        struct pollfd pfd = {.fd = g_inotify_fd, .events = POLLIN, .revents = 0};
+        poll(&pfd, 1, (int)remaining_ms); // A negative fd makes this a plain sleep
+    }
+}
+
+/*
+ * Purpose:
+ *   The background thread of the index: builds it, then rescans the subtrees
+ *   periodically for the lifetime of the process, recording changes in
+ *   between.
+ *
+ * Parameters:
+ *   arg: Unused.
+ *
+ * Returns:
+ *   A void pointer (always NULL).
+ */
+static void *trigram_index_thread(void *arg) {
+    (void)arg;
+    for (unsigned int pass = 1;; pass++) {
+        rescan_pass(pass);
+        g_ready = 1;
+        wait_for_rescan();
+    }
+    return NULL;
+}
+
+/*
+ * Purpose:
+ *   Starts building the index for the given subtrees in the background. The
+ *   same background thread rescans the subtrees periodically afterwards.
+ *
+ * Parameters:
+ *   subtree_paths: The absolute, resolved paths of the subtrees (must stay valid).
+ *   subtree_count: The number of subtrees.
+ *   thread_count: The number of threads reading files.
+ *   rescan_interval_sec: The pause between rescans.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+int trigram_index_start(const char *const *subtree_paths, size_t subtree_count, unsigned int thread_count,
+                        unsigned int rescan_interval_sec) {
+    if (subtree_count == 0 || subtree_count > MAX_SUBTREES) return -1;
+    for (size_t i = 0; i < subtree_count; i++) g_subtrees[i] = subtree_paths[i];
+    g_subtree_count = subtree_count;
+    g_thread_count = thread_count > 0 ? thread_count : TRIGRAM_INDEX_DEFAULT_THREADS;
+    g_rescan_interval = rescan_interval_sec > 0 ? rescan_interval_sec : TRIGRAM_INDEX_RESCAN_SEC;
+    g_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (g_inotify_fd == -1) {
+        perror("inotify_init1 for trigram index; GREP falls back to full scans");
+    }
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, trigram_index_thread, NULL) != 0) {
+        perror("pthread_create for trigram index failed");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Reports whether the initial build has completed.
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   1 if candidates can be requested, 0 otherwise.
+ */
+int trigram_index_ready(void) {
+    return g_ready;
+}
+
+/*
+ * Purpose:
+ *   qsort comparator ordering posting lists by length.
+ *
+ * Parameters:
+ *   a: The first posting list pointer.
+ *   b: The second posting list pointer.
+ *
+ * Returns:
+ *   A negative, zero or positive value, as required by qsort.
+ */
+static int compare_list_lengths(const void *a, const void *b) {
+    uint32_t x = (*(posting_list_t *const *)a)->count, y = (*(posting_list_t *const *)b)->count;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Purpose:
+ *   Adds a candidate file to a result list if it is live and lies below the
+ *   searched directory. Must be called with the index lock held.
+ *
+ * Parameters:
+ *   id: The file id.
+ *   dir_path: The searched directory.
+ *   paths: The result list (grown with realloc).
+ *   count: The number of results (updated).
+ *
+ * Returns:
+ *   0 on success, or -1 on allocation failure.
+ */
+static int add_candidate_locked(uint32_t id, const char *dir_path, char ***paths, size_t *count) {
+    const char *path = g_files[id].path;
+    if (path == NULL || !path_below(path, dir_path)) return 0;
+    char *copy = strdup(path);
+    char **grown = realloc(*paths, (*count + 1) * sizeof(char *));
+    if (copy == NULL || grown == NULL) {
+        free(copy);
+        if (grown != NULL) *paths = grown;
+        return -1;
+    }
+    *paths = grown;
+    (*paths)[(*count)++] = copy;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Takes a copy of the changes that concern a directory, unless changes
+ *   were lost since the last rescan.
+ *
+ * Parameters:
+ *   dir_path: The searched directory.
+ *   changes_out: Receives a malloc'ed array of changes with malloc'ed paths:
+ *                changed paths below the directory, and the directory
+ *                itself (as a changed directory) if it lies in a new one.
+ *   count_out: Receives the number of changes.
+ *
+ * Returns:
+ *   0 on success, or -1 if the index cannot be trusted or on allocation
+ *   failure.
+ */
+static int copy_changes(const char *dir_path, changed_path_t **changes_out, size_t *count_out) {
+    *changes_out = NULL;
+    *count_out = 0;
+    pthread_mutex_lock(&g_change_lock);
+    drain_events_locked();
+    int status = (g_unwatched || g_lost_seq > g_indexed_seq) ? -1 : 0;
+    changed_path_t *changes = (status == 0 && g_changed_count > 0) ? malloc(g_changed_count * sizeof(changed_path_t)) : NULL;
+    if (status == 0 && g_changed_count > 0 && changes == NULL) status = -1;
+    size_t count = 0;
+    for (size_t i = 0; i < g_changed_count && status == 0; i++) {
+        const changed_path_t *change = &g_changed[i];
+        const char *path = NULL;
+        if (path_below(change->path, dir_path)) path = change->path;
+        else if (change->is_dir && path_below(dir_path, change->path)) path = dir_path;
+        if (path == NULL) continue;
+        if ((changes[count].path = strdup(path)) == NULL) {
+            status = -1;
+            break;
+        }
+        changes[count].is_dir = change->is_dir;
+        changes[count].seq = change->seq;
+        count++;
+    }
+    pthread_mutex_unlock(&g_change_lock);
+    if (status == -1) {
+        for (size_t i = 0; i < count; i++) free(changes[i].path);
+        free(changes);
+        return -1;
+    }
+    *changes_out = changes;
+    *count_out = count;
+    return 0;
+}
+
+/*
+ * Purpose:
+ *   Adds the regular files among (or, for changed directories, below) the
+ *   changed paths to a candidate list.
+ *
+ * Parameters:
+ *   changes: The changes from copy_changes.
+ *   change_count: Their number.
+ *   paths: The result list (grown with realloc).
+ *   count: The number of results (updated).
+ *
+ * Returns:
+ *   0 on success, or -1 on allocation failure.
+ */
+static int add_changed_candidates(const changed_path_t *changes, size_t change_count, char ***paths, size_t *count) {
+    scan_item_t *items = NULL;
+    size_t item_count = 0, item_capacity = 0;
+    int status = 0;
+    for (size_t i = 0; i < change_count && status == 0; i++) {
+        struct stat st;
+        if (changes[i].is_dir) {
+            scan_subtree(changes[i].path, &items, &item_count, &item_capacity, NULL);
+            continue;
+        }
+        if (lstat(changes[i].path, &st) == -1 || !S_ISREG(st.st_mode)) continue;
+        char *copy = strdup(changes[i].path);
+        char **grown = realloc(*paths, (*count + 1) * sizeof(char *));
+        if (grown != NULL) *paths = grown;
+        if (copy == NULL || grown == NULL) {
+            free(copy);
+            status = -1;
+            break;
+        }
+        (*paths)[(*count)++] = copy;
+    }
+    size_t taken = 0;
+    if (status == 0 && item_count > 0) {
+        char **grown = realloc(*paths, (*count + item_count) * sizeof(char *));
+        if (grown == NULL) {
+            status = -1;
+        } else {
+            *paths = grown;
+            for (; taken < item_count; taken++) (*paths)[(*count)++] = items[taken].path;
+        }
+    }
+    for (size_t i = taken; i < item_count; i++) free(items[i].path);
+    free(items);
+    return status;
+}
+
+/*
+ * Purpose:
+ *   qsort comparator ordering paths.
+ *
+ * Parameters:
+ *   a: The first path pointer.
+ *   b: The second path pointer.
+ *
+ * Returns:
+ *   A negative, zero or positive value, as required by qsort.
+ */
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Purpose:
+ *   Lists the files below a directory that may contain a string. Binary files
+ *   are never returned by the index itself; files changed since the last
+ *   rescan are always returned, since their indexed content may be out of
+ *   date. Each path is returned once, in path order.
+ *
+ * Parameters:
+ *   dir_path: The absolute, resolved path of the directory to search.
+ *   needle: The string to search for.
+ *   needle_len: The length of the string (at least 3).
+ *   paths_out: Receives a malloc'ed array of malloc'ed absolute paths.
+ *   count_out: Receives the number of paths.
+ *
+ * Returns:
+ *   0 on success, or -1 if the index cannot answer (not ready, the directory
+ *   is not inside an indexed subtree, the string is too short, or changes
+ *   were lost since the last rescan); the caller must then search the files
+ *   itself.
+ */
+int trigram_index_candidates(const char *dir_path, const char *needle, size_t needle_len,
+                             char ***paths_out, size_t *count_out) {
+    *paths_out = NULL;
+    *count_out = 0;
+    if (!g_ready || needle_len < 3) return -1;
+    size_t i;
+    for (i = 0; i < g_subtree_count; i++) {
+        if (path_below(dir_path, g_subtrees[i])) break;
+    }
+    if (i == g_subtree_count) return -1;
+    changed_path_t *changes;
+    size_t change_count;
+    if (copy_changes(dir_path, &changes, &change_count) == -1) return -1;
+
+    size_t key_count = needle_len - 2;
+    uint32_t *keys = malloc(key_count * sizeof(uint32_t));
+    posting_list_t **lists = malloc(key_count * sizeof(posting_list_t *));
+    uint32_t *result = NULL;
+    if (keys == NULL || lists == NULL) {
+        free(keys);
+        free(lists);
+        for (i = 0; i < change_count; i++) free(changes[i].path);
+        free(changes);
+        return -1;
+    }
+    const unsigned char *bytes = (const unsigned char *)needle;
+    for (i = 0; i < key_count; i++) {
+        keys[i] = ((uint32_t)bytes[i] << 16) | ((uint32_t)bytes[i + 1] << 8) | bytes[i + 2];
+    }
+    qsort(keys, key_count, sizeof(uint32_t), compare_keys);
+
+    int status = 0;
+    pthread_rwlock_rdlock(&g_index_lock);
+    size_t list_count = 0;
+    int missing = (g_posting_slots == 0);
+    for (i = 0; i < key_count && !missing; i++) {
+        if (i > 0 && keys[i] == keys[i - 1]) continue;
+        posting_list_t *list = find_posting_slot(keys[i]);
+        if (list->key == 0 || list->count == 0) missing = 1;
+        else lists[list_count++] = list;
+    }
+
+    size_t result_count = 0;
+    if (!missing) {
+        // Start from the shortest list so the intermediate result stays small.
+        qsort(lists, list_count, sizeof(posting_list_t *), compare_list_lengths);
+        result = malloc(lists[0]->count * sizeof(uint32_t));
+        if (result == NULL) {
+            status = -1;
+        } else {
+            memcpy(result, lists[0]->ids, lists[0]->count * sizeof(uint32_t));
+            result_count = lists[0]->count;
+        }
+        for (size_t l = 1; l < list_count && result_count > 0; l++) {
+            size_t a = 0, b = 0, out = 0;
+            while (a < result_count && b < lists[l]->count) {
+                if (result[a] < lists[l]->ids[b]) a++;
+                else if (result[a] > lists[l]->ids[b]) b++;
+                else {
+                    result[out++] = result[a];
+                    a++;
+                    b++;
+                }
+            }
+            result_count = out;
+        }
+    }
+    for (i = 0; i < result_count && status == 0; i++) {
+        status = add_candidate_locked(result[i], dir_path, paths_out, count_out);
+    }
+    for (i = 0; i < g_always_count && status == 0; i++) {
+        status = add_candidate_locked(g_always[i], dir_path, paths_out, count_out);
+    }
+    pthread_rwlock_unlock(&g_index_lock);
+
+    if (status == 0) status = add_changed_candidates(changes, change_count, paths_out, count_out);
+    if (status == 0 && *count_out > 1) {
+        // A changed file may also be an index candidate.
+        qsort(*paths_out, *count_out, sizeof(char *), compare_paths);
+        size_t unique = 1;
+        for (i = 1; i < *count_out; i++) {
+            if (strcmp((*paths_out)[i], (*paths_out)[unique - 1]) == 0) free((*paths_out)[i]);
+            else (*paths_out)[unique++] = (*paths_out)[i];
+        }
+        *count_out = unique;
+    }
+    for (i = 0; i < change_count; i++) free(changes[i].path);
+    free(changes);
+    free(keys);
+    free(lists);
+    free(result);
+    if (status == -1) {
+        for (i = 0; i < *count_out; i++) free((*paths_out)[i]);
+        free(*paths_out);
+        *paths_out = NULL;
+        *count_out = 0;
+    }
+    return status;
+}
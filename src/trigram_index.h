@@ -0,0 +1,75 @@
+/*
+ * src/trigram_index.h
+ *
+ * This header file declares the trigram content index behind GREP. For every
+ * text file below the configured subtrees it records which three-byte
+ * sequences occur in the file. A substring can only occur in a file that
+ * contains all of the substring's trigrams, so a search only has to open the
+ * files in the intersection of those trigrams' file lists. The index is built
+ * in the background and refreshed by a periodic rescan that re-reads only
+ * files whose size, inode or mtime changed. In between, inotify reports the
+ * files that change, and those are always searched as well, so GREP finds
+ * the same lines with and without the index.
+ */
+#ifndef TRIGRAM_INDEX_H
+#define TRIGRAM_INDEX_H
+
+#include <stddef.h> // For size_t
+
+#define TRIGRAM_INDEX_DEFAULT_THREADS 4
+#define TRIGRAM_INDEX_RESCAN_SEC 30
+#define TRIGRAM_INDEX_MAX_FILE_SIZE (16 * 1024 * 1024) // Larger files are always searched
+
+/*
+ * Purpose:
+ *   Starts building the index for the given subtrees in the background. The
+ *   same background thread rescans the subtrees periodically afterwards.
+ *
+ * Parameters:
+ *   subtree_paths: The absolute, resolved paths of the subtrees (must stay valid).
+ *   subtree_count: The number of subtrees.
+ *   thread_count: The number of threads reading files.
+ *   rescan_interval_sec: The pause between rescans.
+ *
+ * Returns:
+ *   0 on success, or -1 on error.
+ */
+int trigram_index_start(const char *const *subtree_paths, size_t subtree_count, unsigned int thread_count,
+                        unsigned int rescan_interval_sec);
+
+/*
+ * Purpose:
+ *   Reports whether the initial build has completed.
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   1 if candidates can be requested, 0 otherwise.
+ */
+int trigram_index_ready(void);
+
+/*
+ * Purpose:
+ *   Lists the files below a directory that may contain a string. Binary files
+ *   are never returned by the index itself; files changed since the last
+ *   rescan are always returned, since their indexed content may be out of
+ *   date. Each path is returned once, in path order.
+ *
+ * Parameters:
+ *   dir_path: The absolute, resolved path of the directory to search.
+ *   needle: The string to search for.
+ *   needle_len: The length of the string (at least 3).
+ *   paths_out: Receives a malloc'ed array of malloc'ed absolute paths.
+ *   count_out: Receives the number of paths.
+ *
+ * Returns:
+ *   0 on success, or -1 if the index cannot answer (not ready, the directory
+ *   is not inside an indexed subtree, the string is too short, or changes
+ *   were lost since the last rescan); the caller must then search the files
+ *   itself.
+ */
+int trigram_index_candidates(const char *dir_path, const char *needle, size_t needle_len,
+                             char ***paths_out, size_t *count_out);
+
+#endif // TRIGRAM_INDEX_H